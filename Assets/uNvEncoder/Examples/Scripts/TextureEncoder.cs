@@ -1,46 +1,60 @@
-﻿using UnityEngine;
-using UnityEngine.Assertions;
-using System.Collections;
-
-namespace uNvEncoder.Examples
-{
-
-public class TextureEncoder : MonoBehaviour
-{
-    public Encoder encoder = new Encoder();
-    public Texture texture = null;
-    public int frameRate = 60;
-    public bool forceIdrFrame = true;
-
-    void OnEnable()
-    {
-        Assert.IsNotNull(texture);
-        encoder.Create(texture.width, texture.height, frameRate);
-        StartCoroutine(EncodeLoop());
-    }
-
-    void OnDisable()
-    {
-        StopAllCoroutines();
-        encoder.Destroy();
-    }
-
-    IEnumerator EncodeLoop()
-    {
-        for (;;)
-        {
-            yield return new WaitForEndOfFrame();
-            Encode();
-        }
-    }
-
-    void Encode()
-    {
-        if (!texture) return;
-
-        encoder.Update();
-        encoder.Encode(texture, forceIdrFrame);
-    }
-}
-
-}
+﻿using UnityEngine;
+using UnityEngine.Assertions;
+using System.Collections;
+
+namespace uNvEncoder.Examples
+{
+
+public class TextureEncoder : MonoBehaviour
+{
+    public Encoder encoder = new Encoder();
+    public Texture texture = null;
+    public int frameRate = 60;
+    public bool intraRefresh = true;
+    public bool forceIdrFrame = false;
+    public bool requestIntraRefresh = false;
+
+    void OnEnable()
+    {
+        Assert.IsNotNull(texture);
+
+        Lib.EncoderConfig config;
+        Lib.GetDefaultEncoderConfig(out config);
+        config.enableIntraRefresh = intraRefresh ? 1 : 0;
+        encoder.Create(texture.width, texture.height, frameRate, config);
+
+        StartCoroutine(EncodeLoop());
+    }
+
+    void OnDisable()
+    {
+        StopAllCoroutines();
+        encoder.Destroy();
+    }
+
+    IEnumerator EncodeLoop()
+    {
+        for (;;)
+        {
+            yield return new WaitForEndOfFrame();
+            Encode();
+        }
+    }
+
+    void Encode()
+    {
+        if (!texture) return;
+
+        encoder.Update();
+
+        if (requestIntraRefresh)
+        {
+            encoder.RequestIntraRefresh();
+            requestIntraRefresh = false;
+        }
+
+        encoder.Encode(texture, forceIdrFrame);
+    }
+}
+
+}
@@ -1,120 +1,342 @@
-﻿using UnityEngine;
-using UnityEngine.Events;
-
-namespace uNvEncoder
-{
-
-[System.Serializable]
-public class Encoder
-{
-    [System.Serializable]
-    public class EncodedCallback : UnityEvent<System.IntPtr, int> {};
-    public EncodedCallback onEncoded = new EncodedCallback();
-
-    public int id { get; private set; } = -1;
-
-    public bool isValid
-    {
-        get { return Lib.IsValid(id); }
-    }
-
-    public int width
-    {
-        get { return Lib.GetWidth(id); }
-    }
-
-    public int height
-    {
-        get { return Lib.GetHeight(id); }
-    }
-
-    public int frameRate
-    {
-        get { return Lib.GetFrameRate(id); }
-    }
-
-    public string error
-    {
-        get 
-        { 
-            if (!Lib.HasError(id)) return "";
-
-            var str = Lib.GetError(id); 
-            Lib.ClearError(id);
-            return str;
-        }
-    }
-
-    public void Create(int width, int height, int frameRate)
-    {
-        id = Lib.CreateEncoder(width, height, frameRate);
-
-        if (!isValid)
-        {
-            Debug.LogError(error);
-        }
-    }
-
-    public void Destroy()
-    {
-        Lib.DestroyEncoder(id);
-    }
-
-    public void Update()
-    {
-        if (!isValid) return;
-
-        Lib.CopyEncodedData(id);
-
-        int n = Lib.GetEncodedDataCount(id);
-        for (int i = 0; i < n; ++i)
-        {
-            var size = Lib.GetEncodedDataSize(id, i);
-            var data = Lib.GetEncodedDataBuffer(id, i);
-            onEncoded.Invoke(data, size);
-        }
-    }
-
-    public bool Encode(Texture texture, bool forceIdrFrame)
-    {
-        if (!texture)
-        {
-            Debug.LogError("The given texture is invalid.");
-            return false;
-        }
-
-        var ptr = texture.GetNativeTexturePtr();
-        if (!Encode(ptr, forceIdrFrame))
-        {
-            Debug.LogError(error);
-            return false;
-        }
-
-        return true;
-    }
-
-    public bool Encode(System.IntPtr ptr, bool forceIdrFrame)
-    {
-        if (ptr == System.IntPtr.Zero)
-        {
-            Debug.LogError("The given texture pointer is invalid.");
-            return false;
-        }
-
-        if (!isValid)
-        {
-            Debug.LogError("uNvEncoder has not been initialized yet.");
-            return false;
-        }
-
-        var result = Lib.Encode(id, ptr, forceIdrFrame);
-        if (!result)
-        {
-            Debug.LogError(error);
-        }
-
-        return result;
-    }
-}
-
-}
+﻿using UnityEngine;
+using UnityEngine.Events;
+
+namespace uNvEncoder
+{
+
+[System.Serializable]
+public class Encoder
+{
+    [System.Serializable]
+    public class EncodedCallback : UnityEvent<System.IntPtr, int> {};
+    public EncodedCallback onEncoded = new EncodedCallback();
+
+    public int id { get; private set; } = -1;
+
+    bool isBitstreamLeaseEnabled_ = false;
+    Lib.EncodedFrame[] frames_ = new Lib.EncodedFrame[32];
+
+    public bool isValid
+    {
+        get { return Lib.IsValid(id); }
+    }
+
+    public int width
+    {
+        get { return Lib.GetWidth(id); }
+    }
+
+    public int height
+    {
+        get { return Lib.GetHeight(id); }
+    }
+
+    public int frameRate
+    {
+        get { return Lib.GetFrameRate(id); }
+    }
+
+    public Lib.Codec codec
+    {
+        get { return Lib.GetCodec(id); }
+    }
+
+    public bool isBitstreamLeaseEnabled
+    {
+        get { return isBitstreamLeaseEnabled_; }
+        set 
+        { 
+            isBitstreamLeaseEnabled_ = value;
+            Lib.SetBitstreamLeaseEnabled(id, value); 
+        }
+    }
+
+    public ulong encodedDataOverflowCount
+    {
+        get { return Lib.GetEncodedDataOverflowCount(id); }
+    }
+
+    // Frames that equaled the previous one with static-frame skip, and the
+    // ones of them that were not encoded.
+    public ulong duplicateFrameCount
+    {
+        get { return Lib.GetDuplicateFrameCount(id); }
+    }
+
+    public ulong skippedDuplicateFrameCount
+    {
+        get { return Lib.GetSkippedDuplicateFrameCount(id); }
+    }
+
+    // What ABR currently estimates the link to carry, or 0 when it is off.
+    public int abrEstimatedBitRate
+    {
+        get { return Lib.GetAbrEstimatedBitRate(id); }
+    }
+
+    public int ltrSlotCount
+    {
+        get { return Lib.GetLtrSlotCount(id); }
+    }
+
+    public string error
+    {
+        get 
+        { 
+            if (!Lib.HasError(id)) return "";
+
+            var str = Lib.GetError(id); 
+            Lib.ClearError(id);
+            return str;
+        }
+    }
+
+    public void Create(int width, int height, int frameRate)
+    {
+        id = Lib.CreateEncoder(width, height, frameRate);
+        OnCreated();
+    }
+
+    public void Create(int width, int height, int frameRate, Lib.EncoderConfig config, int asyncDepth = 3)
+    {
+        var configError = Lib.GetEncoderConfigError(config, asyncDepth);
+        if (configError != null)
+        {
+            Debug.LogError(configError);
+            return;
+        }
+
+        const int formatR8G8B8A8Unorm = 28;
+        id = Lib.CreateEncoderEx(width, height, formatR8G8B8A8Unorm, frameRate, asyncDepth, ref config);
+        OnCreated();
+    }
+
+    // Wraps a rendition of a SimulcastEncoder, which is destroyed with it.
+    internal void Attach(int id)
+    {
+        this.id = id;
+        OnCreated();
+    }
+
+    void OnCreated()
+    {
+        if (!isValid)
+        {
+            Debug.LogError(error);
+            return;
+        }
+
+        Lib.SetBitstreamLeaseEnabled(id, isBitstreamLeaseEnabled_);
+    }
+
+    public void Destroy()
+    {
+        Lib.DestroyEncoder(id);
+    }
+
+    // Zero keeps the current value. Cheap enough to call several times a second.
+    public bool SetRateControl(int averageBitRate, int maxBitRate = 0, int frameRate = 0, bool forceIdrFrame = false)
+    {
+        return Lib.SetRateControl(id, averageBitRate, maxBitRate, frameRate, forceIdrFrame);
+    }
+
+    // Lets the plugin adapt the bitrate and the frame rate to the feedback of
+    // the receiver. Meanwhile SetRateControl fails, and Encode skips frames
+    // while the frame rate is lowered but still returns true for them.
+    public bool EnableAbr(Lib.AbrConfig config)
+    {
+        return Lib.SetAbrConfig(id, ref config);
+    }
+
+    // Keeps the last bitrate and restores the frame rate.
+    public bool DisableAbr()
+    {
+        return Lib.DisableAbr(id);
+    }
+
+    // Can be called from any thread, for example the one receiving reports.
+    public void ReportNetworkFeedback(Lib.NetworkFeedback feedback)
+    {
+        Lib.ReportNetworkFeedback(id, ref feedback);
+    }
+
+    // Recovers the stream with an intra-refresh wave from the next frame on,
+    // or with an IDR frame when the encoder was created without intra refresh.
+    public void RequestIntraRefresh()
+    {
+        Lib.RequestIntraRefresh(id);
+    }
+
+    // Returns the frame index held by an LTR slot, or false when it is empty.
+    public bool GetLtrFrameIndex(int slot, out ulong frameIndex)
+    {
+        return Lib.GetLtrFrameIndex(id, slot, out frameIndex);
+    }
+
+    // Returns the slot of the newest LTR frame that a receiver which decoded
+    // up to frameIndex holds, or -1 when an IDR frame is needed instead.
+    public int FindLtrSlot(ulong frameIndex)
+    {
+        return Lib.FindLtrSlot(id, frameIndex);
+    }
+
+    // Stops later frames from referencing frames the receiver lost, given by
+    // the frameIndex of EncodedFrame. Returns how many were still references,
+    // or -1 on an error.
+    public int InvalidateRefFrames(ulong[] frameIndices)
+    {
+        return Lib.InvalidateRefFrames(id, frameIndices, frameIndices.Length);
+    }
+
+    // Same as InvalidateRefFrames, with the timestamp of EncodedFrame.
+    public int InvalidateRefFramesByTimestamp(ulong[] timestamps)
+    {
+        return Lib.InvalidateRefFramesByTimestamp(id, timestamps, timestamps.Length);
+    }
+
+    // QP delta maps need an encoder created with enableQpDeltaMap. They apply
+    // from the next frame on and can be set every frame, for example with the
+    // latest gaze point. A map has one delta per macroblock, or per 32x32 CTU
+    // for HEVC, in rows of GetQpMapSize() columns, and only lasts until the
+    // encoder is resized.
+    public bool GetQpMapSize(out int columnCount, out int rowCount)
+    {
+        return Lib.GetQpMapSize(id, out columnCount, out rowCount);
+    }
+
+    public bool SetQpDeltaMap(sbyte[] deltas)
+    {
+        return Lib.SetQpDeltaMap(id, deltas, deltas != null ? deltas.Length : 0);
+    }
+
+    // Replaces a map given with SetQpDeltaMap, and the other way round.
+    public bool SetFoveation(Lib.Foveation foveation)
+    {
+        return Lib.SetFoveation(id, ref foveation);
+    }
+
+    public bool ClearFoveation()
+    {
+        return Lib.ClearFoveation(id);
+    }
+
+    // Drawn over the map or the foveation in order, an empty array removes
+    // them.
+    public bool SetQpRegions(Lib.QpRegion[] regions)
+    {
+        return Lib.SetQpRegions(id, regions, regions != null ? regions.Length : 0);
+    }
+
+    public void Update()
+    {
+        if (!isValid) return;
+
+        int n;
+        do
+        {
+            n = Lib.GetEncodedFrames(id, frames_, frames_.Length);
+            for (int i = 0; i < n; ++i)
+            {
+                var frame = frames_[i];
+                onEncoded.Invoke(frame.buffer, frame.size);
+
+                if (frame.isLeased != 0)
+                {
+                    Lib.ReleaseEncodedData(id, frame.frameIndex);
+                }
+            }
+        }
+        while (n == frames_.Length);
+    }
+
+    public bool Encode(Texture texture, bool forceIdrFrame)
+    {
+        if (!texture)
+        {
+            Debug.LogError("The given texture is invalid.");
+            return false;
+        }
+
+        var ptr = texture.GetNativeTexturePtr();
+        if (!Encode(ptr, forceIdrFrame))
+        {
+            Debug.LogError(error);
+            return false;
+        }
+
+        return true;
+    }
+
+    public bool Encode(System.IntPtr ptr, bool forceIdrFrame)
+    {
+        if (ptr == System.IntPtr.Zero)
+        {
+            Debug.LogError("The given texture pointer is invalid.");
+            return false;
+        }
+
+        if (!isValid)
+        {
+            Debug.LogError("uNvEncoder has not been initialized yet.");
+            return false;
+        }
+
+        var result = Lib.Encode(id, ptr, forceIdrFrame);
+        if (!result)
+        {
+            Debug.LogError(error);
+        }
+
+        return result;
+    }
+
+    public bool Encode(System.IntPtr ptr, Lib.EncodeOptions options)
+    {
+        if (ptr == System.IntPtr.Zero)
+        {
+            Debug.LogError("The given texture pointer is invalid.");
+            return false;
+        }
+
+        if (!isValid)
+        {
+            Debug.LogError("uNvEncoder has not been initialized yet.");
+            return false;
+        }
+
+        var result = Lib.EncodeWithOptions(id, ptr, ref options);
+        if (!result)
+        {
+            Debug.LogError(error);
+        }
+
+        return result;
+    }
+
+    // Encodes a frame in system memory, from AsyncGPUReadback for example.
+    // format is a DXGI_FORMAT and the data is copied before this returns.
+    public bool EncodeFromMemory(System.IntPtr data, int pitch, int format, bool forceIdrFrame)
+    {
+        if (data == System.IntPtr.Zero)
+        {
+            Debug.LogError("The given frame data is invalid.");
+            return false;
+        }
+
+        if (!isValid)
+        {
+            Debug.LogError("uNvEncoder has not been initialized yet.");
+            return false;
+        }
+
+        var result = Lib.EncodeFromMemory(id, data, pitch, format, forceIdrFrame);
+        if (!result)
+        {
+            Debug.LogError(error);
+        }
+
+        return result;
+    }
+}
+
+}
@@ -1,51 +1,384 @@
-﻿using System;
-using System.Runtime.InteropServices;
-
-#pragma warning disable CS0465
-
-namespace uNvEncoder
-{
-
-public static class Lib
-{
-    public const string dllName = "uNvEncoder";
-
-    // ---
-
-    [DllImport(dllName, EntryPoint = "uNvEncoderCreateEncoder")]
-    public static extern int CreateEncoder(int width, int height, int frameRate);
-    [DllImport(dllName, EntryPoint = "uNvEncoderDestroyEncoder")]
-    public static extern int DestroyEncoder(int id);
-    [DllImport(dllName, EntryPoint = "uNvEncoderIsValid")]
-    public static extern bool IsValid(int id);
-    [DllImport(dllName, EntryPoint = "uNvEncoderGetWidth")]
-    public static extern int GetWidth(int id);
-    [DllImport(dllName, EntryPoint = "uNvEncoderGetHeight")]
-    public static extern int GetHeight(int id);
-    [DllImport(dllName, EntryPoint = "uNvEncoderGetFrameRate")]
-    public static extern int GetFrameRate(int id);
-    [DllImport(dllName, EntryPoint = "uNvEncoderEncode")]
-    public static extern bool Encode(int id, IntPtr texturePtr, bool forceIdrFrame);
-    [DllImport(dllName, EntryPoint = "uNvEncoderCopyEncodedData")]
-    public static extern void CopyEncodedData(int id);
-    [DllImport(dllName, EntryPoint = "uNvEncoderGetEncodedDataCount")]
-    public static extern int GetEncodedDataCount(int id);
-    [DllImport(dllName, EntryPoint = "uNvEncoderGetEncodedDataSize")]
-    public static extern int GetEncodedDataSize(int id, int index);
-    [DllImport(dllName, EntryPoint = "uNvEncoderGetEncodedDataBuffer")]
-    public static extern IntPtr GetEncodedDataBuffer(int id, int index);
-    [DllImport(dllName, EntryPoint = "uNvEncoderGetError")]
-    private static extern IntPtr GetErrorInternal(int id);
-    [DllImport(dllName, EntryPoint = "uNvEncoderHasError")]
-    public static extern bool HasError(int id);
-    [DllImport(dllName, EntryPoint = "uNvEncoderClearError")]
-    public static extern void ClearError(int id);
-
-    public static string GetError(int id)
-    {
-        var ptr = GetErrorInternal(id);
-        return Marshal.PtrToStringAnsi(ptr);
-    }
-}
-
-}
+﻿using System;
+using System.Runtime.InteropServices;
+
+#pragma warning disable CS0465
+
+namespace uNvEncoder
+{
+
+public static class Lib
+{
+    public const string dllName = "uNvEncoder";
+
+    public enum Codec
+    {
+        H264 = 0,
+        HEVC = 1,
+    }
+
+    public enum Preset
+    {
+        Default = 0,
+        HighPerformance = 1,
+        HighQuality = 2,
+        LowLatencyDefault = 3,
+        LowLatencyHighQuality = 4,
+        LowLatencyHighPerformance = 5,
+    }
+
+    public enum Profile
+    {
+        Auto = 0,
+        H264Baseline = 1,
+        H264Main = 2,
+        H264High = 3,
+        HevcMain = 4,
+        HevcMain10 = 5,
+    }
+
+    public enum SliceMode
+    {
+        Macroblocks = 0,
+        Bytes = 1,
+        MacroblockRows = 2,
+        Count = 3,
+    }
+
+    public enum RateControlMode
+    {
+        ConstQp = 0,
+        Vbr = 1,
+        Cbr = 2,
+        CbrLowDelayHq = 3,
+        CbrHq = 4,
+        VbrHq = 5,
+    }
+
+    public enum InputConversion
+    {
+        None = 0,
+        Nv12 = 1,
+        Yuv444 = 2,
+    }
+
+    public enum ColorMatrix
+    {
+        Bt601 = 0,
+        Bt709 = 1,
+    }
+
+    public enum ColorRange
+    {
+        Limited = 0,
+        Full = 1,
+    }
+
+    // Must match EncoderConfig in EncoderConfig.h. Start from GetDefaultEncoderConfig().
+    [StructLayout(LayoutKind.Sequential)]
+    public struct EncoderConfig
+    {
+        public Codec codec;
+        public Preset preset;
+        public Profile profile;
+        public RateControlMode rateControlMode;
+        public uint averageBitRate;
+        public uint maxBitRate;
+        public uint vbvBufferSize;
+        public uint gopLength;
+        public uint bFrameCount;
+        public uint lookaheadDepth;
+        public uint targetQuality;
+        public int enableSpatialAq;
+        public int enableTemporalAq;
+        public uint aqStrength;
+        public uint maxWidth;
+        public uint maxHeight;
+        public int enableIntraRefresh;
+        public uint intraRefreshPeriod;
+        public uint intraRefreshCount;
+        public SliceMode sliceMode;
+        public uint sliceModeData;
+        public int enableSubFrameReadback;
+        public int enableLtr;
+        public uint ltrFrameCount;
+        public int ltrTrustMode;
+        public int enableQpDeltaMap;
+        public InputConversion inputConversion;
+        public ColorMatrix colorMatrix;
+        public ColorRange colorRange;
+        public int enableStaticFrameSkip;
+        public uint staticFrameKeepAlive;
+    }
+
+    // Must match EncodeOptions in EncoderConfig.h. Bit n of ltrUseSlotMask
+    // stands for LTR slot n.
+    [StructLayout(LayoutKind.Sequential)]
+    public struct EncodeOptions
+    {
+        public int forceIdrFrame;
+        public int markLtrFrame;
+        public uint ltrMarkSlot;
+        public int useLtrFrames;
+        public uint ltrUseSlotMask;
+        public int isUnchanged;
+    }
+
+    // Must match AbrConfig in AbrController.h. Bitrates are in bits per second.
+    [StructLayout(LayoutKind.Sequential)]
+    public struct AbrConfig
+    {
+        public uint minBitRate;
+        public uint maxBitRate;
+        public uint startBitRate;
+        public uint minFrameRate;
+        public uint hysteresisPercent;
+        public uint increaseIntervalMs;
+        public uint decreaseIntervalMs;
+        public uint maxBitRatePercent;
+    }
+
+    // Must match NetworkFeedback in AbrController.h. Times are in microseconds.
+    [StructLayout(LayoutKind.Sequential)]
+    public struct NetworkFeedback
+    {
+        public ulong time;
+        public long delay;
+        public uint rtt;
+        public uint receivedBitRate;
+        public float lossRate;
+    }
+
+    // Must match QpRegion in QpMap.h. The rectangle is in pixels.
+    [StructLayout(LayoutKind.Sequential)]
+    public struct QpRegion
+    {
+        public int x;
+        public int y;
+        public int width;
+        public int height;
+        public int qpDelta;
+    }
+
+    // Must match Foveation in QpMap.h. Start from GetDefaultFoveation(). The
+    // gaze is in fractions of the frame size and the radii in fractions of its
+    // height.
+    [StructLayout(LayoutKind.Sequential)]
+    public struct Foveation
+    {
+        public float gazeX;
+        public float gazeY;
+        public float innerRadius;
+        public float outerRadius;
+        public int innerQpDelta;
+        public int outerQpDelta;
+    }
+
+    // Must match EncoderCaps in EncodeCaps.h. Flags are 0 or 1, and bit n of
+    // presetMask stands for Preset n.
+    [StructLayout(LayoutKind.Sequential)]
+    public struct EncoderCaps
+    {
+        public int isSupported;
+        public uint maxWidth;
+        public uint maxHeight;
+        public uint maxMacroblockCount;
+        public uint maxBFrameCount;
+        public uint maxLtrFrameCount;
+        public uint presetMask;
+        public int supportsLookahead;
+        public int supportsTemporalAq;
+        public int supports10Bit;
+        public int supportsYuv444;
+        public int supportsLossless;
+        public int supportsIntraRefresh;
+        public int supportsRefPicInvalidation;
+        public int supportsCustomVbv;
+        public int supportsDynamicResolutionChange;
+        public int supportsDynamicBitrateChange;
+        public int supportsDynamicSliceMode;
+        public int supportsSubframeReadback;
+    }
+
+    // Must match SimulcastRendition in SimulcastEncoder.h. Zero bitrates take
+    // the ones of the config.
+    [StructLayout(LayoutKind.Sequential)]
+    public struct SimulcastRendition
+    {
+        public uint width;
+        public uint height;
+        public uint averageBitRate;
+        public uint maxBitRate;
+    }
+
+    [StructLayout(LayoutKind.Sequential)]
+    public struct EncodedFrame
+    {
+        public IntPtr buffer;
+        public int size;
+        public int pictureType;
+        public ulong frameIndex;
+        public ulong timestamp;
+        public Codec codec;
+        public uint offset;
+        public int isFrameEnd;
+        // Leased frames have to be released with ReleaseEncodedData.
+        public int isLeased;
+    }
+
+    // ---
+
+    [DllImport(dllName, EntryPoint = "uNvEncoderCreateEncoder")]
+    public static extern int CreateEncoder(int width, int height, int frameRate);
+    [DllImport(dllName, EntryPoint = "uNvEncoderCreateEncoderWithCodec")]
+    public static extern int CreateEncoderWithCodec(int width, int height, int format, int frameRate, int asyncDepth, Codec codec);
+    [DllImport(dllName, EntryPoint = "uNvEncoderCreateEncoderEx")]
+    public static extern int CreateEncoderEx(int width, int height, int format, int frameRate, int asyncDepth, ref EncoderConfig config);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetDefaultEncoderConfig")]
+    public static extern void GetDefaultEncoderConfig(out EncoderConfig config);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetDefaultAbrConfig")]
+    public static extern void GetDefaultAbrConfig(out AbrConfig config);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetDefaultFoveation")]
+    public static extern void GetDefaultFoveation(out Foveation foveation);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetEncoderConfigError")]
+    private static extern IntPtr GetEncoderConfigErrorInternal(ref EncoderConfig config, int asyncDepth);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetEncoderCaps")]
+    public static extern bool GetEncoderCaps(Codec codec, out EncoderCaps caps);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetEncoderCapsError")]
+    private static extern IntPtr GetEncoderCapsErrorInternal(ref EncoderCaps caps, ref EncoderConfig config, int width, int height);
+    [DllImport(dllName, EntryPoint = "uNvEncoderSetEncoderCapsCachePath")]
+    public static extern void SetEncoderCapsCachePath(string path);
+    [DllImport(dllName, EntryPoint = "uNvEncoderDestroyEncoder")]
+    public static extern int DestroyEncoder(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderIsValid")]
+    public static extern bool IsValid(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetWidth")]
+    public static extern int GetWidth(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetHeight")]
+    public static extern int GetHeight(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetFrameRate")]
+    public static extern int GetFrameRate(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetCodec")]
+    public static extern Codec GetCodec(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderEncode")]
+    public static extern bool Encode(int id, IntPtr texturePtr, bool forceIdrFrame);
+    [DllImport(dllName, EntryPoint = "uNvEncoderEncodeWithOptions")]
+    public static extern bool EncodeWithOptions(int id, IntPtr texturePtr, ref EncodeOptions options);
+    [DllImport(dllName, EntryPoint = "uNvEncoderEncodeFromMemory")]
+    public static extern bool EncodeFromMemory(int id, IntPtr data, int pitch, int format, bool forceIdrFrame);
+    [DllImport(dllName, EntryPoint = "uNvEncoderEncodeFromMemoryWithOptions")]
+    public static extern bool EncodeFromMemoryWithOptions(int id, IntPtr data, int pitch, int format, ref EncodeOptions options);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetLtrSlotCount")]
+    public static extern int GetLtrSlotCount(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetLtrFrameIndex")]
+    public static extern bool GetLtrFrameIndex(int id, int slot, out ulong frameIndex);
+    [DllImport(dllName, EntryPoint = "uNvEncoderFindLtrSlot")]
+    public static extern int FindLtrSlot(int id, ulong frameIndex);
+    [DllImport(dllName, EntryPoint = "uNvEncoderInvalidateRefFrames")]
+    public static extern int InvalidateRefFrames(int id, ulong[] frameIndices, int count);
+    [DllImport(dllName, EntryPoint = "uNvEncoderInvalidateRefFramesByTimestamp")]
+    public static extern int InvalidateRefFramesByTimestamp(int id, ulong[] timestamps, int count);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetQpMapSize")]
+    public static extern bool GetQpMapSize(int id, out int columnCount, out int rowCount);
+    [DllImport(dllName, EntryPoint = "uNvEncoderSetQpDeltaMap")]
+    public static extern bool SetQpDeltaMap(int id, sbyte[] deltas, int size);
+    [DllImport(dllName, EntryPoint = "uNvEncoderSetFoveation")]
+    public static extern bool SetFoveation(int id, ref Foveation foveation);
+    [DllImport(dllName, EntryPoint = "uNvEncoderSetFoveation")]
+    private static extern bool SetFoveationInternal(int id, IntPtr foveation);
+    [DllImport(dllName, EntryPoint = "uNvEncoderSetQpRegions")]
+    public static extern bool SetQpRegions(int id, QpRegion[] regions, int count);
+    [DllImport(dllName, EntryPoint = "uNvEncoderSetRateControl")]
+    public static extern bool SetRateControl(int id, int averageBitRate, int maxBitRate, int frameRate, bool forceIdrFrame);
+    [DllImport(dllName, EntryPoint = "uNvEncoderSetAbrConfig")]
+    public static extern bool SetAbrConfig(int id, ref AbrConfig config);
+    [DllImport(dllName, EntryPoint = "uNvEncoderSetAbrConfig")]
+    private static extern bool SetAbrConfigInternal(int id, IntPtr config);
+    [DllImport(dllName, EntryPoint = "uNvEncoderReportNetworkFeedback")]
+    public static extern void ReportNetworkFeedback(int id, ref NetworkFeedback feedback);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetAbrEstimatedBitRate")]
+    public static extern int GetAbrEstimatedBitRate(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderRequestIntraRefresh")]
+    public static extern void RequestIntraRefresh(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderCopyEncodedData")]
+    public static extern void CopyEncodedData(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetEncodedDataCount")]
+    public static extern int GetEncodedDataCount(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetEncodedDataSize")]
+    public static extern int GetEncodedDataSize(int id, int index);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetEncodedDataBuffer")]
+    public static extern IntPtr GetEncodedDataBuffer(int id, int index);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetEncodedFrames")]
+    public static extern int GetEncodedFrames(int id, [Out] EncodedFrame[] frames, int maxCount);
+    [DllImport(dllName, EntryPoint = "uNvEncoderSetBitstreamLeaseEnabled")]
+    public static extern void SetBitstreamLeaseEnabled(int id, bool enabled);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetLeasedEncodedData")]
+    public static extern bool GetLeasedEncodedData(int id, int index, out IntPtr buffer, out int size, out ulong token);
+    [DllImport(dllName, EntryPoint = "uNvEncoderReleaseEncodedData")]
+    public static extern bool ReleaseEncodedData(int id, ulong token);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetEncodedDataOverflowCount")]
+    public static extern ulong GetEncodedDataOverflowCount(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetDuplicateFrameCount")]
+    public static extern ulong GetDuplicateFrameCount(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetSkippedDuplicateFrameCount")]
+    public static extern ulong GetSkippedDuplicateFrameCount(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderCreateSimulcastEncoder")]
+    public static extern int CreateSimulcastEncoder(int width, int height, int format, int frameRate, int asyncDepth, ref EncoderConfig config, SimulcastRendition[] renditions, int renditionCount);
+    [DllImport(dllName, EntryPoint = "uNvEncoderDestroySimulcastEncoder")]
+    public static extern void DestroySimulcastEncoder(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderIsSimulcastValid")]
+    public static extern bool IsSimulcastValid(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderEncodeSimulcast")]
+    public static extern bool EncodeSimulcast(int id, IntPtr texturePtr, ref EncodeOptions options);
+    [DllImport(dllName, EntryPoint = "uNvEncoderRequestSimulcastIntraRefresh")]
+    public static extern void RequestSimulcastIntraRefresh(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetSimulcastRenditionCount")]
+    public static extern int GetSimulcastRenditionCount(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetSimulcastRenditionEncoder")]
+    public static extern int GetSimulcastRenditionEncoder(int id, int index);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetSimulcastError")]
+    private static extern IntPtr GetSimulcastErrorInternal(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderClearSimulcastError")]
+    public static extern void ClearSimulcastError(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderGetError")]
+    private static extern IntPtr GetErrorInternal(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderHasError")]
+    public static extern bool HasError(int id);
+    [DllImport(dllName, EntryPoint = "uNvEncoderClearError")]
+    public static extern void ClearError(int id);
+
+    public static string GetError(int id)
+    {
+        var ptr = GetErrorInternal(id);
+        return Marshal.PtrToStringAnsi(ptr);
+    }
+
+    public static string GetSimulcastError(int id)
+    {
+        var ptr = GetSimulcastErrorInternal(id);
+        return ptr == IntPtr.Zero ? null : Marshal.PtrToStringAnsi(ptr);
+    }
+
+    public static string GetEncoderConfigError(EncoderConfig config, int asyncDepth)
+    {
+        var ptr = GetEncoderConfigErrorInternal(ref config, asyncDepth);
+        return ptr == IntPtr.Zero ? null : Marshal.PtrToStringAnsi(ptr);
+    }
+
+    public static string GetEncoderCapsError(EncoderCaps caps, EncoderConfig config, int width, int height)
+    {
+        var ptr = GetEncoderCapsErrorInternal(ref caps, ref config, width, height);
+        return ptr == IntPtr.Zero ? null : Marshal.PtrToStringAnsi(ptr);
+    }
+
+    public static bool DisableAbr(int id)
+    {
+        return SetAbrConfigInternal(id, IntPtr.Zero);
+    }
+
+    public static bool ClearFoveation(int id)
+    {
+        return SetFoveationInternal(id, IntPtr.Zero);
+    }
+}
+
+}
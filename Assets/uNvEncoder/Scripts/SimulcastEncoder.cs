@@ -0,0 +1,115 @@
+﻿using UnityEngine;
+
+namespace uNvEncoder
+{
+
+// Encodes one texture into several renditions of it, for example for an SFU
+// that forwards the one a receiver can take. Each rendition is read out like
+// a normal encoder, and all of them have IDR frames at the same frames.
+public class SimulcastEncoder
+{
+    public int id { get; private set; } = -1;
+    public Encoder[] renditions { get; private set; } = new Encoder[0];
+
+    public bool isValid
+    {
+        get { return Lib.IsSimulcastValid(id); }
+    }
+
+    public string error
+    {
+        get
+        {
+            var str = Lib.GetSimulcastError(id);
+            Lib.ClearSimulcastError(id);
+            return str ?? "";
+        }
+    }
+
+    // Renditions must not be larger than the source. Smaller ones are scaled
+    // on the GPU.
+    public void Create(int width, int height, int frameRate, Lib.EncoderConfig config, Lib.SimulcastRendition[] renditions, int asyncDepth = 3)
+    {
+        var configError = Lib.GetEncoderConfigError(config, asyncDepth);
+        if (configError != null)
+        {
+            Debug.LogError(configError);
+            return;
+        }
+
+        const int formatR8G8B8A8Unorm = 28;
+        id = Lib.CreateSimulcastEncoder(width, height, formatR8G8B8A8Unorm, frameRate, asyncDepth, ref config, renditions, renditions.Length);
+
+        this.renditions = new Encoder[Lib.GetSimulcastRenditionCount(id)];
+        for (int i = 0; i < this.renditions.Length; ++i)
+        {
+            this.renditions[i] = new Encoder();
+            this.renditions[i].Attach(Lib.GetSimulcastRenditionEncoder(id, i));
+        }
+
+        if (!isValid)
+        {
+            Debug.LogError(error);
+        }
+    }
+
+    public void Destroy()
+    {
+        Lib.DestroySimulcastEncoder(id);
+        renditions = new Encoder[0];
+    }
+
+    public void RequestIntraRefresh()
+    {
+        Lib.RequestSimulcastIntraRefresh(id);
+    }
+
+    public void Update()
+    {
+        foreach (var rendition in renditions)
+        {
+            rendition.Update();
+        }
+    }
+
+    public bool Encode(Texture texture, bool forceIdrFrame)
+    {
+        if (!texture)
+        {
+            Debug.LogError("The given texture is invalid.");
+            return false;
+        }
+
+        var options = new Lib.EncodeOptions();
+        options.forceIdrFrame = forceIdrFrame ? 1 : 0;
+        return Encode(texture.GetNativeTexturePtr(), options);
+    }
+
+    // Returns false without an error when a rendition is still busy, and
+    // then no rendition takes the frame.
+    public bool Encode(System.IntPtr ptr, Lib.EncodeOptions options)
+    {
+        if (ptr == System.IntPtr.Zero)
+        {
+            Debug.LogError("The given texture pointer is invalid.");
+            return false;
+        }
+
+        if (!isValid)
+        {
+            Debug.LogError("uNvEncoder has not been initialized yet.");
+            return false;
+        }
+
+        var result = Lib.EncodeSimulcast(id, ptr, ref options);
+        if (!result)
+        {
+            var str = error;
+            if (str != "") Debug.LogError(str);
+        }
+
+        return result;
+    }
+}
+
+}
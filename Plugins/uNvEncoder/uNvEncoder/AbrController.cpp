@@ -0,0 +1,377 @@
+#include <algorithm>
+#include <cmath>
+#include "AbrController.h"
+
+
+namespace uNvEncoder
+{
+
+
+namespace
+{
+
+
+constexpr size_t trendWindowSize = 20;
+constexpr double delaySmoothing = 0.9;
+constexpr double trendGain = 4.0;
+constexpr uint32_t maxTrendSampleCount = 60;
+constexpr double initialThreshold = 12.5;
+constexpr double minThreshold = 6.0;
+constexpr double maxThreshold = 600.0;
+constexpr double thresholdIncreaseRate = 0.0087;
+constexpr double thresholdDecreaseRate = 0.039;
+constexpr double maxThresholdStepMs = 100.0;
+constexpr double overuseTimeMs = 10.0;
+
+constexpr double decreaseFactor = 0.85;
+constexpr double increaseFactorPerSecond = 1.08;
+constexpr double maxReceivedRatio = 1.5;
+constexpr double packetBits = 1200.0 * 8.0;
+constexpr double responseTimeMs = 100.0;
+
+constexpr double highLossRate = 0.1;
+constexpr double lowLossRate = 0.02;
+constexpr double lossIncreaseFactorPerSecond = 1.05;
+// Reports only cover a few packets each, so losses are judged over windows
+// of about a second like RTCP receiver reports do.
+constexpr double lossWindowMs = 1000.0;
+
+// Below the lower one the frame rate is halved, and it is only doubled again
+// when the doubled rate still gets the higher one.
+constexpr double lowBitsPerPixel = 0.02;
+constexpr double highBitsPerPixel = 0.03;
+
+
+}
+
+
+const char * GetAbrConfigError(const AbrConfig &config)
+{
+    if (config.minBitRate == 0) return "The min bitrate of ABR must be positive.";
+    if (config.maxBitRate < config.minBitRate) return "The max bitrate of ABR is lower than the min bitrate.";
+    if (config.startBitRate != 0 && (config.startBitRate < config.minBitRate || config.startBitRate > config.maxBitRate))
+    {
+        return "The start bitrate of ABR is outside the min and max bitrate.";
+    }
+    if (config.hysteresisPercent >= 50) return "The ABR hysteresis must be less than 50 percent.";
+    if (config.maxBitRatePercent < 100) return "The ABR max bitrate must be at least 100 percent of the average.";
+    if (config.decreaseIntervalMs > config.increaseIntervalMs)
+    {
+        return "The ABR decrease interval must not be longer than the increase interval.";
+    }
+
+    return nullptr;
+}
+
+
+AbrController::AbrController(const AbrConfig &config, uint32_t startBitRate, uint32_t width, uint32_t height, uint32_t frameRate)
+    : config_(config)
+    , width_(width)
+    , height_(height)
+    , sourceFrameRate_(frameRate)
+    , threshold_(initialThreshold)
+{
+    const auto bitRate = config.startBitRate ? config.startBitRate : startBitRate;
+    delayBasedBitRate_ = std::min(std::max(bitRate, config.minBitRate), config.maxBitRate);
+    lossBasedBitRate_ = config.maxBitRate;
+    estimatedBitRate_ = delayBasedBitRate_;
+
+    // The session may not run at the start bitrate yet, so it is the first
+    // target whatever the hysteresis says.
+    appliedTarget_ = MakeTarget(estimatedBitRate_, GetFrameRate(estimatedBitRate_));
+    pendingTarget_ = appliedTarget_;
+    isTargetPending_ = true;
+}
+
+
+void AbrController::OnFeedback(const NetworkFeedback &feedback)
+{
+    // Reports that arrive out of order would make the delay trend meaningless.
+    if (hasFeedback_ && feedback.time <= lastTime_) return;
+
+    if (!hasFeedback_)
+    {
+        hasFeedback_ = true;
+        firstTime_ = feedback.time;
+        firstDelay_ = feedback.delay;
+        lastTime_ = feedback.time;
+        lastChangeTime_ = feedback.time;
+    }
+
+    const double intervalMs = (feedback.time - lastTime_) / 1000.0;
+    lastTime_ = feedback.time;
+
+    const auto usage = DetectUsage(feedback, intervalMs);
+    UpdateDelayBasedBitRate(feedback, usage, intervalMs);
+    UpdateLossBasedBitRate(feedback, intervalMs);
+
+    const double bitRate = std::min(delayBasedBitRate_, lossBasedBitRate_);
+    estimatedBitRate_ = std::min(std::max(bitRate, static_cast<double>(config_.minBitRate)), static_cast<double>(config_.maxBitRate));
+
+    UpdateTarget(feedback.time);
+}
+
+
+AbrController::Usage AbrController::DetectUsage(const NetworkFeedback &feedback, double intervalMs)
+{
+    const double delayMs = (feedback.delay - firstDelay_) / 1000.0;
+    smoothedDelayMs_ = sampleCount_ ? delaySmoothing * smoothedDelayMs_ + (1.0 - delaySmoothing) * delayMs : delayMs;
+    sampleCount_ = std::min(sampleCount_ + 1, maxTrendSampleCount);
+
+    delaySamples_.push_back({ (feedback.time - firstTime_) / 1000.0, smoothedDelayMs_ });
+    if (delaySamples_.size() > trendWindowSize) delaySamples_.pop_front();
+    if (delaySamples_.size() < trendWindowSize) return Usage::Normal;
+
+    double meanTime = 0.0;
+    double meanDelay = 0.0;
+    for (const auto &sample : delaySamples_)
+    {
+        meanTime += sample.timeMs;
+        meanDelay += sample.delayMs;
+    }
+    meanTime /= delaySamples_.size();
+    meanDelay /= delaySamples_.size();
+
+    double numerator = 0.0;
+    double denominator = 0.0;
+    for (const auto &sample : delaySamples_)
+    {
+        numerator += (sample.timeMs - meanTime) * (sample.delayMs - meanDelay);
+        denominator += (sample.timeMs - meanTime) * (sample.timeMs - meanTime);
+    }
+    const double slope = denominator > 0.0 ? numerator / denominator : 0.0;
+    const double trend = sampleCount_ * slope * trendGain;
+
+    auto usage = Usage::Normal;
+    if (trend > threshold_)
+    {
+        overuseTimeMs_ = overuseTimeMs_ < 0.0 ? intervalMs / 2.0 : overuseTimeMs_ + intervalMs;
+        ++overuseCount_;
+        if (overuseTimeMs_ > overuseTimeMs && overuseCount_ > 1 && trend >= previousTrend_)
+        {
+            usage = Usage::Over;
+            overuseTimeMs_ = 0.0;
+            overuseCount_ = 0;
+        }
+    }
+    else
+    {
+        overuseTimeMs_ = -1.0;
+        overuseCount_ = 0;
+        if (trend < -threshold_) usage = Usage::Under;
+    }
+    previousTrend_ = trend;
+
+    UpdateThreshold(trend, intervalMs);
+    return usage;
+}
+
+
+// The threshold follows the trend slowly so that a queue that another flow
+// keeps full does not starve this one, but ignores spikes far above it.
+void AbrController::UpdateThreshold(double trend, double intervalMs)
+{
+    const double absTrend = std::abs(trend);
+    if (absTrend > threshold_ + 15.0) return;
+
+    const double rate = absTrend < threshold_ ? thresholdDecreaseRate : thresholdIncreaseRate;
+    threshold_ += rate * (absTrend - threshold_) * std::min(intervalMs, maxThresholdStepMs);
+    threshold_ = std::min(std::max(threshold_, minThreshold), maxThreshold);
+}
+
+
+void AbrController::UpdateDelayBasedBitRate(const NetworkFeedback &feedback, Usage usage, double intervalMs)
+{
+    switch (usage)
+    {
+        case Usage::Over:
+            rateState_ = RateState::Decrease;
+            break;
+        case Usage::Under:
+            rateState_ = RateState::Hold;
+            break;
+        case Usage::Normal:
+            if (rateState_ == RateState::Hold) rateState_ = RateState::Increase;
+            else if (rateState_ == RateState::Decrease) rateState_ = RateState::Hold;
+            break;
+    }
+
+    const double receivedBitRate = feedback.receivedBitRate;
+    switch (rateState_)
+    {
+        case RateState::Hold:
+            break;
+
+        case RateState::Increase:
+        {
+            // The encoder only follows the estimate past the hysteresis, so
+            // the estimate leaving the capacity band counts like the received
+            // rate doing so.
+            const double rateKbps = std::max(receivedBitRate, delayBasedBitRate_) / 1000.0;
+            if (linkCapacity_ >= 0.0)
+            {
+                const double deviation = std::sqrt(linkCapacityVariance_ * linkCapacity_);
+                if (rateKbps > linkCapacity_ + 3.0 * deviation) linkCapacity_ = -1.0;
+            }
+
+            if (linkCapacity_ >= 0.0)
+            {
+                // Near the capacity the rate grows by about a packet per
+                // response time.
+                const double responseMs = responseTimeMs + feedback.rtt / 1000.0;
+                delayBasedBitRate_ += std::max(1000.0, packetBits * 1000.0 / responseMs) * intervalMs / 1000.0;
+            }
+            else
+            {
+                delayBasedBitRate_ *= std::pow(increaseFactorPerSecond, std::min(intervalMs, 1000.0) / 1000.0);
+            }
+
+            // Only raise as far as the link has shown it can carry.
+            if (receivedBitRate > 0.0)
+            {
+                delayBasedBitRate_ = std::min(delayBasedBitRate_, maxReceivedRatio * receivedBitRate + 10000.0);
+            }
+            break;
+        }
+
+        case RateState::Decrease:
+            if (receivedBitRate > 0.0)
+            {
+                delayBasedBitRate_ = std::min(delayBasedBitRate_, decreaseFactor * receivedBitRate);
+                UpdateLinkCapacity(receivedBitRate / 1000.0);
+            }
+            rateState_ = RateState::Hold;
+            break;
+    }
+
+    delayBasedBitRate_ = std::min(std::max(delayBasedBitRate_, static_cast<double>(config_.minBitRate)), static_cast<double>(config_.maxBitRate));
+}
+
+
+void AbrController::UpdateLossBasedBitRate(const NetworkFeedback &feedback, double intervalMs)
+{
+    lossSum_ += std::min(std::max(static_cast<double>(feedback.lossRate), 0.0), 1.0) * intervalMs;
+    lossWindowMs_ += intervalMs;
+    if (lossWindowMs_ < lossWindowMs) return;
+
+    const double lossRate = lossSum_ / lossWindowMs_;
+    if (lossRate > highLossRate)
+    {
+        lossBasedBitRate_ = std::min(lossBasedBitRate_, estimatedBitRate_) * (1.0 - 0.5 * lossRate);
+    }
+    else if (lossRate < lowLossRate)
+    {
+        lossBasedBitRate_ *= std::pow(lossIncreaseFactorPerSecond, lossWindowMs_ / 1000.0);
+    }
+    lossSum_ = 0.0;
+    lossWindowMs_ = 0.0;
+
+    lossBasedBitRate_ = std::min(std::max(lossBasedBitRate_, static_cast<double>(config_.minBitRate)), static_cast<double>(config_.maxBitRate));
+}
+
+
+void AbrController::UpdateLinkCapacity(double bitRateKbps)
+{
+    // Far below the average the link itself has changed, so it starts over.
+    if (linkCapacity_ >= 0.0 && bitRateKbps < linkCapacity_ - 3.0 * std::sqrt(linkCapacityVariance_ * linkCapacity_))
+    {
+        linkCapacity_ = -1.0;
+    }
+
+    if (linkCapacity_ < 0.0)
+    {
+        linkCapacity_ = bitRateKbps;
+    }
+    else
+    {
+        linkCapacity_ = 0.95 * linkCapacity_ + 0.05 * bitRateKbps;
+    }
+
+    const double difference = linkCapacity_ - bitRateKbps;
+    linkCapacityVariance_ = 0.95 * linkCapacityVariance_ + 0.05 * difference * difference / std::max(linkCapacity_, 1.0);
+    linkCapacityVariance_ = std::min(std::max(linkCapacityVariance_, 0.4), 2.5);
+}
+
+
+void AbrController::SetResolution(uint32_t width, uint32_t height)
+{
+    width_ = width;
+    height_ = height;
+}
+
+
+uint32_t AbrController::GetFrameRate(double bitRate) const
+{
+    if (config_.minFrameRate == 0 || config_.minFrameRate >= sourceFrameRate_ || width_ == 0 || height_ == 0)
+    {
+        return sourceFrameRate_;
+    }
+
+    const double pixelCount = static_cast<double>(width_) * height_;
+    const auto getBitsPerPixel = [&](uint32_t frameRate) { return bitRate / (pixelCount * frameRate); };
+
+    auto frameRate = appliedTarget_.frameRate ? appliedTarget_.frameRate : sourceFrameRate_;
+    if (getBitsPerPixel(frameRate) < lowBitsPerPixel)
+    {
+        while (frameRate > config_.minFrameRate && getBitsPerPixel(frameRate) < lowBitsPerPixel)
+        {
+            frameRate = std::max(config_.minFrameRate, frameRate / 2);
+        }
+    }
+    else
+    {
+        while (frameRate < sourceFrameRate_ && getBitsPerPixel(std::min(frameRate * 2, sourceFrameRate_)) >= highBitsPerPixel)
+        {
+            frameRate = std::min(frameRate * 2, sourceFrameRate_);
+        }
+    }
+
+    return frameRate;
+}
+
+
+void AbrController::UpdateTarget(uint64_t time)
+{
+    const auto frameRate = GetFrameRate(estimatedBitRate_);
+    const double appliedBitRate = appliedTarget_.averageBitRate;
+    const double hysteresis = config_.hysteresisPercent / 100.0;
+    const bool isBitRateLower = estimatedBitRate_ < appliedBitRate * (1.0 - hysteresis);
+    const bool isBitRateHigher = estimatedBitRate_ > appliedBitRate * (1.0 + hysteresis);
+    const bool isLower = isBitRateLower || frameRate < appliedTarget_.frameRate;
+    const bool isHigher = isBitRateHigher || frameRate > appliedTarget_.frameRate;
+    if (!isLower && !isHigher) return;
+
+    const uint64_t intervalMs = isLower ? config_.decreaseIntervalMs : config_.increaseIntervalMs;
+    if (time - lastChangeTime_ < intervalMs * 1000) return;
+
+    // Within the hysteresis the bitrate stays, so that a frame rate change
+    // alone does not nudge it.
+    const double bitRate = (isBitRateLower || isBitRateHigher) ? estimatedBitRate_ : appliedBitRate;
+    appliedTarget_ = MakeTarget(bitRate, frameRate);
+    pendingTarget_ = appliedTarget_;
+    isTargetPending_ = true;
+    lastChangeTime_ = time;
+}
+
+
+AbrTarget AbrController::MakeTarget(double bitRate, uint32_t frameRate) const
+{
+    AbrTarget target;
+    target.averageBitRate = static_cast<uint32_t>(bitRate);
+    target.maxBitRate = static_cast<uint32_t>(std::min(bitRate * config_.maxBitRatePercent / 100.0, 4294967295.0));
+    target.frameRate = frameRate;
+    return target;
+}
+
+
+bool AbrController::TakeTarget(AbrTarget &target)
+{
+    if (!isTargetPending_) return false;
+
+    target = pendingTarget_;
+    isTargetPending_ = false;
+    return true;
+}
+
+
+}
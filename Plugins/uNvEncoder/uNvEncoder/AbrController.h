@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+
+
+namespace uNvEncoder
+{
+
+
+// Blittable ABR settings shared with C#. Bitrates are in bits per second. A
+// zero startBitRate starts from the average bitrate of the session, and a zero
+// minFrameRate never lowers the frame rate. Estimates that differ from the
+// applied bitrate by less than hysteresisPercent are not applied, and changes
+// are at least decreaseIntervalMs apart, or increaseIntervalMs when they raise
+// the bitrate or the frame rate. The max bitrate follows the average bitrate
+// at maxBitRatePercent of it.
+struct AbrConfig
+{
+    uint32_t minBitRate = 300000;
+    uint32_t maxBitRate = 20000000;
+    uint32_t startBitRate = 0;
+    uint32_t minFrameRate = 0;
+    uint32_t hysteresisPercent = 5;
+    uint32_t increaseIntervalMs = 1000;
+    uint32_t decreaseIntervalMs = 200;
+    uint32_t maxBitRatePercent = 150;
+};
+
+
+// Blittable receiver report shared with C#, sent every few tens of
+// milliseconds. time is when the report arrived and delay the one-way delay
+// of the latest received frame, both in microseconds. Clocks of the sender
+// and the receiver may differ by a constant offset since only changes of the
+// delay matter. rtt is in microseconds too, and lossRate is the fraction of
+// packets lost since the previous report.
+struct NetworkFeedback
+{
+    uint64_t time;
+    int64_t delay;
+    uint32_t rtt;
+    uint32_t receivedBitRate;
+    float lossRate;
+};
+
+
+struct AbrTarget
+{
+    uint32_t averageBitRate = 0;
+    uint32_t maxBitRate = 0;
+    uint32_t frameRate = 0;
+};
+
+
+// Returns why the ABR config cannot be used, or nullptr if it is valid.
+const char * GetAbrConfigError(const AbrConfig &config);
+
+
+// Estimates the available bitrate from receiver reports, like GCC does with a
+// delay-based and a loss-based part. The delay-based part fits a trend line to
+// the smoothed one-way delay and compares it with an adaptive threshold: a
+// growing queue decreases the rate to 85% of what arrived, a stable one
+// increases it by 8% per second, or additively near the rate of the last
+// decrease. The loss-based part only lowers the estimate when more than 10%
+// of the packets are lost. The frame rate is halved toward minFrameRate while
+// the estimate leaves too few bits per pixel.
+//
+// It holds no clock and no encoder, so everything happens in report time and
+// the same reports always give the same targets.
+class AbrController final
+{
+public:
+    AbrController(const AbrConfig &config, uint32_t startBitRate, uint32_t width, uint32_t height, uint32_t frameRate);
+    void OnFeedback(const NetworkFeedback &feedback);
+    void SetResolution(uint32_t width, uint32_t height);
+    // Returns the latest target that moved past the hysteresis and the rate
+    // limit, once. The first one is the start bitrate.
+    bool TakeTarget(AbrTarget &target);
+    uint32_t GetEstimatedBitRate() const { return static_cast<uint32_t>(estimatedBitRate_); }
+
+private:
+    enum class Usage
+    {
+        Normal,
+        Over,
+        Under,
+    };
+
+    enum class RateState
+    {
+        Hold,
+        Increase,
+        Decrease,
+    };
+
+    struct DelaySample
+    {
+        double timeMs;
+        double delayMs;
+    };
+
+    Usage DetectUsage(const NetworkFeedback &feedback, double intervalMs);
+    void UpdateThreshold(double trend, double intervalMs);
+    void UpdateDelayBasedBitRate(const NetworkFeedback &feedback, Usage usage, double intervalMs);
+    void UpdateLossBasedBitRate(const NetworkFeedback &feedback, double intervalMs);
+    void UpdateLinkCapacity(double bitRate);
+    uint32_t GetFrameRate(double bitRate) const;
+    void UpdateTarget(uint64_t time);
+    AbrTarget MakeTarget(double bitRate, uint32_t frameRate) const;
+
+    const AbrConfig config_;
+    uint32_t width_;
+    uint32_t height_;
+    const uint32_t sourceFrameRate_;
+
+    bool hasFeedback_ = false;
+    uint64_t firstTime_ = 0;
+    uint64_t lastTime_ = 0;
+    int64_t firstDelay_ = 0;
+    uint32_t sampleCount_ = 0;
+    double smoothedDelayMs_ = 0.0;
+    std::deque<DelaySample> delaySamples_;
+    double threshold_;
+    double previousTrend_ = 0.0;
+    double overuseTimeMs_ = -1.0;
+    uint32_t overuseCount_ = 0;
+
+    RateState rateState_ = RateState::Hold;
+    double delayBasedBitRate_;
+    double lossBasedBitRate_;
+    double estimatedBitRate_;
+    // Average in kbps of what arrived whenever the queue started to grow, or
+    // negative until it has.
+    double linkCapacity_ = -1.0;
+    double linkCapacityVariance_ = 0.4;
+    double lossSum_ = 0.0;
+    double lossWindowMs_ = 0.0;
+
+    AbrTarget appliedTarget_;
+    AbrTarget pendingTarget_;
+    bool isTargetPending_ = false;
+    uint64_t lastChangeTime_ = 0;
+};
+
+
+}
@@ -0,0 +1,115 @@
+#include "BitstreamPool.h"
+
+
+namespace uNvEncoder
+{
+
+
+BitstreamBuffer::BitstreamBuffer(BitstreamBuffer &&other) noexcept
+    : pool_(other.pool_)
+    , data_(other.data_)
+    , sizeClass_(other.sizeClass_)
+{
+    other.pool_ = nullptr;
+    other.data_ = nullptr;
+}
+
+
+BitstreamBuffer & BitstreamBuffer::operator=(BitstreamBuffer &&other) noexcept
+{
+    if (this != &other)
+    {
+        Reset();
+        pool_ = other.pool_;
+        data_ = other.data_;
+        sizeClass_ = other.sizeClass_;
+        other.pool_ = nullptr;
+        other.data_ = nullptr;
+    }
+    return *this;
+}
+
+
+BitstreamBuffer::~BitstreamBuffer()
+{
+    Reset();
+}
+
+
+void BitstreamBuffer::Reset()
+{
+    if (!data_) return;
+
+    pool_->Release(data_, sizeClass_);
+    pool_ = nullptr;
+    data_ = nullptr;
+}
+
+
+BitstreamPool::~BitstreamPool()
+{
+    for (auto &freeList : freeLists_)
+    {
+        for (auto data : freeList)
+        {
+            delete[] data;
+        }
+    }
+}
+
+
+BitstreamBuffer BitstreamPool::Acquire(size_t size)
+{
+    uint32_t sizeClass = minSizeClass;
+    while (sizeClass < unpooledSizeClass && (static_cast<size_t>(1) << sizeClass) < size)
+    {
+        ++sizeClass;
+    }
+
+    BitstreamBuffer buffer;
+    buffer.pool_ = this;
+    buffer.sizeClass_ = sizeClass;
+
+    if (sizeClass == unpooledSizeClass)
+    {
+        buffer.data_ = new uint8_t[size];
+        ++allocationCount_;
+        return buffer;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto &freeList = freeLists_[sizeClass - minSizeClass];
+        if (!freeList.empty())
+        {
+            buffer.data_ = freeList.back();
+            freeList.pop_back();
+            return buffer;
+        }
+        ++allocationCount_;
+    }
+
+    buffer.data_ = new uint8_t[static_cast<size_t>(1) << sizeClass];
+    return buffer;
+}
+
+
+void BitstreamPool::Release(uint8_t *data, uint32_t sizeClass)
+{
+    if (sizeClass != unpooledSizeClass)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto &freeList = freeLists_[sizeClass - minSizeClass];
+        if (freeList.size() < maxFreeBuffersPerClass)
+        {
+            if (freeList.capacity() == 0) freeList.reserve(maxFreeBuffersPerClass);
+            freeList.push_back(data);
+            return;
+        }
+    }
+
+    delete[] data;
+}
+
+
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+namespace uNvEncoder
+{
+
+
+class BitstreamPool;
+
+
+// Move-only bitstream payload. The storage goes back to the pool it was
+// acquired from when the buffer is destroyed or reset.
+class BitstreamBuffer final
+{
+public:
+    BitstreamBuffer() = default;
+    BitstreamBuffer(BitstreamBuffer &&other) noexcept;
+    BitstreamBuffer & operator=(BitstreamBuffer &&other) noexcept;
+    BitstreamBuffer(const BitstreamBuffer &) = delete;
+    BitstreamBuffer & operator=(const BitstreamBuffer &) = delete;
+    ~BitstreamBuffer();
+    void Reset();
+    uint8_t * Get() const { return data_; }
+    explicit operator bool() const { return data_ != nullptr; }
+
+private:
+    friend class BitstreamPool;
+    BitstreamPool *pool_ = nullptr;
+    uint8_t *data_ = nullptr;
+    uint32_t sizeClass_ = 0;
+};
+
+
+// Power-of-two size-class pool for encoded frames. Buffers are acquired on the
+// output thread and released on the consumer thread, so after warm-up no frame
+// touches the heap.
+class BitstreamPool final
+{
+public:
+    BitstreamPool() = default;
+    ~BitstreamPool();
+    BitstreamPool(const BitstreamPool &) = delete;
+    BitstreamPool & operator=(const BitstreamPool &) = delete;
+    BitstreamBuffer Acquire(size_t size);
+    uint64_t GetAllocationCount() const { return allocationCount_; }
+
+private:
+    friend class BitstreamBuffer;
+    void Release(uint8_t *data, uint32_t sizeClass);
+
+    static constexpr uint32_t minSizeClass = 12;
+    static constexpr uint32_t sizeClassCount = 17;
+    static constexpr uint32_t unpooledSizeClass = minSizeClass + sizeClassCount;
+    static constexpr size_t maxFreeBuffersPerClass = 64;
+
+    std::mutex mutex_;
+    std::vector<uint8_t*> freeLists_[sizeClassCount];
+    std::atomic<uint64_t> allocationCount_ = { 0 };
+};
+
+
+}
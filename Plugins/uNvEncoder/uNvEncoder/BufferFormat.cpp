@@ -0,0 +1,42 @@
+#include "BufferFormat.h"
+
+
+namespace uNvEncoder
+{
+
+
+static_assert(GetBufferFormat(DXGI_FORMAT_R8G8B8A8_UNORM) == NV_ENC_BUFFER_FORMAT_ABGR, "RGBA is ABGR in NVENC word order.");
+static_assert(GetBufferFormat(DXGI_FORMAT_B8G8R8A8_UNORM) == NV_ENC_BUFFER_FORMAT_ARGB, "BGRA is ARGB in NVENC word order.");
+static_assert(GetBufferFormat(DXGI_FORMAT_R10G10B10A2_UNORM) == NV_ENC_BUFFER_FORMAT_ABGR10, "RGB10A2 is ABGR10 in NVENC word order.");
+static_assert(GetBufferFormat(DXGI_FORMAT_P010) == NV_ENC_BUFFER_FORMAT_YUV420_10BIT, "P010 is 10-bit NV12.");
+static_assert(GetBufferFormat(DXGI_FORMAT_R16G16B16A16_FLOAT) == NV_ENC_BUFFER_FORMAT_UNDEFINED, "NVENC reads no float formats.");
+static_assert(Is10BitBufferFormat(GetBufferFormat(DXGI_FORMAT_P010)), "P010 is a 10-bit format.");
+static_assert(!Is10BitBufferFormat(GetBufferFormat(DXGI_FORMAT_NV12)), "NV12 is an 8-bit format.");
+static_assert(GetBytesPerPixel(GetBufferFormat(DXGI_FORMAT_P010)) == 2, "P010 has 16-bit samples.");
+static_assert(GetBufferRowCount(NV_ENC_BUFFER_FORMAT_NV12, 1081) == 1622, "NV12 chroma rows round up.");
+static_assert(GetBufferRowCount(NV_ENC_BUFFER_FORMAT_YUV444, 1080) == 3240, "YUV 4:4:4 has three full planes.");
+
+
+const char * GetInputFormatError(DXGI_FORMAT format, const EncoderConfig &config)
+{
+    const auto bufferFormat = GetBufferFormat(format);
+    if (bufferFormat == NV_ENC_BUFFER_FORMAT_UNDEFINED) return "The texture format cannot be encoded by NVENC.";
+
+    if (Is10BitBufferFormat(bufferFormat))
+    {
+        if (config.codec != NvencCodec::HEVC) return "10-bit input needs HEVC.";
+        if (config.profile != NvencProfile::Auto && config.profile != NvencProfile::HevcMain10)
+        {
+            return "10-bit input needs the HEVC Main10 profile.";
+        }
+    }
+    if (config.inputConversion == NvencInputConversion::Yuv444 && HasChromaPlane(bufferFormat))
+    {
+        return "4:2:0 input cannot be encoded as YUV 4:4:4.";
+    }
+
+    return nullptr;
+}
+
+
+}
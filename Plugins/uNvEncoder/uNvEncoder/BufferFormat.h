@@ -0,0 +1,93 @@
+#pragma once
+
+#include "nvEncodeAPI.h"
+#include "DxgiFormat.h"
+#include "EncoderConfig.h"
+
+
+namespace uNvEncoder
+{
+
+
+// NVENC names packed RGB formats by their order in a little-endian word, so
+// DXGI_FORMAT_R8G8B8A8 with R in the lowest byte is NVENC's ABGR and
+// DXGI_FORMAT_B8G8R8A8 is ARGB. Typeless and sRGB textures hold the same
+// bytes. Returns NV_ENC_BUFFER_FORMAT_UNDEFINED for formats NVENC cannot read.
+constexpr NV_ENC_BUFFER_FORMAT GetBufferFormat(DXGI_FORMAT format)
+{
+    switch (format)
+    {
+        case DXGI_FORMAT_R8G8B8A8_TYPELESS:
+        case DXGI_FORMAT_R8G8B8A8_UNORM:
+        case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+            return NV_ENC_BUFFER_FORMAT_ABGR;
+        case DXGI_FORMAT_B8G8R8A8_TYPELESS:
+        case DXGI_FORMAT_B8G8R8A8_UNORM:
+        case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+        case DXGI_FORMAT_B8G8R8X8_UNORM:
+        case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB:
+            return NV_ENC_BUFFER_FORMAT_ARGB;
+        case DXGI_FORMAT_R10G10B10A2_UNORM:
+            return NV_ENC_BUFFER_FORMAT_ABGR10;
+        case DXGI_FORMAT_AYUV:
+            return NV_ENC_BUFFER_FORMAT_AYUV;
+        case DXGI_FORMAT_NV12:
+            return NV_ENC_BUFFER_FORMAT_NV12;
+        case DXGI_FORMAT_P010:
+            return NV_ENC_BUFFER_FORMAT_YUV420_10BIT;
+        default:
+            return NV_ENC_BUFFER_FORMAT_UNDEFINED;
+    }
+}
+
+
+constexpr bool Is10BitBufferFormat(NV_ENC_BUFFER_FORMAT format)
+{
+    return
+        format == NV_ENC_BUFFER_FORMAT_YUV420_10BIT ||
+        format == NV_ENC_BUFFER_FORMAT_YUV444_10BIT ||
+        format == NV_ENC_BUFFER_FORMAT_ARGB10 ||
+        format == NV_ENC_BUFFER_FORMAT_ABGR10;
+}
+
+
+// Bytes per pixel of the first plane, which is the only one of packed
+// formats. NV12 and P010 follow it with an interleaved chroma plane of half
+// the height whose rows are as long, and YUV 4:4:4 with a U and a V plane
+// like the Y plane.
+constexpr uint32_t GetBytesPerPixel(NV_ENC_BUFFER_FORMAT format)
+{
+    return
+        format == NV_ENC_BUFFER_FORMAT_NV12 || format == NV_ENC_BUFFER_FORMAT_YUV444 ? 1 :
+        format == NV_ENC_BUFFER_FORMAT_YUV420_10BIT || format == NV_ENC_BUFFER_FORMAT_YUV444_10BIT ? 2 : 4;
+}
+
+
+constexpr bool HasChromaPlane(NV_ENC_BUFFER_FORMAT format)
+{
+    return format == NV_ENC_BUFFER_FORMAT_NV12 || format == NV_ENC_BUFFER_FORMAT_YUV420_10BIT;
+}
+
+
+constexpr bool IsYuv444BufferFormat(NV_ENC_BUFFER_FORMAT format)
+{
+    return format == NV_ENC_BUFFER_FORMAT_YUV444 || format == NV_ENC_BUFFER_FORMAT_YUV444_10BIT;
+}
+
+
+// Rows of a buffer of the given height with all its planes at one pitch.
+constexpr uint32_t GetBufferRowCount(NV_ENC_BUFFER_FORMAT format, uint32_t height)
+{
+    return
+        HasChromaPlane(format) ? height + (height + 1) / 2 :
+        IsYuv444BufferFormat(format) ? 3 * height : height;
+}
+
+
+// Returns why textures of the format cannot be encoded with the config, or
+// nullptr if they can. 10-bit input is only encoded by HEVC, as Main10, and
+// 4:2:0 input never as YUV 4:4:4.
+const char * GetInputFormatError(DXGI_FORMAT format, const EncoderConfig &config);
+
+
+}
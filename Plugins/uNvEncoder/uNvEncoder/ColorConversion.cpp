@@ -0,0 +1,544 @@
+#include <algorithm>
+#include <cmath>
+#include "ColorConversion.h"
+#include "Common.h"
+
+#ifdef UNVENC_SIMD
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define UNVENC_TARGET_SSE41
+#define UNVENC_TARGET_AVX2
+#else
+#define UNVENC_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define UNVENC_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+
+namespace uNvEncoder
+{
+
+
+namespace
+{
+
+
+constexpr int coefficientBits = 14;
+
+
+int16_t ToFixed(double value)
+{
+    return static_cast<int16_t>(std::lround(value * (1 << coefficientBits)));
+}
+
+
+void SetCoefficients(int16_t (&coefficients)[4], int32_t r, int32_t g, int32_t b, bool isBgra)
+{
+    coefficients[isBgra ? 2 : 0] = static_cast<int16_t>(r);
+    coefficients[1] = static_cast<int16_t>(g);
+    coefficients[isBgra ? 0 : 2] = static_cast<int16_t>(b);
+    coefficients[3] = 0;
+}
+
+
+uint8_t Saturate(int32_t value)
+{
+    return static_cast<uint8_t>(std::min(std::max(value, 0), 255));
+}
+
+
+template <typename T>
+int32_t Dot(const int16_t (&coefficients)[4], const T *pixel)
+{
+    return coefficients[0] * pixel[0] + coefficients[1] * pixel[1] + coefficients[2] * pixel[2];
+}
+
+
+void ConvertRow444Scalar(
+    const uint8_t *source, uint8_t *y, uint8_t *u, uint8_t *v,
+    uint32_t x, uint32_t width, const YuvCoefficients &c)
+{
+    for (; x < width; ++x)
+    {
+        const auto pixel = source + 4 * x;
+        y[x] = Saturate((Dot(c.y, pixel) + c.yBias) >> coefficientBits);
+        u[x] = Saturate((Dot(c.u, pixel) + c.uvBias) >> coefficientBits);
+        v[x] = Saturate((Dot(c.v, pixel) + c.uvBias) >> coefficientBits);
+    }
+}
+
+
+// y1 is null for the last row of an odd height, which then is row1 as well.
+void ConvertRowPairNv12Scalar(
+    const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1, uint8_t *uv,
+    uint32_t x, uint32_t width, const YuvCoefficients &c)
+{
+    for (auto i = x; i < width; ++i)
+    {
+        y0[i] = Saturate((Dot(c.y, row0 + 4 * i) + c.yBias) >> coefficientBits);
+        if (y1) y1[i] = Saturate((Dot(c.y, row1 + 4 * i) + c.yBias) >> coefficientBits);
+    }
+
+    for (; x < width; x += 2)
+    {
+        const auto left = 4 * x;
+        const auto right = 4 * std::min(x + 1, width - 1);
+        int32_t sum[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            sum[i] = row0[left + i] + row0[right + i] + row1[left + i] + row1[right + i];
+        }
+        uv[x] = Saturate((Dot(c.u, sum) + c.uvBlockBias) >> (coefficientBits + 2));
+        uv[x + 1] = Saturate((Dot(c.v, sum) + c.uvBlockBias) >> (coefficientBits + 2));
+    }
+}
+
+
+#ifdef UNVENC_SIMD
+
+// The kernels widen each pixel to four 16-bit lanes, multiply them with the
+// coefficients and add neighbouring products with madd, and add the two
+// halves of each pixel with hadd. The sums are the same as the scalar ones,
+// and packing saturates like Saturate(), so the bytes match exactly.
+
+UNVENC_TARGET_SSE41
+__m128i LoadCoefficientsSse41(const int16_t (&coefficients)[4])
+{
+    const auto c = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(coefficients));
+    return _mm_unpacklo_epi64(c, c);
+}
+
+
+// pixels holds 16 widened pixels, two per vector.
+template <int shift>
+UNVENC_TARGET_SSE41
+__m128i ConvertPlaneSse41(const __m128i (&pixels)[8], __m128i coefficients, __m128i bias)
+{
+    __m128i sums[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        const auto dot = _mm_hadd_epi32(
+            _mm_madd_epi16(pixels[2 * i], coefficients),
+            _mm_madd_epi16(pixels[2 * i + 1], coefficients));
+        sums[i] = _mm_srai_epi32(_mm_add_epi32(dot, bias), shift);
+    }
+    return _mm_packus_epi16(_mm_packs_epi32(sums[0], sums[1]), _mm_packs_epi32(sums[2], sums[3]));
+}
+
+
+UNVENC_TARGET_SSE41
+void LoadPixelsSse41(const uint8_t *source, __m128i (&pixels)[8])
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        const auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 16 * i));
+        pixels[2 * i] = _mm_cvtepu8_epi16(bytes);
+        pixels[2 * i + 1] = _mm_cvtepu8_epi16(_mm_srli_si128(bytes, 8));
+    }
+}
+
+
+UNVENC_TARGET_SSE41
+uint32_t ConvertRow444Sse41(
+    const uint8_t *source, uint8_t *y, uint8_t *u, uint8_t *v,
+    uint32_t width, const YuvCoefficients &c)
+{
+    const auto yCoefficients = LoadCoefficientsSse41(c.y);
+    const auto uCoefficients = LoadCoefficientsSse41(c.u);
+    const auto vCoefficients = LoadCoefficientsSse41(c.v);
+    const auto yBias = _mm_set1_epi32(c.yBias);
+    const auto uvBias = _mm_set1_epi32(c.uvBias);
+
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i pixels[8];
+        LoadPixelsSse41(source + 4 * x, pixels);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(y + x), ConvertPlaneSse41<coefficientBits>(pixels, yCoefficients, yBias));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(u + x), ConvertPlaneSse41<coefficientBits>(pixels, uCoefficients, uvBias));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(v + x), ConvertPlaneSse41<coefficientBits>(pixels, vCoefficients, uvBias));
+    }
+    return x;
+}
+
+
+UNVENC_TARGET_SSE41
+uint32_t ConvertRowPairNv12Sse41(
+    const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1, uint8_t *uv,
+    uint32_t width, const YuvCoefficients &c)
+{
+    const auto yCoefficients = LoadCoefficientsSse41(c.y);
+    const auto uCoefficients = LoadCoefficientsSse41(c.u);
+    const auto vCoefficients = LoadCoefficientsSse41(c.v);
+    const auto yBias = _mm_set1_epi32(c.yBias);
+    const auto uvBias = _mm_set1_epi32(c.uvBlockBias);
+
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i pixels0[8];
+        __m128i pixels1[8];
+        LoadPixelsSse41(row0 + 4 * x, pixels0);
+        LoadPixelsSse41(row1 + 4 * x, pixels1);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(y0 + x), ConvertPlaneSse41<coefficientBits>(pixels0, yCoefficients, yBias));
+        if (y1) _mm_storeu_si128(reinterpret_cast<__m128i*>(y1 + x), ConvertPlaneSse41<coefficientBits>(pixels1, yCoefficients, yBias));
+
+        // Each vector holds two pixels of both rows once they are added, and
+        // adding its halves leaves the sum of one 2x2 block in the low half.
+        __m128i blocks[4];
+        for (int i = 0; i < 4; ++i)
+        {
+            const auto a = _mm_add_epi16(pixels0[2 * i], pixels1[2 * i]);
+            const auto b = _mm_add_epi16(pixels0[2 * i + 1], pixels1[2 * i + 1]);
+            blocks[i] = _mm_unpacklo_epi64(
+                _mm_add_epi16(a, _mm_srli_si128(a, 8)),
+                _mm_add_epi16(b, _mm_srli_si128(b, 8)));
+        }
+
+        __m128i chroma[2];
+        for (int i = 0; i < 2; ++i)
+        {
+            const auto &coefficients = i == 0 ? uCoefficients : vCoefficients;
+            const auto low = _mm_hadd_epi32(_mm_madd_epi16(blocks[0], coefficients), _mm_madd_epi16(blocks[1], coefficients));
+            const auto high = _mm_hadd_epi32(_mm_madd_epi16(blocks[2], coefficients), _mm_madd_epi16(blocks[3], coefficients));
+            chroma[i] = _mm_packs_epi32(
+                _mm_srai_epi32(_mm_add_epi32(low, uvBias), coefficientBits + 2),
+                _mm_srai_epi32(_mm_add_epi32(high, uvBias), coefficientBits + 2));
+        }
+        const auto interleaved = _mm_packus_epi16(
+            _mm_unpacklo_epi16(chroma[0], chroma[1]),
+            _mm_unpackhi_epi16(chroma[0], chroma[1]));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(uv + x), interleaved);
+    }
+    return x;
+}
+
+
+// The AVX2 kernels work like the SSE4.1 ones on both 128-bit lanes, which
+// leaves pairs of output bytes from the low lane at even positions and from
+// the high lane at odd ones. Interleaving the lanes by 16 bits restores the
+// order.
+
+UNVENC_TARGET_AVX2
+__m256i LoadCoefficientsAvx2(const int16_t (&coefficients)[4])
+{
+    return _mm256_broadcastq_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(coefficients)));
+}
+
+
+UNVENC_TARGET_AVX2
+void StoreAvx2(uint8_t *destination, __m256i bytes)
+{
+    const auto low = _mm256_castsi256_si128(bytes);
+    const auto high = _mm256_extracti128_si256(bytes, 1);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(destination), _mm_unpacklo_epi16(low, high));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + 16), _mm_unpackhi_epi16(low, high));
+}
+
+
+// pixels holds 32 widened pixels, four per vector.
+template <int shift>
+UNVENC_TARGET_AVX2
+__m256i ConvertPlaneAvx2(const __m256i (&pixels)[8], __m256i coefficients, __m256i bias)
+{
+    __m256i sums[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        const auto dot = _mm256_hadd_epi32(
+            _mm256_madd_epi16(pixels[2 * i], coefficients),
+            _mm256_madd_epi16(pixels[2 * i + 1], coefficients));
+        sums[i] = _mm256_srai_epi32(_mm256_add_epi32(dot, bias), shift);
+    }
+    return _mm256_packus_epi16(_mm256_packs_epi32(sums[0], sums[1]), _mm256_packs_epi32(sums[2], sums[3]));
+}
+
+
+UNVENC_TARGET_AVX2
+void LoadPixelsAvx2(const uint8_t *source, __m256i (&pixels)[8])
+{
+    for (int i = 0; i < 8; ++i)
+    {
+        pixels[i] = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 16 * i)));
+    }
+}
+
+
+UNVENC_TARGET_AVX2
+uint32_t ConvertRow444Avx2(
+    const uint8_t *source, uint8_t *y, uint8_t *u, uint8_t *v,
+    uint32_t width, const YuvCoefficients &c)
+{
+    const auto yCoefficients = LoadCoefficientsAvx2(c.y);
+    const auto uCoefficients = LoadCoefficientsAvx2(c.u);
+    const auto vCoefficients = LoadCoefficientsAvx2(c.v);
+    const auto yBias = _mm256_set1_epi32(c.yBias);
+    const auto uvBias = _mm256_set1_epi32(c.uvBias);
+
+    uint32_t x = 0;
+    for (; x + 32 <= width; x += 32)
+    {
+        __m256i pixels[8];
+        LoadPixelsAvx2(source + 4 * x, pixels);
+        StoreAvx2(y + x, ConvertPlaneAvx2<coefficientBits>(pixels, yCoefficients, yBias));
+        StoreAvx2(u + x, ConvertPlaneAvx2<coefficientBits>(pixels, uCoefficients, uvBias));
+        StoreAvx2(v + x, ConvertPlaneAvx2<coefficientBits>(pixels, vCoefficients, uvBias));
+    }
+    return x;
+}
+
+
+UNVENC_TARGET_AVX2
+uint32_t ConvertRowPairNv12Avx2(
+    const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1, uint8_t *uv,
+    uint32_t width, const YuvCoefficients &c)
+{
+    const auto yCoefficients = LoadCoefficientsAvx2(c.y);
+    const auto uCoefficients = LoadCoefficientsAvx2(c.u);
+    const auto vCoefficients = LoadCoefficientsAvx2(c.v);
+    const auto yBias = _mm256_set1_epi32(c.yBias);
+    const auto uvBias = _mm256_set1_epi32(c.uvBlockBias);
+
+    uint32_t x = 0;
+    for (; x + 32 <= width; x += 32)
+    {
+        __m256i pixels0[8];
+        __m256i pixels1[8];
+        LoadPixelsAvx2(row0 + 4 * x, pixels0);
+        LoadPixelsAvx2(row1 + 4 * x, pixels1);
+        StoreAvx2(y0 + x, ConvertPlaneAvx2<coefficientBits>(pixels0, yCoefficients, yBias));
+        if (y1) StoreAvx2(y1 + x, ConvertPlaneAvx2<coefficientBits>(pixels1, yCoefficients, yBias));
+
+        __m256i blocks[4];
+        for (int i = 0; i < 4; ++i)
+        {
+            const auto a = _mm256_add_epi16(pixels0[2 * i], pixels1[2 * i]);
+            const auto b = _mm256_add_epi16(pixels0[2 * i + 1], pixels1[2 * i + 1]);
+            blocks[i] = _mm256_unpacklo_epi64(
+                _mm256_add_epi16(a, _mm256_srli_si256(a, 8)),
+                _mm256_add_epi16(b, _mm256_srli_si256(b, 8)));
+        }
+
+        __m256i chroma[2];
+        for (int i = 0; i < 2; ++i)
+        {
+            const auto &coefficients = i == 0 ? uCoefficients : vCoefficients;
+            const auto low = _mm256_hadd_epi32(_mm256_madd_epi16(blocks[0], coefficients), _mm256_madd_epi16(blocks[1], coefficients));
+            const auto high = _mm256_hadd_epi32(_mm256_madd_epi16(blocks[2], coefficients), _mm256_madd_epi16(blocks[3], coefficients));
+            chroma[i] = _mm256_packs_epi32(
+                _mm256_srai_epi32(_mm256_add_epi32(low, uvBias), coefficientBits + 2),
+                _mm256_srai_epi32(_mm256_add_epi32(high, uvBias), coefficientBits + 2));
+        }
+        StoreAvx2(uv + x, _mm256_packus_epi16(
+            _mm256_unpacklo_epi16(chroma[0], chroma[1]),
+            _mm256_unpackhi_epi16(chroma[0], chroma[1])));
+    }
+    return x;
+}
+
+#endif
+
+
+void ConvertRow444(
+    ConversionIsa isa, const uint8_t *source, uint8_t *y, uint8_t *u, uint8_t *v,
+    uint32_t width, const YuvCoefficients &c)
+{
+    uint32_t x = 0;
+#ifdef UNVENC_SIMD
+    if (isa == ConversionIsa::Avx2) x = ConvertRow444Avx2(source, y, u, v, width, c);
+    else if (isa == ConversionIsa::Sse41) x = ConvertRow444Sse41(source, y, u, v, width, c);
+#endif
+    ConvertRow444Scalar(source, y, u, v, x, width, c);
+}
+
+
+void ConvertRowPairNv12(
+    ConversionIsa isa, const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1, uint8_t *uv,
+    uint32_t width, const YuvCoefficients &c)
+{
+    uint32_t x = 0;
+#ifdef UNVENC_SIMD
+    if (isa == ConversionIsa::Avx2) x = ConvertRowPairNv12Avx2(row0, row1, y0, y1, uv, width, c);
+    else if (isa == ConversionIsa::Sse41) x = ConvertRowPairNv12Sse41(row0, row1, y0, y1, uv, width, c);
+#endif
+    ConvertRowPairNv12Scalar(row0, row1, y0, y1, uv, x, width, c);
+}
+
+
+}
+
+
+YuvCoefficients GetYuvCoefficients(NvencColorMatrix matrix, NvencColorRange range, bool isBgra)
+{
+    const bool isBt601 = matrix == NvencColorMatrix::Bt601;
+    const double kr = isBt601 ? 0.299 : 0.2126;
+    const double kb = isBt601 ? 0.114 : 0.0722;
+    const bool isFullRange = range == NvencColorRange::Full;
+    const double yScale = isFullRange ? 1.0 : 219.0 / 255.0;
+    const double chromaScale = isFullRange ? 1.0 : 224.0 / 255.0;
+    const int32_t yOffset = isFullRange ? 0 : 16;
+
+    // Green takes what rounding the others left over, so that the luma
+    // coefficients add up to the scale and the chroma ones to zero, which
+    // keeps grays exactly gray.
+    const int32_t yR = ToFixed(kr * yScale);
+    const int32_t yB = ToFixed(kb * yScale);
+    const int32_t uR = ToFixed(-kr / (2 * (1 - kb)) * chromaScale);
+    const int32_t uB = ToFixed(0.5 * chromaScale);
+    const int32_t vR = ToFixed(0.5 * chromaScale);
+    const int32_t vB = ToFixed(-kb / (2 * (1 - kr)) * chromaScale);
+
+    YuvCoefficients coefficients;
+    SetCoefficients(coefficients.y, yR, ToFixed(yScale) - yR - yB, yB, isBgra);
+    SetCoefficients(coefficients.u, uR, -uR - uB, uB, isBgra);
+    SetCoefficients(coefficients.v, vR, -vR - vB, vB, isBgra);
+    coefficients.yBias = (yOffset << coefficientBits) + (1 << (coefficientBits - 1));
+    coefficients.uvBias = (128 << coefficientBits) + (1 << (coefficientBits - 1));
+    coefficients.uvBlockBias = (128 << (coefficientBits + 2)) + (1 << (coefficientBits + 1));
+    return coefficients;
+}
+
+
+ConversionIsa GetBestConversionIsa()
+{
+#if !defined(UNVENC_SIMD)
+    return ConversionIsa::Scalar;
+#elif defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    ::__cpuid(info, 1);
+    const bool hasSse41 = (info[2] & (1 << 19)) != 0;
+    const bool hasAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (::_xgetbv(0) & 6) == 6;
+    ::__cpuidex(info, 7, 0);
+    const bool hasAvx2 = hasAvx && (info[1] & (1 << 5));
+    return hasAvx2 ? ConversionIsa::Avx2 : hasSse41 ? ConversionIsa::Sse41 : ConversionIsa::Scalar;
+#else
+    return
+        __builtin_cpu_supports("avx2") ? ConversionIsa::Avx2 :
+        __builtin_cpu_supports("sse4.1") ? ConversionIsa::Sse41 : ConversionIsa::Scalar;
+#endif
+}
+
+
+void ConvertRows(
+    const RgbImage &source, const YuvImage &destination, YuvFormat format,
+    const YuvCoefficients &coefficients, ConversionIsa isa, uint32_t firstRow, uint32_t lastRow)
+{
+    const auto &d = destination;
+    if (format == YuvFormat::Yuv444)
+    {
+        for (auto row = firstRow; row < lastRow; ++row)
+        {
+            const auto offset = row * d.pitch;
+            ConvertRow444(isa, source.data + row * source.pitch, d.y + offset, d.u + offset, d.v + offset, source.width, coefficients);
+        }
+        return;
+    }
+
+    for (auto row = firstRow; row < lastRow; row += 2)
+    {
+        const bool hasSecondRow = row + 1 < lastRow;
+        const auto row0 = source.data + row * source.pitch;
+        const auto y0 = d.y + row * d.pitch;
+        ConvertRowPairNv12(
+            isa, row0, hasSecondRow ? row0 + source.pitch : row0, y0, hasSecondRow ? y0 + d.pitch : nullptr,
+            d.u + row / 2 * d.pitch, source.width, coefficients);
+    }
+}
+
+
+ColorConverter::ColorConverter(uint32_t threadCount, ConversionIsa isa)
+    : isa_(isa)
+{
+    for (uint32_t i = 1; i < threadCount; ++i)
+    {
+        threads_.emplace_back(&ColorConverter::Run, this);
+    }
+}
+
+
+ColorConverter::~ColorConverter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        shouldStop_ = true;
+    }
+    workCondition_.notify_all();
+
+    for (auto &thread : threads_)
+    {
+        thread.join();
+    }
+}
+
+
+void ColorConverter::Convert(const RgbImage &source, const YuvImage &destination, YuvFormat format, NvencColorMatrix matrix, NvencColorRange range)
+{
+    const auto coefficients = GetYuvCoefficients(matrix, range, source.isBgra);
+    const auto threadCount = GetThreadCount();
+    if (threadCount == 1 || source.height < 2 * threadCount)
+    {
+        ConvertRows(source, destination, format, coefficients, isa_, 0, source.height);
+        return;
+    }
+
+    // NV12 bands start on even rows so that no block of chroma is split.
+    auto bandHeight = (source.height + threadCount - 1) / threadCount;
+    bandHeight += bandHeight & 1;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    job_ = Job { source, destination, format, coefficients, bandHeight, (source.height + bandHeight - 1) / bandHeight };
+    nextBand_ = 0;
+    pendingBandCount_ = job_.bandCount;
+    ++generation_;
+    workCondition_.notify_all();
+
+    ConvertBands(lock);
+    doneCondition_.wait(lock, [this] { return pendingBandCount_ == 0; });
+}
+
+
+void ColorConverter::Run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto generation = generation_;
+    for (;;)
+    {
+        workCondition_.wait(lock, [&] { return shouldStop_ || generation_ != generation; });
+        if (shouldStop_) return;
+
+        generation = generation_;
+        ConvertBands(lock);
+    }
+}
+
+
+// Bands are claimed with the job under the lock, so a worker that wakes late
+// never mixes a band of one frame with the job of the next.
+void ColorConverter::ConvertBands(std::unique_lock<std::mutex> &lock)
+{
+    while (nextBand_ < job_.bandCount)
+    {
+        const auto band = nextBand_++;
+        const auto job = job_;
+        lock.unlock();
+
+        const auto firstRow = band * job.bandHeight;
+        const auto lastRow = std::min(firstRow + job.bandHeight, job.source.height);
+        ConvertRows(job.source, job.destination, job.format, job.coefficients, isa_, firstRow, lastRow);
+
+        lock.lock();
+        if (--pendingBandCount_ == 0) doneCondition_.notify_one();
+    }
+}
+
+
+uint32_t GetConversionThreadCount(uint32_t width, uint32_t height)
+{
+    const auto pixelCount = static_cast<uint64_t>(width) * height;
+    const auto maxCount = std::min(std::max(std::thread::hardware_concurrency(), 1U), 4U);
+    const auto count = static_cast<uint32_t>(std::min<uint64_t>(pixelCount / (1920 * 1080), maxCount));
+    return std::max(count, 1U);
+}
+
+
+}
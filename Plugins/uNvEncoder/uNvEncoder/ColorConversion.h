@@ -0,0 +1,125 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "EncoderConfig.h"
+
+
+namespace uNvEncoder
+{
+
+
+// 8-bit RGBA or BGRA frame. Alpha is ignored.
+struct RgbImage
+{
+    const uint8_t *data;
+    size_t pitch;
+    uint32_t width;
+    uint32_t height;
+    bool isBgra;
+};
+
+
+// Planes of an 8-bit YUV frame sharing one pitch. For NV12 u is the
+// interleaved chroma plane of half the height and v is unused.
+struct YuvImage
+{
+    uint8_t *y;
+    uint8_t *u;
+    uint8_t *v;
+    size_t pitch;
+};
+
+
+enum class YuvFormat
+{
+    Nv12,
+    Yuv444,
+};
+
+
+enum class ConversionIsa
+{
+    Scalar,
+    Sse41,
+    Avx2,
+};
+
+
+// The matrix in Q14 fixed point, ordered like the bytes of a source pixel so
+// that RGBA and BGRA take the same code. The range offsets are folded into
+// the rounding biases.
+struct YuvCoefficients
+{
+    int16_t y[4];
+    int16_t u[4];
+    int16_t v[4];
+    int32_t yBias;
+    int32_t uvBias;
+    // Chroma of NV12 is computed from the sum of a 2x2 block.
+    int32_t uvBlockBias;
+};
+
+
+YuvCoefficients GetYuvCoefficients(NvencColorMatrix matrix, NvencColorRange range, bool isBgra);
+
+// The best instruction set of this CPU that the converters are built for.
+ConversionIsa GetBestConversionIsa();
+
+// Converts the rows [firstRow, lastRow), where NV12 bands have to start on an
+// even row. Every instruction set gives the same bytes as the scalar one,
+// which is the reference. NV12 chroma is the average of each 2x2 block, with
+// the last column or row repeated when the size is odd.
+void ConvertRows(
+    const RgbImage &source, const YuvImage &destination, YuvFormat format,
+    const YuvCoefficients &coefficients, ConversionIsa isa, uint32_t firstRow, uint32_t lastRow);
+
+
+// Converts frames in bands of rows on a few worker threads plus the calling
+// one. The workers sleep between frames, and converting allocates nothing.
+class ColorConverter final
+{
+public:
+    explicit ColorConverter(uint32_t threadCount, ConversionIsa isa = GetBestConversionIsa());
+    ~ColorConverter();
+    void Convert(const RgbImage &source, const YuvImage &destination, YuvFormat format, NvencColorMatrix matrix, NvencColorRange range);
+    uint32_t GetThreadCount() const { return static_cast<uint32_t>(threads_.size()) + 1; }
+    ConversionIsa GetIsa() const { return isa_; }
+
+private:
+    struct Job
+    {
+        RgbImage source;
+        YuvImage destination;
+        YuvFormat format;
+        YuvCoefficients coefficients;
+        uint32_t bandHeight;
+        uint32_t bandCount;
+    };
+
+    void Run();
+    void ConvertBands(std::unique_lock<std::mutex> &lock);
+
+    const ConversionIsa isa_;
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable workCondition_;
+    std::condition_variable doneCondition_;
+    Job job_;
+    uint64_t generation_ = 0;
+    uint32_t nextBand_ = 0;
+    uint32_t pendingBandCount_ = 0;
+    bool shouldStop_ = false;
+};
+
+
+// Threads pay off once a frame takes one core several milliseconds, so
+// frames up to 1440p convert on the calling thread and 4K frames on four.
+uint32_t GetConversionThreadCount(uint32_t width, uint32_t height);
+
+
+}
@@ -1,50 +1,62 @@
-#include <d3d11.h>
-#include <IUnityInterface.h>
-#include <IUnityGraphicsD3D11.h>
-#include "Common.h"
-
-
-namespace uNvEncoder
-{
-
-
-extern IUnityInterfaces *g_unity;
-
-
-IUnityInterfaces * GetUnity()
-{
-    return g_unity;
-}
-
-
-ID3D11Device * GetUnityDevice()
-{
-    return GetUnity()->Get<IUnityGraphicsD3D11>()->GetDevice();
-}
-
-
-void ThrowError(const std::string &error)
-{
-    ::OutputDebugStringA((error + "\n").c_str());
-    throw std::exception(error.c_str());
-}
-
-
-ScopedTimer::ScopedTimer(const StartFunc &startFunc, const EndFunc &endFunc)
-    : func_(endFunc)
-    , start_(std::chrono::high_resolution_clock::now())
-{
-    startFunc();
-}
-
-
-ScopedTimer::~ScopedTimer()
-{
-    using namespace std::chrono;
-    const auto end = high_resolution_clock::now();
-    const auto time = duration_cast<microseconds>(end - start_);
-    func_(time);
-}
-
-
-}
+#include <cstdio>
+#include <stdexcept>
+#ifdef _WIN32
+#include <d3d11.h>
+#endif
+#include <IUnityInterface.h>
+#ifdef _WIN32
+#include <IUnityGraphicsD3D11.h>
+#endif
+#include "Common.h"
+
+
+namespace uNvEncoder
+{
+
+
+extern IUnityInterfaces *g_unity;
+
+
+IUnityInterfaces * GetUnity()
+{
+    return g_unity;
+}
+
+
+#ifdef _WIN32
+ID3D11Device * GetUnityDevice()
+{
+    return GetUnity()->Get<IUnityGraphicsD3D11>()->GetDevice();
+}
+#endif
+
+
+void ThrowError(const std::string &error)
+{
+#ifdef _WIN32
+    ::OutputDebugStringA((error + "\n").c_str());
+#else
+    ::fprintf(stderr, "%s\n", error.c_str());
+#endif
+    throw std::runtime_error(error);
+}
+
+
+ScopedTimer::ScopedTimer(const StartFunc &startFunc, const EndFunc &endFunc)
+    : func_(endFunc)
+    , start_(std::chrono::steady_clock::now())
+{
+    startFunc();
+}
+
+
+ScopedTimer::~ScopedTimer()
+{
+    using namespace std::chrono;
+    const auto end = steady_clock::now();
+    const auto time = duration_cast<microseconds>(end - start_);
+    func_(time);
+}
+
+
+}
@@ -1,62 +1,73 @@
-#pragma once
-
-#include <chrono>
-#include <functional>
-#include <string>
-#include <sstream>
-#include <thread>
-#include <wrl/client.h>
-
-
-namespace uNvEncoder
-{
-
-
-template <class T>
-using ComPtr = Microsoft::WRL::ComPtr<T>;
-
-
-struct IUnityInterfaces * GetUnity();
-struct ID3D11Device * GetUnityDevice();
-void ThrowError(const std::string &error);
-
-
-#define UNVENC_DEBUG_ON
-
-
-class ScopedTimer final
-{
-public:
-    using StartFunc = std::function<void()>;
-    using EndFunc = std::function<void(const std::chrono::microseconds &)>;
-    ScopedTimer(const StartFunc &startFunc, const EndFunc &endFunc);
-    ~ScopedTimer();
-
-private:
-    const EndFunc func_;
-    const std::chrono::time_point<std::chrono::steady_clock> start_;
-};
-
-#ifdef UNVENC_DEBUG_ON
-#define UNVENC_FUNC_SCOPED_TIMER \
-    ScopedTimer _timer_##__COUNTER__( \
-    [] \
-    { \
-        std::stringstream ss; \
-        const auto threadId = std::this_thread::get_id(); \
-        ss << threadId << ": " << __FUNCTION__ << "@" << __FILE__ << ":" << __LINE__ << " => {" << std::endl; \
-        ::OutputDebugStringA(ss.str().c_str()); \
-    }, \
-    [](const std::chrono::microseconds &us) \
-    { \
-        std::stringstream ss; \
-        const auto threadId = std::this_thread::get_id(); \
-        ss << threadId << ": " << "} " << __FUNCTION__ << "@" << __FILE__ << ":" << __LINE__ << " => " << us.count() << " [us]" << std::endl; \
-        ::OutputDebugStringA(ss.str().c_str()); \
-    });
-#else
-#define UNVENC_FUNC_SCOPED_TIMER
-#endif
-
-
-}
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <sstream>
+#include <thread>
+#ifdef _WIN32
+#include <wrl/client.h>
+#endif
+
+
+namespace uNvEncoder
+{
+
+
+#ifdef _WIN32
+template <class T>
+using ComPtr = Microsoft::WRL::ComPtr<T>;
+#endif
+
+
+struct IUnityInterfaces * GetUnity();
+struct ID3D11Device * GetUnityDevice();
+void ThrowError(const std::string &error);
+
+
+#define UNVENC_DEBUG_ON
+
+
+// SSE2 comes with every x86-64 CPU and wider instructions are picked at run
+// time, so all the SIMD paths key on the architecture alone.
+#if defined(_M_X64) || defined(__x86_64__)
+#define UNVENC_SIMD
+#endif
+
+
+class ScopedTimer final
+{
+public:
+    using StartFunc = std::function<void()>;
+    using EndFunc = std::function<void(const std::chrono::microseconds &)>;
+    ScopedTimer(const StartFunc &startFunc, const EndFunc &endFunc);
+    ~ScopedTimer();
+
+private:
+    const EndFunc func_;
+    const std::chrono::time_point<std::chrono::steady_clock> start_;
+};
+
+#ifdef UNVENC_DEBUG_ON
+#define UNVENC_FUNC_SCOPED_TIMER \
+    ScopedTimer _timer_##__COUNTER__( \
+    [] \
+    { \
+        std::stringstream ss; \
+        const auto threadId = std::this_thread::get_id(); \
+        ss << threadId << ": " << __FUNCTION__ << "@" << __FILE__ << ":" << __LINE__ << " => {" << std::endl; \
+        ::OutputDebugStringA(ss.str().c_str()); \
+    }, \
+    [](const std::chrono::microseconds &us) \
+    { \
+        std::stringstream ss; \
+        const auto threadId = std::this_thread::get_id(); \
+        ss << threadId << ": " << "} " << __FUNCTION__ << "@" << __FILE__ << ":" << __LINE__ << " => " << us.count() << " [us]" << std::endl; \
+        ::OutputDebugStringA(ss.str().c_str()); \
+    });
+#else
+#define UNVENC_FUNC_SCOPED_TIMER
+#endif
+
+
+}
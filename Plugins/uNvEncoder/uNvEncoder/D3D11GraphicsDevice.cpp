@@ -0,0 +1,270 @@
+#include "D3D11GraphicsDevice.h"
+
+
+namespace uNvEncoder
+{
+
+
+D3D11GraphicsDevice::D3D11GraphicsDevice()
+{
+    ComPtr<IDXGIDevice1> dxgiDevice;
+    if (FAILED(GetUnityDevice()->QueryInterface(IID_PPV_ARGS(&dxgiDevice)))) 
+    {
+        ThrowError("Failed to get IDXGIDevice1.");
+        return;
+    }
+
+    ComPtr<IDXGIAdapter> dxgiAdapter;
+    if (FAILED(dxgiDevice->GetAdapter(&dxgiAdapter))) 
+    {
+        ThrowError("Failed to get IDXGIAdapter.");
+        return;
+    }
+
+    DXGI_ADAPTER_DESC adapterDesc;
+    if (SUCCEEDED(dxgiAdapter->GetDesc(&adapterDesc)))
+    {
+        const auto &luid = adapterDesc.AdapterLuid;
+        adapterId_ = (static_cast<uint64_t>(static_cast<uint32_t>(luid.HighPart)) << 32) | luid.LowPart;
+        adapterIdentity_.vendorId = adapterDesc.VendorId;
+        adapterIdentity_.deviceId = adapterDesc.DeviceId;
+        adapterIdentity_.subSysId = adapterDesc.SubSysId;
+        adapterIdentity_.revision = adapterDesc.Revision;
+    }
+
+    // The user mode driver version changes with every driver install.
+    LARGE_INTEGER umdVersion;
+    if (SUCCEEDED(dxgiAdapter->CheckInterfaceSupport(__uuidof(IDXGIDevice), &umdVersion)))
+    {
+        driverVersion_ = static_cast<uint64_t>(umdVersion.QuadPart);
+    }
+
+    constexpr auto driverType = D3D_DRIVER_TYPE_UNKNOWN;
+    constexpr auto flags = D3D11_CREATE_DEVICE_BGRA_SUPPORT;
+    constexpr D3D_FEATURE_LEVEL featureLevelsRequested[] =
+    {
+        D3D_FEATURE_LEVEL_11_0,
+        D3D_FEATURE_LEVEL_10_1,
+        D3D_FEATURE_LEVEL_10_0,
+        D3D_FEATURE_LEVEL_9_3,
+        D3D_FEATURE_LEVEL_9_2,
+        D3D_FEATURE_LEVEL_9_1
+    };
+    constexpr UINT numLevelsRequested = sizeof(featureLevelsRequested) / sizeof(D3D_FEATURE_LEVEL);
+    D3D_FEATURE_LEVEL featureLevelsSupported;
+
+    D3D11CreateDevice(
+        dxgiAdapter.Get(),
+        driverType,
+        nullptr,
+        flags,
+        featureLevelsRequested,
+        numLevelsRequested,
+        D3D11_SDK_VERSION,
+        &device_,
+        &featureLevelsSupported,
+        nullptr);
+
+    if (!device_) ThrowError("Failed to create D3D11 device.");
+}
+
+
+void * D3D11GraphicsDevice::CreateSharedTexture(uint32_t width, uint32_t height, DXGI_FORMAT format, void **sharedHandle)
+{
+    D3D11_TEXTURE2D_DESC desc = { 0 };
+    desc.Width = width;
+    desc.Height = height;
+    desc.MipLevels = 1;
+    desc.ArraySize = 1;
+    desc.Format = format;
+    desc.SampleDesc.Count = 1;
+    desc.Usage = D3D11_USAGE_DEFAULT;
+    desc.BindFlags = D3D11_BIND_RENDER_TARGET;
+    desc.CPUAccessFlags = 0;
+    desc.MiscFlags = D3D11_RESOURCE_MISC_SHARED;
+
+    ComPtr<ID3D11Texture2D> texture;
+    if (FAILED(device_->CreateTexture2D(&desc, NULL, &texture)))
+    {
+        ThrowError("Failed to create shared texture.");
+        return nullptr;
+    }
+
+    ComPtr<IDXGIResource> dxgiResource;
+    texture.As(&dxgiResource);
+    if (FAILED(dxgiResource->GetSharedHandle(sharedHandle)))
+    {
+        ThrowError("Failed to get shared handle.");
+        return nullptr;
+    }
+
+    return texture.Detach();
+}
+
+
+void * D3D11GraphicsDevice::OpenSharedTexture(void *sharedHandle)
+{
+    ComPtr<ID3D11Texture2D> texture;
+    if (FAILED(GetUnityDevice()->OpenSharedResource(
+        sharedHandle,
+        __uuidof(ID3D11Texture2D),
+        &texture)))
+    {
+        return nullptr;
+    }
+
+    return texture.Detach();
+}
+
+
+void D3D11GraphicsDevice::RetainTexture(void *texture)
+{
+    if (texture) static_cast<ID3D11Texture2D*>(texture)->AddRef();
+}
+
+
+void D3D11GraphicsDevice::ReleaseTexture(void *texture)
+{
+    if (texture) static_cast<ID3D11Texture2D*>(texture)->Release();
+}
+
+
+void * D3D11GraphicsDevice::GetImmediateContext()
+{
+    ComPtr<ID3D11DeviceContext> context;
+    GetUnityDevice()->GetImmediateContext(&context);
+    return context.Detach();
+}
+
+
+void D3D11GraphicsDevice::ReleaseContext(void *context)
+{
+    if (context) static_cast<ID3D11DeviceContext*>(context)->Release();
+}
+
+
+void D3D11GraphicsDevice::CopyTexture(void *context, void *destination, void *source, uint32_t width, uint32_t height)
+{
+    auto d3d11Context = static_cast<ID3D11DeviceContext*>(context);
+    const D3D11_BOX box = { 0, 0, 0, width, height, 1 };
+    d3d11Context->CopySubresourceRegion(
+        static_cast<ID3D11Texture2D*>(destination), 
+        0, 0, 0, 0,
+        static_cast<ID3D11Texture2D*>(source),
+        0,
+        &box);
+}
+
+
+// The scaling runs on the Unity device like the copies, with the video
+// processor of the driver, so no shaders are needed for any input format.
+void D3D11GraphicsDevice::ScaleTexture(
+    void *context,
+    void *destination, uint32_t destinationWidth, uint32_t destinationHeight,
+    void *source, uint32_t sourceWidth, uint32_t sourceHeight)
+{
+    auto d3d11Context = static_cast<ID3D11DeviceContext*>(context);
+    auto destinationTexture = static_cast<ID3D11Texture2D*>(destination);
+
+    ComPtr<ID3D11VideoContext> videoContext;
+    if (FAILED(d3d11Context->QueryInterface(IID_PPV_ARGS(&videoContext))))
+    {
+        ThrowError("Failed to get ID3D11VideoContext.");
+        return;
+    }
+
+    D3D11_TEXTURE2D_DESC desc;
+    destinationTexture->GetDesc(&desc);
+    const auto &scaler = GetScaler({ sourceWidth, sourceHeight, destinationWidth, destinationHeight, static_cast<uint32_t>(desc.Format) });
+
+    // Views are cheap next to the blit, and cached ones would keep the
+    // textures alive.
+    D3D11_VIDEO_PROCESSOR_INPUT_VIEW_DESC inputViewDesc = {};
+    inputViewDesc.ViewDimension = D3D11_VPIV_DIMENSION_TEXTURE2D;
+    ComPtr<ID3D11VideoProcessorInputView> inputView;
+    if (FAILED(videoDevice_->CreateVideoProcessorInputView(
+        static_cast<ID3D11Texture2D*>(source), scaler.enumerator.Get(), &inputViewDesc, &inputView)))
+    {
+        ThrowError("Failed to create the input view of the scaler.");
+        return;
+    }
+
+    D3D11_VIDEO_PROCESSOR_OUTPUT_VIEW_DESC outputViewDesc = {};
+    outputViewDesc.ViewDimension = D3D11_VPOV_DIMENSION_TEXTURE2D;
+    ComPtr<ID3D11VideoProcessorOutputView> outputView;
+    if (FAILED(videoDevice_->CreateVideoProcessorOutputView(
+        destinationTexture, scaler.enumerator.Get(), &outputViewDesc, &outputView)))
+    {
+        ThrowError("Failed to create the output view of the scaler.");
+        return;
+    }
+
+    const RECT sourceRect = { 0, 0, static_cast<LONG>(sourceWidth), static_cast<LONG>(sourceHeight) };
+    const RECT destinationRect = { 0, 0, static_cast<LONG>(destinationWidth), static_cast<LONG>(destinationHeight) };
+    const auto processor = scaler.processor.Get();
+    videoContext->VideoProcessorSetStreamFrameFormat(processor, 0, D3D11_VIDEO_FRAME_FORMAT_PROGRESSIVE);
+    videoContext->VideoProcessorSetStreamAutoProcessingMode(processor, 0, FALSE);
+    videoContext->VideoProcessorSetStreamSourceRect(processor, 0, TRUE, &sourceRect);
+    videoContext->VideoProcessorSetStreamDestRect(processor, 0, TRUE, &destinationRect);
+    videoContext->VideoProcessorSetOutputTargetRect(processor, TRUE, &destinationRect);
+
+    D3D11_VIDEO_PROCESSOR_STREAM stream = {};
+    stream.Enable = TRUE;
+    stream.pInputSurface = inputView.Get();
+    if (FAILED(videoContext->VideoProcessorBlt(processor, outputView.Get(), 0, 1, &stream)))
+    {
+        ThrowError("Failed to scale the texture.");
+    }
+}
+
+
+void D3D11GraphicsDevice::Flush(void *context)
+{
+    static_cast<ID3D11DeviceContext*>(context)->Flush();
+}
+
+
+D3D11GraphicsDevice::Scaler & D3D11GraphicsDevice::GetScaler(const ScalerKey &key)
+{
+    const auto it = scalers_.find(key);
+    if (it != scalers_.end()) return it->second;
+
+    if (!videoDevice_ && FAILED(GetUnityDevice()->QueryInterface(IID_PPV_ARGS(&videoDevice_))))
+    {
+        ThrowError("Failed to get ID3D11VideoDevice.");
+    }
+
+    D3D11_VIDEO_PROCESSOR_CONTENT_DESC contentDesc = {};
+    contentDesc.InputFrameFormat = D3D11_VIDEO_FRAME_FORMAT_PROGRESSIVE;
+    contentDesc.InputFrameRate = { 1, 1 };
+    contentDesc.InputWidth = key[0];
+    contentDesc.InputHeight = key[1];
+    contentDesc.OutputFrameRate = { 1, 1 };
+    contentDesc.OutputWidth = key[2];
+    contentDesc.OutputHeight = key[3];
+    contentDesc.Usage = D3D11_VIDEO_USAGE_OPTIMAL_SPEED;
+
+    Scaler scaler;
+    if (FAILED(videoDevice_->CreateVideoProcessorEnumerator(&contentDesc, &scaler.enumerator)))
+    {
+        ThrowError("Failed to create the video processor enumerator.");
+    }
+
+    UINT formatSupport = 0;
+    constexpr UINT inputOutput = D3D11_VIDEO_PROCESSOR_FORMAT_SUPPORT_INPUT | D3D11_VIDEO_PROCESSOR_FORMAT_SUPPORT_OUTPUT;
+    const auto format = static_cast<DXGI_FORMAT>(key[4]);
+    if (FAILED(scaler.enumerator->CheckVideoProcessorFormat(format, &formatSupport)) || (formatSupport & inputOutput) != inputOutput)
+    {
+        ThrowError("The input format cannot be scaled by this GPU.");
+    }
+
+    if (FAILED(videoDevice_->CreateVideoProcessor(scaler.enumerator.Get(), 0, &scaler.processor)))
+    {
+        ThrowError("Failed to create the video processor.");
+    }
+
+    return scalers_.emplace(key, std::move(scaler)).first->second;
+}
+
+
+}
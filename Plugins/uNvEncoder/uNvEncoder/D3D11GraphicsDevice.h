@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <map>
+#include <d3d11.h>
+#include "Common.h"
+#include "GraphicsDevice.h"
+
+
+namespace uNvEncoder
+{
+
+
+class D3D11GraphicsDevice final : public IGraphicsDevice
+{
+public:
+    D3D11GraphicsDevice();
+    void * GetEncodeDevice() override { return device_.Get(); }
+    uint64_t GetAdapterId() const override { return adapterId_; }
+    AdapterIdentity GetAdapterIdentity() const override { return adapterIdentity_; }
+    uint64_t GetDriverVersion() const override { return driverVersion_; }
+    void * CreateSharedTexture(uint32_t width, uint32_t height, DXGI_FORMAT format, void **sharedHandle) override;
+    void * OpenSharedTexture(void *sharedHandle) override;
+    void RetainTexture(void *texture) override;
+    void ReleaseTexture(void *texture) override;
+    void * GetImmediateContext() override;
+    void ReleaseContext(void *context) override;
+    void CopyTexture(void *context, void *destination, void *source, uint32_t width, uint32_t height) override;
+    void ScaleTexture(
+        void *context,
+        void *destination, uint32_t destinationWidth, uint32_t destinationHeight,
+        void *source, uint32_t sourceWidth, uint32_t sourceHeight) override;
+    void Flush(void *context) override;
+
+private:
+    // A video processor is made for the sizes it scales between.
+    struct Scaler
+    {
+        ComPtr<ID3D11VideoProcessorEnumerator> enumerator;
+        ComPtr<ID3D11VideoProcessor> processor;
+    };
+    using ScalerKey = std::array<uint32_t, 5>;
+
+    Scaler & GetScaler(const ScalerKey &key);
+
+    ComPtr<ID3D11Device> device_;
+    uint64_t adapterId_ = 0;
+    AdapterIdentity adapterIdentity_;
+    uint64_t driverVersion_ = 0;
+    ComPtr<ID3D11VideoDevice> videoDevice_;
+    std::map<ScalerKey, Scaler> scalers_;
+};
+
+
+}
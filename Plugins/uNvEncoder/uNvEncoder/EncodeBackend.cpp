@@ -0,0 +1,55 @@
+#include <mutex>
+#include "EncodeBackend.h"
+#include "EncodeCaps.h"
+#include "Common.h"
+#ifdef _WIN32
+#include "NvencModuleBackend.h"
+#endif
+
+
+namespace uNvEncoder
+{
+
+
+namespace
+{
+    std::mutex g_backendMutex;
+    std::shared_ptr<IEncodeBackend> g_backend;
+    std::weak_ptr<IEncodeBackend> g_moduleBackend;
+}
+
+
+std::shared_ptr<IEncodeBackend> GetEncodeBackend()
+{
+    std::lock_guard<std::mutex> lock(g_backendMutex);
+
+    if (g_backend) return g_backend;
+
+    auto backend = g_moduleBackend.lock();
+    if (!backend)
+    {
+#ifdef _WIN32
+        backend = std::make_shared<NvencModuleBackend>();
+        g_moduleBackend = backend;
+#else
+        ThrowError("NVENC is not available on this platform.");
+#endif
+    }
+
+    return backend;
+}
+
+
+void SetEncodeBackend(const std::shared_ptr<IEncodeBackend> &backend)
+{
+    {
+        std::lock_guard<std::mutex> lock(g_backendMutex);
+        g_backend = backend;
+    }
+
+    // Probed caps belong to the previous backend.
+    ClearEncoderCaps();
+}
+
+
+}
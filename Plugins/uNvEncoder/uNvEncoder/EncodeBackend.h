@@ -0,0 +1,34 @@
+#pragma once
+
+#include <memory>
+#include "nvEncodeAPI.h"
+#include "GraphicsDevice.h"
+
+
+namespace uNvEncoder
+{
+
+
+// Source of the NVENC entry points together with the graphics device the
+// encode session runs on. The default backend loads the NVENC driver; a stub
+// backend can be installed instead to run the pipeline without a GPU.
+class IEncodeBackend
+{
+public:
+    virtual ~IEncodeBackend() = default;
+    virtual const NV_ENCODE_API_FUNCTION_LIST & GetFunctionList() const = 0;
+    virtual NV_ENC_DEVICE_TYPE GetDeviceType() const = 0;
+    virtual std::unique_ptr<IGraphicsDevice> CreateGraphicsDevice() = 0;
+};
+
+
+// Returns the installed backend, or the shared NVENC driver backend which is
+// loaded on first use and unloaded when the last encoder releases it.
+std::shared_ptr<IEncodeBackend> GetEncodeBackend();
+
+// Replaces the backend used by encoders created afterwards. Passing nullptr
+// restores the NVENC driver backend.
+void SetEncodeBackend(const std::shared_ptr<IEncodeBackend> &backend);
+
+
+}
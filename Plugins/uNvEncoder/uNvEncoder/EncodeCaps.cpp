@@ -0,0 +1,342 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <vector>
+#include "EncodeCaps.h"
+#include "Common.h"
+
+
+namespace uNvEncoder
+{
+
+
+namespace
+{
+
+
+constexpr int cacheFileVersion = 2;
+constexpr size_t capsFieldCount = sizeof(EncoderCaps) / sizeof(uint32_t);
+static_assert(sizeof(EncoderCaps) == capsFieldCount * sizeof(uint32_t), "EncoderCaps must only hold 32-bit fields.");
+
+
+// Adapters of this process are told apart by their LUID, which is only
+// valid until the next boot.
+struct CapsKey
+{
+    uint64_t adapterId;
+    uint64_t driverVersion;
+    NvencCodec codec;
+
+    bool operator<(const CapsKey &other) const
+    {
+        return std::tie(adapterId, driverVersion, codec) < std::tie(other.adapterId, other.driverVersion, other.codec);
+    }
+};
+
+
+// Entries of the cache file name the adapter model instead, so they match
+// the same GPU after a reboot and any identical GPU next to it.
+struct CachedCapsKey
+{
+    AdapterIdentity adapter;
+    uint64_t driverVersion;
+    NvencCodec codec;
+
+    bool IsSameAdapter(const CachedCapsKey &other) const
+    {
+        return
+            std::tie(adapter.vendorId, adapter.deviceId, adapter.subSysId, adapter.revision) ==
+            std::tie(other.adapter.vendorId, other.adapter.deviceId, other.adapter.subSysId, other.adapter.revision);
+    }
+
+    bool operator<(const CachedCapsKey &other) const
+    {
+        return
+            std::tie(adapter.vendorId, adapter.deviceId, adapter.subSysId, adapter.revision, driverVersion, codec) <
+            std::tie(other.adapter.vendorId, other.adapter.deviceId, other.adapter.subSysId, other.adapter.revision, other.driverVersion, other.codec);
+    }
+};
+
+
+std::mutex g_capsMutex;
+std::map<CapsKey, EncoderCaps> g_caps;
+std::map<CachedCapsKey, EncoderCaps> g_cachedCaps;
+std::string g_cachePath;
+
+
+bool IsSameGuid(const GUID &a, const GUID &b)
+{
+    return ::memcmp(&a, &b, sizeof(GUID)) == 0;
+}
+
+
+void CheckStatus(NVENCSTATUS status, const char *apiName)
+{
+    if (status != NV_ENC_SUCCESS)
+    {
+        ThrowError(std::string(apiName) + " call failed while probing encoder caps.");
+    }
+}
+
+
+EncoderCaps ProbeEncoderCaps(const NV_ENCODE_API_FUNCTION_LIST &api, void *session, NvencCodec codec)
+{
+    EncoderCaps caps;
+
+    uint32_t count = 0;
+    CheckStatus(api.nvEncGetEncodeGUIDCount(session, &count), "nvEncGetEncodeGUIDCount");
+    std::vector<GUID> guids(count);
+    CheckStatus(api.nvEncGetEncodeGUIDs(session, guids.data(), count, &count), "nvEncGetEncodeGUIDs");
+    guids.resize(std::min<size_t>(count, guids.size()));
+
+    const auto codecGuid = GetCodecGuid(codec);
+    const auto isCodecGuid = [&](const GUID &guid) { return IsSameGuid(guid, codecGuid); };
+    if (std::none_of(guids.begin(), guids.end(), isCodecGuid)) return caps;
+
+    caps.isSupported = 1;
+
+    const auto getCap = [&](NV_ENC_CAPS capsToQuery)
+    {
+        NV_ENC_CAPS_PARAM capsParam = { NV_ENC_CAPS_PARAM_VER };
+        capsParam.capsToQuery = capsToQuery;
+        int value = 0;
+        CheckStatus(api.nvEncGetEncodeCaps(session, codecGuid, &capsParam, &value), "nvEncGetEncodeCaps");
+        return static_cast<uint32_t>(std::max(value, 0));
+    };
+    const auto hasCap = [&](NV_ENC_CAPS capsToQuery)
+    {
+        return getCap(capsToQuery) != 0 ? 1 : 0;
+    };
+
+    caps.maxWidth = getCap(NV_ENC_CAPS_WIDTH_MAX);
+    caps.maxHeight = getCap(NV_ENC_CAPS_HEIGHT_MAX);
+    caps.maxMacroblockCount = getCap(NV_ENC_CAPS_MB_NUM_MAX);
+    caps.maxBFrameCount = getCap(NV_ENC_CAPS_NUM_MAX_BFRAMES);
+    caps.maxLtrFrameCount = getCap(NV_ENC_CAPS_NUM_MAX_LTR_FRAMES);
+    caps.supportsLookahead = hasCap(NV_ENC_CAPS_SUPPORT_LOOKAHEAD);
+    caps.supportsTemporalAq = hasCap(NV_ENC_CAPS_SUPPORT_TEMPORAL_AQ);
+    caps.supports10Bit = hasCap(NV_ENC_CAPS_SUPPORT_10BIT_ENCODE);
+    caps.supportsYuv444 = hasCap(NV_ENC_CAPS_SUPPORT_YUV444_ENCODE);
+    caps.supportsLossless = hasCap(NV_ENC_CAPS_SUPPORT_LOSSLESS_ENCODE);
+    caps.supportsIntraRefresh = hasCap(NV_ENC_CAPS_SUPPORT_INTRA_REFRESH);
+    caps.supportsRefPicInvalidation = hasCap(NV_ENC_CAPS_SUPPORT_REF_PIC_INVALIDATION);
+    caps.supportsCustomVbv = hasCap(NV_ENC_CAPS_SUPPORT_CUSTOM_VBV_BUF_SIZE);
+    caps.supportsDynamicResolutionChange = hasCap(NV_ENC_CAPS_SUPPORT_DYN_RES_CHANGE);
+    caps.supportsDynamicBitrateChange = hasCap(NV_ENC_CAPS_SUPPORT_DYN_BITRATE_CHANGE);
+    caps.supportsDynamicSliceMode = hasCap(NV_ENC_CAPS_SUPPORT_DYNAMIC_SLICE_MODE);
+    caps.supportsSubframeReadback = hasCap(NV_ENC_CAPS_SUPPORT_SUBFRAME_READBACK);
+
+    CheckStatus(api.nvEncGetEncodePresetCount(session, codecGuid, &count), "nvEncGetEncodePresetCount");
+    std::vector<GUID> presetGuids(count);
+    CheckStatus(api.nvEncGetEncodePresetGUIDs(session, codecGuid, presetGuids.data(), count, &count), "nvEncGetEncodePresetGUIDs");
+    presetGuids.resize(std::min<size_t>(count, presetGuids.size()));
+
+    for (int i = 0; i <= static_cast<int>(NvencPreset::LowLatencyHighPerformance); ++i)
+    {
+        const auto presetGuid = GetPresetGuid(static_cast<NvencPreset>(i));
+        const auto isPresetGuid = [&](const GUID &guid) { return IsSameGuid(guid, presetGuid); };
+        if (std::any_of(presetGuids.begin(), presetGuids.end(), isPresetGuid))
+        {
+            caps.presetMask |= 1U << i;
+        }
+    }
+
+    return caps;
+}
+
+
+// The cache file is text: a header line with the format version and the
+// number of fields, then one line per adapter identity, driver version and
+// codec.
+void LoadCacheFile()
+{
+    if (g_cachePath.empty()) return;
+
+    std::ifstream file(g_cachePath);
+    if (!file) return;
+
+    std::string magic;
+    int version = 0;
+    size_t fieldCount = 0;
+    file >> magic >> version >> fieldCount;
+    if (!file || magic != "uNvEncoderCaps" || version != cacheFileVersion || fieldCount != capsFieldCount) return;
+
+    CachedCapsKey key;
+    int codec = 0;
+    while (file >> std::hex >> key.adapter.vendorId >> key.adapter.deviceId >> key.adapter.subSysId >> key.adapter.revision
+        >> key.driverVersion >> std::dec >> codec)
+    {
+        uint32_t fields[capsFieldCount];
+        for (auto &field : fields) file >> field;
+        if (!file) break;
+
+        key.codec = static_cast<NvencCodec>(codec);
+        EncoderCaps caps;
+        ::memcpy(&caps, fields, sizeof(caps));
+        g_cachedCaps.emplace(key, caps);
+    }
+}
+
+
+void SaveCacheFile()
+{
+    if (g_cachePath.empty()) return;
+
+    std::ofstream file(g_cachePath, std::ios::trunc);
+    if (!file)
+    {
+        ::fprintf(stdout, "Failed to write the encoder caps cache to %s.\n", g_cachePath.c_str());
+        return;
+    }
+
+    file << "uNvEncoderCaps " << cacheFileVersion << " " << capsFieldCount << "\n";
+    for (const auto &pair : g_cachedCaps)
+    {
+        const auto &key = pair.first;
+        uint32_t fields[capsFieldCount];
+        ::memcpy(fields, &pair.second, sizeof(fields));
+
+        file << std::hex
+            << key.adapter.vendorId << " " << key.adapter.deviceId << " " << key.adapter.subSysId << " " << key.adapter.revision << " "
+            << key.driverVersion << std::dec << " " << static_cast<int>(key.codec);
+        for (const auto field : fields) file << " " << field;
+        file << "\n";
+    }
+}
+
+
+// Entries of another driver on the same adapter will never match again.
+void StoreCaps(const CapsKey &key, const CachedCapsKey &cachedKey, const EncoderCaps &caps)
+{
+    for (auto it = g_caps.begin(); it != g_caps.end();)
+    {
+        const bool isStale = it->first.adapterId == key.adapterId && it->first.driverVersion != key.driverVersion;
+        it = isStale ? g_caps.erase(it) : std::next(it);
+    }
+    for (auto it = g_cachedCaps.begin(); it != g_cachedCaps.end();)
+    {
+        const bool isStale = it->first.IsSameAdapter(cachedKey) && it->first.driverVersion != cachedKey.driverVersion;
+        it = isStale ? g_cachedCaps.erase(it) : std::next(it);
+    }
+
+    g_caps[key] = caps;
+    g_cachedCaps[cachedKey] = caps;
+    SaveCacheFile();
+}
+
+
+}
+
+
+EncoderCaps GetEncoderCaps(IEncodeBackend &backend, IGraphicsDevice &device, NvencCodec codec, void *session)
+{
+    const CapsKey key = { device.GetAdapterId(), device.GetDriverVersion(), codec };
+    const CachedCapsKey cachedKey = { device.GetAdapterIdentity(), device.GetDriverVersion(), codec };
+
+    std::lock_guard<std::mutex> lock(g_capsMutex);
+
+    const auto it = g_caps.find(key);
+    if (it != g_caps.end()) return it->second;
+
+    const auto cachedIt = g_cachedCaps.find(cachedKey);
+    if (cachedIt != g_cachedCaps.end())
+    {
+        g_caps.emplace(key, cachedIt->second);
+        return cachedIt->second;
+    }
+
+    const auto &api = backend.GetFunctionList();
+    EncoderCaps caps;
+    if (session)
+    {
+        caps = ProbeEncoderCaps(api, session, codec);
+    }
+    else
+    {
+        NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS encSessionParams = { NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS_VER };
+        encSessionParams.device = device.GetEncodeDevice();
+        encSessionParams.deviceType = backend.GetDeviceType();
+        encSessionParams.apiVersion = NVENCAPI_VERSION;
+
+        void *probeSession = nullptr;
+        const auto status = api.nvEncOpenEncodeSessionEx(&encSessionParams, &probeSession);
+        if (status != NV_ENC_SUCCESS)
+        {
+            if (probeSession) api.nvEncDestroyEncoder(probeSession);
+            CheckStatus(status, "nvEncOpenEncodeSessionEx");
+        }
+
+        try
+        {
+            caps = ProbeEncoderCaps(api, probeSession, codec);
+        }
+        catch (const std::exception &)
+        {
+            api.nvEncDestroyEncoder(probeSession);
+            throw;
+        }
+        api.nvEncDestroyEncoder(probeSession);
+    }
+
+    StoreCaps(key, cachedKey, caps);
+    return caps;
+}
+
+
+const char * GetEncoderCapsError(const EncoderCaps &caps, const EncoderConfig &config, uint32_t width, uint32_t height)
+{
+    if (!caps.isSupported) return "The codec is not supported by this GPU.";
+
+    if (std::max(width, config.maxWidth) > caps.maxWidth || std::max(height, config.maxHeight) > caps.maxHeight)
+    {
+        return "The resolution exceeds the maximum of the encoder.";
+    }
+    const uint64_t macroblockCount = static_cast<uint64_t>((width + 15) / 16) * ((height + 15) / 16);
+    if (caps.maxMacroblockCount && macroblockCount > caps.maxMacroblockCount)
+    {
+        return "The frame has more macroblocks than the encoder supports.";
+    }
+
+    const auto presetBit = 1U << static_cast<int>(config.preset);
+    if (caps.presetMask && !(caps.presetMask & presetBit)) return "The preset is not supported by this GPU.";
+
+    if (config.bFrameCount > caps.maxBFrameCount) return "This GPU supports fewer B-frames.";
+    if (config.lookaheadDepth > 0 && !caps.supportsLookahead) return "Lookahead is not supported by this GPU.";
+    if (config.enableTemporalAq && !caps.supportsTemporalAq) return "Temporal AQ is not supported by this GPU.";
+    if (config.profile == NvencProfile::HevcMain10 && !caps.supports10Bit) return "10-bit encoding is not supported by this GPU.";
+    if (config.inputConversion == NvencInputConversion::Yuv444 && !caps.supportsYuv444)
+    {
+        return "YUV 4:4:4 encoding is not supported by this GPU.";
+    }
+    if (config.vbvBufferSize > 0 && !caps.supportsCustomVbv) return "A custom VBV size is not supported by this GPU.";
+    if (config.enableIntraRefresh && !caps.supportsIntraRefresh) return "Intra refresh is not supported by this GPU.";
+    if (config.enableSubFrameReadback && !caps.supportsSubframeReadback) return "Sub-frame readback is not supported by this GPU.";
+    if (config.enableLtr && caps.maxLtrFrameCount == 0) return "LTR is not supported by this GPU.";
+    if (config.enableLtr && config.ltrFrameCount > caps.maxLtrFrameCount) return "This GPU supports fewer LTR frames.";
+
+    return nullptr;
+}
+
+
+void SetEncoderCapsCachePath(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(g_capsMutex);
+
+    g_cachePath = path;
+    LoadCacheFile();
+    if (!g_cachedCaps.empty()) SaveCacheFile();
+}
+
+
+void ClearEncoderCaps()
+{
+    std::lock_guard<std::mutex> lock(g_capsMutex);
+    g_caps.clear();
+    g_cachedCaps.clear();
+}
+
+
+}
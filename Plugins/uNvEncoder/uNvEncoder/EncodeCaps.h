@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "EncodeBackend.h"
+#include "EncoderConfig.h"
+
+
+namespace uNvEncoder
+{
+
+
+// Blittable capabilities of one codec on one adapter, shared with C#. Flags
+// are 0 or 1, and presetMask has bit n set when NvencPreset n is available.
+// Every field is 32-bit so that the cache file can store it as a plain list.
+struct EncoderCaps
+{
+    int32_t isSupported = 0;
+    uint32_t maxWidth = 0;
+    uint32_t maxHeight = 0;
+    uint32_t maxMacroblockCount = 0;
+    uint32_t maxBFrameCount = 0;
+    uint32_t maxLtrFrameCount = 0;
+    uint32_t presetMask = 0;
+    int32_t supportsLookahead = 0;
+    int32_t supportsTemporalAq = 0;
+    int32_t supports10Bit = 0;
+    int32_t supportsYuv444 = 0;
+    int32_t supportsLossless = 0;
+    int32_t supportsIntraRefresh = 0;
+    int32_t supportsRefPicInvalidation = 0;
+    int32_t supportsCustomVbv = 0;
+    int32_t supportsDynamicResolutionChange = 0;
+    int32_t supportsDynamicBitrateChange = 0;
+    int32_t supportsDynamicSliceMode = 0;
+    int32_t supportsSubframeReadback = 0;
+};
+
+
+// Returns the capabilities of the codec on the adapter of the device. They are
+// probed once per adapter, driver version and codec and then served from
+// memory. When a session is given the probe runs on it, otherwise a
+// temporary one is opened.
+EncoderCaps GetEncoderCaps(IEncodeBackend &backend, IGraphicsDevice &device, NvencCodec codec, void *session = nullptr);
+
+// Returns why the config cannot be encoded at the given size with these
+// capabilities, or nullptr if it can.
+const char * GetEncoderCapsError(const EncoderCaps &caps, const EncoderConfig &config, uint32_t width, uint32_t height);
+
+// Keeps probed capabilities in the given file so that later processes skip
+// probing on the same GPU model while the driver version stays the same. An
+// empty path only keeps them in memory.
+void SetEncoderCapsCachePath(const std::string &path);
+
+// Forgets every probed capability in memory. The cache file is left as is.
+void ClearEncoderCaps();
+
+
+}
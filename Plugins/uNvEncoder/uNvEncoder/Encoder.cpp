@@ -1,269 +1,768 @@
-#include "Encoder.h"
-#include "Nvenc.h"
-
-
-namespace uNvEncoder
-{
-
-
-Encoder::Encoder(const EncoderDesc &desc)
-    : desc_(desc)
-{
-    try
-    {
-        CreateDevice();
-        CreateNvenc();
-        StartThread();
-    }
-    catch (const std::exception& e)
-    {
-        
-        error_ = e.what();
-        ::fprintf(stdout, "Encoder %s", error_.c_str());
-    }
-}
-
-
-Encoder::~Encoder()
-{
-    try
-    {
-        StopThread();
-        DestroyNvenc();
-        DestroyDevice();
-    }
-    catch (const std::exception& e)
-    {        
-        error_ = e.what();
-        ::fprintf(stdout, "~Encoder %s", error_.c_str());
-    }
-}
-
-
-bool Encoder::IsValid() const
-{
-    return device_ && nvenc_ && nvenc_->IsValid();
-}
-
-
-void Encoder::CreateDevice()
-{
-    ComPtr<IDXGIDevice1> dxgiDevice;
-    if (FAILED(GetUnityDevice()->QueryInterface(IID_PPV_ARGS(&dxgiDevice)))) 
-    {
-        ThrowError("Failed to get IDXGIDevice1.");
-        return;
-    }
-
-    ComPtr<IDXGIAdapter> dxgiAdapter;
-    if (FAILED(dxgiDevice->GetAdapter(&dxgiAdapter))) 
-    {
-        ThrowError("Failed to get IDXGIAdapter.");
-        return;
-    }
-
-    constexpr auto driverType = D3D_DRIVER_TYPE_UNKNOWN;
-    constexpr auto flags = D3D11_CREATE_DEVICE_BGRA_SUPPORT;
-    constexpr D3D_FEATURE_LEVEL featureLevelsRequested[] =
-    {
-        D3D_FEATURE_LEVEL_11_0,
-        D3D_FEATURE_LEVEL_10_1,
-        D3D_FEATURE_LEVEL_10_0,
-        D3D_FEATURE_LEVEL_9_3,
-        D3D_FEATURE_LEVEL_9_2,
-        D3D_FEATURE_LEVEL_9_1
-    };
-    constexpr UINT numLevelsRequested = sizeof(featureLevelsRequested) / sizeof(D3D_FEATURE_LEVEL);
-    D3D_FEATURE_LEVEL featureLevelsSupported;
-
-    D3D11CreateDevice(
-        dxgiAdapter.Get(),
-        driverType,
-        nullptr,
-        flags,
-        featureLevelsRequested,
-        numLevelsRequested,
-        D3D11_SDK_VERSION,
-        &device_,
-        &featureLevelsSupported,
-        nullptr);
-}
-
-
-void Encoder::DestroyDevice()
-{
-    if(device_) device_->Release();
-    device_ = nullptr;
-}
-
-
-void Encoder::CreateNvenc()
-{
-    NvencDesc desc = { 0 };
-    desc.d3d11Device = device_;
-    desc.width = desc_.width;
-    desc.height = desc_.height;
-    desc.format = desc_.format;
-    desc.frameRate = desc_.frameRate;
-
-    nvenc_ = std::make_unique<Nvenc>(desc);
-    nvenc_->Initialize();
-}
-
-
-void Encoder::DestroyNvenc()
-{
-    nvenc_->Finalize();
-    nvenc_.reset();
-}
-
-void Encoder::Resize(uint32_t width, uint32_t height)
-{
-    desc_.width = width;
-    desc_.height = height;
-
-    try
-    {
-        nvenc_->Resize(width, height);
-    }
-    catch (const std::exception & e)
-    {        
-        error_ = e.what();
-        ::fprintf(stdout, "Resize %s", error_.c_str());
-    }
-}
-
-
-void Encoder::StartThread()
-{
-    encodeThread_ = std::thread([&]
-    {
-        while (!shouldStopEncodeThread_)
-        {
-            WaitForEncodeRequest();
-            UpdateGetEncodedData();
-        }
-    });
-}
-
-
-void Encoder::StopThread()
-{
-    shouldStopEncodeThread_ = true;
-    encodeCond_.notify_one();
-
-    if (encodeThread_.joinable())
-    {
-        encodeThread_.join();
-    }
-}
-
-
-void Encoder::SetPrimarySource(const ComPtr<ID3D11Texture2D>& source)
-{
-	primarySource_ = ComPtr<ID3D11Texture2D>(source.Get());
-}
-
-bool Encoder::EncodePrimarySource(bool forceIdrFrame)
-{
-	if (primarySource_.Get() == nullptr)
-	{
-		::fprintf(stdout, "Missing call to SetPrimarySource.");
-		return false;
-	}
-
-	return Encode(primarySource_, forceIdrFrame);
-}
-
-bool Encoder::Encode(const ComPtr<ID3D11Texture2D> &source, bool forceIdrFrame)
-{
-    try
-    {
-        bool result = nvenc_->Encode(source, forceIdrFrame);
-		if (!result) return false;
-    }
-    catch (const std::exception& e)
-    {        
-        error_ = e.what();
-        ::fprintf(stdout, "Encoder::Encode %s", error_.c_str());
-        return false;
-    }
-
-    RequestGetEncodedData();
-    return true;
-}
-
-
-bool Encoder::Encode(HANDLE sharedHandle, bool forceIdrFrame)
-{
-    ComPtr<ID3D11Texture2D> source;
-    if (FAILED(GetUnityDevice()->OpenSharedResource(
-        sharedHandle,
-        __uuidof(ID3D11Texture2D),
-        &source)))
-    {
-        return false;
-    }
-
-    return Encode(source, forceIdrFrame);
-}
-
-
-void Encoder::WaitForEncodeRequest()
-{
-    std::unique_lock<std::mutex> encodeLock(encodeMutex_);
-    encodeCond_.wait(encodeLock, [&] 
-    { 
-        return isEncodeRequested || shouldStopEncodeThread_; 
-    });
-    isEncodeRequested = false;
-}
-
-
-void Encoder::RequestGetEncodedData()
-{
-    std::lock_guard<std::mutex> lock(encodeMutex_);
-    isEncodeRequested = true;
-    encodeCond_.notify_one();
-}
-
-
-void Encoder::UpdateGetEncodedData()
-{
-    std::vector<NvencEncodedData> data;
-
-    try
-    {
-        nvenc_->GetEncodedData(data);
-    }
-    catch (const std::exception& e)
-    {
-        ::fprintf(stdout, "GetEncodedData %s", error_.c_str());
-        error_ = e.what();
-        return;
-    }
-
-    std::lock_guard<std::mutex> dataLock(encodeDataListMutex_);
-    for (auto &ed : data)
-    {
-        encodedDataList_.push_back(std::move(ed));
-    }
-}
-
-
-void Encoder::CopyEncodedDataList()
-{
-    std::lock_guard<std::mutex> lock(encodeDataListMutex_);
-
-    encodedDataListCopied_.clear();
-    std::swap(encodedDataListCopied_, encodedDataList_);
-}
-
-
-const std::vector<NvencEncodedData> & Encoder::GetEncodedDataList() const
-{
-    return encodedDataListCopied_;
-}
-
-
-}
+#include "Encoder.h"
+#include "Nvenc.h"
+
+
+namespace uNvEncoder
+{
+
+
+// The consumer usually drains once per game frame, so this leaves plenty of
+// headroom. When it is exceeded the newest frame is dropped and counted, and an
+// intra refresh is requested so that the stream can recover. The next frame
+// then starts the waves of intra refresh, or is an IDR frame when intra
+// refresh is off.
+constexpr size_t encodedDataQueueSize = 256;
+
+
+Encoder::Encoder(const EncoderDesc &desc)
+    : desc_(desc)
+    , encodedDataQueue_(encodedDataQueueSize)
+{
+    encodedDataListCopied_.reserve(encodedDataQueue_.GetCapacity());
+    encodedData_.reserve(encodedDataQueue_.GetCapacity());
+
+    try
+    {
+        CreateDevice();
+        CreateNvenc();
+        UpdateQpMapSize();
+        StartThread();
+    }
+    catch (const std::exception& e)
+    {
+        
+        error_ = e.what();
+        ::fprintf(stdout, "Encoder %s", error_.c_str());
+    }
+}
+
+
+Encoder::Encoder(const EncoderDesc &desc, const std::shared_ptr<IEncodeBackend> &backend, const std::shared_ptr<IGraphicsDevice> &device)
+    : desc_(desc)
+    , backend_(backend)
+    , device_(device)
+    , encodedDataQueue_(encodedDataQueueSize)
+    , isRendition_(true)
+{
+    encodedDataListCopied_.reserve(encodedDataQueue_.GetCapacity());
+    encodedData_.reserve(encodedDataQueue_.GetCapacity());
+
+    try
+    {
+        CreateNvenc();
+        UpdateQpMapSize();
+    }
+    catch (const std::exception& e)
+    {
+        error_ = e.what();
+        ::fprintf(stdout, "Encoder %s", error_.c_str());
+    }
+}
+
+
+Encoder::~Encoder()
+{
+    try
+    {
+        StopThread();
+        DestroyNvenc();
+        DestroyDevice();
+    }
+    catch (const std::exception& e)
+    {        
+        error_ = e.what();
+        ::fprintf(stdout, "~Encoder %s", error_.c_str());
+    }
+}
+
+
+bool Encoder::IsValid() const
+{
+    return device_ && nvenc_ && nvenc_->IsValid();
+}
+
+
+void Encoder::CreateDevice()
+{
+    backend_ = GetEncodeBackend();
+    device_ = backend_->CreateGraphicsDevice();
+}
+
+
+void Encoder::DestroyDevice()
+{
+    SetPrimarySource(nullptr);
+    device_.reset();
+    backend_.reset();
+}
+
+
+void Encoder::CreateNvenc()
+{
+    NvencDesc desc;
+    desc.backend = backend_.get();
+    desc.device = device_.get();
+    desc.config = desc_.config;
+    desc.width = desc_.width;
+    desc.height = desc_.height;
+    desc.format = desc_.format;
+    desc.frameRate = desc_.frameRate;
+    desc.asyncDepth = static_cast<uint32_t>(std::max(desc_.asyncDepth, 0));
+    desc.bitstreamPool = &bitstreamPool_;
+
+    nvenc_ = std::make_unique<Nvenc>(desc);
+    nvenc_->Initialize();
+
+    desc_.asyncDepth = nvenc_->GetAsyncDepth();
+}
+
+
+void Encoder::DestroyNvenc()
+{
+    // There is no session when the backend or the device could not be made.
+    if (!nvenc_) return;
+
+    nvenc_->Finalize();
+    nvenc_.reset();
+}
+
+void Encoder::Resize(uint32_t width, uint32_t height)
+{
+    if (!IsValid() || (GetWidth() == width && GetHeight() == height)) return;
+
+    if (isRendition_)
+    {
+        ::fprintf(stdout, "Resize The renditions of a simulcast keep their size.");
+        return;
+    }
+
+    // A resize within the input surfaces is a plain reconfigure, so frames in
+    // flight keep draining on the encode thread.
+    if (!nvenc_->IsFlushNeededToResize(width, height))
+    {
+        try
+        {
+            nvenc_->Resize(width, height);
+            desc_.width = width;
+            desc_.height = height;
+            UpdateAbrResolution();
+            UpdateQpMapSize();
+        }
+        catch (const std::exception & e)
+        {
+            error_ = e.what();
+            ::fprintf(stdout, "Resize %s", error_.c_str());
+        }
+        return;
+    }
+
+    StopThread();
+
+    try
+    {
+        encodedData_.clear();
+        nvenc_->Flush(encodedData_);
+        AddEncodedData(encodedData_);
+
+        nvenc_->Resize(width, height);
+
+        desc_.width = width;
+        desc_.height = height;
+        UpdateAbrResolution();
+        UpdateQpMapSize();
+    }
+    catch (const std::exception & e)
+    {        
+        error_ = e.what();
+        ::fprintf(stdout, "Resize %s", error_.c_str());
+    }
+
+    StartThread();
+}
+
+
+bool Encoder::SetRateControl(uint32_t averageBitRate, uint32_t maxBitRate, uint32_t frameRate, bool forceIdrFrame)
+{
+    if (!IsValid()) return false;
+
+    try
+    {
+        if (IsAbrEnabled()) ThrowError("ABR controls the rate while it is enabled.");
+        // The renditions of a simulcast share the frame rate and the IDR frames.
+        if (isRendition_ && ((frameRate && frameRate != GetFrameRate()) || forceIdrFrame))
+        {
+            ThrowError("A rendition can only change its bitrates.");
+        }
+        nvenc_->SetRateControl(averageBitRate, maxBitRate, frameRate, forceIdrFrame);
+    }
+    catch (const std::exception &e)
+    {
+        error_ = e.what();
+        ::fprintf(stdout, "SetRateControl %s", error_.c_str());
+        return false;
+    }
+
+    desc_.frameRate = nvenc_->GetFrameRate();
+    desc_.config = nvenc_->GetConfig();
+    return true;
+}
+
+
+bool Encoder::SetAbrConfig(const AbrConfig *config)
+{
+    if (!IsValid()) return false;
+
+    if (!config)
+    {
+        {
+            std::lock_guard<std::mutex> lock(abrMutex_);
+            if (!abr_) return true;
+            abr_.reset();
+        }
+
+        const auto sourceFrameRate = abrSourceFrameRate_;
+        abrSourceFrameRate_ = 0;
+        abrFrameRate_ = 0;
+        skipCredit_ = 0;
+        if (GetFrameRate() == sourceFrameRate) return true;
+        return SetRateControl(0, 0, sourceFrameRate, false);
+    }
+
+    try
+    {
+        if (isRendition_) ThrowError("The renditions of a simulcast cannot use ABR.");
+        if (const auto error = GetAbrConfigError(*config)) ThrowError(error);
+        if (desc_.config.rateControlMode == NvencRateControlMode::ConstQp)
+        {
+            ThrowError("Constant QP has no bitrate to adapt.");
+        }
+        if (!nvenc_->GetCaps().supportsDynamicBitrateChange) ThrowError("This GPU cannot change the bitrate while encoding.");
+    }
+    catch (const std::exception &e)
+    {
+        error_ = e.what();
+        ::fprintf(stdout, "SetAbrConfig %s", error_.c_str());
+        return false;
+    }
+
+    // A new config replaces a running controller but keeps the frame rate it
+    // started from, since the session may already run below it.
+    if (abrSourceFrameRate_ == 0) abrSourceFrameRate_ = GetFrameRate();
+    abrFrameRate_ = GetFrameRate();
+
+    std::lock_guard<std::mutex> lock(abrMutex_);
+    abr_ = std::make_unique<AbrController>(*config, desc_.config.averageBitRate, GetWidth(), GetHeight(), abrSourceFrameRate_);
+    return true;
+}
+
+
+void Encoder::ReportNetworkFeedback(const NetworkFeedback &feedback)
+{
+    std::lock_guard<std::mutex> lock(abrMutex_);
+    if (abr_) abr_->OnFeedback(feedback);
+}
+
+
+uint32_t Encoder::GetAbrEstimatedBitRate() const
+{
+    std::lock_guard<std::mutex> lock(abrMutex_);
+    return abr_ ? abr_->GetEstimatedBitRate() : 0;
+}
+
+
+bool Encoder::IsAbrEnabled() const
+{
+    std::lock_guard<std::mutex> lock(abrMutex_);
+    return abr_ != nullptr;
+}
+
+
+void Encoder::UpdateAbrResolution()
+{
+    std::lock_guard<std::mutex> lock(abrMutex_);
+    if (abr_) abr_->SetResolution(GetWidth(), GetHeight());
+}
+
+
+void Encoder::ApplyAbrTarget()
+{
+    AbrTarget target;
+    {
+        std::lock_guard<std::mutex> lock(abrMutex_);
+        if (!abr_ || !abr_->TakeTarget(target)) return;
+    }
+
+    try
+    {
+        nvenc_->SetRateControl(target.averageBitRate, target.maxBitRate, target.frameRate, false);
+    }
+    catch (const std::exception &e)
+    {
+        error_ = e.what();
+        ::fprintf(stdout, "ApplyAbrTarget %s", error_.c_str());
+        return;
+    }
+
+    desc_.frameRate = nvenc_->GetFrameRate();
+    desc_.config = nvenc_->GetConfig();
+    abrFrameRate_ = target.frameRate;
+}
+
+
+// Kept frames are spread evenly over the submitted ones. Frames that carry a
+// request are always encoded.
+bool Encoder::ShouldSkipFrame(const EncodeOptions &options)
+{
+    if (abrFrameRate_ == 0 || abrFrameRate_ >= abrSourceFrameRate_) return false;
+    if (options.forceIdrFrame || options.markLtrFrame || options.useLtrFrames) return false;
+
+    skipCredit_ += abrFrameRate_;
+    if (skipCredit_ < abrSourceFrameRate_) return true;
+
+    skipCredit_ -= abrSourceFrameRate_;
+    return false;
+}
+
+
+void Encoder::StartThread()
+{
+    shouldStopEncodeThread_ = false;
+
+    encodeThread_ = std::thread([&]
+    {
+        while (!shouldStopEncodeThread_)
+        {
+            WaitForEncodedData(&encodeEvent_);
+            UpdateGetEncodedData();
+        }
+    });
+}
+
+
+void Encoder::StopThread()
+{
+    shouldStopEncodeThread_ = true;
+    encodeEvent_.Set();
+
+    if (encodeThread_.joinable())
+    {
+        encodeThread_.join();
+    }
+}
+
+
+void Encoder::SetPrimarySource(void *source)
+{
+	if (!device_) return;
+
+	device_->RetainTexture(source);
+	device_->ReleaseTexture(primarySource_);
+	primarySource_ = source;
+}
+
+bool Encoder::EncodePrimarySource(bool forceIdrFrame)
+{
+	if (primarySource_ == nullptr)
+	{
+		::fprintf(stdout, "Missing call to SetPrimarySource.");
+		return false;
+	}
+
+	return Encode(primarySource_, forceIdrFrame);
+}
+
+bool Encoder::Encode(void *source, bool forceIdrFrame)
+{
+    EncodeOptions options;
+    options.forceIdrFrame = forceIdrFrame ? 1 : 0;
+    return Encode(source, options);
+}
+
+
+bool Encoder::Encode(void *source, const EncodeOptions &options)
+{
+    return EncodeFrame(source, nullptr, options);
+}
+
+
+bool Encoder::EncodeFromMemory(const NvencMemoryFrame &frame, const EncodeOptions &options)
+{
+    return EncodeFrame(nullptr, &frame, options);
+}
+
+
+bool Encoder::EncodeFrame(void *source, const NvencMemoryFrame *frame, const EncodeOptions &options)
+{
+    if (isRendition_)
+    {
+        ::fprintf(stdout, "Encoder::Encode A rendition is encoded by its simulcast.");
+        return false;
+    }
+
+    ApplyAbrTarget();
+    if (ShouldSkipFrame(options))
+    {
+        if (!options.isUnchanged) isChangeSkipped_ = true;
+        return true;
+    }
+
+    EncodeOptions frameOptions = options;
+    if (isChangeSkipped_) frameOptions.isUnchanged = 0;
+
+    try
+    {
+        // Only this thread builds the map, so it stays valid after unlocking.
+        const int8_t *qpDeltaMap = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(qpMapMutex_);
+            qpDeltaMap = qpMap_.Build();
+        }
+
+        const bool isIntraRefreshRequested = isIntraRefreshRequested_.exchange(false);
+        bool result = frame ?
+            nvenc_->EncodeFromMemory(*frame, frameOptions, isIntraRefreshRequested, qpDeltaMap) :
+            nvenc_->Encode(source, frameOptions, isIntraRefreshRequested, qpDeltaMap);
+        if (!result)
+        {
+            if (isIntraRefreshRequested) isIntraRefreshRequested_ = true;
+            return false;
+        }
+        isChangeSkipped_ = false;
+    }
+    catch (const std::exception& e)
+    {        
+        error_ = e.what();
+        ::fprintf(stdout, "Encoder::Encode %s", error_.c_str());
+        return false;
+    }
+
+    encodeEvent_.Set();
+    return true;
+}
+
+
+void * Encoder::GetNextInputTexture() const
+{
+    return nvenc_ ? nvenc_->GetNextInputTexture() : nullptr;
+}
+
+
+// Like EncodeFrame without ABR. The simulcast decides about intra refresh and
+// IDR frames for all renditions.
+bool Encoder::EncodeRendition(const EncodeOptions &options, bool startIntraRefresh)
+{
+    try
+    {
+        const int8_t *qpDeltaMap = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(qpMapMutex_);
+            qpDeltaMap = qpMap_.Build();
+        }
+
+        return nvenc_->EncodeNextInputTexture(options, startIntraRefresh, qpDeltaMap);
+    }
+    catch (const std::exception& e)
+    {
+        error_ = e.what();
+        ::fprintf(stdout, "Encoder::EncodeRendition %s", error_.c_str());
+    }
+
+    return false;
+}
+
+
+bool Encoder::EncodeSharedHandle(void *sharedHandle, bool forceIdrFrame)
+{
+    if (!device_) return false;
+
+    const auto source = device_->OpenSharedTexture(sharedHandle);
+    if (!source) return false;
+
+    const bool result = Encode(source, forceIdrFrame);
+    device_->ReleaseTexture(source);
+    return result;
+}
+
+
+void Encoder::WaitForEncodedData(Event *interruptEvent)
+{
+    try
+    {
+        nvenc_->WaitForEncodedData(interruptEvent);
+    }
+    catch (const std::exception& e)
+    {
+        error_ = e.what();
+        ::fprintf(stdout, "WaitForEncodedData %s", error_.c_str());
+    }
+}
+
+
+size_t Encoder::AddCompletionEvents(Event **events, size_t maxCount, std::chrono::milliseconds &timeout)
+{
+    try
+    {
+        return nvenc_->AddCompletionEvents(events, maxCount, timeout);
+    }
+    catch (const std::exception& e)
+    {
+        error_ = e.what();
+        ::fprintf(stdout, "AddCompletionEvents %s", error_.c_str());
+    }
+    return 0;
+}
+
+
+void Encoder::SetCompleted(const Event *event)
+{
+    nvenc_->SetCompleted(event);
+}
+
+
+void Encoder::CheckCompletionTimeout()
+{
+    try
+    {
+        nvenc_->CheckCompletionTimeout();
+    }
+    catch (const std::exception& e)
+    {
+        error_ = e.what();
+        ::fprintf(stdout, "CheckCompletionTimeout %s", error_.c_str());
+    }
+}
+
+
+void Encoder::UpdateGetEncodedData()
+{
+    encodedData_.clear();
+
+    try
+    {
+        nvenc_->GetEncodedData(encodedData_);
+    }
+    catch (const std::exception& e)
+    {
+        error_ = e.what();
+        ::fprintf(stdout, "GetEncodedData %s", error_.c_str());
+    }
+
+    AddEncodedData(encodedData_);
+}
+
+
+void Encoder::AddEncodedData(std::vector<NvencEncodedData> &data)
+{
+    if (data.empty()) return;
+
+    for (auto &ed : data)
+    {
+        const auto index = ed.index;
+        const bool isLeased = ed.IsLeased();
+        if (!encodedDataQueue_.TryPush(std::move(ed)))
+        {
+            if (isLeased) ReleaseEncodedData(index);
+            ++encodedDataOverflowCount_;
+            isIntraRefreshRequested_ = true;
+        }
+    }
+}
+
+
+void Encoder::CopyEncodedDataList()
+{
+    CopyEncodedDataList(encodedDataQueue_.GetCapacity());
+}
+
+
+void Encoder::CopyEncodedDataList(size_t maxCount)
+{
+    encodedDataListCopied_.clear();
+
+    NvencEncodedData ed;
+    while (encodedDataListCopied_.size() < maxCount && encodedDataQueue_.TryPop(ed))
+    {
+        encodedDataListCopied_.push_back(std::move(ed));
+    }
+}
+
+
+const std::vector<NvencEncodedData> & Encoder::GetEncodedDataList() const
+{
+    return encodedDataListCopied_;
+}
+
+
+uint64_t Encoder::GetDuplicateFrameCount() const
+{
+    return nvenc_ ? nvenc_->GetDuplicateFrameCount() : 0;
+}
+
+
+uint64_t Encoder::GetSkippedDuplicateFrameCount() const
+{
+    return nvenc_ ? nvenc_->GetSkippedDuplicateFrameCount() : 0;
+}
+
+
+uint32_t Encoder::GetLtrSlotCount() const
+{
+    return nvenc_ ? nvenc_->GetLtrSlotCount() : 0;
+}
+
+
+bool Encoder::GetLtrFrameIndex(uint32_t slot, uint64_t &frameIndex) const
+{
+    return nvenc_ ? nvenc_->GetLtrFrameIndex(slot, frameIndex) : false;
+}
+
+
+int Encoder::FindLtrSlot(uint64_t frameIndex) const
+{
+    return nvenc_ ? nvenc_->FindLtrSlot(frameIndex) : -1;
+}
+
+
+int Encoder::InvalidateRefFrames(const uint64_t *frameIndices, size_t count)
+{
+    if (!IsValid()) return -1;
+
+    try
+    {
+        return static_cast<int>(nvenc_->InvalidateRefFrames(frameIndices, count));
+    }
+    catch (const std::exception &e)
+    {
+        error_ = e.what();
+        ::fprintf(stdout, "InvalidateRefFrames %s", error_.c_str());
+    }
+
+    return -1;
+}
+
+
+// Timestamps that are no longer in the reference history belong to frames
+// that cannot be referenced anyway, so they are dropped here.
+int Encoder::InvalidateRefFramesByTimestamp(const uint64_t *timestamps, size_t count)
+{
+    if (!IsValid()) return -1;
+
+    std::vector<uint64_t> frameIndices;
+    frameIndices.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint64_t frameIndex = 0;
+        if (nvenc_->FindFrameIndex(timestamps[i], frameIndex)) frameIndices.push_back(frameIndex);
+    }
+
+    return InvalidateRefFrames(frameIndices.data(), frameIndices.size());
+}
+
+
+bool Encoder::SetQpDeltaMap(const int8_t *deltas, size_t size)
+{
+    if (!IsValid()) return false;
+
+    try
+    {
+        CheckQpDeltaMapEnabled();
+        std::lock_guard<std::mutex> lock(qpMapMutex_);
+        qpMap_.SetDeltas(deltas, size);
+    }
+    catch (const std::exception &e)
+    {
+        error_ = e.what();
+        ::fprintf(stdout, "SetQpDeltaMap %s", error_.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
+bool Encoder::SetFoveation(const Foveation *foveation)
+{
+    if (!IsValid()) return false;
+
+    try
+    {
+        CheckQpDeltaMapEnabled();
+        std::lock_guard<std::mutex> lock(qpMapMutex_);
+        qpMap_.SetFoveation(foveation);
+    }
+    catch (const std::exception &e)
+    {
+        error_ = e.what();
+        ::fprintf(stdout, "SetFoveation %s", error_.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
+bool Encoder::SetQpRegions(const QpRegion *regions, size_t count)
+{
+    if (!IsValid()) return false;
+
+    try
+    {
+        CheckQpDeltaMapEnabled();
+        std::lock_guard<std::mutex> lock(qpMapMutex_);
+        qpMap_.SetRegions(regions, count);
+    }
+    catch (const std::exception &e)
+    {
+        error_ = e.what();
+        ::fprintf(stdout, "SetQpRegions %s", error_.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
+void Encoder::GetQpMapSize(uint32_t &columnCount, uint32_t &rowCount) const
+{
+    std::lock_guard<std::mutex> lock(qpMapMutex_);
+    columnCount = qpMap_.GetColumnCount();
+    rowCount = qpMap_.GetRowCount();
+}
+
+
+void Encoder::CheckQpDeltaMapEnabled() const
+{
+    if (!desc_.config.enableQpDeltaMap) ThrowError("QP delta maps are not enabled.");
+}
+
+
+void Encoder::UpdateQpMapSize()
+{
+    std::lock_guard<std::mutex> lock(qpMapMutex_);
+    qpMap_.SetFrameSize(GetWidth(), GetHeight(), GetQpMapBlockSize(GetCodec()));
+}
+
+
+void Encoder::SetBitstreamLeaseEnabled(bool enabled)
+{
+    if (nvenc_) nvenc_->SetBitstreamLeaseEnabled(enabled);
+}
+
+
+bool Encoder::ReleaseEncodedData(uint64_t token)
+{
+    try
+    {
+        return nvenc_->ReleaseBitstream(token);
+    }
+    catch (const std::exception& e)
+    {
+        error_ = e.what();
+        ::fprintf(stdout, "ReleaseEncodedData %s", error_.c_str());
+    }
+
+    return false;
+}
+
+
+}
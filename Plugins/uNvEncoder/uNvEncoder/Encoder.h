@@ -1,78 +1,158 @@
-#pragma once
-
-#include <cstdio>
-#include <vector>
-#include <memory>
-#include <thread>
-#include <condition_variable>
-#include <mutex>
-#include <d3d11.h>
-#include "Common.h"
-
-
-namespace uNvEncoder
-{
-
-
-struct NvencEncodedData;
-
-
-struct EncoderDesc
-{
-    int width; 
-    int height;
-    int frameRate;
-    DXGI_FORMAT format;
-};
-
-
-class Encoder final
-{
-public:
-    explicit Encoder(const EncoderDesc &desc);
-    ~Encoder();
-    bool IsValid() const;
-    bool Encode(const ComPtr<ID3D11Texture2D> &source, bool forceIdrFrame);
-    bool Encode(HANDLE sharedHandle, bool forceIdrFrame);
-    void CopyEncodedDataList();
-    const std::vector<NvencEncodedData> & GetEncodedDataList() const;
-    const uint32_t GetWidth() { return desc_.width; }
-    const uint32_t GetHeight() { return desc_.height; }
-    const uint32_t GetFrameRate() const { return desc_.frameRate; }
-    const DXGI_FORMAT GetFormat() const { return desc_.format; }
-    bool HasError() const { return !error_.empty(); }
-    const std::string & GetError() const { return error_; }
-    void ClearError() { error_.clear(); }
-    void Resize(uint32_t width, uint32_t height);
-
-	void SetPrimarySource(const ComPtr<ID3D11Texture2D>& source);
-	bool EncodePrimarySource(bool forceIdrFrame);
-
-private:
-    void CreateDevice();
-    void DestroyDevice();
-    void CreateNvenc();
-    void DestroyNvenc();
-    void StartThread();
-    void StopThread();
-    void WaitForEncodeRequest();
-    void RequestGetEncodedData();
-    void UpdateGetEncodedData();
-
-    EncoderDesc desc_;
-    ComPtr<ID3D11Device> device_;
-    std::unique_ptr<class Nvenc> nvenc_;
-    std::vector<NvencEncodedData> encodedDataList_;
-    std::vector<NvencEncodedData> encodedDataListCopied_;
-    std::thread encodeThread_;
-    std::condition_variable encodeCond_;
-    std::mutex encodeMutex_;
-    std::mutex encodeDataListMutex_;
-    bool shouldStopEncodeThread_ = false;
-    bool isEncodeRequested = false;
-    std::string error_;
-	ComPtr<ID3D11Texture2D> primarySource_;
-};
-
-
-}
+#pragma once
+
+#include <cstdio>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include "Common.h"
+#include "Event.h"
+#include "SpscRing.h"
+#include "BitstreamPool.h"
+#include "GraphicsDevice.h"
+#include "EncodeBackend.h"
+#include "Nvenc.h"
+#include "AbrController.h"
+#include "QpMap.h"
+
+
+namespace uNvEncoder
+{
+
+
+struct EncoderDesc
+{
+    int width; 
+    int height;
+    int frameRate;
+    DXGI_FORMAT format;
+    int asyncDepth;
+    EncoderConfig config;
+};
+
+
+class Encoder final
+{
+public:
+    explicit Encoder(const EncoderDesc &desc);
+    // A rendition of a SimulcastEncoder, which shares the backend and the
+    // device with the other renditions and feeds and drains it instead of a
+    // thread of its own. It reads out like any other encoder, but it cannot
+    // encode, resize or change its frame rate by itself.
+    Encoder(const EncoderDesc &desc, const std::shared_ptr<IEncodeBackend> &backend, const std::shared_ptr<IGraphicsDevice> &device);
+    ~Encoder();
+    bool IsValid() const;
+    bool IsRendition() const { return isRendition_; }
+    bool Encode(void *source, bool forceIdrFrame);
+    bool Encode(void *source, const EncodeOptions &options);
+    bool EncodeSharedHandle(void *sharedHandle, bool forceIdrFrame);
+    // Encodes a frame in system memory, which is copied before it returns.
+    bool EncodeFromMemory(const NvencMemoryFrame &frame, const EncodeOptions &options);
+    void CopyEncodedDataList();
+    void CopyEncodedDataList(size_t maxCount);
+    const std::vector<NvencEncodedData> & GetEncodedDataList() const;
+    void SetBitstreamLeaseEnabled(bool enabled);
+    bool ReleaseEncodedData(uint64_t token);
+    uint32_t GetWidth() const { return desc_.width; }
+    uint32_t GetHeight() const { return desc_.height; }
+    uint32_t GetFrameRate() const { return desc_.frameRate; }
+    uint32_t GetAsyncDepth() const { return desc_.asyncDepth; }
+    DXGI_FORMAT GetFormat() const { return desc_.format; }
+    NvencCodec GetCodec() const { return desc_.config.codec; }
+    const EncoderConfig & GetConfig() const { return desc_.config; }
+    bool HasError() const { return !error_.empty(); }
+    const std::string & GetError() const { return error_; }
+    void ClearError() { error_.clear(); }
+    uint64_t GetEncodedDataOverflowCount() const { return encodedDataOverflowCount_; }
+    uint64_t GetBitstreamAllocationCount() const { return bitstreamPool_.GetAllocationCount(); }
+    uint64_t GetDuplicateFrameCount() const;
+    uint64_t GetSkippedDuplicateFrameCount() const;
+    void Resize(uint32_t width, uint32_t height);
+    bool SetRateControl(uint32_t averageBitRate, uint32_t maxBitRate, uint32_t frameRate, bool forceIdrFrame);
+    // While ABR runs it owns the bitrates and the frame rate, so
+    // SetRateControl fails. Targets are applied by Encode, which skips frames
+    // evenly while the target frame rate is below the session one. Skipped
+    // frames still return true. A null config stops ABR and restores the
+    // frame rate. Feedback can be reported from any thread.
+    bool SetAbrConfig(const AbrConfig *config);
+    void ReportNetworkFeedback(const NetworkFeedback &feedback);
+    uint32_t GetAbrEstimatedBitRate() const;
+    // Starts an intra-refresh wave with the next encoded frame, or forces an
+    // IDR frame when intra refresh is disabled.
+    void RequestIntraRefresh() { isIntraRefreshRequested_ = true; }
+    uint32_t GetLtrSlotCount() const;
+    bool GetLtrFrameIndex(uint32_t slot, uint64_t &frameIndex) const;
+    int FindLtrSlot(uint64_t frameIndex) const;
+    // Returns how many of the frames were invalidated, or -1 on an error.
+    int InvalidateRefFrames(const uint64_t *frameIndices, size_t count);
+    int InvalidateRefFramesByTimestamp(const uint64_t *timestamps, size_t count);
+    // QP delta maps need enableQpDeltaMap in the config. What is set applies
+    // from the next encoded frame on until it is replaced, and can be set
+    // from any thread. Null deltas or a null foveation remove them.
+    bool SetQpDeltaMap(const int8_t *deltas, size_t size);
+    bool SetFoveation(const Foveation *foveation);
+    bool SetQpRegions(const QpRegion *regions, size_t count);
+    void GetQpMapSize(uint32_t &columnCount, uint32_t &rowCount) const;
+
+	void SetPrimarySource(void *source);
+	bool EncodePrimarySource(bool forceIdrFrame);
+
+private:
+    friend class SimulcastEncoder;
+
+    void CreateDevice();
+    void DestroyDevice();
+    void CreateNvenc();
+    void DestroyNvenc();
+    void StartThread();
+    void StopThread();
+    void WaitForEncodedData(Event *interruptEvent);
+    size_t AddCompletionEvents(Event **events, size_t maxCount, std::chrono::milliseconds &timeout);
+    void SetCompleted(const Event *event);
+    void CheckCompletionTimeout();
+    void UpdateGetEncodedData();
+    void AddEncodedData(std::vector<NvencEncodedData> &data);
+    bool IsAbrEnabled() const;
+    void UpdateAbrResolution();
+    void ApplyAbrTarget();
+    bool ShouldSkipFrame(const EncodeOptions &options);
+    bool EncodeFrame(void *source, const NvencMemoryFrame *frame, const EncodeOptions &options);
+    void CheckQpDeltaMapEnabled() const;
+    void UpdateQpMapSize();
+    void * GetNextInputTexture() const;
+    bool TakeIntraRefreshRequest() { return isIntraRefreshRequested_.exchange(false); }
+    bool EncodeRendition(const EncodeOptions &options, bool startIntraRefresh);
+
+    EncoderDesc desc_;
+    std::shared_ptr<IEncodeBackend> backend_;
+    std::shared_ptr<IGraphicsDevice> device_;
+    std::unique_ptr<class Nvenc> nvenc_;
+    BitstreamPool bitstreamPool_;
+    SpscRing<NvencEncodedData> encodedDataQueue_;
+    std::vector<NvencEncodedData> encodedDataListCopied_;
+    // What one pass of the encode thread, or the flush of a resize, takes
+    // from the session. Kept to not allocate per frame.
+    std::vector<NvencEncodedData> encodedData_;
+    std::atomic<uint64_t> encodedDataOverflowCount_ = { 0 };
+    std::atomic<bool> isIntraRefreshRequested_ = { false };
+    std::thread encodeThread_;
+    Event encodeEvent_;
+    std::atomic<bool> shouldStopEncodeThread_ = { false };
+    std::string error_;
+    mutable std::mutex abrMutex_;
+    std::unique_ptr<AbrController> abr_;
+    uint32_t abrSourceFrameRate_ = 0;
+    uint32_t abrFrameRate_ = 0;
+    uint32_t skipCredit_ = 0;
+    // A changed frame that ABR skipped has to make the next one count as
+    // changed, since isUnchanged compares with the previous call.
+    bool isChangeSkipped_ = false;
+    mutable std::mutex qpMapMutex_;
+    QpMap qpMap_;
+	void *primarySource_ = nullptr;
+    bool isRendition_ = false;
+};
+
+
+}
@@ -0,0 +1,158 @@
+#include "EncoderConfig.h"
+
+
+namespace uNvEncoder
+{
+
+
+const char * GetEncoderConfigError(const EncoderConfig &config, uint32_t asyncDepth)
+{
+    const bool isHevc = config.codec == NvencCodec::HEVC;
+    if (config.codec != NvencCodec::H264 && !isHevc) return "Unsupported codec.";
+
+    if (config.preset < NvencPreset::Default || config.preset > NvencPreset::LowLatencyHighPerformance)
+    {
+        return "Unsupported preset.";
+    }
+
+    switch (config.profile)
+    {
+        case NvencProfile::Auto:
+            break;
+        case NvencProfile::H264Baseline:
+        case NvencProfile::H264Main:
+        case NvencProfile::H264High:
+            if (isHevc) return "The profile is not an HEVC profile.";
+            break;
+        case NvencProfile::HevcMain:
+        case NvencProfile::HevcMain10:
+            if (!isHevc) return "The profile is not an H.264 profile.";
+            break;
+        default:
+            return "Unsupported profile.";
+    }
+
+    switch (config.rateControlMode)
+    {
+        case NvencRateControlMode::ConstQp:
+        case NvencRateControlMode::Vbr:
+        case NvencRateControlMode::VbrHq:
+            break;
+        case NvencRateControlMode::Cbr:
+        case NvencRateControlMode::CbrLowDelayHq:
+        case NvencRateControlMode::CbrHq:
+            if (config.averageBitRate == 0) return "CBR needs an average bitrate.";
+            break;
+        default:
+            return "Unsupported rate control mode.";
+    }
+
+    if (config.maxBitRate != 0 && config.maxBitRate < config.averageBitRate)
+    {
+        return "The max bitrate is lower than the average bitrate.";
+    }
+    if (config.targetQuality > 51) return "The target quality must be between 0 and 51.";
+
+    if (config.bFrameCount > 4) return "At most 4 B-frames are supported.";
+    if (config.bFrameCount > 0 && config.profile == NvencProfile::H264Baseline)
+    {
+        return "The H.264 baseline profile does not allow B-frames.";
+    }
+    if (config.gopLength != 0 && config.gopLength <= config.bFrameCount)
+    {
+        return "The GOP length must be longer than the number of B-frames.";
+    }
+
+    if (config.lookaheadDepth > 32) return "The lookahead depth must be 32 or less.";
+    if (config.lookaheadDepth > 0 && config.rateControlMode == NvencRateControlMode::ConstQp)
+    {
+        return "Lookahead does not work with constant QP.";
+    }
+
+    if (asyncDepth == 0 || asyncDepth > maxAsyncDepth) return "The async depth must be between 1 and 16.";
+
+    // The encoder holds back B-frames and lookahead frames until later input
+    // arrives, so the ring has to be able to keep submitting meanwhile.
+    if (config.bFrameCount + config.lookaheadDepth >= asyncDepth)
+    {
+        return "The async depth must be larger than the number of B-frames plus the lookahead depth.";
+    }
+
+    if (config.aqStrength > 15) return "The AQ strength must be between 0 and 15.";
+    if (config.aqStrength > 0 && !config.enableSpatialAq) return "The AQ strength needs spatial AQ.";
+    if (config.enableTemporalAq && isHevc) return "Temporal AQ is only supported for H.264.";
+
+    if (config.sliceMode < NvencSliceMode::Macroblocks || config.sliceMode > NvencSliceMode::Count)
+    {
+        return "Unsupported slice mode.";
+    }
+    if (config.sliceMode != NvencSliceMode::Macroblocks && config.sliceModeData == 0)
+    {
+        return "The slice mode needs slice mode data.";
+    }
+    if (config.enableSubFrameReadback && (config.bFrameCount > 0 || config.lookaheadDepth > 0))
+    {
+        return "Sub-frame readback does not work with B-frames or lookahead.";
+    }
+
+    if (config.enableIntraRefresh)
+    {
+        if (config.bFrameCount > 0) return "Intra refresh does not work with B-frames.";
+        if (config.intraRefreshPeriod == 1) return "The intra-refresh period must be at least 2 frames.";
+        if (config.intraRefreshPeriod != 0 && config.intraRefreshCount >= config.intraRefreshPeriod)
+        {
+            return "The intra-refresh count must be smaller than the period.";
+        }
+    }
+
+    if (config.enableLtr)
+    {
+        if (config.bFrameCount > 0) return "LTR does not work with B-frames.";
+        if (config.ltrFrameCount > maxLtrSlotCount) return "At most 32 LTR frames are supported.";
+    }
+
+    switch (config.inputConversion)
+    {
+        case NvencInputConversion::None:
+        case NvencInputConversion::Nv12:
+            break;
+        case NvencInputConversion::Yuv444:
+            if (config.profile != NvencProfile::Auto) return "YUV 4:4:4 input needs the auto profile.";
+            break;
+        default:
+            return "Unsupported input conversion.";
+    }
+    if (config.colorMatrix != NvencColorMatrix::Bt601 && config.colorMatrix != NvencColorMatrix::Bt709)
+    {
+        return "Unsupported color matrix.";
+    }
+    if (config.colorRange != NvencColorRange::Limited && config.colorRange != NvencColorRange::Full)
+    {
+        return "Unsupported color range.";
+    }
+
+    return nullptr;
+}
+
+
+GUID GetCodecGuid(NvencCodec codec)
+{
+    return codec == NvencCodec::HEVC ? NV_ENC_CODEC_HEVC_GUID : NV_ENC_CODEC_H264_GUID;
+}
+
+
+GUID GetPresetGuid(NvencPreset preset)
+{
+    switch (preset)
+    {
+        case NvencPreset::HighPerformance: return NV_ENC_PRESET_HP_GUID;
+        case NvencPreset::HighQuality: return NV_ENC_PRESET_HQ_GUID;
+        case NvencPreset::LowLatencyDefault: return NV_ENC_PRESET_LOW_LATENCY_DEFAULT_GUID;
+        case NvencPreset::LowLatencyHighQuality: return NV_ENC_PRESET_LOW_LATENCY_HQ_GUID;
+        case NvencPreset::LowLatencyHighPerformance: return NV_ENC_PRESET_LOW_LATENCY_HP_GUID;
+        default: return NV_ENC_PRESET_DEFAULT_GUID;
+    }
+}
+
+
+}
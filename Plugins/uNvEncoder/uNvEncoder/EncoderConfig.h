@@ -0,0 +1,198 @@
+#pragma once
+
+#include <cstdint>
+#include "nvEncodeAPI.h"
+
+
+namespace uNvEncoder
+{
+
+
+// LTR slots are addressed by a 32-bit mask.
+constexpr uint32_t maxLtrSlotCount = 32;
+constexpr uint32_t maxAsyncDepth = 16;
+
+
+enum class NvencCodec : int32_t
+{
+    H264 = 0,
+    HEVC = 1,
+};
+
+
+enum class NvencPreset : int32_t
+{
+    Default = 0,
+    HighPerformance = 1,
+    HighQuality = 2,
+    LowLatencyDefault = 3,
+    LowLatencyHighQuality = 4,
+    LowLatencyHighPerformance = 5,
+};
+
+
+enum class NvencProfile : int32_t
+{
+    Auto = 0,
+    H264Baseline = 1,
+    H264Main = 2,
+    H264High = 3,
+    HevcMain = 4,
+    HevcMain10 = 5,
+};
+
+
+// How a frame is split into slices, with sliceModeData as the number of
+// macroblocks, bytes or macroblock rows per slice, or as the slice count.
+// Macroblocks with zero data is one slice per frame.
+enum class NvencSliceMode : int32_t
+{
+    Macroblocks = 0,
+    Bytes = 1,
+    MacroblockRows = 2,
+    Count = 3,
+};
+
+
+enum class NvencRateControlMode : int32_t
+{
+    ConstQp = 0,
+    Vbr = 1,
+    Cbr = 2,
+    CbrLowDelayHq = 3,
+    CbrHq = 4,
+    VbrHq = 5,
+};
+
+
+// What frames encoded from memory are converted to before NVENC gets them.
+// Only 8-bit RGBA and BGRA frames are converted, others are passed as is.
+enum class NvencInputConversion : int32_t
+{
+    None = 0,
+    Nv12 = 1,
+    Yuv444 = 2,
+};
+
+
+enum class NvencColorMatrix : int32_t
+{
+    Bt601 = 0,
+    Bt709 = 1,
+};
+
+
+enum class NvencColorRange : int32_t
+{
+    Limited = 0,
+    Full = 1,
+};
+
+
+// Blittable encoder settings shared with C#. Bitrates are in bits per second
+// and the VBV size in bits; zero leaves them to the preset, except that VBR
+// without a maximum bitrate gets one scaled from 12 Mbps at 1080p. A zero GOP
+// length means two seconds. targetQuality is the VBR target, or the QP of
+// every frame in ConstQp mode. Input surfaces are allocated at maxWidth x
+// maxHeight, or at the initial size when they are zero, and resizing within
+// them only reconfigures the session.
+//
+// With intra refresh the stream has no periodic IDR frames unless a GOP
+// length is given. Instead a wave of intra-coded regions sweeps the picture
+// over intraRefreshCount frames every intraRefreshPeriod frames, and recovery
+// requests start a wave rather than forcing an IDR frame. A zero period means
+// two seconds and a zero count half a second, at most one frame less than
+// the period.
+//
+// With sub-frame readback every slice is handed out as soon as the encoder
+// has written it, so a frame arrives as several chunks. This runs the session
+// in synchronous mode, which NVENC needs to report slice offsets, and never
+// leases bitstreams.
+//
+// With LTR the encoder keeps up to ltrFrameCount long-term reference frames,
+// zero meaning as many as the GPU supports. In the default per-picture mode
+// frames are marked and referenced through EncodeOptions, and the plugin
+// remembers which frame index each slot holds. In trust mode NVENC marks the
+// first frames after every IDR frame by itself and EncodeOptions cannot
+// mark or reference them.
+//
+// With a QP delta map every frame can shift the QP that rate control picks,
+// per macroblock for H.264 and per 32x32 CTU for HEVC. The map is built from
+// a list of deltas, a foveation around a gaze point or rectangles, see
+// QpMap.h.
+//
+// With input conversion, RGBA and BGRA frames encoded from memory are turned
+// into NV12 or YUV 4:4:4 on the CPU with colorMatrix and colorRange, which
+// the stream also signals, rather than by NVENC. This shrinks what is
+// uploaded by half for NV12, and 4:4:4 keeps the chroma of text sharp, see
+// ColorConversion.h. RGB textures are still converted by NVENC, whose matrix
+// may not be the signalled one.
+//
+// With static-frame skip, frames that equal the last submitted one are not
+// copied or encoded at all. Textures are compared by EncodeOptions::isUnchanged
+// and memory frames by hash unless that flag is set. Every staticFrameKeepAlive-th unchanged frame
+// in a row is still encoded, which costs a nearly empty P-frame and keeps
+// receivers and rate control going. Zero means once a second. Frames that
+// carry a request or are due to be IDR frames are never skipped.
+struct EncoderConfig
+{
+    NvencCodec codec = NvencCodec::H264;
+    NvencPreset preset = NvencPreset::LowLatencyDefault;
+    NvencProfile profile = NvencProfile::Auto;
+    NvencRateControlMode rateControlMode = NvencRateControlMode::Vbr;
+    uint32_t averageBitRate = 0;
+    uint32_t maxBitRate = 0;
+    uint32_t vbvBufferSize = 0;
+    uint32_t gopLength = 0;
+    uint32_t bFrameCount = 0;
+    uint32_t lookaheadDepth = 0;
+    uint32_t targetQuality = 18;
+    int32_t enableSpatialAq = 0;
+    int32_t enableTemporalAq = 0;
+    uint32_t aqStrength = 0;
+    uint32_t maxWidth = 0;
+    uint32_t maxHeight = 0;
+    int32_t enableIntraRefresh = 0;
+    uint32_t intraRefreshPeriod = 0;
+    uint32_t intraRefreshCount = 0;
+    NvencSliceMode sliceMode = NvencSliceMode::Macroblocks;
+    uint32_t sliceModeData = 0;
+    int32_t enableSubFrameReadback = 0;
+    int32_t enableLtr = 0;
+    uint32_t ltrFrameCount = 0;
+    int32_t ltrTrustMode = 0;
+    int32_t enableQpDeltaMap = 0;
+    NvencInputConversion inputConversion = NvencInputConversion::None;
+    NvencColorMatrix colorMatrix = NvencColorMatrix::Bt709;
+    NvencColorRange colorRange = NvencColorRange::Limited;
+    int32_t enableStaticFrameSkip = 0;
+    uint32_t staticFrameKeepAlive = 0;
+};
+
+
+// Blittable per-frame options shared with C#. markLtrFrame stores the frame in
+// LTR slot ltrMarkSlot, replacing what the slot held. useLtrFrames predicts the
+// frame only from the slots set in ltrUseSlotMask, and later frames never
+// reference anything older, which recovers a receiver that lost frames after
+// the ones in those slots. isUnchanged tells a session with static-frame skip
+// that the frame equals the one of the previous call.
+struct EncodeOptions
+{
+    int32_t forceIdrFrame = 0;
+    int32_t markLtrFrame = 0;
+    uint32_t ltrMarkSlot = 0;
+    int32_t useLtrFrames = 0;
+    uint32_t ltrUseSlotMask = 0;
+    int32_t isUnchanged = 0;
+};
+
+
+// Returns why the config cannot be used with the given async depth, or
+// nullptr if it is valid.
+const char * GetEncoderConfigError(const EncoderConfig &config, uint32_t asyncDepth);
+
+GUID GetCodecGuid(NvencCodec codec);
+GUID GetPresetGuid(NvencPreset preset);
+
+
+}
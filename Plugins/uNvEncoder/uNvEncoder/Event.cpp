@@ -0,0 +1,127 @@
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <condition_variable>
+#include <mutex>
+#endif
+#include "Event.h"
+#include "Common.h"
+
+
+namespace uNvEncoder
+{
+
+
+#ifdef _WIN32
+
+
+Event::Event()
+    : handle_(::CreateEventA(NULL, FALSE, FALSE, NULL))
+{
+    if (!handle_) ThrowError("Failed to create an event.");
+}
+
+
+Event::~Event()
+{
+    ::CloseHandle(handle_);
+}
+
+
+void Event::Set(void *nativeHandle)
+{
+    ::SetEvent(nativeHandle);
+}
+
+
+int Event::WaitAny(Event *const *events, size_t count, std::chrono::milliseconds timeout)
+{
+    static_assert(maxWaitCount == MAXIMUM_WAIT_OBJECTS, "maxWaitCount must match WaitForMultipleObjects.");
+    HANDLE handles[maxWaitCount];
+    if (count > maxWaitCount) ThrowError("Too many events to wait for.");
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        handles[i] = events[i]->handle_;
+    }
+
+    const auto duration = static_cast<DWORD>(timeout.count());
+    const auto result = ::WaitForMultipleObjects(static_cast<DWORD>(count), handles, FALSE, duration);
+    if (result == WAIT_TIMEOUT) return waitTimeout;
+    if (result >= WAIT_OBJECT_0 + count) ThrowError("Failed to wait for events.");
+
+    return static_cast<int>(result - WAIT_OBJECT_0);
+}
+
+
+#else
+
+
+namespace
+{
+    std::mutex g_eventMutex;
+    std::condition_variable g_eventCond;
+}
+
+
+Event::Event()
+    : handle_(this)
+{
+}
+
+
+Event::~Event()
+{
+}
+
+
+void Event::Set(void *nativeHandle)
+{
+    {
+        std::lock_guard<std::mutex> lock(g_eventMutex);
+        static_cast<Event*>(nativeHandle)->isSet_ = true;
+    }
+    g_eventCond.notify_all();
+}
+
+
+int Event::WaitAny(Event *const *events, size_t count, std::chrono::milliseconds timeout)
+{
+    if (count > maxWaitCount) ThrowError("Too many events to wait for.");
+
+    int index = waitTimeout;
+
+    std::unique_lock<std::mutex> lock(g_eventMutex);
+    g_eventCond.wait_for(lock, timeout, [&]
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (!events[i]->isSet_) continue;
+            events[i]->isSet_ = false;
+            index = static_cast<int>(i);
+            return true;
+        }
+        return false;
+    });
+
+    return index;
+}
+
+
+#endif
+
+
+void Event::Set()
+{
+    Set(handle_);
+}
+
+
+bool Event::Wait(std::chrono::milliseconds timeout)
+{
+    Event *event = this;
+    return WaitAny(&event, 1, timeout) != waitTimeout;
+}
+
+
+}
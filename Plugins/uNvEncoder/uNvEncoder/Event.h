@@ -0,0 +1,39 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+
+namespace uNvEncoder
+{
+
+
+// Auto-reset event used for NVENC completion notification. On Windows this is
+// a Win32 event whose handle is given to NVENC, elsewhere it is emulated with
+// a condition variable so that completions can be signaled by a fake driver.
+class Event final
+{
+public:
+    Event();
+    ~Event();
+    Event(const Event &) = delete;
+    Event & operator=(const Event &) = delete;
+    void Set();
+    bool Wait(std::chrono::milliseconds timeout);
+    void * GetNativeHandle() const { return handle_; }
+
+    static void Set(void *nativeHandle);
+    static int WaitAny(Event *const *events, size_t count, std::chrono::milliseconds timeout);
+    static constexpr int waitTimeout = -1;
+    // What WaitForMultipleObjects takes, enforced on every platform.
+    static constexpr size_t maxWaitCount = 64;
+
+private:
+    void *handle_ = nullptr;
+#ifndef _WIN32
+    bool isSet_ = false;
+#endif
+};
+
+
+}
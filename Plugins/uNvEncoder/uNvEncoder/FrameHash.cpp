@@ -0,0 +1,208 @@
+#include <cstring>
+#include "FrameHash.h"
+#include "Common.h"
+
+#ifdef UNVENC_SIMD
+#include <emmintrin.h>
+#endif
+
+
+namespace uNvEncoder
+{
+
+
+namespace
+{
+
+
+constexpr size_t laneCount = 8;
+constexpr size_t stripeSize = laneCount * sizeof(uint64_t);
+
+constexpr uint64_t prime32_1 = 0x9E3779B1ULL;
+constexpr uint64_t prime32_2 = 0x85EBCA77ULL;
+constexpr uint64_t prime32_3 = 0xC2B2AE3DULL;
+constexpr uint64_t prime64_1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t prime64_2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t prime64_3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t prime64_4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t prime64_5 = 0x27D4EB2F165667C5ULL;
+
+alignas(16) constexpr uint64_t key[laneCount] =
+{
+    0xBE4BA423396CFEB8ULL, 0x1CAD21F72C81017CULL, 0xDB979083E96DD4DEULL, 0x1F67B3B7A4A44072ULL,
+    0x78E5C0CC4EE679CBULL, 0x2172FFCC7DD05A82ULL, 0x8E2443F7744608B8ULL, 0x4C263A81E69035E0ULL,
+};
+
+alignas(16) constexpr uint64_t initialLanes[laneCount] =
+{
+    prime32_3, prime64_1, prime64_2, prime64_3, prime64_4, prime32_2, prime64_5, prime32_1,
+};
+
+
+uint64_t Rotate(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+
+uint64_t Avalanche(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= prime64_2;
+    hash ^= hash >> 29;
+    hash *= prime64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+
+uint64_t Merge(const uint64_t (&lanes)[laneCount], size_t rowSize, uint32_t rowCount, uint64_t seed)
+{
+    auto hash = seed ^ (rowSize * prime64_1) ^ (static_cast<uint64_t>(rowCount) * prime64_2);
+    for (const auto lane : lanes)
+    {
+        hash ^= Avalanche(lane);
+        hash = Rotate(hash, 27) * prime64_1 + prime64_4;
+    }
+    return Avalanche(hash);
+}
+
+
+// The part of a row after its last full stripe is hashed as a stripe padded
+// with zeros. The length of the row goes into the merge, so the padding does
+// not collide with real zeros.
+void LoadTail(const uint8_t *row, size_t rowSize, uint8_t (&stripe)[stripeSize])
+{
+    const auto tailSize = rowSize % stripeSize;
+    ::memset(stripe, 0, stripeSize);
+    ::memcpy(stripe, row + rowSize - tailSize, tailSize);
+}
+
+
+void AccumulateReference(uint64_t (&lanes)[laneCount], const uint8_t *stripe)
+{
+    for (size_t i = 0; i < laneCount; ++i)
+    {
+        uint64_t data;
+        ::memcpy(&data, stripe + i * sizeof(uint64_t), sizeof(data));
+        const auto dataKey = data ^ key[i];
+        lanes[i ^ 1] += data;
+        lanes[i] += (dataKey & 0xFFFFFFFFULL) * (dataKey >> 32);
+    }
+}
+
+
+void ScrambleReference(uint64_t (&lanes)[laneCount])
+{
+    for (size_t i = 0; i < laneCount; ++i)
+    {
+        lanes[i] = (lanes[i] ^ (lanes[i] >> 47) ^ key[i]) * prime32_1;
+    }
+}
+
+
+#ifdef UNVENC_SIMD
+
+// Each vector holds two lanes. mul_epu32 multiplies the low halves of the
+// lanes, so the high halves are shuffled down to get one 32x32 product per
+// lane, and swapping the lanes of the data adds each word to its neighbour.
+void AccumulateSse2(__m128i (&lanes)[4], const uint8_t *stripe)
+{
+    const auto keys = reinterpret_cast<const __m128i*>(key);
+    for (int i = 0; i < 4; ++i)
+    {
+        const auto data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(stripe) + i);
+        const auto dataKey = _mm_xor_si128(data, _mm_load_si128(keys + i));
+        const auto product = _mm_mul_epu32(dataKey, _mm_shuffle_epi32(dataKey, _MM_SHUFFLE(0, 3, 0, 1)));
+        const auto swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+        lanes[i] = _mm_add_epi64(lanes[i], _mm_add_epi64(product, swapped));
+    }
+}
+
+
+// A 64x32-bit multiply is the sum of the products of both halves.
+void ScrambleSse2(__m128i (&lanes)[4])
+{
+    const auto keys = reinterpret_cast<const __m128i*>(key);
+    const auto prime = _mm_set1_epi32(static_cast<int>(prime32_1));
+    for (int i = 0; i < 4; ++i)
+    {
+        auto lane = _mm_xor_si128(lanes[i], _mm_srli_epi64(lanes[i], 47));
+        lane = _mm_xor_si128(lane, _mm_load_si128(keys + i));
+        const auto low = _mm_mul_epu32(lane, prime);
+        const auto high = _mm_mul_epu32(_mm_shuffle_epi32(lane, _MM_SHUFFLE(0, 3, 0, 1)), prime);
+        lanes[i] = _mm_add_epi64(low, _mm_slli_epi64(high, 32));
+    }
+}
+
+#endif
+
+
+}
+
+
+uint64_t HashRows(const void *data, size_t pitch, size_t rowSize, uint32_t rowCount, uint64_t seed)
+{
+#ifdef UNVENC_SIMD
+    __m128i lanes[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        lanes[i] = _mm_load_si128(reinterpret_cast<const __m128i*>(initialLanes) + i);
+    }
+
+    const auto *row = static_cast<const uint8_t*>(data);
+    const auto fullSize = rowSize - rowSize % stripeSize;
+    for (uint32_t y = 0; y < rowCount; ++y, row += pitch)
+    {
+        for (size_t x = 0; x < fullSize; x += stripeSize)
+        {
+            AccumulateSse2(lanes, row + x);
+        }
+        if (fullSize != rowSize)
+        {
+            uint8_t tail[stripeSize];
+            LoadTail(row, rowSize, tail);
+            AccumulateSse2(lanes, tail);
+        }
+        ScrambleSse2(lanes);
+    }
+
+    alignas(16) uint64_t result[laneCount];
+    for (int i = 0; i < 4; ++i)
+    {
+        _mm_store_si128(reinterpret_cast<__m128i*>(result) + i, lanes[i]);
+    }
+    return Merge(result, rowSize, rowCount, seed);
+#else
+    return HashRowsReference(data, pitch, rowSize, rowCount, seed);
+#endif
+}
+
+
+uint64_t HashRowsReference(const void *data, size_t pitch, size_t rowSize, uint32_t rowCount, uint64_t seed)
+{
+    uint64_t lanes[laneCount];
+    ::memcpy(lanes, initialLanes, sizeof(lanes));
+
+    const auto *row = static_cast<const uint8_t*>(data);
+    const auto fullSize = rowSize - rowSize % stripeSize;
+    for (uint32_t y = 0; y < rowCount; ++y, row += pitch)
+    {
+        for (size_t x = 0; x < fullSize; x += stripeSize)
+        {
+            AccumulateReference(lanes, row + x);
+        }
+        if (fullSize != rowSize)
+        {
+            uint8_t tail[stripeSize];
+            LoadTail(row, rowSize, tail);
+            AccumulateReference(lanes, tail);
+        }
+        ScrambleReference(lanes);
+    }
+
+    return Merge(lanes, rowSize, rowCount, seed);
+}
+
+
+}
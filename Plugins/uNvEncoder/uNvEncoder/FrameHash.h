@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace uNvEncoder
+{
+
+
+// 64-bit hash of rowCount rows of rowSize bytes, which tells whether a frame
+// equals an earlier one. Bytes between rows are not read. Each row feeds
+// eight 64-bit lanes in 64-byte stripes like the accumulate loop of XXH3,
+// with the first 64 bytes of its default secret as a fixed key, and then
+// scrambles them, so rows that move change the hash as well. The output is
+// not the one of xxHash. The SSE2 version gives the same hashes as the
+// reference.
+uint64_t HashRows(const void *data, size_t pitch, size_t rowSize, uint32_t rowCount, uint64_t seed);
+uint64_t HashRowsReference(const void *data, size_t pitch, size_t rowSize, uint32_t rowCount, uint64_t seed);
+
+
+}
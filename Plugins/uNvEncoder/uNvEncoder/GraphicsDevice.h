@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include "DxgiFormat.h"
+
+
+namespace uNvEncoder
+{
+
+
+// Model of an adapter as DXGI_ADAPTER_DESC reports it. Unlike the adapter id,
+// a LUID that changes with every boot, it is the same in every process.
+struct AdapterIdentity
+{
+    uint32_t vendorId = 0;
+    uint32_t deviceId = 0;
+    uint32_t subSysId = 0;
+    uint32_t revision = 0;
+};
+
+
+// Graphics API operations used by Nvenc. Input textures are created on the
+// encode device and opened once on the Unity device, whose immediate context
+// copies the source texture into them. Textures, handles and contexts are
+// opaque pointers owned by the implementation until they are released.
+// Encoder caps are kept in memory per adapter id and driver version, and on
+// disk per adapter identity and driver version, which outlive the process.
+// CopyTexture copies the top-left width x height region, since input
+// textures can be larger than the frame, and ScaleTexture stretches such a
+// region of the source over one of the destination in the same format.
+// Neither submits its work; the encode device only sees it after Flush.
+class IGraphicsDevice
+{
+public:
+    virtual ~IGraphicsDevice() = default;
+    virtual void * GetEncodeDevice() = 0;
+    virtual uint64_t GetAdapterId() const = 0;
+    virtual AdapterIdentity GetAdapterIdentity() const = 0;
+    virtual uint64_t GetDriverVersion() const = 0;
+    virtual void * CreateSharedTexture(uint32_t width, uint32_t height, DXGI_FORMAT format, void **sharedHandle) = 0;
+    virtual void * OpenSharedTexture(void *sharedHandle) = 0;
+    virtual void RetainTexture(void *texture) = 0;
+    virtual void ReleaseTexture(void *texture) = 0;
+    virtual void * GetImmediateContext() = 0;
+    virtual void ReleaseContext(void *context) = 0;
+    virtual void CopyTexture(void *context, void *destination, void *source, uint32_t width, uint32_t height) = 0;
+    virtual void ScaleTexture(
+        void *context,
+        void *destination, uint32_t destinationWidth, uint32_t destinationHeight,
+        void *source, uint32_t sourceWidth, uint32_t sourceHeight) = 0;
+    virtual void Flush(void *context) = 0;
+};
+
+
+}
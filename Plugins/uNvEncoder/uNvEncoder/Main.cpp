@@ -1,232 +1,731 @@
-#include <memory>
-#include <map>
-#include <d3d11.h>
-#include <IUnityInterface.h>
-#include <IUnityRenderingExtensions.h>
-#include "Encoder.h"
-#include "Nvenc.h"
-
-#pragma comment(lib, "d3d11.lib")
-#pragma comment(lib, "dxgi.lib")
-
-
-using namespace uNvEncoder;
-using EncoderId = int;
-
-
-namespace uNvEncoder
-{
-    IUnityInterfaces *g_unity = nullptr;
-}
-
-
-namespace
-{
-    std::map<EncoderId, std::unique_ptr<Encoder>> g_encoders;
-    EncoderId g_encoderId = 0;
-}
-
-
-extern "C"
-{
-
-
-UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API UnityPluginLoad(IUnityInterfaces* unityInterfaces)
-{
-    g_unity = unityInterfaces;
-
-#if _DEBUG
-    FILE* pConsole;
-    AllocConsole();
-    freopen_s(&pConsole, "CONOUT$", "wb", stdout);
-#endif
-}
-
-
-UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API UnityPluginUnload()
-{
-    g_unity = nullptr;
-}
-
-
-const std::unique_ptr<Encoder> & GetEncoder(EncoderId id)
-{
-    static std::unique_ptr<Encoder> invalid;
-    const auto it = g_encoders.find(id);
-    return (it != g_encoders.end()) ? it->second : invalid;
-}
-
-
-UNITY_INTERFACE_EXPORT EncoderId UNITY_INTERFACE_API uNvEncoderCreateEncoder(int width, int height, DXGI_FORMAT format, int frameRate)
-{
-    const auto id = g_encoderId++;
-
-    EncoderDesc desc;
-    desc.width = width;
-    desc.height = height;
-    desc.format = format;
-    desc.frameRate = frameRate;
-
-    auto encoder = std::make_unique<Encoder>(desc);
-    g_encoders.emplace(id, std::move(encoder));
-
-    return id;
-}
-
-
-UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderDestroyEncoder(EncoderId id)
-{
-    g_encoders.erase(id);
-}
-
-
-UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderIsValid(EncoderId id)
-{
-    const auto &encoder = GetEncoder(id);
-    return encoder ? encoder->IsValid() : false;
-}
-
-
-UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderGetWidth(EncoderId id)
-{
-    const auto &encoder = GetEncoder(id);
-    
-    int width = encoder ? static_cast<int>(encoder->GetWidth()) : 0;
-    return width;
-}
-
-
-UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderGetHeight(EncoderId id)
-{
-    const auto &encoder = GetEncoder(id);
-    return encoder ? static_cast<int>(encoder->GetHeight()) : 0;
-}
-
-
-UNITY_INTERFACE_EXPORT DXGI_FORMAT UNITY_INTERFACE_API uNvEncoderGetFormat(EncoderId id)
-{
-    const auto &encoder = GetEncoder(id);
-    return encoder ? encoder->GetFormat() : DXGI_FORMAT_UNKNOWN;
-}
-
-
-UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderGetFrameRate(EncoderId id)
-{
-    const auto &encoder = GetEncoder(id);
-    return encoder ? static_cast<int>(encoder->GetFrameRate()) : 0;
-}
-
-
-UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderEncode(EncoderId id, ID3D11Texture2D *texture, bool forceIdrFrame)
-{
-    if (const auto &encoder = GetEncoder(id))
-    {
-        return encoder->Encode(ComPtr<ID3D11Texture2D>(texture), forceIdrFrame);
-    }
-    return false;
-}
-
-UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderResize(EncoderId id, uint32_t width, uint32_t height)
-{
-    ::fprintf(stdout, "Resize %d, %d\n", width, height);
-    if (const auto& encoder = GetEncoder(id))
-    {
-        return encoder->Resize(width, height);
-    }
-}
-
-
-
-UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderEncodeSharedHandle(EncoderId id, HANDLE handle, bool forceIdrFrame)
-{
-    if (const auto &encoder = GetEncoder(id))
-    {
-        return encoder->Encode(handle, forceIdrFrame);
-    }
-    return false;
-}
-
-
-UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderCopyEncodedData(EncoderId id)
-{
-    if (const auto &encoder = GetEncoder(id))
-    {
-        encoder->CopyEncodedDataList();
-    }
-}
-
-
-UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderGetEncodedDataCount(EncoderId id)
-{
-    const auto &encoder = GetEncoder(id);
-    return encoder ? static_cast<int>(encoder->GetEncodedDataList().size()) : 0;
-}
-
-
-UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderGetEncodedDataSize(EncoderId id, int index)
-{
-    const auto &encoder = GetEncoder(id);
-    if (!encoder) return 0;
-
-    const auto &list = encoder->GetEncodedDataList();
-    if (index < 0 || index >= static_cast<int>(list.size())) return 0;
-
-    return static_cast<int>(list.at(index).size);
-}
-
-
-UNITY_INTERFACE_EXPORT const void * UNITY_INTERFACE_API uNvEncoderGetEncodedDataBuffer(EncoderId id, int index)
-{
-    const auto &encoder = GetEncoder(id);
-    if (!encoder) return nullptr;
-
-    const auto &list = encoder->GetEncodedDataList();
-    if (index < 0 || index >= static_cast<int>(list.size())) return nullptr;
-
-    return list.at(index).buffer.get();
-}
-
-
-UNITY_INTERFACE_EXPORT const char * UNITY_INTERFACE_API uNvEncoderGetError(EncoderId id)
-{
-    const auto &encoder = GetEncoder(id);
-    return encoder ? encoder->GetError().c_str() : nullptr;
-}
-
-
-UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderHasError(EncoderId id)
-{
-    const auto &encoder = GetEncoder(id);
-    return encoder ? encoder->HasError() : false;
-}
-
-
-UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderClearError(EncoderId id)
-{
-    if (const auto &encoder = GetEncoder(id))
-    {
-        encoder->ClearError();
-    }
-}
-
-UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderSetPrimarySource(EncoderId id, ID3D11Texture2D* texture)
-{
-	if (const auto& encoder = GetEncoder(id))
-	{
-		encoder->SetPrimarySource(ComPtr<ID3D11Texture2D>(texture));
-	}
-}
-
-void UNITY_INTERFACE_API uNvEncoderEncodePrimarySource(int id)
-{
-	if (const auto& encoder = GetEncoder(id))
-	{
-		encoder->EncodePrimarySource(false);
-	}
-}
-
-UNITY_INTERFACE_EXPORT UnityRenderingEvent  UNITY_INTERFACE_API uNvEncoderGetEncodePrimarySourceEvent()
-{
-	return uNvEncoderEncodePrimarySource;
-}
+#include <memory>
+#include <algorithm>
+#include <map>
+#include <IUnityInterface.h>
+#include <IUnityRenderingExtensions.h>
+#include "Encoder.h"
+#include "Nvenc.h"
+#include "SimulcastEncoder.h"
+
+#ifdef _WIN32
+#pragma comment(lib, "d3d11.lib")
+#pragma comment(lib, "dxgi.lib")
+#endif
+
+
+using namespace uNvEncoder;
+using EncoderId = int;
+
+struct ID3D11Texture2D;
+
+
+// With sub-frame readback a frame comes as several entries with the same
+// frameIndex, and offset is where the entry starts within the frame. Leased
+// frames are released with frameIndex, whatever the lease mode is by then.
+struct EncodedFrame
+{
+    const void *buffer;
+    int32_t size;
+    int32_t pictureType;
+    uint64_t frameIndex;
+    uint64_t timestamp;
+    int32_t codec;
+    uint32_t offset;
+    int32_t isFrameEnd;
+    int32_t isLeased;
+};
+
+
+namespace uNvEncoder
+{
+    IUnityInterfaces *g_unity = nullptr;
+}
+
+
+namespace
+{
+    // The renditions of a simulcast are registered as encoders too, with ids
+    // from the same counter, so that they read out like any other encoder.
+    struct Simulcast
+    {
+        std::unique_ptr<SimulcastEncoder> encoder;
+        std::vector<EncoderId> renditionIds;
+    };
+
+    std::map<EncoderId, std::shared_ptr<Encoder>> g_encoders;
+    std::map<EncoderId, Simulcast> g_simulcasts;
+    EncoderId g_encoderId = 0;
+}
+
+
+extern "C"
+{
+
+
+UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API UnityPluginLoad(IUnityInterfaces* unityInterfaces)
+{
+    g_unity = unityInterfaces;
+
+#if defined(_WIN32) && _DEBUG
+    FILE* pConsole;
+    AllocConsole();
+    freopen_s(&pConsole, "CONOUT$", "wb", stdout);
+#endif
+}
+
+
+UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API UnityPluginUnload()
+{
+    g_unity = nullptr;
+}
+
+
+const std::shared_ptr<Encoder> & GetEncoder(EncoderId id)
+{
+    static std::shared_ptr<Encoder> invalid;
+    const auto it = g_encoders.find(id);
+    return (it != g_encoders.end()) ? it->second : invalid;
+}
+
+
+EncoderId CreateEncoder(const EncoderDesc &desc)
+{
+    const auto id = g_encoderId++;
+
+    auto encoder = std::make_shared<Encoder>(desc);
+    g_encoders.emplace(id, std::move(encoder));
+
+    return id;
+}
+
+
+UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderGetDefaultEncoderConfig(EncoderConfig *config)
+{
+    if (config) *config = EncoderConfig();
+}
+
+
+UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderGetDefaultAbrConfig(AbrConfig *config)
+{
+    if (config) *config = AbrConfig();
+}
+
+
+UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderGetDefaultFoveation(Foveation *foveation)
+{
+    if (foveation) *foveation = Foveation();
+}
+
+
+UNITY_INTERFACE_EXPORT const char * UNITY_INTERFACE_API uNvEncoderGetEncoderConfigError(const EncoderConfig *config, int asyncDepth)
+{
+    if (!config) return "Config is not given.";
+    return GetEncoderConfigError(*config, static_cast<uint32_t>(std::max(asyncDepth, 0)));
+}
+
+
+UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderGetEncoderCaps(NvencCodec codec, EncoderCaps *caps)
+{
+    if (!caps) return false;
+
+    try
+    {
+        const auto backend = GetEncodeBackend();
+        const auto device = backend->CreateGraphicsDevice();
+        *caps = GetEncoderCaps(*backend, *device, codec);
+        return true;
+    }
+    catch (const std::exception &e)
+    {
+        ::fprintf(stdout, "GetEncoderCaps %s", e.what());
+    }
+
+    *caps = EncoderCaps();
+    return false;
+}
+
+
+UNITY_INTERFACE_EXPORT const char * UNITY_INTERFACE_API uNvEncoderGetEncoderCapsError(const EncoderCaps *caps, const EncoderConfig *config, int width, int height)
+{
+    if (!caps || !config) return "Caps or config is not given.";
+    return GetEncoderCapsError(*caps, *config, static_cast<uint32_t>(std::max(width, 0)), static_cast<uint32_t>(std::max(height, 0)));
+}
+
+
+UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderSetEncoderCapsCachePath(const char *path)
+{
+    SetEncoderCapsCachePath(path ? path : "");
+}
+
+
+UNITY_INTERFACE_EXPORT EncoderId UNITY_INTERFACE_API uNvEncoderCreateEncoderEx(int width, int height, DXGI_FORMAT format, int frameRate, int asyncDepth, const EncoderConfig *config)
+{
+    EncoderDesc desc;
+    desc.width = width;
+    desc.height = height;
+    desc.format = format;
+    desc.frameRate = frameRate;
+    desc.asyncDepth = asyncDepth;
+    if (config) desc.config = *config;
+
+    return CreateEncoder(desc);
+}
+
+
+UNITY_INTERFACE_EXPORT EncoderId UNITY_INTERFACE_API uNvEncoderCreateEncoderWithCodec(int width, int height, DXGI_FORMAT format, int frameRate, int asyncDepth, NvencCodec codec)
+{
+    EncoderConfig config;
+    config.codec = codec;
+    return uNvEncoderCreateEncoderEx(width, height, format, frameRate, asyncDepth, &config);
+}
+
+
+UNITY_INTERFACE_EXPORT EncoderId UNITY_INTERFACE_API uNvEncoderCreateEncoderWithAsyncDepth(int width, int height, DXGI_FORMAT format, int frameRate, int asyncDepth)
+{
+    return uNvEncoderCreateEncoderWithCodec(width, height, format, frameRate, asyncDepth, NvencCodec::H264);
+}
+
+
+UNITY_INTERFACE_EXPORT EncoderId UNITY_INTERFACE_API uNvEncoderCreateEncoder(int width, int height, DXGI_FORMAT format, int frameRate)
+{
+    return uNvEncoderCreateEncoderWithAsyncDepth(width, height, format, frameRate, NvencDesc().asyncDepth);
+}
+
+
+UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderDestroyEncoder(EncoderId id)
+{
+    // Renditions go away with their simulcast.
+    const auto &encoder = GetEncoder(id);
+    if (encoder && encoder->IsRendition()) return;
+
+    g_encoders.erase(id);
+}
+
+
+UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderIsValid(EncoderId id)
+{
+    const auto &encoder = GetEncoder(id);
+    return encoder ? encoder->IsValid() : false;
+}
+
+
+UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderGetWidth(EncoderId id)
+{
+    const auto &encoder = GetEncoder(id);
+    
+    int width = encoder ? static_cast<int>(encoder->GetWidth()) : 0;
+    return width;
+}
+
+
+UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderGetHeight(EncoderId id)
+{
+    const auto &encoder = GetEncoder(id);
+    return encoder ? static_cast<int>(encoder->GetHeight()) : 0;
+}
+
+
+UNITY_INTERFACE_EXPORT DXGI_FORMAT UNITY_INTERFACE_API uNvEncoderGetFormat(EncoderId id)
+{
+    const auto &encoder = GetEncoder(id);
+    return encoder ? encoder->GetFormat() : DXGI_FORMAT_UNKNOWN;
+}
+
+
+UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderGetFrameRate(EncoderId id)
+{
+    const auto &encoder = GetEncoder(id);
+    return encoder ? static_cast<int>(encoder->GetFrameRate()) : 0;
+}
+
+
+UNITY_INTERFACE_EXPORT NvencCodec UNITY_INTERFACE_API uNvEncoderGetCodec(EncoderId id)
+{
+    const auto &encoder = GetEncoder(id);
+    return encoder ? encoder->GetCodec() : NvencCodec::H264;
+}
+
+
+UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderGetAsyncDepth(EncoderId id)
+{
+    const auto &encoder = GetEncoder(id);
+    return encoder ? static_cast<int>(encoder->GetAsyncDepth()) : 0;
+}
+
+
+UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderEncode(EncoderId id, ID3D11Texture2D *texture, bool forceIdrFrame)
+{
+    if (const auto &encoder = GetEncoder(id))
+    {
+        return encoder->Encode(texture, forceIdrFrame);
+    }
+    return false;
+}
+
+
+UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderEncodeWithOptions(EncoderId id, ID3D11Texture2D *texture, const EncodeOptions *options)
+{
+    if (const auto &encoder = GetEncoder(id))
+    {
+        return encoder->Encode(texture, options ? *options : EncodeOptions());
+    }
+    return false;
+}
+
+
+UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderEncodeFromMemory(EncoderId id, const void *data, int pitch, DXGI_FORMAT format, bool forceIdrFrame)
+{
+    if (const auto &encoder = GetEncoder(id))
+    {
+        if (pitch <= 0) return false;
+
+        const NvencMemoryFrame frame = { data, static_cast<uint32_t>(pitch), format };
+        EncodeOptions options;
+        options.forceIdrFrame = forceIdrFrame ? 1 : 0;
+        return encoder->EncodeFromMemory(frame, options);
+    }
+    return false;
+}
+
+
+UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderEncodeFromMemoryWithOptions(EncoderId id, const void *data, int pitch, DXGI_FORMAT format, const EncodeOptions *options)
+{
+    if (const auto &encoder = GetEncoder(id))
+    {
+        if (pitch <= 0) return false;
+
+        const NvencMemoryFrame frame = { data, static_cast<uint32_t>(pitch), format };
+        return encoder->EncodeFromMemory(frame, options ? *options : EncodeOptions());
+    }
+    return false;
+}
+
+
+UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderGetLtrSlotCount(EncoderId id)
+{
+    const auto &encoder = GetEncoder(id);
+    return encoder ? static_cast<int>(encoder->GetLtrSlotCount()) : 0;
+}
+
+
+UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderGetLtrFrameIndex(EncoderId id, int slot, uint64_t *frameIndex)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder || !frameIndex || slot < 0) return false;
+
+    return encoder->GetLtrFrameIndex(static_cast<uint32_t>(slot), *frameIndex);
+}
+
+
+UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderFindLtrSlot(EncoderId id, uint64_t frameIndex)
+{
+    const auto &encoder = GetEncoder(id);
+    return encoder ? encoder->FindLtrSlot(frameIndex) : -1;
+}
+
+
+// Frame indices and timestamps are the frameIndex and timestamp of
+// EncodedFrame. Returns how many frames were invalidated, or -1 on an error.
+UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderInvalidateRefFrames(EncoderId id, const uint64_t *frameIndices, int count)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder || !frameIndices || count < 0) return -1;
+
+    return encoder->InvalidateRefFrames(frameIndices, static_cast<size_t>(count));
+}
+
+
+UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderInvalidateRefFramesByTimestamp(EncoderId id, const uint64_t *timestamps, int count)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder || !timestamps || count < 0) return -1;
+
+    return encoder->InvalidateRefFramesByTimestamp(timestamps, static_cast<size_t>(count));
+}
+
+
+// The map has columnCount x rowCount deltas in raster order, one per block of
+// the current frame size.
+UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderGetQpMapSize(EncoderId id, int *columnCount, int *rowCount)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder || !columnCount || !rowCount) return false;
+
+    uint32_t columns = 0;
+    uint32_t rows = 0;
+    encoder->GetQpMapSize(columns, rows);
+    *columnCount = static_cast<int>(columns);
+    *rowCount = static_cast<int>(rows);
+    return true;
+}
+
+
+UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderSetQpDeltaMap(EncoderId id, const int8_t *deltas, int size)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder || size < 0) return false;
+
+    return encoder->SetQpDeltaMap(deltas, static_cast<size_t>(size));
+}
+
+
+UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderSetFoveation(EncoderId id, const Foveation *foveation)
+{
+    const auto &encoder = GetEncoder(id);
+    return encoder ? encoder->SetFoveation(foveation) : false;
+}
+
+
+UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderSetQpRegions(EncoderId id, const QpRegion *regions, int count)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder || count < 0 || (!regions && count > 0)) return false;
+
+    return encoder->SetQpRegions(regions, static_cast<size_t>(count));
+}
+
+
+UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderSetRateControl(EncoderId id, int averageBitRate, int maxBitRate, int frameRate, bool forceIdrFrame)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder) return false;
+
+    return encoder->SetRateControl(
+        static_cast<uint32_t>(std::max(averageBitRate, 0)),
+        static_cast<uint32_t>(std::max(maxBitRate, 0)),
+        static_cast<uint32_t>(std::max(frameRate, 0)),
+        forceIdrFrame);
+}
+
+
+UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderSetAbrConfig(EncoderId id, const AbrConfig *config)
+{
+    const auto &encoder = GetEncoder(id);
+    return encoder ? encoder->SetAbrConfig(config) : false;
+}
+
+
+UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderReportNetworkFeedback(EncoderId id, const NetworkFeedback *feedback)
+{
+    const auto &encoder = GetEncoder(id);
+    if (encoder && feedback) encoder->ReportNetworkFeedback(*feedback);
+}
+
+
+UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderGetAbrEstimatedBitRate(EncoderId id)
+{
+    const auto &encoder = GetEncoder(id);
+    return encoder ? static_cast<int>(encoder->GetAbrEstimatedBitRate()) : 0;
+}
+
+
+UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderRequestIntraRefresh(EncoderId id)
+{
+    if (const auto &encoder = GetEncoder(id))
+    {
+        encoder->RequestIntraRefresh();
+    }
+}
+
+
+UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderResize(EncoderId id, uint32_t width, uint32_t height)
+{
+    if (const auto& encoder = GetEncoder(id))
+    {
+        return encoder->Resize(width, height);
+    }
+}
+
+
+
+UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderEncodeSharedHandle(EncoderId id, void *handle, bool forceIdrFrame)
+{
+    if (const auto &encoder = GetEncoder(id))
+    {
+        return encoder->EncodeSharedHandle(handle, forceIdrFrame);
+    }
+    return false;
+}
+
+
+UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderCopyEncodedData(EncoderId id)
+{
+    if (const auto &encoder = GetEncoder(id))
+    {
+        encoder->CopyEncodedDataList();
+    }
+}
+
+
+UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderGetEncodedDataCount(EncoderId id)
+{
+    const auto &encoder = GetEncoder(id);
+    return encoder ? static_cast<int>(encoder->GetEncodedDataList().size()) : 0;
+}
+
+
+UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderGetEncodedDataSize(EncoderId id, int index)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder) return 0;
+
+    const auto &list = encoder->GetEncodedDataList();
+    if (index < 0 || index >= static_cast<int>(list.size())) return 0;
+
+    return static_cast<int>(list.at(index).size);
+}
+
+
+UNITY_INTERFACE_EXPORT const void * UNITY_INTERFACE_API uNvEncoderGetEncodedDataBuffer(EncoderId id, int index)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder) return nullptr;
+
+    const auto &list = encoder->GetEncodedDataList();
+    if (index < 0 || index >= static_cast<int>(list.size())) return nullptr;
+
+    return list.at(index).GetBuffer();
+}
+
+
+UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderGetEncodedFrames(EncoderId id, EncodedFrame *frames, int maxCount)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder || !frames || maxCount <= 0) return 0;
+
+    encoder->CopyEncodedDataList(static_cast<size_t>(maxCount));
+
+    const auto &list = encoder->GetEncodedDataList();
+    for (size_t i = 0; i < list.size(); ++i)
+    {
+        const auto &ed = list[i];
+        auto &frame = frames[i];
+        frame.buffer = ed.GetBuffer();
+        frame.size = static_cast<int32_t>(ed.size);
+        frame.pictureType = static_cast<int32_t>(ed.pictureType);
+        frame.frameIndex = ed.index;
+        frame.timestamp = ed.timestamp;
+        frame.codec = static_cast<int32_t>(ed.codec);
+        frame.offset = ed.offset;
+        frame.isFrameEnd = ed.isFrameEnd ? 1 : 0;
+        frame.isLeased = ed.IsLeased() ? 1 : 0;
+    }
+
+    return static_cast<int>(list.size());
+}
+
+
+UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderSetBitstreamLeaseEnabled(EncoderId id, bool enabled)
+{
+    if (const auto &encoder = GetEncoder(id))
+    {
+        encoder->SetBitstreamLeaseEnabled(enabled);
+    }
+}
+
+
+UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderGetLeasedEncodedData(EncoderId id, int index, const void **buffer, int *size, uint64_t *token)
+{
+    const auto &encoder = GetEncoder(id);
+    if (!encoder || !buffer || !size || !token) return false;
+
+    const auto &list = encoder->GetEncodedDataList();
+    if (index < 0 || index >= static_cast<int>(list.size())) return false;
+
+    const auto &ed = list.at(index);
+    if (!ed.IsLeased()) return false;
+
+    *buffer = ed.GetBuffer();
+    *size = static_cast<int>(ed.size);
+    *token = ed.index;
+    return true;
+}
+
+
+UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderReleaseEncodedData(EncoderId id, uint64_t token)
+{
+    const auto &encoder = GetEncoder(id);
+    return encoder ? encoder->ReleaseEncodedData(token) : false;
+}
+
+
+UNITY_INTERFACE_EXPORT uint64_t UNITY_INTERFACE_API uNvEncoderGetEncodedDataOverflowCount(EncoderId id)
+{
+    const auto &encoder = GetEncoder(id);
+    return encoder ? encoder->GetEncodedDataOverflowCount() : 0;
+}
+
+
+UNITY_INTERFACE_EXPORT uint64_t UNITY_INTERFACE_API uNvEncoderGetBitstreamAllocationCount(EncoderId id)
+{
+    const auto &encoder = GetEncoder(id);
+    return encoder ? encoder->GetBitstreamAllocationCount() : 0;
+}
+
+
+UNITY_INTERFACE_EXPORT uint64_t UNITY_INTERFACE_API uNvEncoderGetDuplicateFrameCount(EncoderId id)
+{
+    const auto &encoder = GetEncoder(id);
+    return encoder ? encoder->GetDuplicateFrameCount() : 0;
+}
+
+
+UNITY_INTERFACE_EXPORT uint64_t UNITY_INTERFACE_API uNvEncoderGetSkippedDuplicateFrameCount(EncoderId id)
+{
+    const auto &encoder = GetEncoder(id);
+    return encoder ? encoder->GetSkippedDuplicateFrameCount() : 0;
+}
+
+
+SimulcastEncoder * GetSimulcastEncoder(EncoderId id)
+{
+    const auto it = g_simulcasts.find(id);
+    return (it != g_simulcasts.end()) ? it->second.encoder.get() : nullptr;
+}
+
+
+UNITY_INTERFACE_EXPORT EncoderId UNITY_INTERFACE_API uNvEncoderCreateSimulcastEncoder(
+    int width, int height, DXGI_FORMAT format, int frameRate, int asyncDepth, const EncoderConfig *config,
+    const SimulcastRendition *renditions, int renditionCount)
+{
+    SimulcastDesc desc;
+    desc.width = static_cast<uint32_t>(std::max(width, 0));
+    desc.height = static_cast<uint32_t>(std::max(height, 0));
+    desc.format = format;
+    desc.frameRate = static_cast<uint32_t>(std::max(frameRate, 0));
+    desc.asyncDepth = static_cast<uint32_t>(std::max(asyncDepth, 0));
+    if (config) desc.config = *config;
+    if (renditions && renditionCount > 0) desc.renditions.assign(renditions, renditions + renditionCount);
+
+    const auto id = g_encoderId++;
+
+    Simulcast simulcast;
+    simulcast.encoder = std::make_unique<SimulcastEncoder>(desc);
+    for (size_t i = 0; i < simulcast.encoder->GetRenditionCount(); ++i)
+    {
+        const auto renditionId = g_encoderId++;
+        g_encoders.emplace(renditionId, simulcast.encoder->GetRendition(i));
+        simulcast.renditionIds.push_back(renditionId);
+    }
+    g_simulcasts.emplace(id, std::move(simulcast));
+
+    return id;
+}
+
+
+UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderDestroySimulcastEncoder(EncoderId id)
+{
+    const auto it = g_simulcasts.find(id);
+    if (it == g_simulcasts.end()) return;
+
+    for (const auto renditionId : it->second.renditionIds)
+    {
+        g_encoders.erase(renditionId);
+    }
+    g_simulcasts.erase(it);
+}
+
+
+UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderIsSimulcastValid(EncoderId id)
+{
+    const auto encoder = GetSimulcastEncoder(id);
+    return encoder ? encoder->IsValid() : false;
+}
+
+
+UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderEncodeSimulcast(EncoderId id, ID3D11Texture2D *texture, const EncodeOptions *options)
+{
+    if (const auto encoder = GetSimulcastEncoder(id))
+    {
+        return encoder->Encode(texture, options ? *options : EncodeOptions());
+    }
+    return false;
+}
+
+
+UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderRequestSimulcastIntraRefresh(EncoderId id)
+{
+    if (const auto encoder = GetSimulcastEncoder(id))
+    {
+        encoder->RequestIntraRefresh();
+    }
+}
+
+
+UNITY_INTERFACE_EXPORT int UNITY_INTERFACE_API uNvEncoderGetSimulcastRenditionCount(EncoderId id)
+{
+    const auto it = g_simulcasts.find(id);
+    return (it != g_simulcasts.end()) ? static_cast<int>(it->second.renditionIds.size()) : 0;
+}
+
+
+// The encoder id of a rendition, or -1.
+UNITY_INTERFACE_EXPORT EncoderId UNITY_INTERFACE_API uNvEncoderGetSimulcastRenditionEncoder(EncoderId id, int index)
+{
+    const auto it = g_simulcasts.find(id);
+    if (it == g_simulcasts.end() || index < 0) return -1;
+
+    const auto &renditionIds = it->second.renditionIds;
+    return (static_cast<size_t>(index) < renditionIds.size()) ? renditionIds[index] : -1;
+}
+
+
+UNITY_INTERFACE_EXPORT const char * UNITY_INTERFACE_API uNvEncoderGetSimulcastError(EncoderId id)
+{
+    const auto encoder = GetSimulcastEncoder(id);
+    return encoder ? encoder->GetError().c_str() : nullptr;
+}
+
+
+UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderClearSimulcastError(EncoderId id)
+{
+    if (const auto encoder = GetSimulcastEncoder(id))
+    {
+        encoder->ClearError();
+    }
+}
+
+
+UNITY_INTERFACE_EXPORT const char * UNITY_INTERFACE_API uNvEncoderGetError(EncoderId id)
+{
+    const auto &encoder = GetEncoder(id);
+    return encoder ? encoder->GetError().c_str() : nullptr;
+}
+
+
+UNITY_INTERFACE_EXPORT bool UNITY_INTERFACE_API uNvEncoderHasError(EncoderId id)
+{
+    const auto &encoder = GetEncoder(id);
+    return encoder ? encoder->HasError() : false;
+}
+
+
+UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderClearError(EncoderId id)
+{
+    if (const auto &encoder = GetEncoder(id))
+    {
+        encoder->ClearError();
+    }
+}
+
+UNITY_INTERFACE_EXPORT void UNITY_INTERFACE_API uNvEncoderSetPrimarySource(EncoderId id, ID3D11Texture2D* texture)
+{
+	if (const auto& encoder = GetEncoder(id))
+	{
+		encoder->SetPrimarySource(texture);
+	}
+}
+
+void UNITY_INTERFACE_API uNvEncoderEncodePrimarySource(int id)
+{
+	if (const auto& encoder = GetEncoder(id))
+	{
+		encoder->EncodePrimarySource(false);
+	}
+}
+
+UNITY_INTERFACE_EXPORT UnityRenderingEvent  UNITY_INTERFACE_API uNvEncoderGetEncodePrimarySourceEvent()
+{
+	return uNvEncoderEncodePrimarySource;
+}
 }
\ No newline at end of file
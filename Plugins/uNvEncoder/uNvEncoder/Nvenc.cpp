@@ -1,616 +1,1655 @@
-#include <string>
-#include <map>
-#include "Nvenc.h"
-
-
-namespace uNvEncoder
-{
-
-
-void OutputNvencApiError(const std::string &apiName, NVENCSTATUS status)
-{
-#define STATUS_STR_PAIR(Code) { Code, #Code },
-    static const std::map<NVENCSTATUS, std::string> nvEncStatusErrorNameTable = {
-        STATUS_STR_PAIR(NV_ENC_SUCCESS)
-        STATUS_STR_PAIR(NV_ENC_ERR_NO_ENCODE_DEVICE)
-        STATUS_STR_PAIR(NV_ENC_ERR_UNSUPPORTED_DEVICE)
-        STATUS_STR_PAIR(NV_ENC_ERR_INVALID_ENCODERDEVICE)
-        STATUS_STR_PAIR(NV_ENC_ERR_INVALID_DEVICE)
-        STATUS_STR_PAIR(NV_ENC_ERR_DEVICE_NOT_EXIST)
-        STATUS_STR_PAIR(NV_ENC_ERR_INVALID_PTR)
-        STATUS_STR_PAIR(NV_ENC_ERR_INVALID_EVENT)
-        STATUS_STR_PAIR(NV_ENC_ERR_INVALID_PARAM)
-        STATUS_STR_PAIR(NV_ENC_ERR_INVALID_CALL)
-        STATUS_STR_PAIR(NV_ENC_ERR_OUT_OF_MEMORY)
-        STATUS_STR_PAIR(NV_ENC_ERR_ENCODER_NOT_INITIALIZED)
-        STATUS_STR_PAIR(NV_ENC_ERR_UNSUPPORTED_PARAM)
-        STATUS_STR_PAIR(NV_ENC_ERR_LOCK_BUSY)
-        STATUS_STR_PAIR(NV_ENC_ERR_NOT_ENOUGH_BUFFER)
-        STATUS_STR_PAIR(NV_ENC_ERR_INVALID_VERSION)
-        STATUS_STR_PAIR(NV_ENC_ERR_MAP_FAILED)
-        STATUS_STR_PAIR(NV_ENC_ERR_NEED_MORE_INPUT)
-        STATUS_STR_PAIR(NV_ENC_ERR_ENCODER_BUSY)
-        STATUS_STR_PAIR(NV_ENC_ERR_EVENT_NOT_REGISTERD)
-        STATUS_STR_PAIR(NV_ENC_ERR_GENERIC)
-        STATUS_STR_PAIR(NV_ENC_ERR_INCOMPATIBLE_CLIENT_KEY)
-        STATUS_STR_PAIR(NV_ENC_ERR_UNIMPLEMENTED)
-        STATUS_STR_PAIR(NV_ENC_ERR_RESOURCE_REGISTER_FAILED)
-        STATUS_STR_PAIR(NV_ENC_ERR_RESOURCE_NOT_REGISTERED)
-        STATUS_STR_PAIR(NV_ENC_ERR_RESOURCE_NOT_MAPPED)
-    };
-#undef STATUS_STR_PAIR
-
-    const auto it = nvEncStatusErrorNameTable.find(status);
-    const auto statusStr = it != nvEncStatusErrorNameTable.end() ? it->second : "Unknown";
-    ThrowError(apiName + " call failed: " + statusStr);
-}
-
-
-template <class Api, class ...Args>
-NVENCSTATUS CallNvencApi(const std::string &apiName, const Api &api, const Args &... args)
-{
-    const auto status = api(args...);
-    if (status != NV_ENC_SUCCESS && status != NV_ENC_ERR_NEED_MORE_INPUT)
-    {
-        OutputNvencApiError(apiName, status);
-    }
-
-    return status;
-}
-
-
-#define CALL_NVENC_API(Api, ...) CallNvencApi(#Api, Api, __VA_ARGS__)
-
-
-
-decltype(Nvenc::s_module) Nvenc::s_module = NULL;
-decltype(Nvenc::s_nvenc) Nvenc::s_nvenc = { 0 };
-decltype(Nvenc::s_referenceCount) Nvenc::s_referenceCount = 0;
-
-
-void Nvenc::LoadModule()
-{
-    ++s_referenceCount;
-
-    if (s_module != NULL) return;
-
-#if defined(_WIN64)
-    s_module = ::LoadLibraryA("nvEncodeAPI64.dll");
-#else
-    s_module = ::LoadLibraryA("nvEncodeAPI.dll");
-#endif
-    if (s_module == NULL) ThrowError("NVENC is not available.");
-
-    if (const auto funcAddress = ::GetProcAddress(s_module, "NvEncodeAPIGetMaxSupportedVersion"))
-    {
-        using FuncType = decltype(NvEncodeAPIGetMaxSupportedVersion);
-        const auto func = reinterpret_cast<FuncType*>(funcAddress);
-        uint32_t version = 0;
-        const auto res = func(&version);
-        constexpr uint32_t currentVersion = (NVENCAPI_MAJOR_VERSION << 4) | NVENCAPI_MINOR_VERSION;
-        if (currentVersion > version) ThrowError("NVENC version is wrong.");
-    }
-
-    if (const auto funcAddress = ::GetProcAddress(s_module, "NvEncodeAPICreateInstance"))
-    {
-        using FuncType = decltype(NvEncodeAPICreateInstance);
-        const auto func = reinterpret_cast<FuncType*>(funcAddress);
-        s_nvenc = { NV_ENCODE_API_FUNCTION_LIST_VER };
-        func(&s_nvenc);
-
-        if (!s_nvenc.nvEncOpenEncodeSession)
-        {
-            ThrowError("Failed to load functions from DLL.");
-        }
-    }
-}
-
-
-void Nvenc::UnloadModule()
-{
-    if (--s_referenceCount > 0) return;
-
-    if (s_module != NULL)
-    {
-        ::FreeLibrary(s_module);
-        s_module = NULL;
-    }
-}
-
-
-Nvenc::Nvenc(const NvencDesc &desc)
-    : desc_(desc)
-    , resources_(1)
-{
-}
-
-
-Nvenc::~Nvenc()
-{
-}
-
-
-void Nvenc::Initialize()
-{
-    if (isInitialized_) return;
-
-    LoadModule();
-    OpenEncodeSession();
-    InitializeEncoder();
-
-    CreateCompletionEvents();
-    CreateInputTextures();
-    RegisterResources();
-    CreateBitstreamBuffers();
-
-    isInitialized_ = true;
-}
-
-
-void Nvenc::Finalize()
-{
-    if (!isInitialized_) return;
-
-    EndEncode();
-    DestroyBitstreamBuffers();
-    UnregisterResources();
-    DestroyCompletionEvents();
-    DestroyEncoder();
-    UnloadModule();
-
-    isInitialized_ = false;
-}
-
-
-void Nvenc::ThrowErrorIfNotInitialized()
-{
-    if (!IsValid()) ThrowError("NVENC has not been initialized yet.");
-}
-
-
-void Nvenc::OpenEncodeSession()
-{
-    NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS encSessionParams = { NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS_VER };
-    encSessionParams.device = desc_.d3d11Device.Get();
-    encSessionParams.deviceType = NV_ENC_DEVICE_TYPE_DIRECTX;
-    encSessionParams.apiVersion = NVENCAPI_VERSION;
-    CALL_NVENC_API(s_nvenc.nvEncOpenEncodeSessionEx, &encSessionParams, &encoder_);
-}
-
-void Nvenc::Resize(const uint32_t width, const uint32_t height)
-{
-    if (desc_.width == width && desc_.height == height) return;
-
-    EndEncode();
-    ::fprintf(stdout, "EndEncode\n");
-
-    DestroyBitstreamBuffers();
-    ::fprintf(stdout, "DestroyBitStream\n");
-
-    UnregisterResources();
-    ::fprintf(stdout, "Unregister resource\ns");
-
-    
-
-    NV_ENC_RECONFIGURE_PARAMS reconfigureParams = { NV_ENC_RECONFIGURE_PARAMS_VER };
-    memcpy(&reconfigureParams.reInitEncodeParams, &initializeParams_, sizeof(initializeParams_));
-    ::fprintf(stdout, "reconfigureParams.reInitEncodeParams %p\n", &reconfigureParams.reInitEncodeParams);
-
-    NV_ENC_CONFIG reInitCodecConfig = { NV_ENC_CONFIG_VER };
-
-    memcpy(&reInitCodecConfig, initializeParams_.encodeConfig, sizeof(reInitCodecConfig));
-    ::fprintf(stdout, "reInitCodecConfig %p\n", &reInitCodecConfig);
-
-    reconfigureParams.reInitEncodeParams.encodeConfig = &reInitCodecConfig;
-
-    
-    reconfigureParams.reInitEncodeParams.encodeWidth = width;
-    reconfigureParams.reInitEncodeParams.encodeHeight = height;
-    reconfigureParams.reInitEncodeParams.darWidth = width;
-    reconfigureParams.reInitEncodeParams.darHeight = height;
-
-    ::fprintf(stdout, "reInitCodecConfig %p\n", encoder_);
-    CALL_NVENC_API(s_nvenc.nvEncReconfigureEncoder, encoder_, &reconfigureParams);
-
-    desc_.width = width;
-    desc_.height = height;
-
-    ::fprintf(stdout, "CreateInputTextures\n");
-    CreateInputTextures();
-
-    ::fprintf(stdout, "Register resources\n");
-    RegisterResources();
-
-    ::fprintf(stdout, "CreateBitstreamBuffers\n");
-    CreateBitstreamBuffers();
-}
-
-
-
-void Nvenc::InitializeEncoder()
-{
-    NV_ENC_INITIALIZE_PARAMS initParams = { NV_ENC_INITIALIZE_PARAMS_VER };
-    initParams.encodeGUID = NV_ENC_CODEC_H264_GUID;
-    initParams.presetGUID = NV_ENC_PRESET_LOW_LATENCY_DEFAULT_GUID;
-    initParams.encodeWidth = desc_.width;
-    initParams.encodeHeight = desc_.height;
-    initParams.darWidth = desc_.width;
-    initParams.darHeight = desc_.height;
-    initParams.frameRateNum = desc_.frameRate;
-    initParams.frameRateDen = 1;
-    initParams.enablePTD = 1;
-    initParams.reportSliceOffsets = 0;
-    initParams.enableSubFrameWrite = 0;
-    initParams.maxEncodeWidth = 4096;
-    initParams.maxEncodeHeight = 4096;
-    initParams.enableMEOnlyMode = false;
-    initParams.enableOutputInVidmem = false;
-    initParams.enableEncodeAsync = true;
-
-    uint32_t bitRate = (static_cast<unsigned int>(12.0f * desc_.width * desc_.height) / (1920 * 1080))* (100 * 10000);
-
-
-    NV_ENC_PRESET_CONFIG presetConfig = { NV_ENC_PRESET_CONFIG_VER, { NV_ENC_CONFIG_VER } };
-    CALL_NVENC_API(s_nvenc.nvEncGetEncodePresetConfig, encoder_, initParams.encodeGUID, initParams.presetGUID, &presetConfig);
-
-    NV_ENC_CONFIG config = { NV_ENC_CONFIG_VER };
-    memcpy(&config, &presetConfig.presetCfg, sizeof(NV_ENC_CONFIG));
-    config.profileGUID = NV_ENC_H264_PROFILE_BASELINE_GUID;
-    config.frameIntervalP = 1;
-    config.gopLength = 2 * desc_.frameRate;
-    config.rcParams.rateControlMode = NV_ENC_PARAMS_RC_VBR;
-    config.rcParams.targetQuality = 18;
-    config.rcParams.maxBitRate = bitRate;
-    initParams.encodeConfig = &config;
-
-    config.encodeCodecConfig.h264Config.repeatSPSPPS = 1;
-    config.encodeCodecConfig.h264Config.maxNumRefFrames = 0;
-    config.encodeCodecConfig.h264Config.idrPeriod = config.gopLength;
-
-    CALL_NVENC_API(s_nvenc.nvEncInitializeEncoder, encoder_, &initParams);
-
-    memcpy(&encodeConfig_, &config, sizeof(config));
-    memcpy(&initializeParams_, &initParams, sizeof(initializeParams_));
-
-    initializeParams_.encodeConfig = &encodeConfig_;
-}
-
-
-void Nvenc::CreateCompletionEvents()
-{
-    ThrowErrorIfNotInitialized();
-
-    for (auto &resource : resources_)
-    {
-        resource.completionEvent_ = ::CreateEventA(NULL, FALSE, FALSE, NULL);
-        NV_ENC_EVENT_PARAMS eventParams = { NV_ENC_EVENT_PARAMS_VER };
-        eventParams.completionEvent = resource.completionEvent_;
-        CALL_NVENC_API(s_nvenc.nvEncRegisterAsyncEvent, encoder_, &eventParams);
-    }
-}
-
-
-void Nvenc::DestroyCompletionEvents()
-{
-    ThrowErrorIfNotInitialized();
-
-    for (auto &resource : resources_)
-    {
-        if (!resource.completionEvent_) continue;
-
-        NV_ENC_EVENT_PARAMS eventParams = { NV_ENC_EVENT_PARAMS_VER };
-        eventParams.completionEvent = resource.completionEvent_;
-        CALL_NVENC_API(s_nvenc.nvEncUnregisterAsyncEvent, encoder_, &eventParams);
-        ::CloseHandle(resource.completionEvent_);
-    }
-}
-
-
-void Nvenc::CreateBitstreamBuffers()
-{
-    ThrowErrorIfNotInitialized();
-
-    for (auto &resource : resources_)
-    {
-        NV_ENC_CREATE_BITSTREAM_BUFFER createBitstreamBuffer = { NV_ENC_CREATE_BITSTREAM_BUFFER_VER };
-        CALL_NVENC_API(s_nvenc.nvEncCreateBitstreamBuffer, encoder_, &createBitstreamBuffer);
-        resource.bitstreamBuffer_ = createBitstreamBuffer.bitstreamBuffer;
-    }
-}
-
-
-void Nvenc::CreateInputTextures()
-{
-    ThrowErrorIfNotInitialized();
-
-    D3D11_TEXTURE2D_DESC desc = { 0 };
-    desc.Width = desc_.width;
-    desc.Height = desc_.height;
-    desc.MipLevels = 1;
-    desc.ArraySize = 1;
-    desc.Format = desc_.format;
-    desc.SampleDesc.Count = 1;
-    desc.Usage = D3D11_USAGE_DEFAULT;
-    desc.BindFlags = D3D11_BIND_RENDER_TARGET;
-    desc.CPUAccessFlags = 0;
-    desc.MiscFlags = D3D11_RESOURCE_MISC_SHARED;
-
-    for (auto &resource : resources_)
-    {
-        if (FAILED(desc_.d3d11Device->CreateTexture2D(&desc, NULL, &resource.inputTexture_)))
-        {
-            ThrowError("Failed to create shared texture.");
-            return;
-        }
-
-        ComPtr<IDXGIResource> dxgiResource;
-        resource.inputTexture_.As(&dxgiResource);
-        if (FAILED(dxgiResource->GetSharedHandle(&resource.inputTextureSharedHandle_)))
-        {
-            ThrowError("Failed to get shared handle.");
-            return;
-        }
-    }
-}
-
-
-void Nvenc::RegisterResources()
-{
-    ThrowErrorIfNotInitialized();
-
-    for (auto &resource : resources_)
-    {
-        NV_ENC_REGISTER_RESOURCE registerResource = { NV_ENC_REGISTER_RESOURCE_VER };
-        registerResource.resourceType = NV_ENC_INPUT_RESOURCE_TYPE_DIRECTX;
-        registerResource.resourceToRegister = resource.inputTexture_.Get();
-        registerResource.width = desc_.width;
-        registerResource.height = desc_.height;
-        registerResource.pitch = 0;
-        registerResource.bufferFormat = NV_ENC_BUFFER_FORMAT_ARGB;
-        registerResource.bufferUsage = NV_ENC_INPUT_IMAGE;
-        CALL_NVENC_API(s_nvenc.nvEncRegisterResource, encoder_, &registerResource);
-
-        resource.registeredResource_ = registerResource.registeredResource;
-    }
-}
-
-
-void Nvenc::UnregisterResources()
-{
-    ThrowErrorIfNotInitialized();
-
-    for (auto &resource : resources_)
-    {
-       if (!resource.registeredResource_) continue;
-        CALL_NVENC_API(s_nvenc.nvEncUnregisterResource, encoder_, resource.registeredResource_);
-    }
-}
-
-
-void Nvenc::DestroyBitstreamBuffers()
-{
-    ThrowErrorIfNotInitialized();
-
-    for (auto &resource : resources_)
-    {
-        if (!resource.bitstreamBuffer_) continue;
-        CALL_NVENC_API(s_nvenc.nvEncDestroyBitstreamBuffer, encoder_, resource.bitstreamBuffer_);
-    }
-}
-
-
-void Nvenc::DestroyEncoder()
-{
-    ThrowErrorIfNotInitialized();
-
-    CALL_NVENC_API(s_nvenc.nvEncDestroyEncoder, encoder_);
-}
-
-
-bool Nvenc::Encode(const ComPtr<ID3D11Texture2D> &source, bool forceIdrFrame)
-{
-    ThrowErrorIfNotInitialized();
-
-    const auto index = GetInputIndex();
-    auto &resource = resources_[index];
-
-    if (resource.isEncoding_) 
-    {
-		return false;
-    }
-    resource.isEncoding_ = true;
-
-	if (!CopyToInputTexture(index, source))
-	{
-		resource.isEncoding_ = false;
-		return false;
-	}
-
-    MapInputResource(index);
-
-    if (EncodeInputTexture(index, forceIdrFrame)) 
-    {
-        ++inputIndex_;
-		return true;
-    }
-    else
-    {
-        resource.isEncoding_ = false;
-		return false;
-    }
-}
-
-
-bool Nvenc::CopyToInputTexture(int index, const ComPtr<ID3D11Texture2D> &texture)
-{
-    ThrowErrorIfNotInitialized();
-
-    auto &resource = resources_[index];
-    ComPtr<ID3D11Texture2D> inputTexture;
-
-    if (FAILED(GetUnityDevice()->OpenSharedResource(
-        resource.inputTextureSharedHandle_,
-        __uuidof(ID3D11Texture2D),
-        &inputTexture)))
-    {
-		::fprintf(stdout, "Unable to open shared texture, %d", GetLastError());
-		return false;
-    }
-
-    ComPtr<ID3D11DeviceContext> context;
-    GetUnityDevice()->GetImmediateContext(&context);
-    context->CopyResource(inputTexture.Get(), texture.Get());
-    context->Flush();
-
-	inputTexture->Release();
-	return true;
-}
-
-
-bool Nvenc::EncodeInputTexture(int index, bool forceIdrFrame)
-{
-    ThrowErrorIfNotInitialized();
-
-    auto &resource = resources_[index];
-
-    NV_ENC_PIC_PARAMS picParams = { NV_ENC_PIC_PARAMS_VER };
-    picParams.pictureStruct = NV_ENC_PIC_STRUCT_FRAME;
-    picParams.inputBuffer = resource.inputResource_;
-    picParams.bufferFmt = NV_ENC_BUFFER_FORMAT_ARGB;
-    picParams.inputWidth = desc_.width;
-    picParams.inputHeight = desc_.height;
-    picParams.outputBitstream = resource.bitstreamBuffer_;
-    picParams.completionEvent = resource.completionEvent_;
-    picParams.frameIdx = static_cast<uint32_t>(inputIndex_);
-    if (forceIdrFrame)
-    {
-        picParams.encodePicFlags = NV_ENC_PIC_FLAG_FORCEIDR | NV_ENC_PIC_FLAG_OUTPUT_SPSPPS;
-    }
-
-    const auto status = CALL_NVENC_API(s_nvenc.nvEncEncodePicture, encoder_, &picParams);
-    if (status != NV_ENC_SUCCESS && status != NV_ENC_ERR_NEED_MORE_INPUT)
-    {
-        return false;
-    }
-
-    return true;
-}
-
-
-void Nvenc::MapInputResource(int index)
-{
-    ThrowErrorIfNotInitialized();
-
-    auto &resource = resources_[index];
-    if (!resource.registeredResource_) return;
-
-    NV_ENC_MAP_INPUT_RESOURCE mapInputResource = { NV_ENC_MAP_INPUT_RESOURCE_VER };
-    mapInputResource.registeredResource = resource.registeredResource_;
-    CALL_NVENC_API(s_nvenc.nvEncMapInputResource, encoder_, &mapInputResource);
-    resource.inputResource_ = mapInputResource.mappedResource;
-}
-
-
-void Nvenc::UnmapInputResource(int index)
-{
-    ThrowErrorIfNotInitialized();
-
-    auto &resource = resources_[index];
-
-    if (!resource.inputResource_)
-    {
-        CALL_NVENC_API(s_nvenc.nvEncUnmapInputResource, encoder_, resource.inputResource_);
-        resource.inputResource_ = nullptr;
-    }
-}
-
-
-void Nvenc::GetEncodedData(std::vector<NvencEncodedData> &data)
-{
-    ThrowErrorIfNotInitialized();
-
-    for (;outputIndex_ < inputIndex_; ++outputIndex_)
-    {
-        const auto index = GetOutputIndex();
-        auto &resource = resources_[index];
-
-        if (!resource.isEncoding_) 
-        {
-            ThrowError("Try to get an invalid bitstream.");
-            continue;
-        }
-
-        constexpr DWORD duration = 10000;
-        if (!WaitForCompletion(index, duration))
-        {
-            ThrowError("Timeout when getting an encoded bitstream.");
-            continue;
-        }
-
-        NV_ENC_LOCK_BITSTREAM lockBitstream = { NV_ENC_LOCK_BITSTREAM_VER };
-        lockBitstream.outputBitstream = resource.bitstreamBuffer_;
-        lockBitstream.doNotWait = false;
-        CALL_NVENC_API(s_nvenc.nvEncLockBitstream, encoder_, &lockBitstream);
-
-        NvencEncodedData ed;
-        ed.index = outputIndex_;
-        ed.size = lockBitstream.bitstreamSizeInBytes;
-        ed.buffer = std::make_unique<uint8_t[]>(ed.size);
-        ::memcpy(ed.buffer.get(), lockBitstream.bitstreamBufferPtr, ed.size);
-        data.push_back(std::move(ed));
-
-        CALL_NVENC_API(s_nvenc.nvEncUnlockBitstream, encoder_, resource.bitstreamBuffer_);
-
-        UnmapInputResource(index);
-
-        resource.isEncoding_ = false;
-    }
-}
-
-
-bool Nvenc::WaitForCompletion(int index, DWORD duration)
-{
-    ThrowErrorIfNotInitialized();
-
-    auto &resource = resources_[index];
-
-    if (::WaitForSingleObject(resource.completionEvent_, duration) == WAIT_FAILED)
-    {
-        ThrowError("Failed to wait for encode completion.");
-        return false;
-    }
-
-    return true;
-}
-
-
-void Nvenc::EndEncode()
-{
-    ThrowErrorIfNotInitialized();
-
-    if (inputIndex_ == 0U) return;
-
-    SendEOS();
-
-    std::vector<NvencEncodedData> data;
-    GetEncodedData(data);
-}
-
-
-void Nvenc::SendEOS()
-{
-    ThrowErrorIfNotInitialized();
-
-    auto &resource = resources_[GetInputIndex()];
-    resource.isEncoding_ = true;
-
-    NV_ENC_PIC_PARAMS picParams = { NV_ENC_PIC_PARAMS_VER };
-    picParams.encodePicFlags = NV_ENC_PIC_FLAG_EOS;
-    picParams.completionEvent = resource.completionEvent_;
-    CALL_NVENC_API(s_nvenc.nvEncEncodePicture, encoder_, &picParams);
-
-    ++inputIndex_;
-}
-
-
-}
\ No newline at end of file
+#include <cstring>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <thread>
+#include "Nvenc.h"
+#include "BufferFormat.h"
+#include "StreamCopy.h"
+#include "QpMap.h"
+#include "FrameHash.h"
+
+
+namespace uNvEncoder
+{
+
+
+void OutputNvencApiError(const std::string &apiName, NVENCSTATUS status)
+{
+#define STATUS_STR_PAIR(Code) { Code, #Code },
+    static const std::map<NVENCSTATUS, std::string> nvEncStatusErrorNameTable = {
+        STATUS_STR_PAIR(NV_ENC_SUCCESS)
+        STATUS_STR_PAIR(NV_ENC_ERR_NO_ENCODE_DEVICE)
+        STATUS_STR_PAIR(NV_ENC_ERR_UNSUPPORTED_DEVICE)
+        STATUS_STR_PAIR(NV_ENC_ERR_INVALID_ENCODERDEVICE)
+        STATUS_STR_PAIR(NV_ENC_ERR_INVALID_DEVICE)
+        STATUS_STR_PAIR(NV_ENC_ERR_DEVICE_NOT_EXIST)
+        STATUS_STR_PAIR(NV_ENC_ERR_INVALID_PTR)
+        STATUS_STR_PAIR(NV_ENC_ERR_INVALID_EVENT)
+        STATUS_STR_PAIR(NV_ENC_ERR_INVALID_PARAM)
+        STATUS_STR_PAIR(NV_ENC_ERR_INVALID_CALL)
+        STATUS_STR_PAIR(NV_ENC_ERR_OUT_OF_MEMORY)
+        STATUS_STR_PAIR(NV_ENC_ERR_ENCODER_NOT_INITIALIZED)
+        STATUS_STR_PAIR(NV_ENC_ERR_UNSUPPORTED_PARAM)
+        STATUS_STR_PAIR(NV_ENC_ERR_LOCK_BUSY)
+        STATUS_STR_PAIR(NV_ENC_ERR_NOT_ENOUGH_BUFFER)
+        STATUS_STR_PAIR(NV_ENC_ERR_INVALID_VERSION)
+        STATUS_STR_PAIR(NV_ENC_ERR_MAP_FAILED)
+        STATUS_STR_PAIR(NV_ENC_ERR_NEED_MORE_INPUT)
+        STATUS_STR_PAIR(NV_ENC_ERR_ENCODER_BUSY)
+        STATUS_STR_PAIR(NV_ENC_ERR_EVENT_NOT_REGISTERD)
+        STATUS_STR_PAIR(NV_ENC_ERR_GENERIC)
+        STATUS_STR_PAIR(NV_ENC_ERR_INCOMPATIBLE_CLIENT_KEY)
+        STATUS_STR_PAIR(NV_ENC_ERR_UNIMPLEMENTED)
+        STATUS_STR_PAIR(NV_ENC_ERR_RESOURCE_REGISTER_FAILED)
+        STATUS_STR_PAIR(NV_ENC_ERR_RESOURCE_NOT_REGISTERED)
+        STATUS_STR_PAIR(NV_ENC_ERR_RESOURCE_NOT_MAPPED)
+    };
+#undef STATUS_STR_PAIR
+
+    const auto it = nvEncStatusErrorNameTable.find(status);
+    const auto statusStr = it != nvEncStatusErrorNameTable.end() ? it->second : "Unknown";
+    ThrowError(apiName + " call failed: " + statusStr);
+}
+
+
+template <class Api, class ...Args>
+NVENCSTATUS CallNvencApi(const char *apiName, const Api &api, const Args &... args)
+{
+    const auto status = api(args...);
+    if (status != NV_ENC_SUCCESS && status != NV_ENC_ERR_NEED_MORE_INPUT)
+    {
+        OutputNvencApiError(apiName, status);
+    }
+
+    return status;
+}
+
+
+#define CALL_NVENC_API(Api, ...) CallNvencApi(#Api, Api, __VA_ARGS__)
+
+
+constexpr auto sliceReadbackInterval = std::chrono::microseconds(250);
+// NV_ENC_LOCK_BITSTREAM::hwEncodeStatus of a frame that is fully written.
+constexpr uint32_t hwEncodeStatusCompleted = 2;
+constexpr uint64_t noLtrFrameIndex = ~0ULL;
+
+
+namespace
+{
+
+
+GUID GetProfileGuid(const EncoderConfig &config, NV_ENC_BUFFER_FORMAT bufferFormat)
+{
+    switch (config.profile)
+    {
+        case NvencProfile::H264Baseline: return NV_ENC_H264_PROFILE_BASELINE_GUID;
+        case NvencProfile::H264Main: return NV_ENC_H264_PROFILE_MAIN_GUID;
+        case NvencProfile::H264High: return NV_ENC_H264_PROFILE_HIGH_GUID;
+        case NvencProfile::HevcMain: return NV_ENC_HEVC_PROFILE_MAIN_GUID;
+        case NvencProfile::HevcMain10: return NV_ENC_HEVC_PROFILE_MAIN10_GUID;
+        default: break;
+    }
+
+    if (config.inputConversion == NvencInputConversion::Yuv444)
+    {
+        return config.codec == NvencCodec::HEVC ? NV_ENC_HEVC_PROFILE_FREXT_GUID : NV_ENC_H264_PROFILE_HIGH_444_GUID;
+    }
+    if (config.codec == NvencCodec::HEVC)
+    {
+        return Is10BitBufferFormat(bufferFormat) ? NV_ENC_HEVC_PROFILE_MAIN10_GUID : NV_ENC_HEVC_PROFILE_MAIN_GUID;
+    }
+    return config.bFrameCount > 0 ? NV_ENC_H264_PROFILE_MAIN_GUID : NV_ENC_H264_PROFILE_BASELINE_GUID;
+}
+
+
+// Signals the matrix and range that the input conversion used, with the
+// primaries and transfer that go with them.
+void SetColorDescription(NV_ENC_CONFIG_H264_VUI_PARAMETERS &vui, const EncoderConfig &config)
+{
+    constexpr uint32_t unspecifiedVideoFormat = 5;
+    const uint32_t colorDescription = config.colorMatrix == NvencColorMatrix::Bt601 ? 6 : 1;
+    vui.videoSignalTypePresentFlag = 1;
+    vui.videoFormat = unspecifiedVideoFormat;
+    vui.videoFullRangeFlag = config.colorRange == NvencColorRange::Full ? 1 : 0;
+    vui.colourDescriptionPresentFlag = 1;
+    vui.colourPrimaries = colorDescription;
+    vui.transferCharacteristics = colorDescription;
+    vui.colourMatrix = colorDescription;
+}
+
+
+// Memory frames in 8-bit RGB are converted when the config asks for it.
+NV_ENC_BUFFER_FORMAT GetConvertedBufferFormat(NV_ENC_BUFFER_FORMAT format, NvencInputConversion conversion)
+{
+    if (format != NV_ENC_BUFFER_FORMAT_ABGR && format != NV_ENC_BUFFER_FORMAT_ARGB) return format;
+
+    switch (conversion)
+    {
+        case NvencInputConversion::Nv12: return NV_ENC_BUFFER_FORMAT_NV12;
+        case NvencInputConversion::Yuv444: return NV_ENC_BUFFER_FORMAT_YUV444;
+        default: return format;
+    }
+}
+
+
+NV_ENC_PARAMS_RC_MODE GetRateControlMode(NvencRateControlMode mode)
+{
+    switch (mode)
+    {
+        case NvencRateControlMode::ConstQp: return NV_ENC_PARAMS_RC_CONSTQP;
+        case NvencRateControlMode::Cbr: return NV_ENC_PARAMS_RC_CBR;
+        case NvencRateControlMode::CbrLowDelayHq: return NV_ENC_PARAMS_RC_CBR_LOWDELAY_HQ;
+        case NvencRateControlMode::CbrHq: return NV_ENC_PARAMS_RC_CBR_HQ;
+        case NvencRateControlMode::VbrHq: return NV_ENC_PARAMS_RC_VBR_HQ;
+        default: return NV_ENC_PARAMS_RC_VBR;
+    }
+}
+
+
+}
+
+
+Nvenc::Nvenc(const NvencDesc &desc)
+    : desc_(desc)
+    , resources_(std::min(std::max(desc.asyncDepth, 1U), maxAsyncDepth))
+{
+}
+
+
+Nvenc::~Nvenc()
+{
+}
+
+
+void Nvenc::Initialize()
+{
+    if (isInitialized_) return;
+
+    if (!desc_.backend) ThrowError("Encode backend is not given.");
+    if (!desc_.device) ThrowError("Graphics device is not given.");
+    if (!desc_.bitstreamPool) ThrowError("Bitstream pool is not given.");
+    if (desc_.frameRate == 0) ThrowError("Frame rate must be positive.");
+    if (const auto error = GetEncoderConfigError(desc_.config, desc_.asyncDepth))
+    {
+        ThrowError(std::string("Invalid encoder config: ") + error);
+    }
+    if (const auto error = GetInputFormatError(desc_.format, desc_.config))
+    {
+        ThrowError(std::string("Unsupported input format: ") + error);
+    }
+    bufferFormat_ = GetBufferFormat(desc_.format);
+
+    api_ = &desc_.backend->GetFunctionList();
+    OpenEncodeSession();
+    CheckEncoderCaps();
+
+    // Consumer GPUs only allow a few sessions, so a failed step must not
+    // leave the session and what was made before it behind.
+    try
+    {
+        surfaceWidth_ = std::max(desc_.width, desc_.config.maxWidth);
+        surfaceHeight_ = std::max(desc_.height, desc_.config.maxHeight);
+        InitializeEncoder();
+
+        CreateCompletionEvents();
+        CreateInputTextures();
+        RegisterResources();
+        CreateBitstreamBuffers();
+    }
+    catch (const std::exception &)
+    {
+        try
+        {
+            DestroyResources();
+        }
+        catch (const std::exception &)
+        {
+            if (encoder_) api_->nvEncDestroyEncoder(encoder_);
+            encoder_ = nullptr;
+        }
+        api_ = nullptr;
+        throw;
+    }
+
+    isInitialized_ = true;
+}
+
+
+void Nvenc::Finalize()
+{
+    if (!isInitialized_) return;
+
+    EndEncode();
+    ReleaseLeasedBitstreams();
+    DestroyResources();
+    api_ = nullptr;
+
+    isInitialized_ = false;
+}
+
+
+// Each step skips what was never made, so this also tears down a session
+// whose initialization failed part-way.
+void Nvenc::DestroyResources()
+{
+    DestroyBitstreamBuffers();
+    UnregisterResources();
+    DestroyInputBuffers();
+    colorConverter_.reset();
+    DestroyInputTextures();
+    DestroyCompletionEvents();
+    DestroyEncoder();
+}
+
+
+void Nvenc::ThrowErrorIfNotInitialized()
+{
+    if (!IsValid()) ThrowError("NVENC has not been initialized yet.");
+}
+
+
+void Nvenc::OpenEncodeSession()
+{
+    NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS encSessionParams = { NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS_VER };
+    encSessionParams.device = desc_.device->GetEncodeDevice();
+    encSessionParams.deviceType = desc_.backend->GetDeviceType();
+    encSessionParams.apiVersion = NVENCAPI_VERSION;
+
+    // A session that failed to open still has to be destroyed.
+    const auto status = api_->nvEncOpenEncodeSessionEx(&encSessionParams, &encoder_);
+    if (status != NV_ENC_SUCCESS)
+    {
+        if (encoder_) api_->nvEncDestroyEncoder(encoder_);
+        encoder_ = nullptr;
+        OutputNvencApiError("api_->nvEncOpenEncodeSessionEx", status);
+    }
+}
+
+
+void Nvenc::CheckEncoderCaps()
+{
+    // Rejecting here gives a reason, where nvEncInitializeEncoder would only
+    // report an invalid parameter.
+    const char *error = nullptr;
+    try
+    {
+        caps_ = GetEncoderCaps(*desc_.backend, *desc_.device, desc_.config.codec, encoder_);
+        error = GetEncoderCapsError(caps_, desc_.config, desc_.width, desc_.height);
+        if (!error && Is10BitBufferFormat(bufferFormat_) && !caps_.supports10Bit)
+        {
+            error = "10-bit input is not supported by this GPU.";
+        }
+    }
+    catch (const std::exception &)
+    {
+        api_->nvEncDestroyEncoder(encoder_);
+        encoder_ = nullptr;
+        throw;
+    }
+
+    if (error)
+    {
+        api_->nvEncDestroyEncoder(encoder_);
+        encoder_ = nullptr;
+        ThrowError(std::string("Unsupported encoder config: ") + error);
+    }
+}
+
+void Nvenc::Resize(const uint32_t width, const uint32_t height)
+{
+    if (desc_.width == width && desc_.height == height) return;
+
+    // Fail before any resource is torn down so that the encoder keeps working
+    // at its current size.
+    if (width > initializeParams_.maxEncodeWidth || height > initializeParams_.maxEncodeHeight)
+    {
+        ThrowError("The resolution exceeds the maximum of the encoder.");
+    }
+
+    // The caller drains with Flush() first, which also sends the end of
+    // stream, so that the frames in flight are not lost.
+    if (IsFlushNeededToResize(width, height) && outputIndex_ != inputIndex_)
+    {
+        ThrowError("Flush before a resize that needs it.");
+    }
+
+    const bool shouldReallocate = width > surfaceWidth_ || height > surfaceHeight_;
+    if (shouldReallocate)
+    {
+        UnregisterResources();
+        DestroyInputBuffers();
+        DestroyInputTextures();
+    }
+
+    ReconfigureSize(width, height);
+
+    if (shouldReallocate)
+    {
+        surfaceWidth_ = std::max(width, desc_.config.maxWidth);
+        surfaceHeight_ = std::max(height, desc_.config.maxHeight);
+        CreateInputTextures();
+        RegisterResources();
+    }
+}
+
+
+bool Nvenc::IsFlushNeededToResize(uint32_t width, uint32_t height) const
+{
+    const bool fitsSurfaces = width <= surfaceWidth_ && height <= surfaceHeight_;
+    const bool holdsFrames = desc_.config.bFrameCount > 0 || desc_.config.lookaheadDepth > 0;
+    return !fitsSurfaces || holdsFrames;
+}
+
+
+void Nvenc::ReconfigureSize(uint32_t width, uint32_t height)
+{
+    NV_ENC_CONFIG config = encodeConfig_;
+
+    NV_ENC_RECONFIGURE_PARAMS reconfigureParams = { NV_ENC_RECONFIGURE_PARAMS_VER };
+    auto &reInitParams = reconfigureParams.reInitEncodeParams;
+    reInitParams = initializeParams_;
+    reInitParams.encodeConfig = &config;
+    reInitParams.encodeWidth = width;
+    reInitParams.encodeHeight = height;
+    reInitParams.darWidth = width;
+    reInitParams.darHeight = height;
+
+    // Frames already in flight keep the size they were submitted with, and the
+    // first frame at the new size starts a new sequence.
+    reconfigureParams.resetEncoder = 1;
+    reconfigureParams.forceIDR = 1;
+    CALL_NVENC_API(api_->nvEncReconfigureEncoder, encoder_, &reconfigureParams);
+    isIdrFramePending_ = true;
+
+    desc_.width = width;
+    desc_.height = height;
+    initializeParams_.encodeWidth = width;
+    initializeParams_.encodeHeight = height;
+    initializeParams_.darWidth = width;
+    initializeParams_.darHeight = height;
+}
+
+
+
+void Nvenc::InitializeEncoder()
+{
+    const auto &settings = desc_.config;
+    const bool isHevc = settings.codec == NvencCodec::HEVC;
+    const bool isConverted = settings.inputConversion != NvencInputConversion::None;
+    const bool isYuv444 = settings.inputConversion == NvencInputConversion::Yuv444;
+
+    NV_ENC_INITIALIZE_PARAMS initParams = { NV_ENC_INITIALIZE_PARAMS_VER };
+    initParams.encodeGUID = GetCodecGuid(settings.codec);
+    initParams.presetGUID = GetPresetGuid(settings.preset);
+    initParams.encodeWidth = desc_.width;
+    initParams.encodeHeight = desc_.height;
+    initParams.darWidth = desc_.width;
+    initParams.darHeight = desc_.height;
+    initParams.frameRateNum = desc_.frameRate;
+    initParams.frameRateDen = 1;
+    initParams.enablePTD = 1;
+    initParams.reportSliceOffsets = settings.enableSubFrameReadback ? 1 : 0;
+    initParams.enableSubFrameWrite = settings.enableSubFrameReadback ? 1 : 0;
+    initParams.maxEncodeWidth = std::max(std::min(4096U, caps_.maxWidth), surfaceWidth_);
+    initParams.maxEncodeHeight = std::max(std::min(4096U, caps_.maxHeight), surfaceHeight_);
+    initParams.enableMEOnlyMode = false;
+    initParams.enableOutputInVidmem = false;
+    // NVENC only reports slice offsets to synchronous sessions.
+    initParams.enableEncodeAsync = settings.enableSubFrameReadback ? 0 : 1;
+
+    NV_ENC_PRESET_CONFIG presetConfig = { NV_ENC_PRESET_CONFIG_VER, { NV_ENC_CONFIG_VER } };
+    CALL_NVENC_API(api_->nvEncGetEncodePresetConfig, encoder_, initParams.encodeGUID, initParams.presetGUID, &presetConfig);
+
+    NV_ENC_CONFIG config = { NV_ENC_CONFIG_VER };
+    memcpy(&config, &presetConfig.presetCfg, sizeof(NV_ENC_CONFIG));
+    config.profileGUID = GetProfileGuid(settings, bufferFormat_);
+    config.frameIntervalP = settings.bFrameCount + 1;
+    config.gopLength = settings.gopLength ? settings.gopLength : 2 * desc_.frameRate;
+
+    auto &rcParams = config.rcParams;
+    rcParams.rateControlMode = GetRateControlMode(settings.rateControlMode);
+    if (settings.rateControlMode == NvencRateControlMode::ConstQp)
+    {
+        rcParams.constQP = { settings.targetQuality, settings.targetQuality, settings.targetQuality };
+    }
+    else
+    {
+        rcParams.targetQuality = static_cast<uint8_t>(settings.targetQuality);
+    }
+    if (settings.averageBitRate) rcParams.averageBitRate = settings.averageBitRate;
+    if (settings.maxBitRate)
+    {
+        rcParams.maxBitRate = settings.maxBitRate;
+    }
+    else if (settings.rateControlMode == NvencRateControlMode::Vbr)
+    {
+        rcParams.maxBitRate = (static_cast<unsigned int>(12.0f * desc_.width * desc_.height) / (1920 * 1080))* (100 * 10000);
+    }
+    if (settings.vbvBufferSize)
+    {
+        rcParams.vbvBufferSize = settings.vbvBufferSize;
+        rcParams.vbvInitialDelay = settings.vbvBufferSize;
+    }
+    if (settings.lookaheadDepth)
+    {
+        rcParams.enableLookahead = 1;
+        rcParams.lookaheadDepth = static_cast<uint16_t>(settings.lookaheadDepth);
+    }
+    rcParams.enableAQ = settings.enableSpatialAq ? 1 : 0;
+    rcParams.aqStrength = settings.aqStrength;
+    rcParams.enableTemporalAQ = settings.enableTemporalAq ? 1 : 0;
+    rcParams.qpMapMode = settings.enableQpDeltaMap ? NV_ENC_QP_MAP_DELTA : NV_ENC_QP_MAP_DISABLED;
+
+    initParams.encodeConfig = &config;
+
+    // NVENC only runs periodic intra-refresh waves in an infinite GOP, so a
+    // GOP length given with intra refresh only sets the IDR period.
+    auto idrPeriod = config.gopLength;
+    uint32_t intraRefreshPeriod = 0;
+    uint32_t intraRefreshCount = 0;
+    if (settings.enableIntraRefresh)
+    {
+        config.gopLength = NVENC_INFINITE_GOPLENGTH;
+        idrPeriod = settings.gopLength ? settings.gopLength : NVENC_INFINITE_GOPLENGTH;
+        intraRefreshPeriod = settings.intraRefreshPeriod ? settings.intraRefreshPeriod : 2 * desc_.frameRate;
+        intraRefreshCount = settings.intraRefreshCount ? settings.intraRefreshCount : std::max(desc_.frameRate / 2, 1U);
+        intraRefreshCount = std::min(intraRefreshCount, intraRefreshPeriod - 1);
+    }
+
+    uint32_t ltrFrameCount = 0;
+    if (settings.enableLtr)
+    {
+        ltrFrameCount = settings.ltrFrameCount ? settings.ltrFrameCount : std::min(caps_.maxLtrFrameCount, maxLtrSlotCount);
+    }
+
+    if (isHevc)
+    {
+        // repeatSPSPPS also repeats the VPS in front of every IDR.
+        auto &hevcConfig = config.encodeCodecConfig.hevcConfig;
+        hevcConfig.repeatSPSPPS = 1;
+        hevcConfig.chromaFormatIDC = isYuv444 ? 3 : 1;
+        hevcConfig.pixelBitDepthMinus8 =
+            settings.profile == NvencProfile::HevcMain10 || Is10BitBufferFormat(bufferFormat_) ? 2 : 0;
+        hevcConfig.maxNumRefFramesInDPB = 0;
+        hevcConfig.idrPeriod = idrPeriod;
+        hevcConfig.enableIntraRefresh = settings.enableIntraRefresh ? 1 : 0;
+        hevcConfig.intraRefreshPeriod = intraRefreshPeriod;
+        hevcConfig.intraRefreshCnt = intraRefreshCount;
+        hevcConfig.enableLTR = settings.enableLtr ? 1 : 0;
+        hevcConfig.ltrNumFrames = ltrFrameCount;
+        hevcConfig.ltrTrustMode = settings.ltrTrustMode ? 1 : 0;
+        hevcConfig.sliceMode = static_cast<uint32_t>(settings.sliceMode);
+        hevcConfig.sliceModeData = settings.sliceModeData;
+        if (isConverted) SetColorDescription(hevcConfig.hevcVUIParameters, settings);
+    }
+    else
+    {
+        auto &h264Config = config.encodeCodecConfig.h264Config;
+        h264Config.repeatSPSPPS = 1;
+        h264Config.chromaFormatIDC = isYuv444 ? 3 : 1;
+        h264Config.maxNumRefFrames = 0;
+        h264Config.idrPeriod = idrPeriod;
+        h264Config.enableIntraRefresh = settings.enableIntraRefresh ? 1 : 0;
+        h264Config.intraRefreshPeriod = intraRefreshPeriod;
+        h264Config.intraRefreshCnt = intraRefreshCount;
+        h264Config.outputRecoveryPointSEI = settings.enableIntraRefresh ? 1 : 0;
+        h264Config.enableLTR = settings.enableLtr ? 1 : 0;
+        h264Config.ltrNumFrames = ltrFrameCount;
+        h264Config.ltrTrustMode = settings.ltrTrustMode ? 1 : 0;
+        h264Config.sliceMode = static_cast<uint32_t>(settings.sliceMode);
+        h264Config.sliceModeData = settings.sliceModeData;
+        if (isConverted) SetColorDescription(h264Config.h264VUIParameters, settings);
+    }
+
+    CALL_NVENC_API(api_->nvEncInitializeEncoder, encoder_, &initParams);
+
+    memcpy(&encodeConfig_, &config, sizeof(config));
+    memcpy(&initializeParams_, &initParams, sizeof(initializeParams_));
+
+    initializeParams_.encodeConfig = &encodeConfig_;
+
+    ltrFrameIndices_.assign(ltrFrameCount, noLtrFrameIndex);
+    framesSinceIdr_ = 0;
+    isIdrFramePending_ = true;
+
+    // NVENC wants room for one offset per macroblock of the largest frame.
+    if (settings.enableSubFrameReadback)
+    {
+        const auto mbCols = (initParams.maxEncodeWidth + 15) / 16;
+        const auto mbRows = (initParams.maxEncodeHeight + 15) / 16;
+        sliceOffsets_.resize(static_cast<size_t>(mbCols) * mbRows);
+    }
+}
+
+
+void Nvenc::CreateCompletionEvents()
+{
+    ThrowErrorIfNotInitialized();
+
+    // Synchronous sessions are polled instead, so only the async ones
+    // register their events.
+    const bool isAsync = initializeParams_.enableEncodeAsync != 0;
+
+    // An event is only kept once it is registered, so that a failure leaves
+    // nothing for DestroyCompletionEvents to unregister that never was.
+    const auto createEvent = [&]
+    {
+        auto event = std::make_unique<Event>();
+        if (isAsync)
+        {
+            NV_ENC_EVENT_PARAMS eventParams = { NV_ENC_EVENT_PARAMS_VER };
+            eventParams.completionEvent = event->GetNativeHandle();
+            CALL_NVENC_API(api_->nvEncRegisterAsyncEvent, encoder_, &eventParams);
+        }
+        return event;
+    };
+
+    for (auto &resource : resources_)
+    {
+        resource.completionEvent_ = createEvent();
+    }
+    eosEvent_ = createEvent();
+}
+
+
+void Nvenc::DestroyCompletionEvents()
+{
+    ThrowErrorIfNotInitialized();
+
+    const bool isAsync = initializeParams_.enableEncodeAsync != 0;
+
+    for (auto &resource : resources_)
+    {
+        if (!resource.completionEvent_) continue;
+
+        if (isAsync)
+        {
+            NV_ENC_EVENT_PARAMS eventParams = { NV_ENC_EVENT_PARAMS_VER };
+            eventParams.completionEvent = resource.completionEvent_->GetNativeHandle();
+            CALL_NVENC_API(api_->nvEncUnregisterAsyncEvent, encoder_, &eventParams);
+        }
+        resource.completionEvent_.reset();
+    }
+
+    if (eosEvent_)
+    {
+        if (isAsync)
+        {
+            NV_ENC_EVENT_PARAMS eventParams = { NV_ENC_EVENT_PARAMS_VER };
+            eventParams.completionEvent = eosEvent_->GetNativeHandle();
+            CALL_NVENC_API(api_->nvEncUnregisterAsyncEvent, encoder_, &eventParams);
+        }
+        eosEvent_.reset();
+    }
+}
+
+
+void Nvenc::CreateBitstreamBuffers()
+{
+    ThrowErrorIfNotInitialized();
+
+    for (auto &resource : resources_)
+    {
+        NV_ENC_CREATE_BITSTREAM_BUFFER createBitstreamBuffer = { NV_ENC_CREATE_BITSTREAM_BUFFER_VER };
+        CALL_NVENC_API(api_->nvEncCreateBitstreamBuffer, encoder_, &createBitstreamBuffer);
+        resource.bitstreamBuffer_ = createBitstreamBuffer.bitstreamBuffer;
+    }
+}
+
+
+void Nvenc::CreateInputTextures()
+{
+    ThrowErrorIfNotInitialized();
+
+    // The textures are opened on the Unity device once here instead of on every
+    // copy, and stay valid until the next resize.
+    for (auto &resource : resources_)
+    {
+        resource.inputTexture_ = desc_.device->CreateSharedTexture(
+            surfaceWidth_, 
+            surfaceHeight_, 
+            desc_.format, 
+            &resource.inputTextureSharedHandle_);
+
+        resource.sharedInputTexture_ = desc_.device->OpenSharedTexture(resource.inputTextureSharedHandle_);
+        if (!resource.sharedInputTexture_)
+        {
+            ThrowError("Failed to open shared texture.");
+            return;
+        }
+    }
+
+    if (!copyContext_)
+    {
+        copyContext_ = desc_.device->GetImmediateContext();
+    }
+}
+
+
+void Nvenc::DestroyInputTextures()
+{
+    ThrowErrorIfNotInitialized();
+
+    for (auto &resource : resources_)
+    {
+        desc_.device->ReleaseTexture(resource.sharedInputTexture_);
+        desc_.device->ReleaseTexture(resource.inputTexture_);
+        resource.sharedInputTexture_ = nullptr;
+        resource.inputTexture_ = nullptr;
+        resource.inputTextureSharedHandle_ = nullptr;
+    }
+
+    desc_.device->ReleaseContext(copyContext_);
+    copyContext_ = nullptr;
+}
+
+
+void Nvenc::RegisterResources()
+{
+    ThrowErrorIfNotInitialized();
+
+    for (auto &resource : resources_)
+    {
+        NV_ENC_REGISTER_RESOURCE registerResource = { NV_ENC_REGISTER_RESOURCE_VER };
+        registerResource.resourceType = NV_ENC_INPUT_RESOURCE_TYPE_DIRECTX;
+        registerResource.resourceToRegister = resource.inputTexture_;
+        registerResource.width = surfaceWidth_;
+        registerResource.height = surfaceHeight_;
+        registerResource.pitch = 0;
+        registerResource.bufferFormat = bufferFormat_;
+        registerResource.bufferUsage = NV_ENC_INPUT_IMAGE;
+        CALL_NVENC_API(api_->nvEncRegisterResource, encoder_, &registerResource);
+
+        resource.registeredResource_ = registerResource.registeredResource;
+    }
+}
+
+
+void Nvenc::UnregisterResources()
+{
+    ThrowErrorIfNotInitialized();
+
+    for (auto &resource : resources_)
+    {
+        if (!resource.registeredResource_) continue;
+        CALL_NVENC_API(api_->nvEncUnregisterResource, encoder_, resource.registeredResource_);
+        resource.registeredResource_ = nullptr;
+    }
+}
+
+
+void Nvenc::CreateInputBuffer(int index, NV_ENC_BUFFER_FORMAT bufferFormat)
+{
+    ThrowErrorIfNotInitialized();
+
+    auto &resource = resources_[index];
+
+    NV_ENC_CREATE_INPUT_BUFFER createInputBuffer = { NV_ENC_CREATE_INPUT_BUFFER_VER };
+    createInputBuffer.width = surfaceWidth_;
+    createInputBuffer.height = surfaceHeight_;
+    createInputBuffer.bufferFmt = bufferFormat;
+    CALL_NVENC_API(api_->nvEncCreateInputBuffer, encoder_, &createInputBuffer);
+
+    resource.inputBuffer_ = createInputBuffer.inputBuffer;
+    resource.inputBufferFormat_ = bufferFormat;
+}
+
+
+void Nvenc::DestroyInputBuffers()
+{
+    ThrowErrorIfNotInitialized();
+
+    for (auto &resource : resources_)
+    {
+        if (!resource.inputBuffer_) continue;
+        CALL_NVENC_API(api_->nvEncDestroyInputBuffer, encoder_, resource.inputBuffer_);
+        resource.inputBuffer_ = nullptr;
+        resource.inputBufferFormat_ = NV_ENC_BUFFER_FORMAT_UNDEFINED;
+    }
+}
+
+
+void Nvenc::DestroyBitstreamBuffers()
+{
+    ThrowErrorIfNotInitialized();
+
+    for (auto &resource : resources_)
+    {
+        if (!resource.bitstreamBuffer_) continue;
+        CALL_NVENC_API(api_->nvEncDestroyBitstreamBuffer, encoder_, resource.bitstreamBuffer_);
+        resource.bitstreamBuffer_ = nullptr;
+    }
+}
+
+
+void Nvenc::DestroyEncoder()
+{
+    ThrowErrorIfNotInitialized();
+
+    CALL_NVENC_API(api_->nvEncDestroyEncoder, encoder_);
+    encoder_ = nullptr;
+}
+
+
+void Nvenc::SetRateControl(uint32_t averageBitRate, uint32_t maxBitRate, uint32_t frameRate, bool forceIdrFrame)
+{
+    ThrowErrorIfNotInitialized();
+
+    if (desc_.config.rateControlMode == NvencRateControlMode::ConstQp)
+    {
+        ThrowError("Constant QP has no bitrate to change.");
+    }
+    if (!caps_.supportsDynamicBitrateChange) ThrowError("This GPU cannot change the bitrate while encoding.");
+
+    NV_ENC_CONFIG config = encodeConfig_;
+    auto &rcParams = config.rcParams;
+    if (averageBitRate) rcParams.averageBitRate = averageBitRate;
+    if (maxBitRate) rcParams.maxBitRate = maxBitRate;
+    if (rcParams.maxBitRate && rcParams.maxBitRate < rcParams.averageBitRate)
+    {
+        ThrowError("The max bitrate is lower than the average bitrate.");
+    }
+
+    // Only the rate control fields differ from the running session, so the
+    // ring keeps its textures, bitstream buffers and in-flight frames.
+    NV_ENC_RECONFIGURE_PARAMS reconfigureParams = { NV_ENC_RECONFIGURE_PARAMS_VER };
+    auto &reInitParams = reconfigureParams.reInitEncodeParams;
+    reInitParams = initializeParams_;
+    reInitParams.encodeConfig = &config;
+    if (frameRate)
+    {
+        reInitParams.frameRateNum = frameRate;
+        reInitParams.frameRateDen = 1;
+    }
+    reconfigureParams.resetEncoder = forceIdrFrame ? 1 : 0;
+    reconfigureParams.forceIDR = forceIdrFrame ? 1 : 0;
+    CALL_NVENC_API(api_->nvEncReconfigureEncoder, encoder_, &reconfigureParams);
+    if (forceIdrFrame) isIdrFramePending_ = true;
+
+    encodeConfig_ = config;
+    initializeParams_.frameRateNum = reInitParams.frameRateNum;
+    initializeParams_.frameRateDen = reInitParams.frameRateDen;
+    initializeParams_.encodeConfig = &encodeConfig_;
+    desc_.config.averageBitRate = rcParams.averageBitRate;
+    desc_.config.maxBitRate = rcParams.maxBitRate;
+    if (frameRate) desc_.frameRate = frameRate;
+}
+
+
+bool Nvenc::Encode(void *source, const EncodeOptions &options, bool startIntraRefresh, const int8_t *qpDeltaMap)
+{
+    if (!source) ThrowError("The source texture is null.");
+    return EncodeFrame(source, nullptr, options, startIntraRefresh, qpDeltaMap);
+}
+
+
+void * Nvenc::GetNextInputTexture() const
+{
+    if (!isInitialized_ || resources_.empty()) return nullptr;
+
+    const auto &resource = resources_[GetInputIndex()];
+    return resource.isEncoding_ ? nullptr : resource.sharedInputTexture_;
+}
+
+
+bool Nvenc::EncodeNextInputTexture(const EncodeOptions &options, bool startIntraRefresh, const int8_t *qpDeltaMap)
+{
+    return EncodeFrame(nullptr, nullptr, options, startIntraRefresh, qpDeltaMap);
+}
+
+
+bool Nvenc::EncodeFromMemory(const NvencMemoryFrame &frame, const EncodeOptions &options, bool startIntraRefresh, const int8_t *qpDeltaMap)
+{
+    ThrowErrorIfNotInitialized();
+
+    CheckMemoryFrame(frame);
+    return EncodeFrame(nullptr, &frame, options, startIntraRefresh, qpDeltaMap);
+}
+
+
+void Nvenc::CheckMemoryFrame(const NvencMemoryFrame &frame) const
+{
+    if (!frame.data) ThrowError("The frame data is null.");
+    if (const auto error = GetInputFormatError(frame.format, desc_.config))
+    {
+        ThrowError(std::string("Unsupported input format: ") + error);
+    }
+
+    const auto bufferFormat = GetBufferFormat(frame.format);
+    if (Is10BitBufferFormat(bufferFormat) != Is10BitBufferFormat(bufferFormat_))
+    {
+        ThrowError("The frame format must have the bit depth of the encoder format.");
+    }
+    if (frame.pitch < static_cast<uint64_t>(desc_.width) * GetBytesPerPixel(bufferFormat))
+    {
+        ThrowError("The pitch is shorter than a row of the frame.");
+    }
+}
+
+
+bool Nvenc::EncodeFrame(void *source, const NvencMemoryFrame *frame, const EncodeOptions &options, bool startIntraRefresh, const int8_t *qpDeltaMap)
+{
+    ThrowErrorIfNotInitialized();
+
+    if (qpDeltaMap && !desc_.config.enableQpDeltaMap) ThrowError("QP delta maps are not enabled.");
+
+    const bool isIntraRefreshEnabled = desc_.config.enableIntraRefresh != 0;
+    const bool forceIdrFrame = options.forceIdrFrame || (startIntraRefresh && !isIntraRefreshEnabled);
+    const bool isIdrFrame = forceIdrFrame || IsIdrFrameDue();
+    CheckLtrOptions(options, isIdrFrame);
+
+    uint64_t frameHash = 0;
+    bool hasFrameHash = false;
+    bool isDuplicate = false;
+    if (desc_.config.enableStaticFrameSkip)
+    {
+        bool isUnchanged = options.isUnchanged != 0;
+        if (frame && !isUnchanged)
+        {
+            frameHash = HashMemoryFrame(*frame);
+            hasFrameHash = true;
+            isUnchanged = hasLastFrameHash_ && frameHash == lastFrameHash_;
+        }
+        else if (isUnchanged)
+        {
+            frameHash = lastFrameHash_;
+            hasFrameHash = hasLastFrameHash_;
+        }
+
+        isDuplicate = isUnchanged && hasLastFrame_;
+        const bool hasRequest = isIdrFrame || startIntraRefresh || options.markLtrFrame || options.useLtrFrames;
+        if (isDuplicate && ShouldSkipUnchangedFrame(hasRequest)) return true;
+    }
+
+    // An IDR frame references nothing, so it also recovers from any loss.
+    EncodeOptions frameOptions = options;
+    frameOptions.forceIdrFrame = forceIdrFrame ? 1 : 0;
+    if (isIdrFrame) frameOptions.useLtrFrames = 0;
+
+    // The caller may retry a frame that is not taken or give up on it, so
+    // after a changed one the next frame cannot be known to equal anything.
+    if (!isDuplicate) hasLastFrame_ = false;
+
+    const auto index = GetInputIndex();
+    auto &resource = resources_[index];
+
+    if (resource.isEncoding_) 
+    {
+		return false;
+    }
+    resource.isEncoding_ = true;
+
+    if (frame)
+    {
+        try
+        {
+            CopyToInputBuffer(index, *frame);
+        }
+        catch (const std::exception &)
+        {
+            resource.isEncoding_ = false;
+            throw;
+        }
+    }
+    else
+    {
+        // Without a source the caller has already filled the texture.
+        if (source && !CopyToInputTexture(index, source))
+        {
+            resource.isEncoding_ = false;
+            return false;
+        }
+
+        MapInputResource(index);
+        resource.inputFormat_ = bufferFormat_;
+    }
+
+    resource.submitTime_ = std::chrono::steady_clock::now();
+    bool isEncoded = false;
+    try
+    {
+        isEncoded = EncodeInputTexture(index, frameOptions, startIntraRefresh, qpDeltaMap);
+    }
+    catch (const std::exception &)
+    {
+        // The slot takes the next frame, and a mapped resource could not be
+        // unregistered.
+        resource.isEncoding_ = false;
+        UnmapInputResource(index);
+        throw;
+    }
+
+    if (isEncoded)
+    {
+        UpdateReferences(frameOptions, isIdrFrame);
+        ++inputIndex_;
+        hasLastFrame_ = true;
+        hasLastFrameHash_ = hasFrameHash;
+        lastFrameHash_ = frameHash;
+        duplicateFrameRun_ = 0;
+        if (isDuplicate) ++duplicateFrameCount_;
+		return true;
+    }
+    else
+    {
+        resource.isEncoding_ = false;
+		return false;
+    }
+}
+
+
+// Hashes the rows that are encoded, so the padding of the pitch is ignored.
+// The format is part of the hash since the same bytes differ in another one.
+uint64_t Nvenc::HashMemoryFrame(const NvencMemoryFrame &frame) const
+{
+    const auto bufferFormat = GetBufferFormat(frame.format);
+    const size_t rowSize = static_cast<size_t>(desc_.width) * GetBytesPerPixel(bufferFormat);
+    const auto *data = static_cast<const uint8_t*>(frame.data);
+    auto hash = HashRows(data, frame.pitch, rowSize, desc_.height, static_cast<uint64_t>(frame.format));
+    if (HasChromaPlane(bufferFormat))
+    {
+        const auto *chroma = data + static_cast<size_t>(frame.pitch) * desc_.height;
+        hash = HashRows(chroma, frame.pitch, rowSize, (desc_.height + 1) / 2, hash);
+    }
+    return hash;
+}
+
+
+// A frame that carries a request is encoded even when nothing changed, and
+// so is every keep-alive frame, which NVENC codes as a P-frame of skipped
+// blocks. Encoded duplicates are counted once they are submitted.
+bool Nvenc::ShouldSkipUnchangedFrame(bool hasRequest)
+{
+    const auto keepAlive = desc_.config.staticFrameKeepAlive ? desc_.config.staticFrameKeepAlive : desc_.frameRate;
+    if (hasRequest || duplicateFrameRun_ + 1 >= keepAlive) return false;
+
+    ++duplicateFrameRun_;
+    ++duplicateFrameCount_;
+    ++skippedDuplicateFrameCount_;
+    return true;
+}
+
+
+bool Nvenc::CopyToInputTexture(int index, void *texture)
+{
+    ThrowErrorIfNotInitialized();
+
+    auto &resource = resources_[index];
+    if (!resource.sharedInputTexture_ || !copyContext_) return false;
+
+    desc_.device->CopyTexture(copyContext_, resource.sharedInputTexture_, texture, desc_.width, desc_.height);
+    desc_.device->Flush(copyContext_);
+    return true;
+}
+
+
+void Nvenc::CopyToInputBuffer(int index, const NvencMemoryFrame &frame)
+{
+    ThrowErrorIfNotInitialized();
+
+    auto &resource = resources_[index];
+    const auto frameFormat = GetBufferFormat(frame.format);
+    const auto bufferFormat = GetConvertedBufferFormat(frameFormat, desc_.config.inputConversion);
+    if (resource.inputBuffer_ && resource.inputBufferFormat_ != bufferFormat)
+    {
+        CALL_NVENC_API(api_->nvEncDestroyInputBuffer, encoder_, resource.inputBuffer_);
+        resource.inputBuffer_ = nullptr;
+    }
+    if (!resource.inputBuffer_)
+    {
+        CreateInputBuffer(index, bufferFormat);
+    }
+
+    // The slot is not encoding, so the lock does not wait.
+    NV_ENC_LOCK_INPUT_BUFFER lockInputBuffer = { NV_ENC_LOCK_INPUT_BUFFER_VER };
+    lockInputBuffer.inputBuffer = resource.inputBuffer_;
+    CALL_NVENC_API(api_->nvEncLockInputBuffer, encoder_, &lockInputBuffer);
+
+    auto *destination = static_cast<uint8_t*>(lockInputBuffer.bufferDataPtr);
+    const auto *source = static_cast<const uint8_t*>(frame.data);
+    // The planes after the first start below the first plane of the whole
+    // buffer.
+    const size_t planeSize = static_cast<size_t>(lockInputBuffer.pitch) * surfaceHeight_;
+    if (bufferFormat != frameFormat)
+    {
+        // Larger frames convert on more threads, so a resize may change them.
+        const auto threadCount = GetConversionThreadCount(desc_.width, desc_.height);
+        if (!colorConverter_ || colorConverter_->GetThreadCount() != threadCount)
+        {
+            colorConverter_ = std::make_unique<ColorConverter>(threadCount);
+        }
+
+        const bool isNv12 = bufferFormat == NV_ENC_BUFFER_FORMAT_NV12;
+        const RgbImage image = { source, frame.pitch, desc_.width, desc_.height, frameFormat == NV_ENC_BUFFER_FORMAT_ARGB };
+        const YuvImage yuv = { destination, destination + planeSize, isNv12 ? nullptr : destination + 2 * planeSize, lockInputBuffer.pitch };
+        colorConverter_->Convert(
+            image, yuv, isNv12 ? YuvFormat::Nv12 : YuvFormat::Yuv444,
+            desc_.config.colorMatrix, desc_.config.colorRange);
+    }
+    else
+    {
+        const size_t rowSize = static_cast<size_t>(desc_.width) * GetBytesPerPixel(bufferFormat);
+        StreamCopyRows(destination, lockInputBuffer.pitch, source, frame.pitch, rowSize, desc_.height);
+        if (HasChromaPlane(bufferFormat))
+        {
+            StreamCopyRows(
+                destination + planeSize,
+                lockInputBuffer.pitch,
+                source + static_cast<size_t>(frame.pitch) * desc_.height,
+                frame.pitch,
+                rowSize,
+                (desc_.height + 1) / 2);
+        }
+    }
+
+    CALL_NVENC_API(api_->nvEncUnlockInputBuffer, encoder_, resource.inputBuffer_);
+    resource.inputResource_ = resource.inputBuffer_;
+    resource.inputFormat_ = bufferFormat;
+}
+
+
+bool Nvenc::EncodeInputTexture(int index, const EncodeOptions &options, bool startIntraRefresh, const int8_t *qpDeltaMap)
+{
+    ThrowErrorIfNotInitialized();
+
+    auto &resource = resources_[index];
+
+    NV_ENC_PIC_PARAMS picParams = { NV_ENC_PIC_PARAMS_VER };
+    picParams.pictureStruct = NV_ENC_PIC_STRUCT_FRAME;
+    picParams.inputBuffer = resource.inputResource_;
+    picParams.bufferFmt = resource.inputFormat_;
+    picParams.inputWidth = desc_.width;
+    picParams.inputHeight = desc_.height;
+    picParams.outputBitstream = resource.bitstreamBuffer_;
+    if (initializeParams_.enableEncodeAsync)
+    {
+        picParams.completionEvent = resource.completionEvent_->GetNativeHandle();
+    }
+    picParams.frameIdx = static_cast<uint32_t>(inputIndex_);
+    const uint64_t submitTime = std::chrono::duration_cast<std::chrono::microseconds>(
+        resource.submitTime_.time_since_epoch()).count();
+    picParams.inputTimeStamp = std::max(submitTime, lastTimestamp_ + 1);
+    const bool isHevc = desc_.config.codec == NvencCodec::HEVC;
+    if (options.forceIdrFrame)
+    {
+        picParams.encodePicFlags = NV_ENC_PIC_FLAG_FORCEIDR | NV_ENC_PIC_FLAG_OUTPUT_SPSPPS;
+    }
+    else if (startIntraRefresh)
+    {
+        // Parameter sets go in front of the wave for decoders that join late.
+        picParams.encodePicFlags = NV_ENC_PIC_FLAG_OUTPUT_SPSPPS;
+        if (isHevc)
+        {
+            const auto count = encodeConfig_.encodeCodecConfig.hevcConfig.intraRefreshCnt;
+            picParams.codecPicParams.hevcPicParams.forceIntraRefreshWithFrameCnt = count;
+        }
+        else
+        {
+            const auto count = encodeConfig_.encodeCodecConfig.h264Config.intraRefreshCnt;
+            picParams.codecPicParams.h264PicParams.forceIntraRefreshWithFrameCnt = count;
+        }
+    }
+    if (isHevc)
+    {
+        auto &hevcPicParams = picParams.codecPicParams.hevcPicParams;
+        hevcPicParams.ltrMarkFrame = options.markLtrFrame ? 1 : 0;
+        hevcPicParams.ltrMarkFrameIdx = options.markLtrFrame ? options.ltrMarkSlot : 0;
+        hevcPicParams.ltrUseFrames = options.useLtrFrames ? 1 : 0;
+        hevcPicParams.ltrUseFrameBitmap = options.useLtrFrames ? options.ltrUseSlotMask : 0;
+    }
+    else
+    {
+        auto &h264PicParams = picParams.codecPicParams.h264PicParams;
+        h264PicParams.ltrMarkFrame = options.markLtrFrame ? 1 : 0;
+        h264PicParams.ltrMarkFrameIdx = options.markLtrFrame ? options.ltrMarkSlot : 0;
+        h264PicParams.ltrUseFrames = options.useLtrFrames ? 1 : 0;
+        h264PicParams.ltrUseFrameBitmap = options.useLtrFrames ? options.ltrUseSlotMask : 0;
+    }
+
+    // The caller rebuilds its map while this frame may still be encoding, so
+    // every slot keeps its own copy.
+    if (qpDeltaMap)
+    {
+        const auto blockSize = GetQpMapBlockSize(desc_.config.codec);
+        const auto columns = (desc_.width + blockSize - 1) / blockSize;
+        const auto rows = (desc_.height + blockSize - 1) / blockSize;
+        resource.qpDeltaMap_.assign(qpDeltaMap, qpDeltaMap + static_cast<size_t>(columns) * rows);
+        picParams.qpDeltaMap = resource.qpDeltaMap_.data();
+        picParams.qpDeltaMapSize = static_cast<uint32_t>(resource.qpDeltaMap_.size());
+    }
+
+    const auto status = CALL_NVENC_API(api_->nvEncEncodePicture, encoder_, &picParams);
+    if (status != NV_ENC_SUCCESS && status != NV_ENC_ERR_NEED_MORE_INPUT)
+    {
+        return false;
+    }
+
+    lastTimestamp_ = picParams.inputTimeStamp;
+    referenceTimestamps_[inputIndex_ % referenceHistorySize] = lastTimestamp_;
+    return true;
+}
+
+
+void Nvenc::CheckLtrOptions(const EncodeOptions &options, bool isIdrFrame) const
+{
+    if (!options.markLtrFrame && !options.useLtrFrames) return;
+
+    if (!desc_.config.enableLtr) ThrowError("LTR is not enabled.");
+
+    if (options.markLtrFrame)
+    {
+        if (desc_.config.ltrTrustMode) ThrowError("LTR frames are marked by NVENC in trust mode.");
+        if (options.ltrMarkSlot >= GetLtrSlotCount()) ThrowError("The LTR slot to mark is out of range.");
+    }
+
+    // The slots that the frame references have to hold a frame once any IDR
+    // frame before it has emptied them.
+    if (options.useLtrFrames && !isIdrFrame)
+    {
+        const auto slotCount = GetLtrSlotCount();
+        const auto mask = options.ltrUseSlotMask;
+        if (mask == 0 || (slotCount < maxLtrSlotCount && (mask >> slotCount) != 0))
+        {
+            ThrowError("The LTR slot mask is out of range.");
+        }
+        for (uint32_t slot = 0; slot < slotCount; ++slot)
+        {
+            if ((mask & (1U << slot)) && ltrFrameIndices_[slot] == noLtrFrameIndex)
+            {
+                ThrowError("The LTR slot mask refers to an empty slot.");
+            }
+        }
+    }
+}
+
+
+// NVENC starts IDR periods on its own after the first frame, a forced IDR
+// frame or a reconfigure that forces one.
+bool Nvenc::IsIdrFrameDue() const
+{
+    if (isIdrFramePending_) return true;
+
+    const auto &codecConfig = encodeConfig_.encodeCodecConfig;
+    const auto idrPeriod = GetCodec() == NvencCodec::HEVC ? codecConfig.hevcConfig.idrPeriod : codecConfig.h264Config.idrPeriod;
+    return idrPeriod != NVENC_INFINITE_GOPLENGTH && framesSinceIdr_ >= idrPeriod;
+}
+
+
+void Nvenc::UpdateReferences(const EncodeOptions &options, bool isIdrFrame)
+{
+    framesSinceIdr_ = isIdrFrame ? 1 : framesSinceIdr_ + 1;
+    isIdrFramePending_ = false;
+
+    if (isIdrFrame)
+    {
+        lastIdrFrameIndex_ = inputIndex_;
+        std::fill(ltrFrameIndices_.begin(), ltrFrameIndices_.end(), noLtrFrameIndex);
+    }
+
+    // Trust mode marks the first reference frames of every IDR period,
+    // starting with the IDR frame itself.
+    if (desc_.config.ltrTrustMode && framesSinceIdr_ <= GetLtrSlotCount())
+    {
+        ltrFrameIndices_[framesSinceIdr_ - 1] = inputIndex_;
+    }
+    else if (options.markLtrFrame)
+    {
+        ltrFrameIndices_[options.ltrMarkSlot] = inputIndex_;
+    }
+}
+
+
+bool Nvenc::GetLtrFrameIndex(uint32_t slot, uint64_t &frameIndex) const
+{
+    if (slot >= GetLtrSlotCount() || ltrFrameIndices_[slot] == noLtrFrameIndex) return false;
+
+    frameIndex = ltrFrameIndices_[slot];
+    return true;
+}
+
+
+int Nvenc::FindLtrSlot(uint64_t frameIndex) const
+{
+    int found = -1;
+    for (uint32_t slot = 0; slot < GetLtrSlotCount(); ++slot)
+    {
+        const auto index = ltrFrameIndices_[slot];
+        if (index == noLtrFrameIndex || index > frameIndex) continue;
+        if (found < 0 || index > ltrFrameIndices_[found]) found = static_cast<int>(slot);
+    }
+    return found;
+}
+
+
+bool Nvenc::IsReference(uint64_t frameIndex) const
+{
+    return frameIndex < inputIndex_ && frameIndex >= lastIdrFrameIndex_ && inputIndex_ - frameIndex <= referenceHistorySize;
+}
+
+
+uint32_t Nvenc::InvalidateRefFrames(const uint64_t *frameIndices, size_t count)
+{
+    ThrowErrorIfNotInitialized();
+
+    if (!caps_.supportsRefPicInvalidation) ThrowError("This GPU cannot invalidate reference frames.");
+
+    uint32_t invalidatedCount = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const auto frameIndex = frameIndices[i];
+        if (!IsReference(frameIndex)) continue;
+
+        const auto timestamp = referenceTimestamps_[frameIndex % referenceHistorySize];
+        CALL_NVENC_API(api_->nvEncInvalidateRefFrames, encoder_, timestamp);
+        ++invalidatedCount;
+
+        // A lost LTR frame would only bring the corruption back.
+        std::replace(ltrFrameIndices_.begin(), ltrFrameIndices_.end(), frameIndex, noLtrFrameIndex);
+    }
+    return invalidatedCount;
+}
+
+
+bool Nvenc::FindFrameIndex(uint64_t timestamp, uint64_t &frameIndex) const
+{
+    const auto historySize = std::min<uint64_t>(inputIndex_, referenceHistorySize);
+    for (uint64_t i = 1; i <= historySize; ++i)
+    {
+        const auto index = inputIndex_ - i;
+        if (referenceTimestamps_[index % referenceHistorySize] == timestamp)
+        {
+            frameIndex = index;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void Nvenc::MapInputResource(int index)
+{
+    ThrowErrorIfNotInitialized();
+
+    auto &resource = resources_[index];
+    if (!resource.registeredResource_) return;
+
+    NV_ENC_MAP_INPUT_RESOURCE mapInputResource = { NV_ENC_MAP_INPUT_RESOURCE_VER };
+    mapInputResource.registeredResource = resource.registeredResource_;
+    CALL_NVENC_API(api_->nvEncMapInputResource, encoder_, &mapInputResource);
+    resource.inputResource_ = mapInputResource.mappedResource;
+}
+
+
+void Nvenc::UnmapInputResource(int index)
+{
+    ThrowErrorIfNotInitialized();
+
+    auto &resource = resources_[index];
+
+    // Input buffers are encoded as they are and never mapped.
+    if (resource.inputResource_ && resource.inputResource_ != resource.inputBuffer_)
+    {
+        CALL_NVENC_API(api_->nvEncUnmapInputResource, encoder_, resource.inputResource_);
+    }
+    resource.inputResource_ = nullptr;
+}
+
+
+void Nvenc::WaitForEncodedData(Event *interruptEvent)
+{
+    ThrowErrorIfNotInitialized();
+
+    if (IsSubFrameReadbackEnabled())
+    {
+        WaitForSlices(interruptEvent);
+        return;
+    }
+
+    using namespace std::chrono;
+
+    Event *events[maxAsyncDepth + 1];
+    size_t count = 0;
+
+    if (interruptEvent)
+    {
+        events[count] = interruptEvent;
+        ++count;
+    }
+
+    auto timeout = completionTimeout;
+    count += AddCompletionEvents(events + count, maxAsyncDepth, timeout);
+    if (count == 0) return;
+
+    auto signaled = Event::WaitAny(events, count, timeout);
+    if (signaled == Event::waitTimeout)
+    {
+        CheckCompletionTimeout();
+        return;
+    }
+
+    // Collect every slot that has already finished so that they are drained in one go.
+    while (signaled != Event::waitTimeout)
+    {
+        if (events[signaled] != interruptEvent) SetCompleted(events[signaled]);
+
+        --count;
+        events[signaled] = events[count];
+        if (count == 0) break;
+
+        signaled = Event::WaitAny(events, count, milliseconds(0));
+    }
+}
+
+
+size_t Nvenc::AddCompletionEvents(Event **events, size_t maxCount, std::chrono::milliseconds &timeout)
+{
+    ThrowErrorIfNotInitialized();
+
+    if (IsSubFrameReadbackEnabled()) return 0;
+
+    using namespace std::chrono;
+
+    size_t count = 0;
+    const Resource *oldestResource = nullptr;
+    for (auto i = outputIndex_; i < inputIndex_ && count < maxCount; ++i)
+    {
+        const auto &resource = resources_[i % GetResourceCount()];
+        if (resource.isCompleted_) continue;
+
+        events[count] = resource.completionEvent_.get();
+        ++count;
+
+        if (!oldestResource) oldestResource = &resource;
+    }
+
+    if (oldestResource)
+    {
+        const auto elapsed = duration_cast<milliseconds>(steady_clock::now() - oldestResource->submitTime_);
+        timeout = std::min(timeout, std::max(completionTimeout - elapsed, milliseconds(0)));
+    }
+
+    return count;
+}
+
+
+void Nvenc::SetCompleted(const Event *event)
+{
+    for (auto i = outputIndex_; i < inputIndex_; ++i)
+    {
+        auto &resource = resources_[i % GetResourceCount()];
+        if (resource.completionEvent_.get() != event) continue;
+
+        resource.isCompleted_ = true;
+        return;
+    }
+}
+
+
+void Nvenc::CheckCompletionTimeout()
+{
+    ThrowErrorIfNotInitialized();
+
+    using namespace std::chrono;
+
+    for (auto i = outputIndex_; i < inputIndex_; ++i)
+    {
+        auto &resource = resources_[i % GetResourceCount()];
+        if (resource.isCompleted_) continue;
+
+        // Only the oldest frame that is still encoding counts.
+        if (steady_clock::now() - resource.submitTime_ < completionTimeout) return;
+
+        resource.submitTime_ = steady_clock::now();
+        ThrowError("Timeout when getting an encoded bitstream.");
+    }
+}
+
+
+void Nvenc::GetEncodedData(std::vector<NvencEncodedData> &data)
+{
+    GetEncodedData(data, isBitstreamLeaseEnabled_);
+}
+
+
+void Nvenc::GetEncodedData(std::vector<NvencEncodedData> &data, bool shouldLease)
+{
+    ThrowErrorIfNotInitialized();
+
+    if (IsSubFrameReadbackEnabled())
+    {
+        GetEncodedSlices(data);
+        return;
+    }
+
+    for (;outputIndex_ < inputIndex_; ++outputIndex_)
+    {
+        const auto index = GetOutputIndex();
+        auto &resource = resources_[index];
+
+        if (!resource.isEncoding_) 
+        {
+            ThrowError("Try to get an invalid bitstream.");
+            continue;
+        }
+
+        if (!resource.isCompleted_) break;
+
+        NV_ENC_LOCK_BITSTREAM lockBitstream = { NV_ENC_LOCK_BITSTREAM_VER };
+        lockBitstream.outputBitstream = resource.bitstreamBuffer_;
+        lockBitstream.doNotWait = false;
+        CALL_NVENC_API(api_->nvEncLockBitstream, encoder_, &lockBitstream);
+
+        NvencEncodedData ed;
+        ed.index = outputIndex_;
+        ed.size = lockBitstream.bitstreamSizeInBytes;
+        ed.pictureType = lockBitstream.pictureType;
+        ed.codec = desc_.config.codec;
+        ed.timestamp = lockBitstream.outputTimeStamp;
+
+        resource.isCompleted_ = false;
+
+        // The input is done with once the bitstream is ready, so only the
+        // bitstream stays with the lease and resizes can replace the inputs.
+        if (shouldLease)
+        {
+            UnmapInputResource(index);
+            ed.leasedBuffer = static_cast<const uint8_t*>(lockBitstream.bitstreamBufferPtr);
+            resource.leasedIndex_ = outputIndex_;
+            resource.isLeased_ = true;
+            data.push_back(std::move(ed));
+            continue;
+        }
+
+        ed.buffer = desc_.bitstreamPool->Acquire(ed.size);
+        ::memcpy(ed.buffer.Get(), lockBitstream.bitstreamBufferPtr, ed.size);
+        data.push_back(std::move(ed));
+
+        CALL_NVENC_API(api_->nvEncUnlockBitstream, encoder_, resource.bitstreamBuffer_);
+
+        UnmapInputResource(index);
+
+        resource.isEncoding_ = false;
+    }
+}
+
+
+// Nothing signals slices, so while a frame is being encoded the bitstream is
+// polled at a fixed interval.
+void Nvenc::WaitForSlices(Event *interruptEvent)
+{
+    using namespace std::chrono;
+
+    if (outputIndex_ == inputIndex_)
+    {
+        if (interruptEvent) interruptEvent->Wait(completionTimeout);
+        return;
+    }
+
+    auto &resource = resources_[GetOutputIndex()];
+    if (steady_clock::now() - resource.submitTime_ > completionTimeout)
+    {
+        resource.submitTime_ = steady_clock::now();
+        ThrowError("Timeout when getting an encoded bitstream.");
+    }
+
+    std::this_thread::sleep_for(sliceReadbackInterval);
+}
+
+
+void Nvenc::GetEncodedSlices(std::vector<NvencEncodedData> &data)
+{
+    for (; outputIndex_ < inputIndex_; ++outputIndex_)
+    {
+        const auto index = GetOutputIndex();
+        auto &resource = resources_[index];
+
+        if (!resource.isEncoding_)
+        {
+            ThrowError("Try to get an invalid bitstream.");
+            continue;
+        }
+
+        NV_ENC_LOCK_BITSTREAM lockBitstream = { NV_ENC_LOCK_BITSTREAM_VER };
+        lockBitstream.outputBitstream = resource.bitstreamBuffer_;
+        lockBitstream.doNotWait = true;
+        lockBitstream.sliceOffsets = sliceOffsets_.data();
+        const auto status = api_->nvEncLockBitstream(encoder_, &lockBitstream);
+        if (status == NV_ENC_ERR_LOCK_BUSY) break;
+        if (status != NV_ENC_SUCCESS) OutputNvencApiError("nvEncLockBitstream", status);
+
+        // Slices end where the next one starts, and the last written one ends
+        // with the written bytes. The first chunk also carries the parameter
+        // sets in front of the first slice.
+        const bool isCompleted = lockBitstream.hwEncodeStatus == hwEncodeStatusCompleted;
+        const auto sliceCount = std::min<uint32_t>(lockBitstream.numSlices, static_cast<uint32_t>(sliceOffsets_.size()));
+        bool hasFrameEnd = false;
+        for (auto i = resource.readbackSliceCount_; i < sliceCount; ++i)
+        {
+            const auto end = i + 1 < sliceCount ? sliceOffsets_[i + 1] : lockBitstream.bitstreamSizeInBytes;
+            hasFrameEnd = isCompleted && end == lockBitstream.bitstreamSizeInBytes;
+            AddEncodedSlice(data, lockBitstream, resource.readbackSize_, end, hasFrameEnd);
+            resource.readbackSize_ = std::max(resource.readbackSize_, end);
+        }
+        resource.readbackSliceCount_ = std::max(resource.readbackSliceCount_, sliceCount);
+
+        // Closes the frame with whatever is left, which is empty when the last
+        // slice was handed out before the encoder reported completion.
+        if (isCompleted && !hasFrameEnd)
+        {
+            AddEncodedSlice(data, lockBitstream, resource.readbackSize_, lockBitstream.bitstreamSizeInBytes, true);
+        }
+
+        CALL_NVENC_API(api_->nvEncUnlockBitstream, encoder_, resource.bitstreamBuffer_);
+
+        if (!isCompleted) break;
+
+        resource.readbackSize_ = 0;
+        resource.readbackSliceCount_ = 0;
+        UnmapInputResource(index);
+        resource.isEncoding_ = false;
+    }
+}
+
+
+void Nvenc::AddEncodedSlice(std::vector<NvencEncodedData> &data, const NV_ENC_LOCK_BITSTREAM &lockBitstream, uint32_t begin, uint32_t end, bool isFrameEnd)
+{
+    NvencEncodedData ed;
+    ed.index = outputIndex_;
+    ed.offset = begin;
+    ed.size = end > begin ? end - begin : 0;
+    ed.isFrameEnd = isFrameEnd;
+    ed.pictureType = lockBitstream.pictureType;
+    ed.codec = desc_.config.codec;
+    ed.timestamp = lockBitstream.outputTimeStamp;
+    ed.buffer = desc_.bitstreamPool->Acquire(ed.size);
+    const auto bitstream = static_cast<const uint8_t*>(lockBitstream.bitstreamBufferPtr);
+    ::memcpy(ed.buffer.Get(), bitstream + begin, ed.size);
+    data.push_back(std::move(ed));
+}
+
+
+bool Nvenc::ReleaseBitstream(uint64_t index)
+{
+    ThrowErrorIfNotInitialized();
+
+    const auto slot = static_cast<int>(index % GetResourceCount());
+    auto &resource = resources_[slot];
+
+    if (!resource.isLeased_ || resource.leasedIndex_ != index) return false;
+    if (!resource.isLeased_.exchange(false)) return false;
+
+    CALL_NVENC_API(api_->nvEncUnlockBitstream, encoder_, resource.bitstreamBuffer_);
+
+    resource.isEncoding_ = false;
+    return true;
+}
+
+
+void Nvenc::ReleaseLeasedBitstreams()
+{
+    ThrowErrorIfNotInitialized();
+
+    for (auto &resource : resources_)
+    {
+        if (!resource.isLeased_) continue;
+        ReleaseBitstream(resource.leasedIndex_);
+    }
+}
+
+
+void Nvenc::Flush(std::vector<NvencEncodedData> &data)
+{
+    ThrowErrorIfNotInitialized();
+
+    if (outputIndex_ == inputIndex_) return;
+
+    // B-frames and lookahead frames stay inside the encoder until it is told
+    // that no more input follows.
+    SendEOS();
+
+    while (outputIndex_ < inputIndex_)
+    {
+        WaitForEncodedData(nullptr);
+        GetEncodedData(data, false);
+    }
+}
+
+
+void Nvenc::EndEncode()
+{
+    ThrowErrorIfNotInitialized();
+
+    if (inputIndex_ == 0U) return;
+
+    if (outputIndex_ == inputIndex_)
+    {
+        SendEOS();
+    }
+    else
+    {
+        std::vector<NvencEncodedData> data;
+        Flush(data);
+    }
+}
+
+
+void Nvenc::SendEOS()
+{
+    ThrowErrorIfNotInitialized();
+
+    const bool isAsync = initializeParams_.enableEncodeAsync != 0;
+
+    NV_ENC_PIC_PARAMS picParams = { NV_ENC_PIC_PARAMS_VER };
+    picParams.encodePicFlags = NV_ENC_PIC_FLAG_EOS;
+    picParams.completionEvent = isAsync ? eosEvent_->GetNativeHandle() : nullptr;
+    CALL_NVENC_API(api_->nvEncEncodePicture, encoder_, &picParams);
+
+    if (isAsync && !eosEvent_->Wait(completionTimeout))
+    {
+        ThrowError("Timeout when waiting for the end of stream.");
+    }
+}
+
+
+}
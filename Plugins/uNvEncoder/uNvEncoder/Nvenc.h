@@ -1,108 +1,265 @@
-#pragma once
-
-#include <vector>
-#include <atomic>
-#include <memory>
-#include <d3d11.h>
-#include <wrl/client.h>
-#include "nvEncodeAPI.h"
-#include "Common.h"
-
-
-namespace uNvEncoder
-{
-
-
-struct NvencDesc
-{
-    ComPtr<ID3D11Device> d3d11Device; 
-    uint32_t width = 1920; 
-    uint32_t height = 1080;
-    DXGI_FORMAT format = DXGI_FORMAT_R8G8B8A8_UNORM;
-    uint32_t frameRate = 60;
-};
-
-
-struct NvencEncodedData
-{
-    uint64_t index = 0;
-    std::unique_ptr<uint8_t[]> buffer;
-    uint32_t size = 0;
-};
-
-
-class Nvenc final
-{
-public:
-    explicit Nvenc(const NvencDesc &desc);
-    ~Nvenc();
-    void Initialize();
-    void Finalize();
-    bool IsValid() const { return encoder_ != nullptr; }
-    void Resize(const uint32_t width, const uint32_t height);
-    bool Encode(const ComPtr<ID3D11Texture2D> &source, bool forceIdrFrame);
-    void GetEncodedData(std::vector<NvencEncodedData> &data);
-    const uint32_t GetWidth() const { return desc_.width; }
-    const uint32_t GetHeight() const { return desc_.height; }
-    const uint32_t GetFrameRate() const { return desc_.frameRate; }
-
-
-private:
-    void ThrowErrorIfNotInitialized();
-
-    void OpenEncodeSession();
-    void InitializeEncoder();
-    void DestroyEncoder();
-    void CreateCompletionEvents();
-    void DestroyCompletionEvents();
-    void CreateBitstreamBuffers();
-    void DestroyBitstreamBuffers();
-    void CreateInputTextures();
-    void RegisterResources();
-    void UnregisterResources();
-
-    bool CopyToInputTexture(int index, const ComPtr<ID3D11Texture2D> &texture);
-    bool EncodeInputTexture(int index, bool forceIdrFrame);
-    void MapInputResource(int index);
-    void UnmapInputResource(int index);
-    bool WaitForCompletion(int index, DWORD duration);
-    void EndEncode();
-    void SendEOS();
-
-    unsigned long GetResourceCount() const { return static_cast<unsigned long>(resources_.size()); }
-    unsigned long GetInputIndex() const { return inputIndex_ % GetResourceCount(); }
-    unsigned long GetOutputIndex() const { return outputIndex_ % GetResourceCount(); }
-
-    NvencDesc desc_;
-    NV_ENC_INITIALIZE_PARAMS initializeParams_ = { NV_ENC_INITIALIZE_PARAMS_VER };
-    NV_ENC_CONFIG encodeConfig_ = { NV_ENC_CONFIG_VER };
-
-    bool isInitialized_ = false;
-    void *encoder_ = nullptr;
-    uint64_t inputIndex_ = 0U;
-    uint64_t outputIndex_ = 0U;
-
-    struct Resource
-    {
-        ComPtr<ID3D11Texture2D> inputTexture_ = nullptr;
-        HANDLE inputTextureSharedHandle_ = nullptr;
-        NV_ENC_REGISTERED_PTR registeredResource_ = nullptr;
-        NV_ENC_INPUT_PTR inputResource_ = nullptr;
-        NV_ENC_OUTPUT_PTR bitstreamBuffer_ = nullptr;
-        void *completionEvent_ = nullptr;
-        std::atomic<bool> isEncoding_ = false;
-    };
-    std::vector<Resource> resources_;
-
-public:
-    static void LoadModule();
-    static void UnloadModule();
-
-private:
-    static HMODULE s_module;
-    static NV_ENCODE_API_FUNCTION_LIST s_nvenc;
-    static uint32_t s_referenceCount;
-};
-
-
-}
+#pragma once
+
+#include <array>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include "nvEncodeAPI.h"
+#include "Common.h"
+#include "GraphicsDevice.h"
+#include "EncodeBackend.h"
+#include "EncoderConfig.h"
+#include "EncodeCaps.h"
+#include "Event.h"
+#include "BitstreamPool.h"
+#include "ColorConversion.h"
+
+
+namespace uNvEncoder
+{
+
+
+// Frames that can still be references, the most an H.264 DPB holds.
+constexpr uint32_t referenceHistorySize = 16;
+// How long a frame may take before the session reports an error.
+constexpr auto completionTimeout = std::chrono::milliseconds(10000);
+
+
+struct NvencDesc
+{
+    IEncodeBackend *backend = nullptr;
+    IGraphicsDevice *device = nullptr;
+    EncoderConfig config;
+    uint32_t width = 1920; 
+    uint32_t height = 1080;
+    DXGI_FORMAT format = DXGI_FORMAT_R8G8B8A8_UNORM;
+    uint32_t frameRate = 60;
+    uint32_t asyncDepth = 3;
+    BitstreamPool *bitstreamPool = nullptr;
+};
+
+
+// A frame in system memory. The chroma plane of NV12 and P010 follows the
+// luma plane at pitch * height bytes.
+struct NvencMemoryFrame
+{
+    const void *data = nullptr;
+    uint32_t pitch = 0;
+    DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN;
+};
+
+
+// One frame, or with sub-frame readback one chunk of slices of the frame
+// starting at offset bytes into it.
+struct NvencEncodedData
+{
+    uint64_t index = 0;
+    BitstreamBuffer buffer;
+    const uint8_t *leasedBuffer = nullptr;
+    uint32_t size = 0;
+    uint32_t offset = 0;
+    bool isFrameEnd = true;
+    NV_ENC_PIC_TYPE pictureType = NV_ENC_PIC_TYPE_UNKNOWN;
+    NvencCodec codec = NvencCodec::H264;
+    uint64_t timestamp = 0;
+
+    const uint8_t * GetBuffer() const { return leasedBuffer ? leasedBuffer : buffer.Get(); }
+    bool IsLeased() const { return leasedBuffer != nullptr; }
+};
+
+
+class Nvenc final
+{
+public:
+    explicit Nvenc(const NvencDesc &desc);
+    ~Nvenc();
+    void Initialize();
+    void Finalize();
+    bool IsValid() const { return encoder_ != nullptr; }
+    // Sizes that fit the input surfaces only reconfigure the session. Larger
+    // ones reallocate the surfaces. Those and sessions that hold frames back
+    // for B-frames or lookahead have to be drained with Flush() first.
+    void Resize(const uint32_t width, const uint32_t height);
+    bool IsFlushNeededToResize(uint32_t width, uint32_t height) const;
+    // startIntraRefresh starts an intra-refresh wave with this frame, or
+    // forces an IDR frame when the session has no intra refresh. LTR options
+    // that do not fit the session or the occupied slots throw before anything
+    // is submitted. qpDeltaMap holds one delta per block of the current size
+    // as laid out by QpMap, or is null.
+    bool Encode(void *source, const EncodeOptions &options, bool startIntraRefresh, const int8_t *qpDeltaMap);
+    // Like Encode but copies the frame into an NVENC input buffer. The
+    // buffers are created the first time, one per async slot, and recreated
+    // when the format changes. The format may differ from the one of the
+    // encoder but not in bit depth. 8-bit RGB frames are converted on the
+    // CPU when the config has an input conversion.
+    bool EncodeFromMemory(const NvencMemoryFrame &frame, const EncodeOptions &options, bool startIntraRefresh, const int8_t *qpDeltaMap);
+    // For callers that fill the input texture of the next slot themselves on
+    // the device of the desc, like simulcast does. The texture is null while
+    // that slot is still encoding, and it is only valid until the frame is
+    // submitted.
+    void * GetNextInputTexture() const;
+    bool EncodeNextInputTexture(const EncodeOptions &options, bool startIntraRefresh, const int8_t *qpDeltaMap);
+    // Changes the bitrates and the frame rate of the running session. Zero
+    // keeps a value as it is. Unlike Resize nothing is flushed or reallocated,
+    // so it has to be called from the thread that calls Encode.
+    void SetRateControl(uint32_t averageBitRate, uint32_t maxBitRate, uint32_t frameRate, bool forceIdrFrame);
+    void WaitForEncodedData(Event *interruptEvent);
+    // Lets one thread wait on the frames in flight of several sessions.
+    // AddCompletionEvents adds the events of the frames that have not
+    // completed yet and shortens the timeout to what the oldest one has left.
+    // SetCompleted marks the frame of a signaled event, and after a timeout
+    // CheckCompletionTimeout throws if the oldest frame is overdue. Sessions
+    // with sub-frame readback are polled and add no events.
+    size_t AddCompletionEvents(Event **events, size_t maxCount, std::chrono::milliseconds &timeout);
+    void SetCompleted(const Event *event);
+    void CheckCompletionTimeout();
+    void GetEncodedData(std::vector<NvencEncodedData> &data);
+    void Flush(std::vector<NvencEncodedData> &data);
+    // In lease mode the NVENC bitstream stays locked and is handed out as is.
+    // The slot is only reused after ReleaseBitstream(). Leases outlast
+    // flushes and resizes, and only Finalize revokes the ones that are still
+    // outstanding. Sessions with sub-frame readback always copy.
+    void SetBitstreamLeaseEnabled(bool enabled) { isBitstreamLeaseEnabled_ = enabled; }
+    bool IsBitstreamLeaseEnabled() const { return isBitstreamLeaseEnabled_; }
+    bool ReleaseBitstream(uint64_t index);
+    NvencCodec GetCodec() const { return desc_.config.codec; }
+    const EncoderConfig & GetConfig() const { return desc_.config; }
+    const EncoderCaps & GetCaps() const { return caps_; }
+    uint32_t GetWidth() const { return desc_.width; }
+    uint32_t GetHeight() const { return desc_.height; }
+    uint32_t GetFrameRate() const { return desc_.frameRate; }
+    uint32_t GetAsyncDepth() const { return static_cast<uint32_t>(resources_.size()); }
+    bool IsSubFrameReadbackEnabled() const { return desc_.config.enableSubFrameReadback != 0; }
+    // LTR bookkeeping follows what has been submitted, so like Encode these
+    // belong to the thread that encodes. Every IDR frame empties all slots.
+    uint32_t GetLtrSlotCount() const { return static_cast<uint32_t>(ltrFrameIndices_.size()); }
+    bool GetLtrFrameIndex(uint32_t slot, uint64_t &frameIndex) const;
+    // Returns the slot of the newest LTR frame that is not newer than the
+    // given frame index, or -1 when no slot holds one.
+    int FindLtrSlot(uint64_t frameIndex) const;
+    // Stops later frames from predicting from frames that the receiver lost.
+    // Frames before the last IDR frame or further back than the reference
+    // history are no references anymore and are skipped. Returns how many
+    // frames were invalidated. Like Encode it belongs to the encoding thread.
+    uint32_t InvalidateRefFrames(const uint64_t *frameIndices, size_t count);
+    // Finds the frame that was submitted with the given timestamp, which is
+    // what NvencEncodedData::timestamp reports. Only the reference history is
+    // searched.
+    bool FindFrameIndex(uint64_t timestamp, uint64_t &frameIndex) const;
+    // Frames found to equal the last submitted one with static-frame skip,
+    // and the ones of them that were not encoded.
+    uint64_t GetDuplicateFrameCount() const { return duplicateFrameCount_; }
+    uint64_t GetSkippedDuplicateFrameCount() const { return skippedDuplicateFrameCount_; }
+
+
+private:
+    void ThrowErrorIfNotInitialized();
+
+    void OpenEncodeSession();
+    void CheckEncoderCaps();
+    void InitializeEncoder();
+    void DestroyEncoder();
+    void DestroyResources();
+    void ReconfigureSize(uint32_t width, uint32_t height);
+    void CreateCompletionEvents();
+    void DestroyCompletionEvents();
+    void CreateBitstreamBuffers();
+    void DestroyBitstreamBuffers();
+    void CreateInputTextures();
+    void DestroyInputTextures();
+    void RegisterResources();
+    void UnregisterResources();
+    void CreateInputBuffer(int index, NV_ENC_BUFFER_FORMAT bufferFormat);
+    void DestroyInputBuffers();
+
+    void CheckMemoryFrame(const NvencMemoryFrame &frame) const;
+    bool EncodeFrame(void *source, const NvencMemoryFrame *frame, const EncodeOptions &options, bool startIntraRefresh, const int8_t *qpDeltaMap);
+    bool CopyToInputTexture(int index, void *texture);
+    void CopyToInputBuffer(int index, const NvencMemoryFrame &frame);
+    bool EncodeInputTexture(int index, const EncodeOptions &options, bool startIntraRefresh, const int8_t *qpDeltaMap);
+    void CheckLtrOptions(const EncodeOptions &options, bool isIdrFrame) const;
+    bool IsIdrFrameDue() const;
+    void UpdateReferences(const EncodeOptions &options, bool isIdrFrame);
+    bool IsReference(uint64_t frameIndex) const;
+    uint64_t HashMemoryFrame(const NvencMemoryFrame &frame) const;
+    bool ShouldSkipUnchangedFrame(bool hasRequest);
+    void MapInputResource(int index);
+    void UnmapInputResource(int index);
+    void GetEncodedData(std::vector<NvencEncodedData> &data, bool shouldLease);
+    void WaitForSlices(Event *interruptEvent);
+    void GetEncodedSlices(std::vector<NvencEncodedData> &data);
+    void AddEncodedSlice(std::vector<NvencEncodedData> &data, const NV_ENC_LOCK_BITSTREAM &lockBitstream, uint32_t begin, uint32_t end, bool isFrameEnd);
+    void ReleaseLeasedBitstreams();
+    void EndEncode();
+    void SendEOS();
+
+    unsigned long GetResourceCount() const { return static_cast<unsigned long>(resources_.size()); }
+    unsigned long GetInputIndex() const { return inputIndex_ % GetResourceCount(); }
+    unsigned long GetOutputIndex() const { return outputIndex_ % GetResourceCount(); }
+
+    NvencDesc desc_;
+    const NV_ENCODE_API_FUNCTION_LIST *api_ = nullptr;
+    EncoderCaps caps_;
+    NV_ENC_BUFFER_FORMAT bufferFormat_ = NV_ENC_BUFFER_FORMAT_UNDEFINED;
+    NV_ENC_INITIALIZE_PARAMS initializeParams_ = { NV_ENC_INITIALIZE_PARAMS_VER };
+    NV_ENC_CONFIG encodeConfig_ = { NV_ENC_CONFIG_VER };
+    std::unique_ptr<Event> eosEvent_;
+    std::vector<uint32_t> sliceOffsets_;
+    std::unique_ptr<ColorConverter> colorConverter_;
+
+    uint32_t surfaceWidth_ = 0;
+    uint32_t surfaceHeight_ = 0;
+
+    bool isInitialized_ = false;
+    void *encoder_ = nullptr;
+    void *copyContext_ = nullptr;
+    std::atomic<uint64_t> inputIndex_ = { 0U };
+    std::atomic<bool> isBitstreamLeaseEnabled_ = { false };
+    uint64_t outputIndex_ = 0U;
+
+    // Frame index held by each LTR slot, or noLtrFrameIndex.
+    std::vector<uint64_t> ltrFrameIndices_;
+    uint32_t framesSinceIdr_ = 0;
+    bool isIdrFramePending_ = true;
+    uint64_t lastIdrFrameIndex_ = 0;
+    // inputTimeStamp of the latest frames by frame index modulo the size.
+    // NVENC invalidates references by timestamp, so they never repeat.
+    std::array<uint64_t, referenceHistorySize> referenceTimestamps_ = {};
+    uint64_t lastTimestamp_ = 0;
+
+    // What static-frame skip compares with. The hash is only known for
+    // frames from memory.
+    bool hasLastFrame_ = false;
+    bool hasLastFrameHash_ = false;
+    uint64_t lastFrameHash_ = 0;
+    uint32_t duplicateFrameRun_ = 0;
+    std::atomic<uint64_t> duplicateFrameCount_ = { 0U };
+    std::atomic<uint64_t> skippedDuplicateFrameCount_ = { 0U };
+
+    struct Resource
+    {
+        void *inputTexture_ = nullptr;
+        void *inputTextureSharedHandle_ = nullptr;
+        void *sharedInputTexture_ = nullptr;
+        NV_ENC_REGISTERED_PTR registeredResource_ = nullptr;
+        NV_ENC_INPUT_PTR inputResource_ = nullptr;
+        NV_ENC_BUFFER_FORMAT inputFormat_ = NV_ENC_BUFFER_FORMAT_UNDEFINED;
+        NV_ENC_INPUT_PTR inputBuffer_ = nullptr;
+        NV_ENC_BUFFER_FORMAT inputBufferFormat_ = NV_ENC_BUFFER_FORMAT_UNDEFINED;
+        NV_ENC_OUTPUT_PTR bitstreamBuffer_ = nullptr;
+        std::unique_ptr<Event> completionEvent_;
+        std::chrono::steady_clock::time_point submitTime_;
+        std::atomic<bool> isEncoding_ = { false };
+        bool isCompleted_ = false;
+        uint32_t readbackSize_ = 0;
+        uint32_t readbackSliceCount_ = 0;
+        std::vector<int8_t> qpDeltaMap_;
+        std::atomic<bool> isLeased_ = { false };
+        std::atomic<uint64_t> leasedIndex_ = { 0U };
+    };
+    std::vector<Resource> resources_;
+};
+
+
+}
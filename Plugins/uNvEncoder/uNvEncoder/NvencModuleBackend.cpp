@@ -0,0 +1,63 @@
+#include "NvencModuleBackend.h"
+#include "D3D11GraphicsDevice.h"
+#include "Common.h"
+
+
+namespace uNvEncoder
+{
+
+
+NvencModuleBackend::NvencModuleBackend()
+{
+#if defined(_WIN64)
+    module_ = ::LoadLibraryA("nvEncodeAPI64.dll");
+#else
+    module_ = ::LoadLibraryA("nvEncodeAPI.dll");
+#endif
+    if (module_ == NULL) ThrowError("NVENC is not available.");
+
+    try
+    {
+        if (const auto funcAddress = ::GetProcAddress(module_, "NvEncodeAPIGetMaxSupportedVersion"))
+        {
+            using FuncType = decltype(NvEncodeAPIGetMaxSupportedVersion);
+            const auto func = reinterpret_cast<FuncType*>(funcAddress);
+            uint32_t version = 0;
+            func(&version);
+            constexpr uint32_t currentVersion = (NVENCAPI_MAJOR_VERSION << 4) | NVENCAPI_MINOR_VERSION;
+            if (currentVersion > version) ThrowError("NVENC version is wrong.");
+        }
+
+        if (const auto funcAddress = ::GetProcAddress(module_, "NvEncodeAPICreateInstance"))
+        {
+            using FuncType = decltype(NvEncodeAPICreateInstance);
+            const auto func = reinterpret_cast<FuncType*>(funcAddress);
+            func(&functionList_);
+        }
+
+        if (!functionList_.nvEncOpenEncodeSessionEx)
+        {
+            ThrowError("Failed to load functions from DLL.");
+        }
+    }
+    catch (...)
+    {
+        ::FreeLibrary(module_);
+        throw;
+    }
+}
+
+
+NvencModuleBackend::~NvencModuleBackend()
+{
+    ::FreeLibrary(module_);
+}
+
+
+std::unique_ptr<IGraphicsDevice> NvencModuleBackend::CreateGraphicsDevice()
+{
+    return std::make_unique<D3D11GraphicsDevice>();
+}
+
+
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <windows.h>
+#include "EncodeBackend.h"
+
+
+namespace uNvEncoder
+{
+
+
+// Backend that loads the NVENC driver DLL and encodes on a D3D11 device
+// created on the same adapter as Unity.
+class NvencModuleBackend final : public IEncodeBackend
+{
+public:
+    NvencModuleBackend();
+    ~NvencModuleBackend();
+    NvencModuleBackend(const NvencModuleBackend &) = delete;
+    NvencModuleBackend & operator=(const NvencModuleBackend &) = delete;
+    const NV_ENCODE_API_FUNCTION_LIST & GetFunctionList() const override { return functionList_; }
+    NV_ENC_DEVICE_TYPE GetDeviceType() const override { return NV_ENC_DEVICE_TYPE_DIRECTX; }
+    std::unique_ptr<IGraphicsDevice> CreateGraphicsDevice() override;
+
+private:
+    HMODULE module_ = NULL;
+    NV_ENCODE_API_FUNCTION_LIST functionList_ = { NV_ENCODE_API_FUNCTION_LIST_VER };
+};
+
+
+}
@@ -0,0 +1,295 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "QpMap.h"
+#include "Common.h"
+
+#ifdef UNVENC_SIMD
+#include <emmintrin.h>
+#endif
+
+
+namespace uNvEncoder
+{
+
+
+namespace
+{
+
+
+// The foveation in pixels of one frame size.
+struct FoveationPixels
+{
+    float gazeX;
+    float gazeY;
+    float innerRadius;
+    float inverseRange;
+    float innerDelta;
+    float deltaRange;
+    float blockSize;
+};
+
+
+FoveationPixels GetFoveationPixels(const Foveation &foveation, uint32_t width, uint32_t height, uint32_t blockSize)
+{
+    const auto h = static_cast<float>(height);
+
+    FoveationPixels pixels;
+    pixels.gazeX = foveation.gazeX * static_cast<float>(width);
+    pixels.gazeY = foveation.gazeY * h;
+    pixels.innerRadius = foveation.innerRadius * h;
+    pixels.inverseRange = 1.0f / ((foveation.outerRadius - foveation.innerRadius) * h);
+    pixels.innerDelta = static_cast<float>(foveation.innerQpDelta);
+    pixels.deltaRange = static_cast<float>(foveation.outerQpDelta - foveation.innerQpDelta);
+    pixels.blockSize = static_cast<float>(blockSize);
+    return pixels;
+}
+
+
+float GetBlockCenter(uint32_t index, float blockSize)
+{
+    return (static_cast<float>(index) + 0.5f) * blockSize;
+}
+
+
+// Both deltas are within the QP range, so the blend needs no clamping.
+int8_t GetFoveatedDelta(const FoveationPixels &pixels, uint32_t column, float dy2)
+{
+    const float dx = GetBlockCenter(column, pixels.blockSize) - pixels.gazeX;
+    const float distance = std::sqrt(dx * dx + dy2);
+    const float t = std::min(std::max((distance - pixels.innerRadius) * pixels.inverseRange, 0.0f), 1.0f);
+    return static_cast<int8_t>(std::lrint(pixels.innerDelta + t * pixels.deltaRange));
+}
+
+
+#ifdef UNVENC_SIMD
+
+// Computes four blocks exactly like GetFoveatedDelta. _mm_cvtps_epi32 rounds
+// to nearest even like std::lrint does.
+__m128i GetFoveatedDeltas(const FoveationPixels &pixels, __m128i columns, __m128 dy2)
+{
+    const auto center = _mm_mul_ps(_mm_add_ps(_mm_cvtepi32_ps(columns), _mm_set1_ps(0.5f)), _mm_set1_ps(pixels.blockSize));
+    const auto dx = _mm_sub_ps(center, _mm_set1_ps(pixels.gazeX));
+    const auto distance = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), dy2));
+    auto t = _mm_mul_ps(_mm_sub_ps(distance, _mm_set1_ps(pixels.innerRadius)), _mm_set1_ps(pixels.inverseRange));
+    t = _mm_min_ps(_mm_max_ps(t, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+    const auto delta = _mm_add_ps(_mm_set1_ps(pixels.innerDelta), _mm_mul_ps(t, _mm_set1_ps(pixels.deltaRange)));
+    return _mm_cvtps_epi32(delta);
+}
+
+#endif
+
+
+}
+
+
+uint32_t GetQpMapBlockSize(NvencCodec codec)
+{
+    return codec == NvencCodec::HEVC ? 32 : 16;
+}
+
+
+const char * GetQpRegionError(const QpRegion &region)
+{
+    if (region.width <= 0 || region.height <= 0) return "A QP region must not be empty.";
+    if (std::abs(region.qpDelta) > maxQpDelta) return "The QP delta of a region must be between -51 and 51.";
+    return nullptr;
+}
+
+
+const char * GetFoveationError(const Foveation &foveation)
+{
+    if (!std::isfinite(foveation.gazeX) || !std::isfinite(foveation.gazeY)) return "The gaze point must be finite.";
+    if (!std::isfinite(foveation.outerRadius) || !(foveation.innerRadius >= 0.0f))
+    {
+        return "The foveation radii must be finite and not negative.";
+    }
+    if (!(foveation.outerRadius > foveation.innerRadius))
+    {
+        return "The outer foveation radius must be larger than the inner one.";
+    }
+    if (std::abs(foveation.innerQpDelta) > maxQpDelta || std::abs(foveation.outerQpDelta) > maxQpDelta)
+    {
+        return "The foveation QP deltas must be between -51 and 51.";
+    }
+    return nullptr;
+}
+
+
+void BuildFoveatedQpMap(const Foveation &foveation, uint32_t width, uint32_t height, uint32_t blockSize, int8_t *map)
+{
+#ifdef UNVENC_SIMD
+    const auto pixels = GetFoveationPixels(foveation, width, height, blockSize);
+    const uint32_t columns = (width + blockSize - 1) / blockSize;
+    const uint32_t rows = (height + blockSize - 1) / blockSize;
+    const auto offsets = _mm_setr_epi32(0, 1, 2, 3);
+    const auto four = _mm_set1_epi32(4);
+
+    // Sixteen blocks per step, packed with signed saturation down to bytes.
+    for (uint32_t row = 0; row < rows; ++row)
+    {
+        const float dy = GetBlockCenter(row, pixels.blockSize) - pixels.gazeY;
+        const float dy2 = dy * dy;
+        const auto dy2s = _mm_set1_ps(dy2);
+        auto *line = map + static_cast<size_t>(row) * columns;
+
+        uint32_t column = 0;
+        for (; column + 16 <= columns; column += 16)
+        {
+            const auto c0 = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(column)), offsets);
+            const auto c1 = _mm_add_epi32(c0, four);
+            const auto c2 = _mm_add_epi32(c1, four);
+            const auto c3 = _mm_add_epi32(c2, four);
+            const auto low = _mm_packs_epi32(GetFoveatedDeltas(pixels, c0, dy2s), GetFoveatedDeltas(pixels, c1, dy2s));
+            const auto high = _mm_packs_epi32(GetFoveatedDeltas(pixels, c2, dy2s), GetFoveatedDeltas(pixels, c3, dy2s));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(line + column), _mm_packs_epi16(low, high));
+        }
+        for (; column < columns; ++column)
+        {
+            line[column] = GetFoveatedDelta(pixels, column, dy2);
+        }
+    }
+#else
+    BuildFoveatedQpMapReference(foveation, width, height, blockSize, map);
+#endif
+}
+
+
+void BuildFoveatedQpMapReference(const Foveation &foveation, uint32_t width, uint32_t height, uint32_t blockSize, int8_t *map)
+{
+    const auto pixels = GetFoveationPixels(foveation, width, height, blockSize);
+    const uint32_t columns = (width + blockSize - 1) / blockSize;
+    const uint32_t rows = (height + blockSize - 1) / blockSize;
+
+    for (uint32_t row = 0; row < rows; ++row)
+    {
+        const float dy = GetBlockCenter(row, pixels.blockSize) - pixels.gazeY;
+        const float dy2 = dy * dy;
+        for (uint32_t column = 0; column < columns; ++column)
+        {
+            map[static_cast<size_t>(row) * columns + column] = GetFoveatedDelta(pixels, column, dy2);
+        }
+    }
+}
+
+
+// Regions are clipped to the frame, and a block that a region only partly
+// covers still belongs to it.
+void ApplyQpRegions(const QpRegion *regions, size_t count, uint32_t width, uint32_t height, uint32_t blockSize, int8_t *map)
+{
+    const uint32_t columns = (width + blockSize - 1) / blockSize;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const auto &region = regions[i];
+        const auto left = std::max<int64_t>(region.x, 0);
+        const auto top = std::max<int64_t>(region.y, 0);
+        const auto right = std::min<int64_t>(static_cast<int64_t>(region.x) + region.width, width);
+        const auto bottom = std::min<int64_t>(static_cast<int64_t>(region.y) + region.height, height);
+        if (left >= right || top >= bottom) continue;
+
+        const auto firstColumn = static_cast<uint32_t>(left / blockSize);
+        const auto lastColumn = static_cast<uint32_t>((right + blockSize - 1) / blockSize);
+        const auto firstRow = static_cast<uint32_t>(top / blockSize);
+        const auto lastRow = static_cast<uint32_t>((bottom + blockSize - 1) / blockSize);
+        for (auto row = firstRow; row < lastRow; ++row)
+        {
+            ::memset(map + static_cast<size_t>(row) * columns + firstColumn, region.qpDelta, lastColumn - firstColumn);
+        }
+    }
+}
+
+
+void QpMap::SetFrameSize(uint32_t width, uint32_t height, uint32_t blockSize)
+{
+    if (width_ == width && height_ == height && blockSize_ == blockSize) return;
+
+    width_ = width;
+    height_ = height;
+    blockSize_ = blockSize;
+    hasDeltas_ = false;
+    isDirty_ = true;
+}
+
+
+void QpMap::SetDeltas(const int8_t *deltas, size_t size)
+{
+    if (!deltas)
+    {
+        hasDeltas_ = false;
+        isDirty_ = true;
+        return;
+    }
+
+    if (size != GetSize()) ThrowError("The QP delta map does not match the frame size.");
+    const auto isOutOfRange = [](int8_t delta) { return delta < -maxQpDelta || delta > maxQpDelta; };
+    if (std::any_of(deltas, deltas + size, isOutOfRange)) ThrowError("QP deltas must be between -51 and 51.");
+
+    deltas_.assign(deltas, deltas + size);
+    hasDeltas_ = true;
+    hasFoveation_ = false;
+    isDirty_ = true;
+}
+
+
+void QpMap::SetFoveation(const Foveation *foveation)
+{
+    if (foveation)
+    {
+        if (const auto error = GetFoveationError(*foveation)) ThrowError(error);
+        foveation_ = *foveation;
+        hasDeltas_ = false;
+    }
+
+    hasFoveation_ = foveation != nullptr;
+    isDirty_ = true;
+}
+
+
+void QpMap::SetRegions(const QpRegion *regions, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (const auto error = GetQpRegionError(regions[i])) ThrowError(error);
+    }
+
+    regions_.assign(regions, regions + count);
+    isDirty_ = true;
+}
+
+
+void QpMap::Clear()
+{
+    hasDeltas_ = false;
+    hasFoveation_ = false;
+    regions_.clear();
+    isDirty_ = true;
+}
+
+
+const int8_t * QpMap::Build()
+{
+    if (IsEmpty() || width_ == 0 || height_ == 0) return nullptr;
+    if (!isDirty_) return map_.data();
+
+    map_.resize(GetSize());
+    if (hasDeltas_)
+    {
+        std::copy(deltas_.begin(), deltas_.end(), map_.begin());
+    }
+    else if (hasFoveation_)
+    {
+        BuildFoveatedQpMap(foveation_, width_, height_, blockSize_, map_.data());
+    }
+    else
+    {
+        std::fill(map_.begin(), map_.end(), static_cast<int8_t>(0));
+    }
+    ApplyQpRegions(regions_.data(), regions_.size(), width_, height_, blockSize_, map_.data());
+
+    isDirty_ = false;
+    return map_.data();
+}
+
+
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "EncoderConfig.h"
+
+
+namespace uNvEncoder
+{
+
+
+constexpr int32_t maxQpDelta = 51;
+
+
+// Blittable rectangle in pixels shared with C#. Every block it touches gets
+// qpDelta on top of the QP that rate control picks, so negative deltas spend
+// more bits there, on a HUD for example.
+struct QpRegion
+{
+    int32_t x;
+    int32_t y;
+    int32_t width;
+    int32_t height;
+    int32_t qpDelta;
+};
+
+
+// Blittable foveation shared with C#. The gaze point is in fractions of the
+// frame size and may lie outside of it, the radii are in fractions of the
+// frame height. Blocks closer to the gaze than innerRadius get innerQpDelta,
+// blocks beyond outerRadius get outerQpDelta, and the deltas in between are
+// blended linearly with the distance.
+struct Foveation
+{
+    float gazeX = 0.5f;
+    float gazeY = 0.5f;
+    float innerRadius = 0.15f;
+    float outerRadius = 0.5f;
+    int32_t innerQpDelta = -2;
+    int32_t outerQpDelta = 4;
+};
+
+
+// NVENC takes one delta per macroblock for H.264 and one per 32x32 CTU for
+// HEVC, in raster order.
+uint32_t GetQpMapBlockSize(NvencCodec codec);
+
+// Returns why the value cannot be used, or nullptr if it is valid.
+const char * GetQpRegionError(const QpRegion &region);
+const char * GetFoveationError(const Foveation &foveation);
+
+// Fills map with one delta per block of a frame of the given size. The SIMD
+// version and the scalar reference give the same deltas.
+void BuildFoveatedQpMap(const Foveation &foveation, uint32_t width, uint32_t height, uint32_t blockSize, int8_t *map);
+void BuildFoveatedQpMapReference(const Foveation &foveation, uint32_t width, uint32_t height, uint32_t blockSize, int8_t *map);
+void ApplyQpRegions(const QpRegion *regions, size_t count, uint32_t width, uint32_t height, uint32_t blockSize, int8_t *map);
+
+
+// Composes the QP delta map of a frame. The base is a map given as is or a
+// foveation, whichever was set last, and regions are drawn on top of it in
+// order. The map is only rebuilt after something changed, and a map given as
+// is only lasts until the frame size changes.
+class QpMap final
+{
+public:
+    void SetFrameSize(uint32_t width, uint32_t height, uint32_t blockSize);
+    void SetDeltas(const int8_t *deltas, size_t size);
+    void SetFoveation(const Foveation *foveation);
+    void SetRegions(const QpRegion *regions, size_t count);
+    void Clear();
+    bool IsEmpty() const { return !hasDeltas_ && !hasFoveation_ && regions_.empty(); }
+    uint32_t GetColumnCount() const { return (width_ + blockSize_ - 1) / blockSize_; }
+    uint32_t GetRowCount() const { return (height_ + blockSize_ - 1) / blockSize_; }
+    size_t GetSize() const { return static_cast<size_t>(GetColumnCount()) * GetRowCount(); }
+    // Returns the map of the current frame size, or nullptr when nothing was
+    // set. It stays valid until the next call.
+    const int8_t * Build();
+
+private:
+    uint32_t width_ = 0;
+    uint32_t height_ = 0;
+    uint32_t blockSize_ = 16;
+    std::vector<int8_t> deltas_;
+    bool hasDeltas_ = false;
+    Foveation foveation_;
+    bool hasFoveation_ = false;
+    std::vector<QpRegion> regions_;
+    std::vector<int8_t> map_;
+    bool isDirty_ = true;
+};
+
+
+}
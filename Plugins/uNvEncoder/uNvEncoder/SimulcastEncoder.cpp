@@ -0,0 +1,284 @@
+#include "SimulcastEncoder.h"
+
+
+namespace uNvEncoder
+{
+
+
+SimulcastEncoder::SimulcastEncoder(const SimulcastDesc &desc)
+    : desc_(desc)
+{
+    try
+    {
+        CheckDesc();
+        backend_ = GetEncodeBackend();
+        device_ = backend_->CreateGraphicsDevice();
+        context_ = device_->GetImmediateContext();
+        CreateRenditions();
+        StartThread();
+    }
+    catch (const std::exception &e)
+    {
+        error_ = e.what();
+        ::fprintf(stdout, "SimulcastEncoder %s", error_.c_str());
+    }
+}
+
+
+SimulcastEncoder::~SimulcastEncoder()
+{
+    StopThread();
+
+    renditions_.clear();
+    if (device_) device_->ReleaseContext(context_);
+    device_.reset();
+    backend_.reset();
+}
+
+
+bool SimulcastEncoder::IsValid() const
+{
+    if (!device_ || renditions_.empty() || !drainThread_.joinable() || hasPartialFrame_) return false;
+
+    for (const auto &rendition : renditions_)
+    {
+        if (!rendition->IsValid()) return false;
+    }
+    return true;
+}
+
+
+void SimulcastEncoder::CheckDesc() const
+{
+    if (desc_.renditions.empty()) ThrowError("A simulcast needs at least one rendition.");
+    if (1 + desc_.renditions.size() * desc_.asyncDepth > Event::maxWaitCount)
+    {
+        ThrowError("The renditions have more frames in flight than one thread can wait for.");
+    }
+
+    for (const auto &rendition : desc_.renditions)
+    {
+        if (rendition.width == 0 || rendition.height == 0) ThrowError("A rendition has no size.");
+        if (rendition.width > desc_.width || rendition.height > desc_.height)
+        {
+            ThrowError("A rendition is larger than the source.");
+        }
+    }
+}
+
+
+void SimulcastEncoder::CreateRenditions()
+{
+    for (const auto &rendition : desc_.renditions)
+    {
+        EncoderDesc desc;
+        desc.width = static_cast<int>(rendition.width);
+        desc.height = static_cast<int>(rendition.height);
+        desc.frameRate = static_cast<int>(desc_.frameRate);
+        desc.format = desc_.format;
+        desc.asyncDepth = static_cast<int>(desc_.asyncDepth);
+        desc.config = desc_.config;
+        desc.config.maxWidth = 0;
+        desc.config.maxHeight = 0;
+        if (rendition.averageBitRate) desc.config.averageBitRate = rendition.averageBitRate;
+        if (rendition.maxBitRate) desc.config.maxBitRate = rendition.maxBitRate;
+
+        auto encoder = std::make_shared<Encoder>(desc, backend_, device_);
+        if (!encoder->IsValid()) ThrowError("Failed to create a rendition: " + encoder->GetError());
+        renditions_.push_back(std::move(encoder));
+    }
+
+    inputTextures_.resize(renditions_.size());
+
+    const auto waitCount = 1 + renditions_.size() * maxAsyncDepth;
+    waitEvents_.reserve(waitCount);
+    waitRenditions_.reserve(waitCount);
+}
+
+
+// Sessions with sub-frame readback have no events to wait on and are polled
+// one after another instead.
+void SimulcastEncoder::StartThread()
+{
+    shouldStopDrainThread_ = false;
+
+    drainThread_ = std::thread([&]
+    {
+        const bool isPolled = desc_.config.enableSubFrameReadback != 0;
+
+        while (!shouldStopDrainThread_)
+        {
+            if (!isPolled)
+            {
+                try
+                {
+                    WaitForEncodedData();
+                }
+                catch (const std::exception &e)
+                {
+                    error_ = e.what();
+                    ::fprintf(stdout, "SimulcastEncoder::WaitForEncodedData %s", error_.c_str());
+                }
+            }
+
+            for (const auto &rendition : renditions_)
+            {
+                if (shouldStopDrainThread_) break;
+                if (isPolled) rendition->WaitForEncodedData(&encodeEvent_);
+                rendition->UpdateGetEncodedData();
+            }
+        }
+    });
+}
+
+
+// One wait covers the frames in flight of every rendition, so the frame of a
+// small rendition is read out as soon as it is done rather than after the
+// ones before it in the list.
+void SimulcastEncoder::WaitForEncodedData()
+{
+    using namespace std::chrono;
+
+    waitEvents_.assign(1, &encodeEvent_);
+    waitRenditions_.assign(1, nullptr);
+
+    auto timeout = completionTimeout;
+    for (const auto &rendition : renditions_)
+    {
+        Event *events[maxAsyncDepth];
+        const auto count = rendition->AddCompletionEvents(events, maxAsyncDepth, timeout);
+        waitEvents_.insert(waitEvents_.end(), events, events + count);
+        waitRenditions_.insert(waitRenditions_.end(), count, rendition.get());
+    }
+
+    auto signaled = Event::WaitAny(waitEvents_.data(), waitEvents_.size(), timeout);
+    if (signaled == Event::waitTimeout)
+    {
+        for (const auto &rendition : renditions_)
+        {
+            rendition->CheckCompletionTimeout();
+        }
+        return;
+    }
+
+    // Collect every frame that has already finished so that they are drained in one go.
+    while (signaled != Event::waitTimeout)
+    {
+        if (const auto rendition = waitRenditions_[signaled])
+        {
+            rendition->SetCompleted(waitEvents_[signaled]);
+        }
+
+        waitEvents_[signaled] = waitEvents_.back();
+        waitRenditions_[signaled] = waitRenditions_.back();
+        waitEvents_.pop_back();
+        waitRenditions_.pop_back();
+        if (waitEvents_.empty()) break;
+
+        signaled = Event::WaitAny(waitEvents_.data(), waitEvents_.size(), milliseconds(0));
+    }
+}
+
+
+void SimulcastEncoder::StopThread()
+{
+    shouldStopDrainThread_ = true;
+    encodeEvent_.Set();
+
+    if (drainThread_.joinable())
+    {
+        drainThread_.join();
+    }
+}
+
+
+void SimulcastEncoder::RequestIntraRefresh()
+{
+    for (const auto &rendition : renditions_)
+    {
+        rendition->RequestIntraRefresh();
+    }
+}
+
+
+bool SimulcastEncoder::Encode(void *source, const EncodeOptions &options)
+{
+    if (!IsValid()) return false;
+
+    // Checking every slot first keeps a busy rendition from falling behind.
+    for (size_t i = 0; i < renditions_.size(); ++i)
+    {
+        inputTextures_[i] = renditions_[i]->GetNextInputTexture();
+        if (!inputTextures_[i]) return false;
+    }
+
+    // Requests of any rendition, such as the one after a queue overflow,
+    // apply to all of them.
+    bool startIntraRefresh = false;
+    for (const auto &rendition : renditions_)
+    {
+        if (rendition->TakeIntraRefreshRequest()) startIntraRefresh = true;
+    }
+
+    size_t submittedCount = 0;
+    try
+    {
+        if (!source) ThrowError("The source texture is null.");
+        FillInputTextures(source);
+
+        for (const auto &rendition : renditions_)
+        {
+            if (!rendition->EncodeRendition(options, startIntraRefresh))
+            {
+                if (submittedCount > 0)
+                {
+                    hasPartialFrame_ = true;
+                    ThrowError("A rendition failed to take a frame the others took: " + rendition->GetError());
+                }
+                break;
+            }
+            ++submittedCount;
+        }
+    }
+    catch (const std::exception &e)
+    {
+        error_ = e.what();
+        ::fprintf(stdout, "SimulcastEncoder::Encode %s", error_.c_str());
+    }
+
+    if (submittedCount > 0) encodeEvent_.Set();
+
+    if (submittedCount == renditions_.size()) return true;
+
+    // Nothing was taken, so the request stays for the next frame.
+    if (submittedCount == 0 && startIntraRefresh) renditions_.front()->RequestIntraRefresh();
+    return false;
+}
+
+
+// Renditions of the size of the source take a plain copy. The others are
+// scaled from the source itself rather than from each other, which would
+// blur the smaller ones twice.
+void SimulcastEncoder::FillInputTextures(void *source)
+{
+    for (size_t i = 0; i < renditions_.size(); ++i)
+    {
+        const auto &rendition = desc_.renditions[i];
+        if (rendition.width == desc_.width && rendition.height == desc_.height)
+        {
+            device_->CopyTexture(context_, inputTextures_[i], source, desc_.width, desc_.height);
+        }
+        else
+        {
+            device_->ScaleTexture(
+                context_,
+                inputTextures_[i], rendition.width, rendition.height,
+                source, desc_.width, desc_.height);
+        }
+    }
+
+    device_->Flush(context_);
+}
+
+
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Encoder.h"
+
+
+namespace uNvEncoder
+{
+
+
+// Must match SimulcastRendition in Lib.cs. Zero bitrates take the ones of the
+// config.
+struct SimulcastRendition
+{
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t averageBitRate = 0;
+    uint32_t maxBitRate = 0;
+};
+
+
+struct SimulcastDesc
+{
+    uint32_t width;
+    uint32_t height;
+    uint32_t frameRate;
+    DXGI_FORMAT format;
+    uint32_t asyncDepth;
+    EncoderConfig config;
+    std::vector<SimulcastRendition> renditions;
+};
+
+
+// Encodes one source into several renditions that are no larger than it. Each
+// frame is copied or scaled straight into the input texture of every
+// rendition with one flush for all of them, and one thread drains all the
+// sessions, waiting on the frames in flight of all of them at once. A frame is
+// only submitted once every rendition has a free slot, so frame indices and
+// IDR frames line up and a receiver can switch between the streams at any IDR
+// frame. Should a rendition still fail to take a frame that others took, the
+// streams are out of step for good: the simulcast keeps the error, takes no
+// more frames and has to be created again.
+class SimulcastEncoder final
+{
+public:
+    explicit SimulcastEncoder(const SimulcastDesc &desc);
+    ~SimulcastEncoder();
+    bool IsValid() const;
+    bool Encode(void *source, const EncodeOptions &options);
+    size_t GetRenditionCount() const { return renditions_.size(); }
+    const std::shared_ptr<Encoder> & GetRendition(size_t index) const { return renditions_[index]; }
+    // Forwarded to every rendition, so the next frame starts the waves of
+    // intra refresh or is an IDR frame everywhere.
+    void RequestIntraRefresh();
+    uint32_t GetWidth() const { return desc_.width; }
+    uint32_t GetHeight() const { return desc_.height; }
+    bool HasError() const { return !error_.empty(); }
+    const std::string & GetError() const { return error_; }
+    void ClearError() { error_.clear(); }
+
+private:
+    void CheckDesc() const;
+    void CreateRenditions();
+    void StartThread();
+    void StopThread();
+    void WaitForEncodedData();
+    void FillInputTextures(void *source);
+
+    SimulcastDesc desc_;
+    std::shared_ptr<IEncodeBackend> backend_;
+    std::shared_ptr<IGraphicsDevice> device_;
+    void *context_ = nullptr;
+    std::vector<std::shared_ptr<Encoder>> renditions_;
+    std::vector<void*> inputTextures_;
+    // What the drain thread waits on, with the rendition of each event or
+    // null for encodeEvent_. Reserved for every frame in flight up front.
+    std::vector<Event*> waitEvents_;
+    std::vector<Encoder*> waitRenditions_;
+    std::thread drainThread_;
+    Event encodeEvent_;
+    std::atomic<bool> shouldStopDrainThread_ = { false };
+    bool hasPartialFrame_ = false;
+    std::string error_;
+};
+
+
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+
+namespace uNvEncoder
+{
+
+
+// Bounded single-producer / single-consumer ring. Push is only called from one
+// thread and Pop from another, so neither side takes a lock. The indices live
+// on separate cache lines to keep the two threads from false sharing.
+template <class T>
+class SpscRing final
+{
+public:
+    explicit SpscRing(size_t capacity)
+        : buffer_(RoundUpToPowerOfTwo(capacity))
+        , mask_(buffer_.size() - 1)
+    {
+    }
+
+    bool TryPush(T &&value)
+    {
+        const auto head = head_.load(std::memory_order_relaxed);
+        if (head - cachedTail_ == buffer_.size())
+        {
+            cachedTail_ = tail_.load(std::memory_order_acquire);
+            if (head - cachedTail_ == buffer_.size()) return false;
+        }
+
+        buffer_[head & mask_] = std::move(value);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool TryPop(T &value)
+    {
+        const auto tail = tail_.load(std::memory_order_relaxed);
+        if (tail == cachedHead_)
+        {
+            cachedHead_ = head_.load(std::memory_order_acquire);
+            if (tail == cachedHead_) return false;
+        }
+
+        value = std::move(buffer_[tail & mask_]);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t GetCapacity() const { return buffer_.size(); }
+
+private:
+    static size_t RoundUpToPowerOfTwo(size_t value)
+    {
+        size_t size = 1;
+        while (size < value) size <<= 1;
+        return size;
+    }
+
+    static constexpr size_t cacheLineSize = 64;
+
+    std::vector<T> buffer_;
+    const size_t mask_;
+
+    char producerPadding_[cacheLineSize];
+    std::atomic<size_t> head_ = { 0 };
+    size_t cachedTail_ = 0;
+
+    char consumerPadding_[cacheLineSize];
+    std::atomic<size_t> tail_ = { 0 };
+    size_t cachedHead_ = 0;
+
+    char endPadding_[cacheLineSize];
+};
+
+
+}
@@ -0,0 +1,101 @@
+#include <algorithm>
+#include <cstring>
+#include "StreamCopy.h"
+#include "Common.h"
+
+#ifdef UNVENC_SIMD
+#include <emmintrin.h>
+#endif
+
+
+namespace uNvEncoder
+{
+
+
+namespace
+{
+
+
+#ifdef UNVENC_SIMD
+
+constexpr size_t streamAlignment = 16;
+
+
+// Aligns the destination with a plain copy, then streams 64 bytes per step,
+// a whole cache line, so that write-combining buffers are flushed full.
+void StreamCopyRow(uint8_t *destination, const uint8_t *source, size_t size)
+{
+    const auto misalignment = reinterpret_cast<uintptr_t>(destination) % streamAlignment;
+    const auto head = misalignment ? std::min(streamAlignment - misalignment, size) : 0;
+    ::memcpy(destination, source, head);
+
+    size_t offset = head;
+    for (; offset + 64 <= size; offset += 64)
+    {
+        const auto s = reinterpret_cast<const __m128i*>(source + offset);
+        const auto d = reinterpret_cast<__m128i*>(destination + offset);
+        const auto a = _mm_loadu_si128(s);
+        const auto b = _mm_loadu_si128(s + 1);
+        const auto c = _mm_loadu_si128(s + 2);
+        const auto e = _mm_loadu_si128(s + 3);
+        _mm_stream_si128(d, a);
+        _mm_stream_si128(d + 1, b);
+        _mm_stream_si128(d + 2, c);
+        _mm_stream_si128(d + 3, e);
+    }
+    for (; offset + 16 <= size; offset += 16)
+    {
+        _mm_stream_si128(
+            reinterpret_cast<__m128i*>(destination + offset),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + offset)));
+    }
+    ::memcpy(destination + offset, source + offset, size - offset);
+}
+
+#endif
+
+
+}
+
+
+void StreamCopyRows(void *destination, size_t destinationPitch, const void *source, size_t sourcePitch, size_t rowSize, uint32_t rowCount)
+{
+#ifdef UNVENC_SIMD
+    auto *d = static_cast<uint8_t*>(destination);
+    auto *s = static_cast<const uint8_t*>(source);
+    for (uint32_t row = 0; row < rowCount; ++row)
+    {
+        StreamCopyRow(d, s, rowSize);
+        d += destinationPitch;
+        s += sourcePitch;
+    }
+
+    // Non-temporal stores are weakly ordered, so they have to land before
+    // NVENC is told that the buffer is unlocked.
+    _mm_sfence();
+#else
+    CopyRowsReference(destination, destinationPitch, source, sourcePitch, rowSize, rowCount);
+#endif
+}
+
+
+void CopyRowsReference(void *destination, size_t destinationPitch, const void *source, size_t sourcePitch, size_t rowSize, uint32_t rowCount)
+{
+    auto *d = static_cast<uint8_t*>(destination);
+    auto *s = static_cast<const uint8_t*>(source);
+    if (destinationPitch == rowSize && sourcePitch == rowSize)
+    {
+        ::memcpy(d, s, rowSize * rowCount);
+        return;
+    }
+
+    for (uint32_t row = 0; row < rowCount; ++row)
+    {
+        ::memcpy(d, s, rowSize);
+        d += destinationPitch;
+        s += sourcePitch;
+    }
+}
+
+
+}
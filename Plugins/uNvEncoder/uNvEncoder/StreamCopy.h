@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace uNvEncoder
+{
+
+
+// Copies rowCount rows of rowSize bytes between buffers of different pitches.
+// The streaming version writes with non-temporal stores that bypass the
+// cache, since a frame is larger than the cache and the CPU never reads it
+// back, and the locked input buffers of NVENC may be write-combined memory
+// that is slow to read. The reference is a memcpy per row.
+void StreamCopyRows(void *destination, size_t destinationPitch, const void *source, size_t sourcePitch, size_t rowSize, uint32_t rowCount);
+void CopyRowsReference(void *destination, size_t destinationPitch, const void *source, size_t sourcePitch, size_t rowSize, uint32_t rowCount);
+
+
+}
@@ -0,0 +1,1250 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "StubEncodeBackend.h"
+#include "StubGraphicsDevice.h"
+#include "BufferFormat.h"
+#include "Event.h"
+
+
+namespace uNvEncoder
+{
+
+
+namespace
+{
+
+
+uint64_t Hash(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+
+// Frames that can be references at once, as in a full H.264 DPB.
+constexpr size_t maxReferenceFrameCount = 16;
+
+
+bool IsSameGuid(const GUID &a, const GUID &b)
+{
+    return ::memcmp(&a, &b, sizeof(GUID)) == 0;
+}
+
+
+// The bits of a block roughly halve with every 6 QP, so a QP delta map scales
+// the frame by the mean of 2^(-delta / 6) over its blocks.
+double GetQpDeltaMapSizeScale(const int8_t *map, size_t size)
+{
+    std::array<uint32_t, 256> histogram = {};
+    for (size_t i = 0; i < size; ++i)
+    {
+        ++histogram[static_cast<uint8_t>(map[i])];
+    }
+
+    double sum = 0.0;
+    for (size_t i = 0; i < histogram.size(); ++i)
+    {
+        if (histogram[i] == 0) continue;
+        sum += histogram[i] * std::exp2(-static_cast<int8_t>(i) / 6.0);
+    }
+    return size > 0 ? sum / size : 1.0;
+}
+
+
+// Copies as many GUIDs as fit, or only reports the total when guids is null.
+NVENCSTATUS CopyGuids(const GUID *source, uint32_t sourceCount, GUID *guids, uint32_t arraySize, uint32_t *count)
+{
+    if (!count) return NV_ENC_ERR_INVALID_PTR;
+
+    if (guids)
+    {
+        sourceCount = std::min(sourceCount, arraySize);
+        std::copy(source, source + sourceCount, guids);
+    }
+    *count = sourceCount;
+    return NV_ENC_SUCCESS;
+}
+
+
+}
+
+
+class StubEncodeSession final
+{
+public:
+    explicit StubEncodeSession(StubEncodeBackend *backend);
+    ~StubEncodeSession();
+    NVENCSTATUS CheckError(const char *function) const;
+    NVENCSTATUS GetEncodeGUIDs(GUID *guids, uint32_t arraySize, uint32_t *count) const;
+    NVENCSTATUS GetEncodeCaps(GUID encodeGUID, const NV_ENC_CAPS_PARAM *capsParam, int *value) const;
+    NVENCSTATUS GetEncodePresetGUIDs(GUID encodeGUID, GUID *guids, uint32_t arraySize, uint32_t *count) const;
+    NVENCSTATUS GetEncodePresetConfig(NV_ENC_PRESET_CONFIG *presetConfig);
+    NVENCSTATUS Initialize(const NV_ENC_INITIALIZE_PARAMS *params);
+    NVENCSTATUS Reconfigure(const NV_ENC_RECONFIGURE_PARAMS *params);
+    NVENCSTATUS RegisterAsyncEvent(const NV_ENC_EVENT_PARAMS *params);
+    NVENCSTATUS UnregisterAsyncEvent(const NV_ENC_EVENT_PARAMS *params);
+    NVENCSTATUS CreateBitstreamBuffer(NV_ENC_CREATE_BITSTREAM_BUFFER *params);
+    NVENCSTATUS DestroyBitstreamBuffer(NV_ENC_OUTPUT_PTR buffer);
+    NVENCSTATUS RegisterResource(NV_ENC_REGISTER_RESOURCE *params);
+    NVENCSTATUS UnregisterResource(NV_ENC_REGISTERED_PTR resource);
+    NVENCSTATUS MapInputResource(NV_ENC_MAP_INPUT_RESOURCE *params);
+    NVENCSTATUS UnmapInputResource(NV_ENC_INPUT_PTR input);
+    NVENCSTATUS CreateInputBuffer(NV_ENC_CREATE_INPUT_BUFFER *params);
+    NVENCSTATUS DestroyInputBuffer(NV_ENC_INPUT_PTR buffer);
+    NVENCSTATUS LockInputBuffer(NV_ENC_LOCK_INPUT_BUFFER *params);
+    NVENCSTATUS UnlockInputBuffer(NV_ENC_INPUT_PTR buffer);
+    NVENCSTATUS EncodePicture(const NV_ENC_PIC_PARAMS *params);
+    NVENCSTATUS InvalidateRefFrames(uint64_t timestamp);
+    NVENCSTATUS LockBitstream(NV_ENC_LOCK_BITSTREAM *params);
+    NVENCSTATUS UnlockBitstream(NV_ENC_OUTPUT_PTR buffer);
+
+private:
+    struct Bitstream
+    {
+        std::vector<uint8_t> data;
+        uint32_t size = 0;
+        std::vector<uint32_t> sliceOffsets;
+        // Slices visible to sub-frame readback before the frame is ready.
+        uint32_t writtenSliceCount = 0;
+        NV_ENC_PIC_TYPE pictureType = NV_ENC_PIC_TYPE_UNKNOWN;
+        uint32_t frameIdx = 0;
+        uint64_t timestamp = 0;
+        bool isPending = false;
+        bool isReady = false;
+        bool isLocked = false;
+    };
+
+    struct RegisteredResource
+    {
+        void *resource = nullptr;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        NV_ENC_BUFFER_FORMAT bufferFormat = NV_ENC_BUFFER_FORMAT_UNDEFINED;
+        bool isMapped = false;
+    };
+
+    // Host memory with rows aligned like the driver aligns them.
+    struct InputBuffer
+    {
+        std::vector<uint8_t> storage;
+        uint8_t *data = nullptr;
+        uint32_t pitch = 0;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        NV_ENC_BUFFER_FORMAT bufferFormat = NV_ENC_BUFFER_FORMAT_UNDEFINED;
+        bool isLocked = false;
+    };
+
+    struct Job
+    {
+        Bitstream *bitstream = nullptr;
+        void *completionEvent = nullptr;
+        NV_ENC_PIC_TYPE pictureType = NV_ENC_PIC_TYPE_UNKNOWN;
+        // Frames of an intra-refresh wave carry a share of an IDR frame.
+        uint32_t intraRefreshSize = 0;
+        bool isRecovery = false;
+        // What a QP delta map saves or spends, as a factor of the frame size.
+        double sizeScale = 1.0;
+        uint32_t sliceCount = 1;
+        uint32_t maxSliceSize = 0;
+        bool isHevc = false;
+        uint32_t frameIdx = 0;
+        uint64_t timestamp = 0;
+        uint64_t number = 0;
+        std::chrono::steady_clock::time_point submitTime;
+    };
+
+    void Run();
+    void Produce(const Job &job);
+    void Complete(const Job &job);
+    Bitstream * FindBitstream(void *buffer);
+    RegisteredResource * FindRegisteredResource(void *resource);
+    InputBuffer * FindInputBuffer(void *buffer);
+
+    StubEncodeBackend *backend_ = nullptr;
+    const StubEncodeConfig &config_;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::deque<Job> jobs_;
+    std::thread thread_;
+    bool shouldStop_ = false;
+
+    bool isInitialized_ = false;
+    NV_ENC_INITIALIZE_PARAMS initializeParams_ = { NV_ENC_INITIALIZE_PARAMS_VER };
+    NV_ENC_CONFIG encodeConfig_ = { NV_ENC_CONFIG_VER };
+    std::vector<void*> events_;
+    std::vector<std::unique_ptr<Bitstream>> bitstreams_;
+    std::vector<std::unique_ptr<RegisteredResource>> registeredResources_;
+    std::vector<std::unique_ptr<InputBuffer>> inputBuffers_;
+    uint64_t frameCount_ = 0;
+    uint32_t framesSinceIdr_ = 0;
+    uint32_t framesSinceIntraRefresh_ = 0;
+    uint32_t intraRefreshLength_ = 0;
+    uint32_t intraRefreshFramesLeft_ = 0;
+    // LTR slots that hold a frame.
+    uint32_t ltrSlotMask_ = 0;
+    // Timestamps of the frames since the last IDR frame that can still be
+    // references, newest last.
+    std::deque<uint64_t> referenceTimestamps_;
+    bool isReferenceInvalidated_ = false;
+    bool shouldForceIdrFrame_ = true;
+    bool isEndOfStream_ = false;
+};
+
+
+StubEncodeSession::StubEncodeSession(StubEncodeBackend *backend)
+    : backend_(backend)
+    , config_(backend->config_)
+{
+    ++backend_->sessionCount_;
+    thread_ = std::thread([this]
+    {
+        StubCallScope scope;
+        Run();
+    });
+}
+
+
+StubEncodeSession::~StubEncodeSession()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        shouldStop_ = true;
+    }
+    condition_.notify_all();
+    thread_.join();
+
+    --backend_->sessionCount_;
+}
+
+
+NVENCSTATUS StubEncodeSession::CheckError(const char *function) const
+{
+    return config_.injectError ? config_.injectError(function) : NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS StubEncodeSession::GetEncodeGUIDs(GUID *guids, uint32_t arraySize, uint32_t *count) const
+{
+    const GUID codecGuids[] = { NV_ENC_CODEC_H264_GUID, NV_ENC_CODEC_HEVC_GUID };
+    return CopyGuids(codecGuids, config_.isHevcSupported ? 2 : 1, guids, arraySize, count);
+}
+
+
+NVENCSTATUS StubEncodeSession::GetEncodeCaps(GUID encodeGUID, const NV_ENC_CAPS_PARAM *capsParam, int *value) const
+{
+    if (!capsParam || !value) return NV_ENC_ERR_INVALID_PTR;
+
+    const bool isHevc = IsSameGuid(encodeGUID, NV_ENC_CODEC_HEVC_GUID);
+    if (isHevc && !config_.isHevcSupported) return NV_ENC_ERR_INVALID_PARAM;
+
+    switch (capsParam->capsToQuery)
+    {
+        case NV_ENC_CAPS_WIDTH_MAX: *value = config_.maxWidth; break;
+        case NV_ENC_CAPS_HEIGHT_MAX: *value = config_.maxHeight; break;
+        case NV_ENC_CAPS_MB_NUM_MAX: *value = (config_.maxWidth / 16) * (config_.maxHeight / 16); break;
+        case NV_ENC_CAPS_NUM_MAX_BFRAMES: *value = config_.maxBFrameCount; break;
+        case NV_ENC_CAPS_NUM_MAX_LTR_FRAMES: *value = 8; break;
+        case NV_ENC_CAPS_SUPPORT_TEMPORAL_AQ: *value = isHevc ? 0 : 1; break;
+        case NV_ENC_CAPS_SUPPORT_10BIT_ENCODE: *value = isHevc ? 1 : 0; break;
+        case NV_ENC_CAPS_SUPPORT_LOOKAHEAD:
+        case NV_ENC_CAPS_SUPPORT_YUV444_ENCODE:
+        case NV_ENC_CAPS_SUPPORT_LOSSLESS_ENCODE:
+        case NV_ENC_CAPS_SUPPORT_INTRA_REFRESH:
+        case NV_ENC_CAPS_SUPPORT_REF_PIC_INVALIDATION:
+        case NV_ENC_CAPS_SUPPORT_CUSTOM_VBV_BUF_SIZE:
+        case NV_ENC_CAPS_SUPPORT_DYN_RES_CHANGE:
+        case NV_ENC_CAPS_SUPPORT_DYN_BITRATE_CHANGE:
+        case NV_ENC_CAPS_SUPPORT_DYNAMIC_SLICE_MODE:
+        case NV_ENC_CAPS_SUPPORT_SUBFRAME_READBACK:
+        case NV_ENC_CAPS_ASYNC_ENCODE_SUPPORT:
+            *value = 1;
+            break;
+        default:
+            *value = 0;
+            break;
+    }
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS StubEncodeSession::GetEncodePresetGUIDs(GUID encodeGUID, GUID *guids, uint32_t arraySize, uint32_t *count) const
+{
+    if (IsSameGuid(encodeGUID, NV_ENC_CODEC_HEVC_GUID) && !config_.isHevcSupported) return NV_ENC_ERR_INVALID_PARAM;
+
+    const GUID presetGuids[] =
+    {
+        NV_ENC_PRESET_DEFAULT_GUID,
+        NV_ENC_PRESET_HP_GUID,
+        NV_ENC_PRESET_HQ_GUID,
+        NV_ENC_PRESET_LOW_LATENCY_DEFAULT_GUID,
+        NV_ENC_PRESET_LOW_LATENCY_HQ_GUID,
+        NV_ENC_PRESET_LOW_LATENCY_HP_GUID,
+    };
+    return CopyGuids(presetGuids, sizeof(presetGuids) / sizeof(GUID), guids, arraySize, count);
+}
+
+
+NVENCSTATUS StubEncodeSession::GetEncodePresetConfig(NV_ENC_PRESET_CONFIG *presetConfig)
+{
+    if (!presetConfig) return NV_ENC_ERR_INVALID_PTR;
+
+    presetConfig->presetCfg = NV_ENC_CONFIG { NV_ENC_CONFIG_VER };
+    presetConfig->presetCfg.gopLength = NVENC_INFINITE_GOPLENGTH;
+    presetConfig->presetCfg.frameIntervalP = 1;
+    presetConfig->presetCfg.rcParams.rateControlMode = NV_ENC_PARAMS_RC_CBR;
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS StubEncodeSession::Initialize(const NV_ENC_INITIALIZE_PARAMS *params)
+{
+    if (!params) return NV_ENC_ERR_INVALID_PTR;
+    if (params->encodeWidth == 0 || params->encodeHeight == 0) return NV_ENC_ERR_INVALID_PARAM;
+    if (params->encodeWidth > config_.maxWidth || params->encodeHeight > config_.maxHeight) return NV_ENC_ERR_INVALID_PARAM;
+    if (params->maxEncodeWidth > config_.maxWidth || params->maxEncodeHeight > config_.maxHeight) return NV_ENC_ERR_INVALID_PARAM;
+    if (IsSameGuid(params->encodeGUID, NV_ENC_CODEC_HEVC_GUID) && !config_.isHevcSupported) return NV_ENC_ERR_UNSUPPORTED_PARAM;
+    if (params->encodeConfig && static_cast<uint32_t>(params->encodeConfig->frameIntervalP) > config_.maxBFrameCount + 1) return NV_ENC_ERR_UNSUPPORTED_PARAM;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (isInitialized_) return NV_ENC_ERR_INVALID_CALL;
+
+    initializeParams_ = *params;
+    if (params->encodeConfig)
+    {
+        encodeConfig_ = *params->encodeConfig;
+    }
+    else
+    {
+        NV_ENC_PRESET_CONFIG presetConfig = { NV_ENC_PRESET_CONFIG_VER, { NV_ENC_CONFIG_VER } };
+        GetEncodePresetConfig(&presetConfig);
+        encodeConfig_ = presetConfig.presetCfg;
+    }
+    initializeParams_.encodeConfig = &encodeConfig_;
+
+    isInitialized_ = true;
+    shouldForceIdrFrame_ = true;
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS StubEncodeSession::Reconfigure(const NV_ENC_RECONFIGURE_PARAMS *params)
+{
+    if (!params) return NV_ENC_ERR_INVALID_PTR;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!isInitialized_) return NV_ENC_ERR_ENCODER_NOT_INITIALIZED;
+
+    const auto &reInit = params->reInitEncodeParams;
+    if (reInit.encodeWidth == 0 || reInit.encodeHeight == 0) return NV_ENC_ERR_INVALID_PARAM;
+    if ((initializeParams_.maxEncodeWidth && reInit.encodeWidth > initializeParams_.maxEncodeWidth) ||
+        (initializeParams_.maxEncodeHeight && reInit.encodeHeight > initializeParams_.maxEncodeHeight))
+    {
+        return NV_ENC_ERR_INVALID_PARAM;
+    }
+    if (reInit.enableEncodeAsync != initializeParams_.enableEncodeAsync) return NV_ENC_ERR_INVALID_PARAM;
+
+    const auto maxEncodeWidth = initializeParams_.maxEncodeWidth;
+    const auto maxEncodeHeight = initializeParams_.maxEncodeHeight;
+    initializeParams_ = reInit;
+    initializeParams_.maxEncodeWidth = maxEncodeWidth;
+    initializeParams_.maxEncodeHeight = maxEncodeHeight;
+    if (reInit.encodeConfig) encodeConfig_ = *reInit.encodeConfig;
+    initializeParams_.encodeConfig = &encodeConfig_;
+
+    if (params->resetEncoder || params->forceIDR) shouldForceIdrFrame_ = true;
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS StubEncodeSession::RegisterAsyncEvent(const NV_ENC_EVENT_PARAMS *params)
+{
+    if (!params || !params->completionEvent) return NV_ENC_ERR_INVALID_PTR;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    events_.push_back(params->completionEvent);
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS StubEncodeSession::UnregisterAsyncEvent(const NV_ENC_EVENT_PARAMS *params)
+{
+    if (!params) return NV_ENC_ERR_INVALID_PTR;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = std::find(events_.begin(), events_.end(), params->completionEvent);
+    if (it == events_.end()) return NV_ENC_ERR_EVENT_NOT_REGISTERD;
+
+    events_.erase(it);
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS StubEncodeSession::CreateBitstreamBuffer(NV_ENC_CREATE_BITSTREAM_BUFFER *params)
+{
+    if (!params) return NV_ENC_ERR_INVALID_PTR;
+
+    std::this_thread::sleep_for(config_.resourceLatency);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    bitstreams_.push_back(std::make_unique<Bitstream>());
+    params->bitstreamBuffer = bitstreams_.back().get();
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS StubEncodeSession::DestroyBitstreamBuffer(NV_ENC_OUTPUT_PTR buffer)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    const auto bitstream = FindBitstream(buffer);
+    if (!bitstream) return NV_ENC_ERR_INVALID_PARAM;
+    if (bitstream->isLocked) return NV_ENC_ERR_INVALID_CALL;
+
+    // The engine may still be writing into it.
+    condition_.wait(lock, [&] { return !bitstream->isPending; });
+
+    bitstreams_.erase(std::find_if(bitstreams_.begin(), bitstreams_.end(),
+        [&](const std::unique_ptr<Bitstream> &b) { return b.get() == bitstream; }));
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS StubEncodeSession::RegisterResource(NV_ENC_REGISTER_RESOURCE *params)
+{
+    if (!params || !params->resourceToRegister) return NV_ENC_ERR_INVALID_PTR;
+    if (params->width == 0 || params->height == 0) return NV_ENC_ERR_INVALID_PARAM;
+    if (params->bufferFormat == NV_ENC_BUFFER_FORMAT_UNDEFINED) return NV_ENC_ERR_INVALID_PARAM;
+
+    std::this_thread::sleep_for(config_.resourceLatency);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Like the driver, H.264 sessions take no 10-bit input.
+    if (Is10BitBufferFormat(params->bufferFormat) && !IsSameGuid(initializeParams_.encodeGUID, NV_ENC_CODEC_HEVC_GUID))
+    {
+        return NV_ENC_ERR_UNSUPPORTED_PARAM;
+    }
+
+    auto registeredResource = std::make_unique<RegisteredResource>();
+    registeredResource->resource = params->resourceToRegister;
+    registeredResource->width = params->width;
+    registeredResource->height = params->height;
+    registeredResource->bufferFormat = params->bufferFormat;
+    params->registeredResource = registeredResource.get();
+    registeredResources_.push_back(std::move(registeredResource));
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS StubEncodeSession::UnregisterResource(NV_ENC_REGISTERED_PTR resource)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    const auto it = std::find_if(registeredResources_.begin(), registeredResources_.end(),
+        [&](const std::unique_ptr<RegisteredResource> &r) { return r.get() == resource; });
+    if (it == registeredResources_.end()) return NV_ENC_ERR_RESOURCE_NOT_REGISTERED;
+    if ((*it)->isMapped) return NV_ENC_ERR_INVALID_CALL;
+
+    registeredResources_.erase(it);
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS StubEncodeSession::MapInputResource(NV_ENC_MAP_INPUT_RESOURCE *params)
+{
+    if (!params) return NV_ENC_ERR_INVALID_PTR;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto registeredResource = FindRegisteredResource(params->registeredResource);
+    if (!registeredResource) return NV_ENC_ERR_RESOURCE_NOT_REGISTERED;
+    if (registeredResource->isMapped) return NV_ENC_ERR_MAP_FAILED;
+
+    registeredResource->isMapped = true;
+    params->mappedResource = registeredResource;
+    params->mappedBufferFmt = registeredResource->bufferFormat;
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS StubEncodeSession::UnmapInputResource(NV_ENC_INPUT_PTR input)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    const auto registeredResource = FindRegisteredResource(input);
+    if (!registeredResource || !registeredResource->isMapped) return NV_ENC_ERR_RESOURCE_NOT_MAPPED;
+
+    registeredResource->isMapped = false;
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS StubEncodeSession::CreateInputBuffer(NV_ENC_CREATE_INPUT_BUFFER *params)
+{
+    if (!params) return NV_ENC_ERR_INVALID_PTR;
+    if (params->width == 0 || params->height == 0) return NV_ENC_ERR_INVALID_PARAM;
+    if (params->bufferFmt == NV_ENC_BUFFER_FORMAT_UNDEFINED) return NV_ENC_ERR_INVALID_PARAM;
+
+    std::this_thread::sleep_for(config_.resourceLatency);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!isInitialized_) return NV_ENC_ERR_ENCODER_NOT_INITIALIZED;
+    if (Is10BitBufferFormat(params->bufferFmt) && !IsSameGuid(initializeParams_.encodeGUID, NV_ENC_CODEC_HEVC_GUID))
+    {
+        return NV_ENC_ERR_UNSUPPORTED_PARAM;
+    }
+
+    constexpr uint32_t pitchAlignment = 256;
+    auto inputBuffer = std::make_unique<InputBuffer>();
+    const auto rowSize = params->width * GetBytesPerPixel(params->bufferFmt);
+    inputBuffer->pitch = (rowSize + pitchAlignment - 1) / pitchAlignment * pitchAlignment;
+    inputBuffer->width = params->width;
+    inputBuffer->height = params->height;
+    inputBuffer->bufferFormat = params->bufferFmt;
+
+    // The planes of YUV formats follow each other at the same pitch.
+    const auto rowCount = GetBufferRowCount(params->bufferFmt, params->height);
+    inputBuffer->storage.resize(static_cast<size_t>(inputBuffer->pitch) * rowCount + pitchAlignment);
+    const auto address = reinterpret_cast<uintptr_t>(inputBuffer->storage.data());
+    inputBuffer->data = inputBuffer->storage.data() + (pitchAlignment - address % pitchAlignment) % pitchAlignment;
+
+    params->inputBuffer = inputBuffer.get();
+    inputBuffers_.push_back(std::move(inputBuffer));
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS StubEncodeSession::DestroyInputBuffer(NV_ENC_INPUT_PTR buffer)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    const auto it = std::find_if(inputBuffers_.begin(), inputBuffers_.end(),
+        [&](const std::unique_ptr<InputBuffer> &b) { return b.get() == buffer; });
+    if (it == inputBuffers_.end()) return NV_ENC_ERR_INVALID_PARAM;
+    if ((*it)->isLocked) return NV_ENC_ERR_INVALID_CALL;
+
+    inputBuffers_.erase(it);
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS StubEncodeSession::LockInputBuffer(NV_ENC_LOCK_INPUT_BUFFER *params)
+{
+    if (!params) return NV_ENC_ERR_INVALID_PTR;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto inputBuffer = FindInputBuffer(params->inputBuffer);
+    if (!inputBuffer) return NV_ENC_ERR_INVALID_PARAM;
+    if (inputBuffer->isLocked) return NV_ENC_ERR_LOCK_BUSY;
+
+    inputBuffer->isLocked = true;
+    params->bufferDataPtr = inputBuffer->data;
+    params->pitch = inputBuffer->pitch;
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS StubEncodeSession::UnlockInputBuffer(NV_ENC_INPUT_PTR buffer)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    const auto inputBuffer = FindInputBuffer(buffer);
+    if (!inputBuffer || !inputBuffer->isLocked) return NV_ENC_ERR_INVALID_PARAM;
+
+    inputBuffer->isLocked = false;
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS StubEncodeSession::EncodePicture(const NV_ENC_PIC_PARAMS *params)
+{
+    if (!params) return NV_ENC_ERR_INVALID_PTR;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!isInitialized_) return NV_ENC_ERR_ENCODER_NOT_INITIALIZED;
+
+    const bool isAsync = initializeParams_.enableEncodeAsync != 0;
+    if (isAsync && std::find(events_.begin(), events_.end(), params->completionEvent) == events_.end())
+    {
+        return NV_ENC_ERR_EVENT_NOT_REGISTERD;
+    }
+
+    Job job;
+    job.completionEvent = isAsync ? params->completionEvent : nullptr;
+    job.submitTime = std::chrono::steady_clock::now();
+
+    if (params->encodePicFlags & NV_ENC_PIC_FLAG_EOS)
+    {
+        if (isEndOfStream_) ++backend_->repeatedEosCount_;
+        isEndOfStream_ = true;
+        jobs_.push_back(job);
+        lock.unlock();
+        condition_.notify_all();
+        return NV_ENC_SUCCESS;
+    }
+
+    // The input is either a mapped resource or an unlocked input buffer.
+    uint32_t inputWidth = 0;
+    uint32_t inputHeight = 0;
+    NV_ENC_BUFFER_FORMAT inputFormat = NV_ENC_BUFFER_FORMAT_UNDEFINED;
+    if (const auto registeredResource = FindRegisteredResource(params->inputBuffer))
+    {
+        if (!registeredResource->isMapped) return NV_ENC_ERR_RESOURCE_NOT_MAPPED;
+        inputWidth = registeredResource->width;
+        inputHeight = registeredResource->height;
+        inputFormat = registeredResource->bufferFormat;
+    }
+    else if (const auto inputBuffer = FindInputBuffer(params->inputBuffer))
+    {
+        if (inputBuffer->isLocked) return NV_ENC_ERR_LOCK_BUSY;
+        inputWidth = inputBuffer->width;
+        inputHeight = inputBuffer->height;
+        inputFormat = inputBuffer->bufferFormat;
+    }
+    else
+    {
+        return NV_ENC_ERR_RESOURCE_NOT_MAPPED;
+    }
+    if (params->bufferFmt != inputFormat) return NV_ENC_ERR_INVALID_PARAM;
+
+    // The frame is read from the top-left corner of a possibly larger input.
+    if (params->inputWidth != initializeParams_.encodeWidth || params->inputHeight != initializeParams_.encodeHeight)
+    {
+        return NV_ENC_ERR_INVALID_PARAM;
+    }
+    if (params->inputWidth > inputWidth || params->inputHeight > inputHeight)
+    {
+        return NV_ENC_ERR_INVALID_PARAM;
+    }
+
+    const auto bitstream = FindBitstream(params->outputBitstream);
+    if (!bitstream) return NV_ENC_ERR_INVALID_PARAM;
+    if (bitstream->isPending || bitstream->isLocked) return NV_ENC_ERR_ENCODER_BUSY;
+
+    const bool isHevc = IsSameGuid(initializeParams_.encodeGUID, NV_ENC_CODEC_HEVC_GUID);
+    const auto &h264Config = encodeConfig_.encodeCodecConfig.h264Config;
+    const auto &hevcConfig = encodeConfig_.encodeCodecConfig.hevcConfig;
+    const bool isIntraRefreshEnabled = isHevc ? hevcConfig.enableIntraRefresh != 0 : h264Config.enableIntraRefresh != 0;
+    const auto forcedIntraRefreshCount = isHevc ?
+        params->codecPicParams.hevcPicParams.forceIntraRefreshWithFrameCnt :
+        params->codecPicParams.h264PicParams.forceIntraRefreshWithFrameCnt;
+    if (forcedIntraRefreshCount && !isIntraRefreshEnabled) return NV_ENC_ERR_INVALID_PARAM;
+
+    // YUV input has to have the chroma format of the stream, while RGB input
+    // is converted to it.
+    const bool isYuv444Stream = (isHevc ? hevcConfig.chromaFormatIDC : h264Config.chromaFormatIDC) == 3;
+    if (IsYuv444BufferFormat(inputFormat) ? !isYuv444Stream : HasChromaPlane(inputFormat) && isYuv444Stream)
+    {
+        return NV_ENC_ERR_INVALID_PARAM;
+    }
+
+    // One delta per macroblock, or per 32x32 CTU for HEVC.
+    double sizeScale = 1.0;
+    if (params->qpDeltaMap)
+    {
+        if (encodeConfig_.rcParams.qpMapMode != NV_ENC_QP_MAP_DELTA) return NV_ENC_ERR_INVALID_PARAM;
+        const uint32_t blockSize = isHevc ? 32 : 16;
+        const auto blockCount =
+            ((params->inputWidth + blockSize - 1) / blockSize) * ((params->inputHeight + blockSize - 1) / blockSize);
+        if (params->qpDeltaMapSize < blockCount) return NV_ENC_ERR_INVALID_PARAM;
+        sizeScale = GetQpDeltaMapSizeScale(params->qpDeltaMap, blockCount);
+    }
+
+    // The IDR period defaults to the GOP length when it is not set.
+    const auto gopLength = encodeConfig_.gopLength;
+    const auto codecIdrPeriod = isHevc ? hevcConfig.idrPeriod : h264Config.idrPeriod;
+    const auto idrPeriod = codecIdrPeriod ? codecIdrPeriod : gopLength;
+    const bool isIdr =
+        shouldForceIdrFrame_ ||
+        (params->encodePicFlags & NV_ENC_PIC_FLAG_FORCEIDR) ||
+        (idrPeriod != 0 && idrPeriod != NVENC_INFINITE_GOPLENGTH && framesSinceIdr_ >= idrPeriod);
+
+    // LTR marks and references are checked against the slots the session
+    // actually holds, which an IDR frame empties before it is marked.
+    const bool isLtrEnabled = isHevc ? hevcConfig.enableLTR != 0 : h264Config.enableLTR != 0;
+    const auto ltrFrameCount = std::min(isHevc ? hevcConfig.ltrNumFrames : h264Config.ltrNumFrames, 32U);
+    const bool isLtrTrustMode = isHevc ? hevcConfig.ltrTrustMode != 0 : h264Config.ltrTrustMode != 0;
+    const auto &h264PicParams = params->codecPicParams.h264PicParams;
+    const auto &hevcPicParams = params->codecPicParams.hevcPicParams;
+    const bool ltrMarkFrame = isHevc ? hevcPicParams.ltrMarkFrame != 0 : h264PicParams.ltrMarkFrame != 0;
+    const auto ltrMarkFrameIdx = isHevc ? hevcPicParams.ltrMarkFrameIdx : h264PicParams.ltrMarkFrameIdx;
+    const bool ltrUseFrames = isHevc ? hevcPicParams.ltrUseFrames != 0 : h264PicParams.ltrUseFrames != 0;
+    const auto ltrUseFrameBitmap = isHevc ? hevcPicParams.ltrUseFrameBitmap : h264PicParams.ltrUseFrameBitmap;
+    if ((ltrMarkFrame || ltrUseFrames) && !isLtrEnabled) return NV_ENC_ERR_INVALID_PARAM;
+    if (ltrMarkFrame && (isLtrTrustMode || ltrMarkFrameIdx >= ltrFrameCount)) return NV_ENC_ERR_INVALID_PARAM;
+    const bool isLtrRecovery = ltrUseFrames && !isIdr;
+    if (isLtrRecovery && (ltrUseFrameBitmap == 0 || (ltrUseFrameBitmap & ~ltrSlotMask_) != 0)) return NV_ENC_ERR_INVALID_PARAM;
+    const bool isRecovery = !isIdr && (isLtrRecovery || isReferenceInvalidated_);
+    isReferenceInvalidated_ = false;
+
+    shouldForceIdrFrame_ = false;
+    framesSinceIdr_ = isIdr ? 1 : framesSinceIdr_ + 1;
+
+    if (isIdr)
+    {
+        ltrSlotMask_ = 0;
+        referenceTimestamps_.clear();
+    }
+    referenceTimestamps_.push_back(params->inputTimeStamp);
+    if (referenceTimestamps_.size() > maxReferenceFrameCount) referenceTimestamps_.pop_front();
+    if (isLtrEnabled && isLtrTrustMode && framesSinceIdr_ <= ltrFrameCount)
+    {
+        ltrSlotMask_ |= 1U << (framesSinceIdr_ - 1);
+    }
+    else if (ltrMarkFrame)
+    {
+        ltrSlotMask_ |= 1U << ltrMarkFrameIdx;
+    }
+
+    // Periodic waves only run in an infinite GOP, as on the real encoder.
+    const auto intraRefreshPeriod = isHevc ? hevcConfig.intraRefreshPeriod : h264Config.intraRefreshPeriod;
+    const bool isPeriodic = isIntraRefreshEnabled && gopLength == NVENC_INFINITE_GOPLENGTH && intraRefreshPeriod > 0;
+    ++framesSinceIntraRefresh_;
+    if (isIdr)
+    {
+        intraRefreshFramesLeft_ = 0;
+        framesSinceIntraRefresh_ = 0;
+    }
+    else if (forcedIntraRefreshCount || (isPeriodic && framesSinceIntraRefresh_ >= intraRefreshPeriod))
+    {
+        const auto count = isHevc ? hevcConfig.intraRefreshCnt : h264Config.intraRefreshCnt;
+        intraRefreshLength_ = std::max(forcedIntraRefreshCount ? forcedIntraRefreshCount : count, 1U);
+        intraRefreshFramesLeft_ = intraRefreshLength_;
+        framesSinceIntraRefresh_ = 0;
+    }
+
+    bitstream->isPending = true;
+    bitstream->isReady = false;
+    bitstream->writtenSliceCount = 0;
+
+    job.bitstream = bitstream;
+    job.pictureType = isIdr ? NV_ENC_PIC_TYPE_IDR : NV_ENC_PIC_TYPE_P;
+    if (intraRefreshFramesLeft_ > 0)
+    {
+        job.intraRefreshSize = config_.idrFrameSize / intraRefreshLength_;
+        --intraRefreshFramesLeft_;
+    }
+    job.isRecovery = isRecovery;
+    job.sizeScale = sizeScale;
+    job.isHevc = isHevc;
+
+    const auto sliceMode = isHevc ? hevcConfig.sliceMode : h264Config.sliceMode;
+    const auto sliceModeData = isHevc ? hevcConfig.sliceModeData : h264Config.sliceModeData;
+    const auto mbRows = (initializeParams_.encodeHeight + 15) / 16;
+    const auto mbCount = ((initializeParams_.encodeWidth + 15) / 16) * mbRows;
+    if (sliceModeData > 0)
+    {
+        switch (sliceMode)
+        {
+            case 0: job.sliceCount = (mbCount + sliceModeData - 1) / sliceModeData; break;
+            case 1: job.maxSliceSize = sliceModeData; break;
+            case 2: job.sliceCount = (mbRows + sliceModeData - 1) / sliceModeData; break;
+            case 3: job.sliceCount = std::min(sliceModeData, mbCount); break;
+            default: return NV_ENC_ERR_INVALID_PARAM;
+        }
+    }
+    job.frameIdx = params->frameIdx;
+    job.timestamp = params->inputTimeStamp;
+    job.number = frameCount_++;
+    jobs_.push_back(job);
+    isEndOfStream_ = false;
+
+    lock.unlock();
+    condition_.notify_all();
+    return NV_ENC_SUCCESS;
+}
+
+
+// The invalidated frame stays in the history, so invalidating it again is
+// accepted like on the real encoder.
+NVENCSTATUS StubEncodeSession::InvalidateRefFrames(uint64_t timestamp)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!isInitialized_) return NV_ENC_ERR_ENCODER_NOT_INITIALIZED;
+
+        const auto it = std::find(referenceTimestamps_.begin(), referenceTimestamps_.end(), timestamp);
+        if (it == referenceTimestamps_.end()) return NV_ENC_ERR_INVALID_PARAM;
+
+        isReferenceInvalidated_ = true;
+    }
+
+    if (config_.onInvalidateRefFrame) config_.onInvalidateRefFrame(timestamp);
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS StubEncodeSession::LockBitstream(NV_ENC_LOCK_BITSTREAM *params)
+{
+    if (!params) return NV_ENC_ERR_INVALID_PTR;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    const auto bitstream = FindBitstream(params->outputBitstream);
+    if (!bitstream) return NV_ENC_ERR_INVALID_PARAM;
+    if (bitstream->isLocked) return NV_ENC_ERR_LOCK_BUSY;
+
+    const bool isPartial = !bitstream->isReady && initializeParams_.enableSubFrameWrite && bitstream->writtenSliceCount > 0;
+    if (params->doNotWait)
+    {
+        if (!bitstream->isReady && !isPartial) return NV_ENC_ERR_LOCK_BUSY;
+    }
+    else
+    {
+        condition_.wait(lock, [&] { return bitstream->isReady || !bitstream->isPending; });
+        if (!bitstream->isReady) return NV_ENC_ERR_INVALID_CALL;
+    }
+
+    // A partial lock covers the slices written so far.
+    const bool isPartialLock = params->doNotWait && isPartial;
+    const auto sliceCount = bitstream->writtenSliceCount;
+    bitstream->isLocked = true;
+    ++backend_->lockedBitstreamCount_;
+    params->bitstreamBufferPtr = bitstream->data.data();
+    params->bitstreamSizeInBytes = isPartialLock ? bitstream->sliceOffsets[sliceCount] : bitstream->size;
+    params->hwEncodeStatus = isPartialLock ? 1 : 2;
+    params->numSlices = 0;
+    if (initializeParams_.reportSliceOffsets)
+    {
+        params->numSlices = sliceCount;
+        if (params->sliceOffsets)
+        {
+            std::copy(bitstream->sliceOffsets.begin(), bitstream->sliceOffsets.begin() + sliceCount, params->sliceOffsets);
+        }
+    }
+    params->pictureType = bitstream->pictureType;
+    params->pictureStruct = NV_ENC_PIC_STRUCT_FRAME;
+    params->frameIdx = bitstream->frameIdx;
+    params->outputTimeStamp = bitstream->timestamp;
+    params->outputDuration = 0;
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS StubEncodeSession::UnlockBitstream(NV_ENC_OUTPUT_PTR buffer)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    const auto bitstream = FindBitstream(buffer);
+    if (!bitstream) return NV_ENC_ERR_INVALID_PARAM;
+    if (!bitstream->isLocked)
+    {
+        ++backend_->unmatchedUnlockCount_;
+        return NV_ENC_ERR_INVALID_CALL;
+    }
+
+    bitstream->isLocked = false;
+    --backend_->lockedBitstreamCount_;
+    bitstream->isReady = false;
+    return NV_ENC_SUCCESS;
+}
+
+
+void StubEncodeSession::Run()
+{
+    using namespace std::chrono;
+
+    auto engineTime = steady_clock::now();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;)
+    {
+        condition_.wait(lock, [&] { return shouldStop_ || !jobs_.empty(); });
+        if (shouldStop_) return;
+
+        const auto job = jobs_.front();
+        jobs_.pop_front();
+
+        if (job.bitstream)
+        {
+            auto latency = config_.encodeLatency;
+            if (config_.latencyReferencePixelCount > 0)
+            {
+                const auto pixelCount = static_cast<uint64_t>(initializeParams_.encodeWidth) * initializeParams_.encodeHeight;
+                latency = microseconds(static_cast<int64_t>(latency.count() * pixelCount / config_.latencyReferencePixelCount));
+            }
+            if (config_.encodeLatencyJitter.count() > 0)
+            {
+                const auto jitter = static_cast<uint64_t>(config_.encodeLatencyJitter.count());
+                latency += microseconds(Hash(~job.number) % (jitter + 1));
+            }
+            engineTime = std::max(engineTime, job.submitTime) + latency;
+
+            // With sub-frame writes the slices become visible one by one while
+            // the frame is encoded.
+            const auto startTime = engineTime - latency;
+            Produce(job);
+            if (initializeParams_.enableSubFrameWrite)
+            {
+                const auto sliceCount = static_cast<uint32_t>(job.bitstream->sliceOffsets.size());
+                for (uint32_t i = 1; i < sliceCount; ++i)
+                {
+                    lock.unlock();
+                    std::this_thread::sleep_until(startTime + latency * i / sliceCount);
+                    lock.lock();
+                    job.bitstream->writtenSliceCount = i;
+                }
+            }
+
+            lock.unlock();
+            std::this_thread::sleep_until(engineTime);
+            lock.lock();
+
+            Complete(job);
+            if (jobs_.empty()) ++backend_->starvedFrameCount_;
+            condition_.notify_all();
+        }
+
+        const auto interval = config_.lostCompletionInterval;
+        const bool isLost = job.bitstream && interval != 0 && (job.number + 1) % interval == 0;
+        if (job.completionEvent && !isLost)
+        {
+            Event::Set(job.completionEvent);
+        }
+    }
+}
+
+
+void StubEncodeSession::Produce(const Job &job)
+{
+    const bool isIdr = job.pictureType == NV_ENC_PIC_TYPE_IDR;
+
+    const auto frameSize = job.isRecovery ? config_.recoveryFrameSize : config_.frameSize;
+    uint32_t size = isIdr ? config_.idrFrameSize : frameSize + job.intraRefreshSize;
+    if (config_.frameSizeJitter > 0)
+    {
+        size += static_cast<uint32_t>(Hash(job.number) % (config_.frameSizeJitter + 1));
+    }
+    size = static_cast<uint32_t>(size * job.sizeScale);
+    auto sliceCount = job.sliceCount;
+    if (job.maxSliceSize > 0) sliceCount = (size + job.maxSliceSize - 1) / job.maxSliceSize;
+    sliceCount = std::max(std::min(sliceCount, size / 6), 1U);
+    size = std::max(size, 6U);
+
+    // One slice NAL unit per slice, each behind an Annex B start code. The
+    // HEVC header is IDR_W_RADL or TRAIL_R with layer 0 and temporal id 0.
+    auto &data = job.bitstream->data;
+    if (data.size() < size) data.resize(size);
+    auto &sliceOffsets = job.bitstream->sliceOffsets;
+    sliceOffsets.resize(sliceCount);
+    for (uint32_t i = 0; i < sliceCount; ++i)
+    {
+        const auto offset = static_cast<uint32_t>(static_cast<uint64_t>(size) * i / sliceCount);
+        sliceOffsets[i] = offset;
+        data[offset + 0] = 0x00;
+        data[offset + 1] = 0x00;
+        data[offset + 2] = 0x00;
+        data[offset + 3] = 0x01;
+        if (job.isHevc)
+        {
+            data[offset + 4] = isIdr ? 0x26 : 0x02;
+            data[offset + 5] = 0x01;
+        }
+        else
+        {
+            data[offset + 4] = isIdr ? 0x65 : 0x41;
+        }
+    }
+
+    job.bitstream->size = size;
+    job.bitstream->writtenSliceCount = 0;
+    job.bitstream->pictureType = job.pictureType;
+    job.bitstream->frameIdx = job.frameIdx;
+    job.bitstream->timestamp = job.timestamp;
+}
+
+
+void StubEncodeSession::Complete(const Job &job)
+{
+    job.bitstream->writtenSliceCount = static_cast<uint32_t>(job.bitstream->sliceOffsets.size());
+    job.bitstream->isPending = false;
+    job.bitstream->isReady = true;
+
+    ++backend_->encodedFrameCount_;
+}
+
+
+StubEncodeSession::Bitstream * StubEncodeSession::FindBitstream(void *buffer)
+{
+    for (const auto &bitstream : bitstreams_)
+    {
+        if (bitstream.get() == buffer) return bitstream.get();
+    }
+    return nullptr;
+}
+
+
+StubEncodeSession::RegisteredResource * StubEncodeSession::FindRegisteredResource(void *resource)
+{
+    for (const auto &registeredResource : registeredResources_)
+    {
+        if (registeredResource.get() == resource) return registeredResource.get();
+    }
+    return nullptr;
+}
+
+
+StubEncodeSession::InputBuffer * StubEncodeSession::FindInputBuffer(void *buffer)
+{
+    for (const auto &inputBuffer : inputBuffers_)
+    {
+        if (inputBuffer.get() == buffer) return inputBuffer.get();
+    }
+    return nullptr;
+}
+
+
+namespace
+{
+
+
+template <class Func>
+NVENCSTATUS CallSession(void *encoder, const char *function, const Func &func)
+{
+    StubCallScope scope;
+    if (!encoder) return NV_ENC_ERR_INVALID_ENCODERDEVICE;
+
+    auto &session = *static_cast<StubEncodeSession*>(encoder);
+    const auto status = session.CheckError(function);
+    if (status != NV_ENC_SUCCESS) return status;
+
+    return func(session);
+}
+
+
+#define STUB_SESSION_CALL(Function, Encoder, Call) \
+    CallSession(Encoder, #Function, [&](StubEncodeSession &session) { return session.Call; })
+
+
+NVENCSTATUS NVENCAPI StubOpenEncodeSessionEx(NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS *params, void **encoder)
+{
+    StubCallScope scope;
+    if (!params || !encoder) return NV_ENC_ERR_INVALID_PTR;
+    if (!params->device) return NV_ENC_ERR_INVALID_DEVICE;
+
+    // The stub graphics device hands out the backend as its encode device.
+    const auto backend = static_cast<StubEncodeBackend*>(params->device);
+    const auto &config = backend->GetConfig();
+    if (config.injectError)
+    {
+        const auto status = config.injectError("nvEncOpenEncodeSessionEx");
+        if (status != NV_ENC_SUCCESS) return status;
+    }
+
+    *encoder = new StubEncodeSession(backend);
+    return NV_ENC_SUCCESS;
+}
+
+
+NVENCSTATUS NVENCAPI StubGetEncodeGUIDCount(void *encoder, uint32_t *count)
+{
+    return STUB_SESSION_CALL(nvEncGetEncodeGUIDCount, encoder, GetEncodeGUIDs(nullptr, 0, count));
+}
+
+
+NVENCSTATUS NVENCAPI StubGetEncodeGUIDs(void *encoder, GUID *guids, uint32_t arraySize, uint32_t *count)
+{
+    return STUB_SESSION_CALL(nvEncGetEncodeGUIDs, encoder, GetEncodeGUIDs(guids, arraySize, count));
+}
+
+
+NVENCSTATUS NVENCAPI StubGetEncodeCaps(void *encoder, GUID encodeGUID, NV_ENC_CAPS_PARAM *capsParam, int *value)
+{
+    return STUB_SESSION_CALL(nvEncGetEncodeCaps, encoder, GetEncodeCaps(encodeGUID, capsParam, value));
+}
+
+
+NVENCSTATUS NVENCAPI StubGetEncodePresetCount(void *encoder, GUID encodeGUID, uint32_t *count)
+{
+    return STUB_SESSION_CALL(nvEncGetEncodePresetCount, encoder, GetEncodePresetGUIDs(encodeGUID, nullptr, 0, count));
+}
+
+
+NVENCSTATUS NVENCAPI StubGetEncodePresetGUIDs(void *encoder, GUID encodeGUID, GUID *guids, uint32_t arraySize, uint32_t *count)
+{
+    return STUB_SESSION_CALL(nvEncGetEncodePresetGUIDs, encoder, GetEncodePresetGUIDs(encodeGUID, guids, arraySize, count));
+}
+
+
+NVENCSTATUS NVENCAPI StubGetEncodePresetConfig(void *encoder, GUID, GUID, NV_ENC_PRESET_CONFIG *presetConfig)
+{
+    return STUB_SESSION_CALL(nvEncGetEncodePresetConfig, encoder, GetEncodePresetConfig(presetConfig));
+}
+
+
+NVENCSTATUS NVENCAPI StubInitializeEncoder(void *encoder, NV_ENC_INITIALIZE_PARAMS *params)
+{
+    return STUB_SESSION_CALL(nvEncInitializeEncoder, encoder, Initialize(params));
+}
+
+
+NVENCSTATUS NVENCAPI StubReconfigureEncoder(void *encoder, NV_ENC_RECONFIGURE_PARAMS *params)
+{
+    return STUB_SESSION_CALL(nvEncReconfigureEncoder, encoder, Reconfigure(params));
+}
+
+
+NVENCSTATUS NVENCAPI StubRegisterAsyncEvent(void *encoder, NV_ENC_EVENT_PARAMS *params)
+{
+    return STUB_SESSION_CALL(nvEncRegisterAsyncEvent, encoder, RegisterAsyncEvent(params));
+}
+
+
+NVENCSTATUS NVENCAPI StubUnregisterAsyncEvent(void *encoder, NV_ENC_EVENT_PARAMS *params)
+{
+    return STUB_SESSION_CALL(nvEncUnregisterAsyncEvent, encoder, UnregisterAsyncEvent(params));
+}
+
+
+NVENCSTATUS NVENCAPI StubCreateBitstreamBuffer(void *encoder, NV_ENC_CREATE_BITSTREAM_BUFFER *params)
+{
+    return STUB_SESSION_CALL(nvEncCreateBitstreamBuffer, encoder, CreateBitstreamBuffer(params));
+}
+
+
+NVENCSTATUS NVENCAPI StubDestroyBitstreamBuffer(void *encoder, NV_ENC_OUTPUT_PTR buffer)
+{
+    return STUB_SESSION_CALL(nvEncDestroyBitstreamBuffer, encoder, DestroyBitstreamBuffer(buffer));
+}
+
+
+NVENCSTATUS NVENCAPI StubRegisterResource(void *encoder, NV_ENC_REGISTER_RESOURCE *params)
+{
+    return STUB_SESSION_CALL(nvEncRegisterResource, encoder, RegisterResource(params));
+}
+
+
+NVENCSTATUS NVENCAPI StubUnregisterResource(void *encoder, NV_ENC_REGISTERED_PTR resource)
+{
+    return STUB_SESSION_CALL(nvEncUnregisterResource, encoder, UnregisterResource(resource));
+}
+
+
+NVENCSTATUS NVENCAPI StubMapInputResource(void *encoder, NV_ENC_MAP_INPUT_RESOURCE *params)
+{
+    return STUB_SESSION_CALL(nvEncMapInputResource, encoder, MapInputResource(params));
+}
+
+
+NVENCSTATUS NVENCAPI StubUnmapInputResource(void *encoder, NV_ENC_INPUT_PTR input)
+{
+    return STUB_SESSION_CALL(nvEncUnmapInputResource, encoder, UnmapInputResource(input));
+}
+
+
+NVENCSTATUS NVENCAPI StubEncodePicture(void *encoder, NV_ENC_PIC_PARAMS *params)
+{
+    return STUB_SESSION_CALL(nvEncEncodePicture, encoder, EncodePicture(params));
+}
+
+
+NVENCSTATUS NVENCAPI StubInvalidateRefFrames(void *encoder, uint64_t invalidRefFrameTimeStamp)
+{
+    return STUB_SESSION_CALL(nvEncInvalidateRefFrames, encoder, InvalidateRefFrames(invalidRefFrameTimeStamp));
+}
+
+
+NVENCSTATUS NVENCAPI StubLockBitstream(void *encoder, NV_ENC_LOCK_BITSTREAM *params)
+{
+    return STUB_SESSION_CALL(nvEncLockBitstream, encoder, LockBitstream(params));
+}
+
+
+NVENCSTATUS NVENCAPI StubUnlockBitstream(void *encoder, NV_ENC_OUTPUT_PTR buffer)
+{
+    return STUB_SESSION_CALL(nvEncUnlockBitstream, encoder, UnlockBitstream(buffer));
+}
+
+
+NVENCSTATUS NVENCAPI StubCreateInputBuffer(void *encoder, NV_ENC_CREATE_INPUT_BUFFER *params)
+{
+    return STUB_SESSION_CALL(nvEncCreateInputBuffer, encoder, CreateInputBuffer(params));
+}
+
+
+NVENCSTATUS NVENCAPI StubDestroyInputBuffer(void *encoder, NV_ENC_INPUT_PTR buffer)
+{
+    return STUB_SESSION_CALL(nvEncDestroyInputBuffer, encoder, DestroyInputBuffer(buffer));
+}
+
+
+NVENCSTATUS NVENCAPI StubLockInputBuffer(void *encoder, NV_ENC_LOCK_INPUT_BUFFER *params)
+{
+    return STUB_SESSION_CALL(nvEncLockInputBuffer, encoder, LockInputBuffer(params));
+}
+
+
+NVENCSTATUS NVENCAPI StubUnlockInputBuffer(void *encoder, NV_ENC_INPUT_PTR buffer)
+{
+    return STUB_SESSION_CALL(nvEncUnlockInputBuffer, encoder, UnlockInputBuffer(buffer));
+}
+
+
+NVENCSTATUS NVENCAPI StubDestroyEncoder(void *encoder)
+{
+    StubCallScope scope;
+    if (!encoder) return NV_ENC_ERR_INVALID_ENCODERDEVICE;
+
+    delete static_cast<StubEncodeSession*>(encoder);
+    return NV_ENC_SUCCESS;
+}
+
+
+#undef STUB_SESSION_CALL
+
+
+}
+
+
+thread_local int StubCallScope::depth_ = 0;
+
+
+StubEncodeBackend::StubEncodeBackend(const StubEncodeConfig &config)
+    : config_(config)
+{
+    // Entry points the plugin does not use are left null.
+    functionList_.nvEncOpenEncodeSessionEx = StubOpenEncodeSessionEx;
+    functionList_.nvEncGetEncodeGUIDCount = StubGetEncodeGUIDCount;
+    functionList_.nvEncGetEncodeGUIDs = StubGetEncodeGUIDs;
+    functionList_.nvEncGetEncodeCaps = StubGetEncodeCaps;
+    functionList_.nvEncGetEncodePresetCount = StubGetEncodePresetCount;
+    functionList_.nvEncGetEncodePresetGUIDs = StubGetEncodePresetGUIDs;
+    functionList_.nvEncGetEncodePresetConfig = StubGetEncodePresetConfig;
+    functionList_.nvEncInitializeEncoder = StubInitializeEncoder;
+    functionList_.nvEncReconfigureEncoder = StubReconfigureEncoder;
+    functionList_.nvEncRegisterAsyncEvent = StubRegisterAsyncEvent;
+    functionList_.nvEncUnregisterAsyncEvent = StubUnregisterAsyncEvent;
+    functionList_.nvEncCreateBitstreamBuffer = StubCreateBitstreamBuffer;
+    functionList_.nvEncDestroyBitstreamBuffer = StubDestroyBitstreamBuffer;
+    functionList_.nvEncRegisterResource = StubRegisterResource;
+    functionList_.nvEncUnregisterResource = StubUnregisterResource;
+    functionList_.nvEncMapInputResource = StubMapInputResource;
+    functionList_.nvEncUnmapInputResource = StubUnmapInputResource;
+    functionList_.nvEncEncodePicture = StubEncodePicture;
+    functionList_.nvEncInvalidateRefFrames = StubInvalidateRefFrames;
+    functionList_.nvEncLockBitstream = StubLockBitstream;
+    functionList_.nvEncUnlockBitstream = StubUnlockBitstream;
+    functionList_.nvEncCreateInputBuffer = StubCreateInputBuffer;
+    functionList_.nvEncDestroyInputBuffer = StubDestroyInputBuffer;
+    functionList_.nvEncLockInputBuffer = StubLockInputBuffer;
+    functionList_.nvEncUnlockInputBuffer = StubUnlockInputBuffer;
+    functionList_.nvEncDestroyEncoder = StubDestroyEncoder;
+}
+
+
+std::unique_ptr<IGraphicsDevice> StubEncodeBackend::CreateGraphicsDevice()
+{
+    return std::make_unique<StubGraphicsDevice>(
+        this, config_.adapterId, config_.adapterIdentity, config_.driverVersion, &deviceStats_);
+}
+
+
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include "EncodeBackend.h"
+#include "StubGraphicsDevice.h"
+
+
+namespace uNvEncoder
+{
+
+
+struct StubEncodeConfig
+{
+    // Time the simulated engine spends on one frame. Frames of a session are
+    // encoded one after another as on a single NVENC engine.
+    std::chrono::microseconds encodeLatency = std::chrono::microseconds(2000);
+    std::chrono::microseconds encodeLatencyJitter = std::chrono::microseconds(0);
+    // Scales encodeLatency by the encoded size of a session relative to this
+    // many pixels, so that smaller sessions finish sooner. Zero gives every
+    // session the same latency.
+    uint64_t latencyReferencePixelCount = 0;
+    uint32_t frameSize = 16 * 1024;
+    uint32_t idrFrameSize = 128 * 1024;
+    uint32_t frameSizeJitter = 0;
+    // P-frames that recover from a loss, predicted from long-term references
+    // or from what is left after references were invalidated. Either lies
+    // further back than the previous frame.
+    uint32_t recoveryFrameSize = 32 * 1024;
+    // Every n-th frame is encoded but its completion event is never signaled.
+    // Zero disables it.
+    uint64_t lostCompletionInterval = 0;
+    // Time the driver spends registering an input resource or creating a
+    // bitstream buffer, which is what makes reallocating resizes expensive.
+    std::chrono::microseconds resourceLatency = std::chrono::microseconds(0);
+    // Capabilities the stubbed driver reports and enforces.
+    uint32_t maxWidth = 4096;
+    uint32_t maxHeight = 4096;
+    uint32_t maxBFrameCount = 4;
+    bool isHevcSupported = true;
+    // What the graphics devices of the backend report as their adapter.
+    uint64_t adapterId = 0;
+    AdapterIdentity adapterIdentity = { 0x10de, 0x2204, 0, 0xa1 };
+    uint64_t driverVersion = 1;
+    // Called on entry of every stubbed function with its name. Any status
+    // other than NV_ENC_SUCCESS is returned by the call instead.
+    std::function<NVENCSTATUS(const char *function)> injectError;
+    // Called with the timestamp of every reference frame that is invalidated.
+    // Timestamps of frames that are no references are rejected instead.
+    std::function<void(uint64_t timestamp)> onInvalidateRefFrame;
+};
+
+
+// Set while the calling thread runs code of the stubbed driver, so that a
+// harness that counts allocations can tell the ones of the driver from the
+// ones of the plugin.
+class StubCallScope final
+{
+public:
+    StubCallScope() { ++depth_; }
+    ~StubCallScope() { --depth_; }
+    StubCallScope(const StubCallScope&) = delete;
+    StubCallScope & operator=(const StubCallScope&) = delete;
+    static bool IsActive() { return depth_ > 0; }
+
+private:
+    static thread_local int depth_;
+};
+
+
+// In-process replacement for the NVENC driver. It produces well-formed but
+// meaningless Annex B access units, so the encode pipeline can be exercised
+// and measured without a GPU.
+class StubEncodeBackend final : public IEncodeBackend
+{
+public:
+    explicit StubEncodeBackend(const StubEncodeConfig &config = StubEncodeConfig());
+    const NV_ENCODE_API_FUNCTION_LIST & GetFunctionList() const override { return functionList_; }
+    NV_ENC_DEVICE_TYPE GetDeviceType() const override { return NV_ENC_DEVICE_TYPE_DIRECTX; }
+    std::unique_ptr<IGraphicsDevice> CreateGraphicsDevice() override;
+    const StubEncodeConfig & GetConfig() const { return config_; }
+    uint32_t GetSessionCount() const { return sessionCount_; }
+    uint64_t GetEncodedFrameCount() const { return encodedFrameCount_; }
+    // Ends of stream sent without a frame since the previous one, which is
+    // what flushing twice does.
+    uint64_t GetRepeatedEosCount() const { return repeatedEosCount_; }
+    // Bitstreams locked and not unlocked yet, and unlocks of bitstreams that
+    // were not locked.
+    int64_t GetLockedBitstreamCount() const { return lockedBitstreamCount_; }
+    uint64_t GetUnmatchedUnlockCount() const { return unmatchedUnlockCount_; }
+    const StubDeviceStats & GetDeviceStats() const { return deviceStats_; }
+    // Frames after which nothing else was queued, so the engine idled until
+    // the next submit. Past a depth of one this only happens when the caller
+    // is slower than the engine.
+    uint64_t GetStarvedFrameCount() const { return starvedFrameCount_; }
+
+private:
+    friend class StubEncodeSession;
+
+    const StubEncodeConfig config_;
+    NV_ENCODE_API_FUNCTION_LIST functionList_ = { NV_ENCODE_API_FUNCTION_LIST_VER };
+    std::atomic<uint32_t> sessionCount_ = { 0 };
+    std::atomic<uint64_t> encodedFrameCount_ = { 0 };
+    std::atomic<uint64_t> repeatedEosCount_ = { 0 };
+    std::atomic<int64_t> lockedBitstreamCount_ = { 0 };
+    std::atomic<uint64_t> unmatchedUnlockCount_ = { 0 };
+    std::atomic<uint64_t> starvedFrameCount_ = { 0 };
+    StubDeviceStats deviceStats_;
+};
+
+
+}
@@ -0,0 +1,122 @@
+#include "StubGraphicsDevice.h"
+#include "Common.h"
+
+
+namespace uNvEncoder
+{
+
+
+StubGraphicsDevice::StubGraphicsDevice(
+    void *encodeDevice,
+    uint64_t adapterId, const AdapterIdentity &adapterIdentity, uint64_t driverVersion,
+    StubDeviceStats *stats)
+    : encodeDevice_(encodeDevice)
+    , adapterId_(adapterId)
+    , adapterIdentity_(adapterIdentity)
+    , driverVersion_(driverVersion)
+    , stats_(stats)
+{
+}
+
+
+StubGraphicsDevice::~StubGraphicsDevice()
+{
+    for (const auto &pair : textures_)
+    {
+        delete pair.first;
+    }
+}
+
+
+void * StubGraphicsDevice::CreateSharedTexture(uint32_t width, uint32_t height, DXGI_FORMAT format, void **sharedHandle)
+{
+    auto texture = new Texture { width, height, format };
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    textures_.emplace(texture, 1);
+
+    if (sharedHandle) *sharedHandle = texture;
+    return texture;
+}
+
+
+void * StubGraphicsDevice::OpenSharedTexture(void *sharedHandle)
+{
+    if (stats_) ++stats_->openCount;
+    RetainTexture(sharedHandle);
+    return sharedHandle;
+}
+
+
+void StubGraphicsDevice::RetainTexture(void *texture)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    const auto it = textures_.find(static_cast<Texture*>(texture));
+    if (it != textures_.end()) ++it->second;
+}
+
+
+void StubGraphicsDevice::ReleaseTexture(void *texture)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    const auto it = textures_.find(static_cast<Texture*>(texture));
+    if (it == textures_.end()) return;
+
+    if (--it->second == 0)
+    {
+        delete it->first;
+        textures_.erase(it);
+    }
+}
+
+
+void * StubGraphicsDevice::GetImmediateContext()
+{
+    if (stats_) ++stats_->contextCount;
+    return this;
+}
+
+
+void StubGraphicsDevice::CopyTexture(void *, void *, void *, uint32_t, uint32_t)
+{
+    ++copyCount_;
+    if (stats_) ++stats_->copyCount;
+}
+
+
+void StubGraphicsDevice::ScaleTexture(
+    void *,
+    void *destination, uint32_t destinationWidth, uint32_t destinationHeight,
+    void *, uint32_t sourceWidth, uint32_t sourceHeight)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const auto texture = static_cast<Texture*>(destination);
+        if (textures_.find(texture) == textures_.end()) ThrowError("The destination is not a texture of this device.");
+        if (destinationWidth > texture->width || destinationHeight > texture->height)
+        {
+            ThrowError("The region is larger than the destination texture.");
+        }
+    }
+    if (sourceWidth == 0 || sourceHeight == 0) ThrowError("The source region is empty.");
+
+    if (stats_) ++stats_->scaleCount;
+}
+
+
+void StubGraphicsDevice::Flush(void *)
+{
+    if (stats_) ++stats_->flushCount;
+}
+
+
+size_t StubGraphicsDevice::GetTextureCount() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return textures_.size();
+}
+
+
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include "GraphicsDevice.h"
+
+
+namespace uNvEncoder
+{
+
+
+// Work given to the stub devices of one backend. Textures are only opened
+// and the immediate context only taken when surfaces are (re)created.
+struct StubDeviceStats
+{
+    std::atomic<uint64_t> copyCount = { 0 };
+    std::atomic<uint64_t> scaleCount = { 0 };
+    std::atomic<uint64_t> flushCount = { 0 };
+    std::atomic<uint64_t> openCount = { 0 };
+    std::atomic<uint64_t> contextCount = { 0 };
+};
+
+
+// Graphics device without a GPU. Textures it creates are reference counted
+// placeholders, and any other texture pointer, such as an encoder source, is
+// passed through untouched. Scaling checks that the region fits a texture
+// that the device created.
+class StubGraphicsDevice final : public IGraphicsDevice
+{
+public:
+    StubGraphicsDevice(
+        void *encodeDevice,
+        uint64_t adapterId, const AdapterIdentity &adapterIdentity, uint64_t driverVersion,
+        StubDeviceStats *stats = nullptr);
+    ~StubGraphicsDevice();
+    void * GetEncodeDevice() override { return encodeDevice_; }
+    uint64_t GetAdapterId() const override { return adapterId_; }
+    AdapterIdentity GetAdapterIdentity() const override { return adapterIdentity_; }
+    uint64_t GetDriverVersion() const override { return driverVersion_; }
+    void * CreateSharedTexture(uint32_t width, uint32_t height, DXGI_FORMAT format, void **sharedHandle) override;
+    void * OpenSharedTexture(void *sharedHandle) override;
+    void RetainTexture(void *texture) override;
+    void ReleaseTexture(void *texture) override;
+    void * GetImmediateContext() override;
+    void ReleaseContext(void *) override {}
+    void CopyTexture(void *context, void *destination, void *source, uint32_t width, uint32_t height) override;
+    void ScaleTexture(
+        void *context,
+        void *destination, uint32_t destinationWidth, uint32_t destinationHeight,
+        void *source, uint32_t sourceWidth, uint32_t sourceHeight) override;
+    void Flush(void *context) override;
+    size_t GetTextureCount() const;
+    uint64_t GetCopyCount() const { return copyCount_; }
+
+private:
+    struct Texture
+    {
+        uint32_t width;
+        uint32_t height;
+        DXGI_FORMAT format;
+    };
+
+    void *encodeDevice_ = nullptr;
+    uint64_t adapterId_ = 0;
+    AdapterIdentity adapterIdentity_;
+    uint64_t driverVersion_ = 0;
+    StubDeviceStats *stats_ = nullptr;
+    mutable std::mutex mutex_;
+    std::map<Texture*, int> textures_;
+    std::atomic<uint64_t> copyCount_ = { 0 };
+};
+
+
+}
@@ -0,0 +1,3050 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <IUnityInterface.h>
+#include "EncodeBackend.h"
+#include "StubEncodeBackend.h"
+#include "AbrController.h"
+#include "BufferFormat.h"
+#include "ColorConversion.h"
+#include "FrameHash.h"
+#include "QpMap.h"
+#include "SimulcastEncoder.h"
+#include "SpscRing.h"
+#include "StreamCopy.h"
+#include "Nvenc.h"
+
+
+using namespace uNvEncoder;
+using EncoderId = int;
+
+
+struct ID3D11Texture2D;
+
+
+// Same layout as in Main.cpp.
+struct EncodedFrame
+{
+    const void *buffer;
+    int32_t size;
+    int32_t pictureType;
+    uint64_t frameIndex;
+    uint64_t timestamp;
+    int32_t codec;
+    uint32_t offset;
+    int32_t isFrameEnd;
+    int32_t isLeased;
+};
+
+
+extern "C"
+{
+    void UNITY_INTERFACE_API uNvEncoderGetDefaultEncoderConfig(EncoderConfig *config);
+    EncoderId UNITY_INTERFACE_API uNvEncoderCreateEncoderEx(int width, int height, DXGI_FORMAT format, int frameRate, int asyncDepth, const EncoderConfig *config);
+    void UNITY_INTERFACE_API uNvEncoderDestroyEncoder(EncoderId id);
+    bool UNITY_INTERFACE_API uNvEncoderIsValid(EncoderId id);
+    int UNITY_INTERFACE_API uNvEncoderGetAsyncDepth(EncoderId id);
+    void UNITY_INTERFACE_API uNvEncoderResize(EncoderId id, uint32_t width, uint32_t height);
+    bool UNITY_INTERFACE_API uNvEncoderEncode(EncoderId id, ID3D11Texture2D *texture, bool forceIdrFrame);
+    bool UNITY_INTERFACE_API uNvEncoderEncodeWithOptions(EncoderId id, ID3D11Texture2D *texture, const EncodeOptions *options);
+    bool UNITY_INTERFACE_API uNvEncoderEncodeFromMemoryWithOptions(EncoderId id, const void *data, int pitch, DXGI_FORMAT format, const EncodeOptions *options);
+    int UNITY_INTERFACE_API uNvEncoderGetWidth(EncoderId id);
+    int UNITY_INTERFACE_API uNvEncoderGetHeight(EncoderId id);
+    int UNITY_INTERFACE_API uNvEncoderFindLtrSlot(EncoderId id, uint64_t frameIndex);
+    int UNITY_INTERFACE_API uNvEncoderInvalidateRefFrames(EncoderId id, const uint64_t *frameIndices, int count);
+    bool UNITY_INTERFACE_API uNvEncoderSetFoveation(EncoderId id, const Foveation *foveation);
+    bool UNITY_INTERFACE_API uNvEncoderSetQpRegions(EncoderId id, const QpRegion *regions, int count);
+    void UNITY_INTERFACE_API uNvEncoderCopyEncodedData(EncoderId id);
+    int UNITY_INTERFACE_API uNvEncoderGetEncodedDataCount(EncoderId id);
+    int UNITY_INTERFACE_API uNvEncoderGetEncodedDataSize(EncoderId id, int index);
+    const void * UNITY_INTERFACE_API uNvEncoderGetEncodedDataBuffer(EncoderId id, int index);
+    int UNITY_INTERFACE_API uNvEncoderGetEncodedFrames(EncoderId id, EncodedFrame *frames, int maxCount);
+    void UNITY_INTERFACE_API uNvEncoderSetBitstreamLeaseEnabled(EncoderId id, bool enabled);
+    bool UNITY_INTERFACE_API uNvEncoderGetLeasedEncodedData(EncoderId id, int index, const void **buffer, int *size, uint64_t *token);
+    bool UNITY_INTERFACE_API uNvEncoderReleaseEncodedData(EncoderId id, uint64_t token);
+    uint64_t UNITY_INTERFACE_API uNvEncoderGetEncodedDataOverflowCount(EncoderId id);
+    uint64_t UNITY_INTERFACE_API uNvEncoderGetBitstreamAllocationCount(EncoderId id);
+    uint64_t UNITY_INTERFACE_API uNvEncoderGetDuplicateFrameCount(EncoderId id);
+    uint64_t UNITY_INTERFACE_API uNvEncoderGetSkippedDuplicateFrameCount(EncoderId id);
+    EncoderId UNITY_INTERFACE_API uNvEncoderCreateSimulcastEncoder(
+        int width, int height, DXGI_FORMAT format, int frameRate, int asyncDepth, const EncoderConfig *config,
+        const SimulcastRendition *renditions, int renditionCount);
+    void UNITY_INTERFACE_API uNvEncoderDestroySimulcastEncoder(EncoderId id);
+    bool UNITY_INTERFACE_API uNvEncoderIsSimulcastValid(EncoderId id);
+    bool UNITY_INTERFACE_API uNvEncoderEncodeSimulcast(EncoderId id, ID3D11Texture2D *texture, const EncodeOptions *options);
+    EncoderId UNITY_INTERFACE_API uNvEncoderGetSimulcastRenditionEncoder(EncoderId id, int index);
+    const char * UNITY_INTERFACE_API uNvEncoderGetSimulcastError(EncoderId id);
+    bool UNITY_INTERFACE_API uNvEncoderSetRateControl(EncoderId id, int averageBitRate, int maxBitRate, int frameRate, bool forceIdrFrame);
+    void UNITY_INTERFACE_API uNvEncoderRequestIntraRefresh(EncoderId id);
+    const char * UNITY_INTERFACE_API uNvEncoderGetError(EncoderId id);
+    const char * UNITY_INTERFACE_API uNvEncoderGetEncoderConfigError(const EncoderConfig *config, int asyncDepth);
+    bool UNITY_INTERFACE_API uNvEncoderGetEncoderCaps(NvencCodec codec, EncoderCaps *caps);
+    void UNITY_INTERFACE_API uNvEncoderSetEncoderCapsCachePath(const char *path);
+    bool UNITY_INTERFACE_API uNvEncoderHasError(EncoderId id);
+}
+
+
+// Every heap allocation in the process is counted, the ones the stub driver
+// makes apart from the others. All the forms of new and delete go through
+// the same pair of functions, so whatever one form allocates any other form
+// can free.
+namespace
+{
+    std::atomic<uint64_t> g_allocationCount = { 0 };
+    std::atomic<uint64_t> g_stubAllocationCount = { 0 };
+
+
+    void * Allocate(size_t size, size_t alignment) noexcept
+    {
+        if (StubCallScope::IsActive()) ++g_stubAllocationCount;
+        else ++g_allocationCount;
+        if (size == 0) size = 1;
+        if (alignment <= alignof(std::max_align_t)) return std::malloc(size);
+#ifdef _WIN32
+        return ::_aligned_malloc(size, alignment);
+#else
+        void *p = nullptr;
+        return ::posix_memalign(&p, alignment, size) == 0 ? p : nullptr;
+#endif
+    }
+
+
+    void Deallocate(void *p, size_t alignment) noexcept
+    {
+#ifdef _WIN32
+        if (alignment > alignof(std::max_align_t))
+        {
+            ::_aligned_free(p);
+            return;
+        }
+#else
+        (void)alignment;
+#endif
+        std::free(p);
+    }
+
+
+    void * AllocateOrThrow(size_t size, size_t alignment)
+    {
+        if (void *p = Allocate(size, alignment)) return p;
+        throw std::bad_alloc();
+    }
+}
+
+
+void * operator new(size_t size) { return AllocateOrThrow(size, 0); }
+void * operator new[](size_t size) { return AllocateOrThrow(size, 0); }
+void * operator new(size_t size, const std::nothrow_t &) noexcept { return Allocate(size, 0); }
+void * operator new[](size_t size, const std::nothrow_t &) noexcept { return Allocate(size, 0); }
+void operator delete(void *p) noexcept { Deallocate(p, 0); }
+void operator delete[](void *p) noexcept { Deallocate(p, 0); }
+void operator delete(void *p, size_t) noexcept { Deallocate(p, 0); }
+void operator delete[](void *p, size_t) noexcept { Deallocate(p, 0); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { Deallocate(p, 0); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { Deallocate(p, 0); }
+
+#ifdef __cpp_aligned_new
+void * operator new(size_t size, std::align_val_t alignment) { return AllocateOrThrow(size, static_cast<size_t>(alignment)); }
+void * operator new[](size_t size, std::align_val_t alignment) { return AllocateOrThrow(size, static_cast<size_t>(alignment)); }
+void * operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept { return Allocate(size, static_cast<size_t>(alignment)); }
+void * operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept { return Allocate(size, static_cast<size_t>(alignment)); }
+void operator delete(void *p, std::align_val_t alignment) noexcept { Deallocate(p, static_cast<size_t>(alignment)); }
+void operator delete[](void *p, std::align_val_t alignment) noexcept { Deallocate(p, static_cast<size_t>(alignment)); }
+void operator delete(void *p, size_t, std::align_val_t alignment) noexcept { Deallocate(p, static_cast<size_t>(alignment)); }
+void operator delete[](void *p, size_t, std::align_val_t alignment) noexcept { Deallocate(p, static_cast<size_t>(alignment)); }
+void operator delete(void *p, std::align_val_t alignment, const std::nothrow_t &) noexcept { Deallocate(p, static_cast<size_t>(alignment)); }
+void operator delete[](void *p, std::align_val_t alignment, const std::nothrow_t &) noexcept { Deallocate(p, static_cast<size_t>(alignment)); }
+#endif
+
+
+namespace
+{
+
+
+enum class Consumer
+{
+    Copy,
+    Frames,
+    Lease,
+};
+
+
+const char * GetConsumerName(Consumer consumer)
+{
+    switch (consumer)
+    {
+        case Consumer::Copy: return "copy";
+        case Consumer::Frames: return "frames";
+        case Consumer::Lease: return "lease";
+    }
+    return "unknown";
+}
+
+
+struct InputFormat
+{
+    const char *name;
+    DXGI_FORMAT format;
+};
+
+
+const InputFormat inputFormats[] =
+{
+    { "rgba", DXGI_FORMAT_R8G8B8A8_UNORM },
+    { "bgra", DXGI_FORMAT_B8G8R8A8_UNORM },
+    { "rgb10a2", DXGI_FORMAT_R10G10B10A2_UNORM },
+    { "ayuv", DXGI_FORMAT_AYUV },
+    { "nv12", DXGI_FORMAT_NV12 },
+    { "p010", DXGI_FORMAT_P010 },
+};
+
+
+const char * GetInputFormatName(DXGI_FORMAT format)
+{
+    for (const auto &inputFormat : inputFormats)
+    {
+        if (inputFormat.format == format) return inputFormat.name;
+    }
+    return "unknown";
+}
+
+
+const char * GetInputConversionName(NvencInputConversion conversion)
+{
+    switch (conversion)
+    {
+        case NvencInputConversion::None: return "none";
+        case NvencInputConversion::Nv12: return "nv12";
+        case NvencInputConversion::Yuv444: return "yuv444";
+    }
+    return "unknown";
+}
+
+
+struct Resolution
+{
+    int width;
+    int height;
+};
+
+
+struct Options
+{
+    std::vector<Resolution> resolutions = { { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 } };
+    std::vector<int> asyncDepths = { 1, 3, 8 };
+    std::vector<int> encoderCounts = { 1, 2, 4 };
+    Consumer consumer = Consumer::Frames;
+    NvencCodec codec = NvencCodec::H264;
+    DXGI_FORMAT format = DXGI_FORMAT_R8G8B8A8_UNORM;
+    int frames = 600;
+    int warmupFrames = 60;
+    int frameRate = 0;
+    // Stub driver cost of a 1080p frame, scaled by the pixel count.
+    int latencyUs = 2000;
+    int jitterUs = 200;
+    int frameSize = 16 * 1024;
+    int idrFrameSize = 128 * 1024;
+    // Frames between bitrate changes, 0 never changes it.
+    int rateChangeInterval = 0;
+    // Frames between resizes, 0 never resizes.
+    int resizeInterval = 0;
+    // Allocates the input surfaces at the case resolution up front. Otherwise
+    // they are reallocated the first time the encoder grows to it.
+    bool isSurfacePreallocated = true;
+    int resourceLatencyUs = 0;
+    // Frames between recovery requests, 0 never requests one. They start an
+    // intra-refresh wave when it is enabled and force an IDR frame otherwise.
+    int recoveryInterval = 0;
+    bool isIntraRefreshEnabled = false;
+    // Frames between LTR marks, 0 disables LTR. Recovery requests then use
+    // the newest LTR frame that a receiver reporting the loss still holds.
+    int ltrInterval = 0;
+    // Recovery requests invalidate the frames that the receiver lost. This
+    // takes precedence over LTR frames and needs the frames consumer to learn
+    // the timestamps that the stub driver is checked against.
+    bool isInvalidationEnabled = false;
+    // Slices per frame handed out as soon as they are written, 0 hands out
+    // whole frames.
+    int sliceCount = 0;
+    // Every frame gets a QP delta map foveated around a moving gaze point,
+    // with a HUD strip at the bottom kept at high quality.
+    bool isQpMapEnabled = false;
+    // Frames come from system memory through the input buffers of the
+    // session instead of from a texture.
+    bool isMemoryInput = false;
+    // Memory frames in RGBA or BGRA are converted to YUV on the CPU, and the
+    // converters are checked against the scalar reference and timed.
+    NvencInputConversion conversion = NvencInputConversion::None;
+    // Ticks that show the same content, 0 changes it every tick. Anything
+    // else enables static-frame skip, and memory frames are hashed while
+    // textures are flagged as unchanged.
+    int staticRun = 0;
+    // One simulcast encoder per case whose renditions halve the size from one
+    // to the next, so the encoder count is the rendition count.
+    bool isSimulcast = false;
+    // Replays canned network traces through the ABR controller instead of
+    // encoding anything.
+    bool isAbrSimulation = false;
+    // Times the handoff of encoded data between threads through SpscRing
+    // and through the mutex and swapped vectors it replaced.
+    bool isHandoffMeasured = false;
+    // Times draining batches of frames through the copy and the frames
+    // consumers, and counts the exported calls that each takes.
+    bool isInteropMeasured = false;
+    std::string outputPath;
+};
+
+
+struct Case
+{
+    Resolution resolution;
+    int asyncDepth;
+    int encoderCount;
+};
+
+
+struct Result
+{
+    Case c;
+    int actualAsyncDepth = 0;
+    uint64_t submitted = 0;
+    uint64_t received = 0;
+    uint64_t submitFailures = 0;
+    uint64_t overflows = 0;
+    uint64_t errors = 0;
+    uint64_t rateChanges = 0;
+    uint64_t resizes = 0;
+    uint64_t recoveries = 0;
+    uint64_t invalidatedFrames = 0;
+    uint64_t invalidationMismatches = 0;
+    // Ends of stream that followed another one without a frame in between,
+    // which a resize that flushes more than once sends.
+    uint64_t repeatedEos = 0;
+    // Bitstreams still locked once every frame was consumed, and unlocks of
+    // bitstreams that were not locked. Either means a lease was lost or
+    // revoked.
+    int64_t lockedBitstreams = 0;
+    uint64_t unmatchedUnlocks = 0;
+    double resizeP50 = 0.0;
+    double resizeP99 = 0.0;
+    double resizeMax = 0.0;
+    double seconds = 0.0;
+    double fps = 0.0;
+    // Encoded frames after which the stub engine had nothing queued.
+    double starvedFrameRatio = 0.0;
+    double latencyP50 = 0.0;
+    double latencyP99 = 0.0;
+    double latencyP999 = 0.0;
+    double latencyMax = 0.0;
+    double firstChunkLatencyP50 = 0.0;
+    double firstChunkLatencyP99 = 0.0;
+    // Allocations per frame outside of the stub driver, which have to be
+    // none once warmed up, and the ones of the stub. The bitstream pool still
+    // allocates the first time a frame falls into a new size class, which
+    // bitstreamAllocations counts instead.
+    double allocationsPerFrame = 0.0;
+    double stubAllocationsPerFrame = 0.0;
+    uint32_t frameSizeP50 = 0;
+    uint32_t frameSizeP99 = 0;
+    uint32_t frameSizeMax = 0;
+    uint64_t bitstreamAllocations = 0;
+    double qpMapBuildUs = 0.0;
+    double qpMapReferenceBuildUs = 0.0;
+    uint64_t qpMapMismatches = 0;
+    // Bytes per second that EncodeFromMemory moved, copy and lock included,
+    // and what the streaming and the plain copy reach on their own.
+    double uploadBytesPerSecond = 0.0;
+    double streamCopyBytesPerSecond = 0.0;
+    double referenceCopyBytesPerSecond = 0.0;
+    uint64_t uploadCopyMismatches = 0;
+    // Bytes of RGB per second that each instruction set converts on one
+    // thread, indexed by ConversionIsa, and the best one on the threads that
+    // the encoder uses at this size. Zero for instruction sets this CPU lacks.
+    double conversionBytesPerSecond[3] = {};
+    double threadedConversionBytesPerSecond = 0.0;
+    uint32_t conversionThreadCount = 0;
+    // Bytes that differ from the scalar reference, and the largest distance
+    // of the reference from the exact formula.
+    uint64_t conversionMismatches = 0;
+    double conversionMaxError = 0.0;
+    // Frames that static-frame skip found unchanged and the ones it did not
+    // encode. Without pacing and resizes every submitted frame is taken, so
+    // the duplicates are known up front, and a difference is a mismatch like
+    // a hash that differs from the reference or misses a changed byte.
+    uint64_t duplicateFrames = 0;
+    uint64_t skippedFrames = 0;
+    double frameHashBytesPerSecond = 0.0;
+    double referenceFrameHashBytesPerSecond = 0.0;
+    uint64_t frameHashMismatches = 0;
+    // Work of the stub device per encoded frame, and IDR frames that are not
+    // in every rendition of a simulcast.
+    double deviceCopiesPerFrame = 0.0;
+    double deviceScalesPerFrame = 0.0;
+    double deviceFlushesPerFrame = 0.0;
+    // Shared textures opened and immediate contexts taken after warmup. Both
+    // belong to creating surfaces, so they have to be none unless a resize
+    // grows the surfaces.
+    uint64_t deviceOpens = 0;
+    uint64_t deviceContexts = 0;
+    uint64_t keyframeMismatches = 0;
+    // Median latency of the first and largest rendition of a simulcast and of
+    // the last and smallest one, which has to finish well before it.
+    double largestRenditionLatencyP50 = 0.0;
+    double smallestRenditionLatencyP50 = 0.0;
+};
+
+
+struct EncoderState
+{
+    EncoderId id = -1;
+    std::vector<std::chrono::steady_clock::time_point> submitTimes;
+    uint64_t received = 0;
+    uint64_t submitFailures = 0;
+    uint32_t receivedSize = 0;
+    EncodeOptions nextOptions;
+    std::vector<uint64_t> timestamps;
+    std::vector<uint64_t> lostFrames;
+    uint64_t invalidatedFrames = 0;
+    uint64_t skippedFrames = 0;
+    std::vector<uint64_t> idrFrames;
+    std::vector<double> latencies;
+};
+
+
+using Clock = std::chrono::steady_clock;
+
+
+void PrintUsage()
+{
+    ::fprintf(stderr,
+        "usage: uNvEncoderBenchmark [options]\n"
+        "  --resolutions WxH,...   default 1280x720,1920x1080,3840x2160\n"
+        "  --depths N,...          async depths, default 1,3,8\n"
+        "  --encoders N,...        concurrent encoders, default 1,2,4\n"
+        "  --consumer NAME         copy | frames | lease, default frames\n"
+        "  --codec NAME            h264 | hevc, default h264\n"
+        "  --format NAME           rgba | bgra | rgb10a2 | ayuv | nv12 | p010 input textures, default rgba\n"
+        "  --frames N              measured frames per encoder, default 600\n"
+        "  --warmup N              unmeasured frames per encoder, default 60\n"
+        "  --fps N                 submit rate, 0 submits as fast as accepted\n"
+        "  --latency-us N          stub encode time of a 1080p frame, default 2000\n"
+        "  --jitter-us N           stub encode time jitter, default 200\n"
+        "  --frame-size N          stub P frame size at 1080p, default 16384\n"
+        "  --idr-size N            stub IDR frame size at 1080p, default 131072\n"
+        "  --bitrate-step N        frames between bitrate changes, default 0 (off)\n"
+        "  --resize-step N         frames between resizes to 3/4 size and back, default 0 (off)\n"
+        "  --surfaces NAME         max | fit, preallocated or grown on resize, default max\n"
+        "  --resource-latency-us N stub time to register a surface or create a bitstream, default 0\n"
+        "  --recovery-step N       frames between recovery requests, default 0 (off)\n"
+        "  --intra-refresh 0|1     recover with intra-refresh waves instead of IDR frames, default 0\n"
+        "  --ltr-step N            frames between LTR marks, recover from LTR frames when set, default 0 (off)\n"
+        "  --invalidate 0|1        recover by invalidating lost reference frames, needs --consumer frames\n"
+        "  --slices N              read back N slices per frame as they are written, needs --consumer frames\n"
+        "  --qp-map NAME           none | foveated, QP delta map of every frame, default none\n"
+        "  --input NAME            texture | memory, encode textures or system memory frames, default texture\n"
+        "  --convert NAME          none | nv12 | yuv444, convert RGB memory frames on the CPU, default none\n"
+        "  --static-run N          ticks that repeat the same frame, skipping unchanged ones, default 0 (off)\n"
+        "  --simulcast 0|1         encode each tick once into renditions of halving size, one per encoder\n"
+        "  --abr-sim 0|1           replay network traces through the ABR controller and check convergence\n"
+        "  --handoff 0|1           time the SPSC ring against a mutex and swapped vectors at 1k to 10k frames/s\n"
+        "  --interop 0|1           compare the calls and time that the copy and frames consumers take per frame\n"
+        "  --output PATH           write JSON there instead of stdout\n");
+}
+
+
+template <class T, class Parse>
+bool ParseList(const char *text, std::vector<T> &values, const Parse &parse)
+{
+    values.clear();
+
+    std::string list(text);
+    size_t begin = 0;
+    while (begin <= list.size())
+    {
+        const auto end = std::min(list.find(',', begin), list.size());
+        T value;
+        if (!parse(list.substr(begin, end - begin), value)) return false;
+        values.push_back(value);
+        begin = end + 1;
+    }
+
+    return !values.empty();
+}
+
+
+bool ParseInt(const std::string &text, int &value)
+{
+    char *end = nullptr;
+    const auto parsed = std::strtol(text.c_str(), &end, 10);
+    if (text.empty() || *end != '\0' || parsed < 0) return false;
+    value = static_cast<int>(parsed);
+    return true;
+}
+
+
+bool ParseResolution(const std::string &text, Resolution &value)
+{
+    const auto x = text.find('x');
+    if (x == std::string::npos) return false;
+    return
+        ParseInt(text.substr(0, x), value.width) &&
+        ParseInt(text.substr(x + 1), value.height) &&
+        value.width > 0 && value.height > 0;
+}
+
+
+bool ParseOptions(int argc, char **argv, Options &options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") return false;
+        if (i + 1 >= argc)
+        {
+            ::fprintf(stderr, "missing value for %s\n", arg.c_str());
+            return false;
+        }
+
+        const char *value = argv[++i];
+        bool isValid = true;
+        if (arg == "--resolutions") isValid = ParseList(value, options.resolutions, ParseResolution);
+        else if (arg == "--depths") isValid = ParseList(value, options.asyncDepths, ParseInt);
+        else if (arg == "--encoders") isValid = ParseList(value, options.encoderCounts, ParseInt);
+        else if (arg == "--frames") isValid = ParseInt(value, options.frames);
+        else if (arg == "--warmup") isValid = ParseInt(value, options.warmupFrames);
+        else if (arg == "--fps") isValid = ParseInt(value, options.frameRate);
+        else if (arg == "--latency-us") isValid = ParseInt(value, options.latencyUs);
+        else if (arg == "--jitter-us") isValid = ParseInt(value, options.jitterUs);
+        else if (arg == "--frame-size") isValid = ParseInt(value, options.frameSize);
+        else if (arg == "--idr-size") isValid = ParseInt(value, options.idrFrameSize);
+        else if (arg == "--bitrate-step") isValid = ParseInt(value, options.rateChangeInterval);
+        else if (arg == "--resize-step") isValid = ParseInt(value, options.resizeInterval);
+        else if (arg == "--resource-latency-us") isValid = ParseInt(value, options.resourceLatencyUs);
+        else if (arg == "--recovery-step") isValid = ParseInt(value, options.recoveryInterval);
+        else if (arg == "--slices") isValid = ParseInt(value, options.sliceCount);
+        else if (arg == "--ltr-step") isValid = ParseInt(value, options.ltrInterval);
+        else if (arg == "--static-run") isValid = ParseInt(value, options.staticRun);
+        else if (arg == "--intra-refresh")
+        {
+            int enabled = 0;
+            isValid = ParseInt(value, enabled) && enabled <= 1;
+            options.isIntraRefreshEnabled = enabled != 0;
+        }
+        else if (arg == "--invalidate")
+        {
+            int enabled = 0;
+            isValid = ParseInt(value, enabled) && enabled <= 1;
+            options.isInvalidationEnabled = enabled != 0;
+        }
+        else if (arg == "--simulcast")
+        {
+            int enabled = 0;
+            isValid = ParseInt(value, enabled) && enabled <= 1;
+            options.isSimulcast = enabled != 0;
+        }
+        else if (arg == "--abr-sim")
+        {
+            int enabled = 0;
+            isValid = ParseInt(value, enabled) && enabled <= 1;
+            options.isAbrSimulation = enabled != 0;
+        }
+        else if (arg == "--handoff")
+        {
+            int enabled = 0;
+            isValid = ParseInt(value, enabled) && enabled <= 1;
+            options.isHandoffMeasured = enabled != 0;
+        }
+        else if (arg == "--interop")
+        {
+            int enabled = 0;
+            isValid = ParseInt(value, enabled) && enabled <= 1;
+            options.isInteropMeasured = enabled != 0;
+        }
+        else if (arg == "--output") options.outputPath = value;
+        else if (arg == "--codec")
+        {
+            const std::string name = value;
+            if (name == "h264") options.codec = NvencCodec::H264;
+            else if (name == "hevc") options.codec = NvencCodec::HEVC;
+            else isValid = false;
+        }
+        else if (arg == "--format")
+        {
+            const std::string name = value;
+            const auto it = std::find_if(std::begin(inputFormats), std::end(inputFormats),
+                [&](const InputFormat &inputFormat) { return name == inputFormat.name; });
+            if (it != std::end(inputFormats)) options.format = it->format;
+            else isValid = false;
+        }
+        else if (arg == "--input")
+        {
+            const std::string name = value;
+            if (name == "texture") options.isMemoryInput = false;
+            else if (name == "memory") options.isMemoryInput = true;
+            else isValid = false;
+        }
+        else if (arg == "--convert")
+        {
+            const std::string name = value;
+            if (name == "none") options.conversion = NvencInputConversion::None;
+            else if (name == "nv12") options.conversion = NvencInputConversion::Nv12;
+            else if (name == "yuv444") options.conversion = NvencInputConversion::Yuv444;
+            else isValid = false;
+        }
+        else if (arg == "--qp-map")
+        {
+            const std::string name = value;
+            if (name == "none") options.isQpMapEnabled = false;
+            else if (name == "foveated") options.isQpMapEnabled = true;
+            else isValid = false;
+        }
+        else if (arg == "--surfaces")
+        {
+            const std::string name = value;
+            if (name == "max") options.isSurfacePreallocated = true;
+            else if (name == "fit") options.isSurfacePreallocated = false;
+            else isValid = false;
+        }
+        else if (arg == "--consumer")
+        {
+            const std::string name = value;
+            if (name == "copy") options.consumer = Consumer::Copy;
+            else if (name == "frames") options.consumer = Consumer::Frames;
+            else if (name == "lease") options.consumer = Consumer::Lease;
+            else isValid = false;
+        }
+        else
+        {
+            ::fprintf(stderr, "unknown option %s\n", arg.c_str());
+            return false;
+        }
+
+        if (!isValid)
+        {
+            ::fprintf(stderr, "invalid value for %s: %s\n", arg.c_str(), value);
+            return false;
+        }
+    }
+
+    if (options.sliceCount > 0 && options.consumer != Consumer::Frames)
+    {
+        ::fprintf(stderr, "--slices needs --consumer frames\n");
+        return false;
+    }
+    if (options.isInvalidationEnabled && options.consumer != Consumer::Frames)
+    {
+        ::fprintf(stderr, "--invalidate needs --consumer frames\n");
+        return false;
+    }
+    if (options.isSimulcast && (options.resizeInterval > 0 || options.ltrInterval > 0 || options.isMemoryInput))
+    {
+        ::fprintf(stderr, "--simulcast cannot resize, use LTR frames or take memory input\n");
+        return false;
+    }
+
+    if (options.isAbrSimulation + options.isHandoffMeasured + options.isInteropMeasured > 1)
+    {
+        ::fprintf(stderr, "--abr-sim, --handoff and --interop are separate runs\n");
+        return false;
+    }
+
+    return options.frames > 0;
+}
+
+
+// Resizing encoders start at about 3/4 of the case resolution and step up to
+// it and back, like a streamer adapting the resolution to the link.
+Resolution GetEncodeResolution(const Options &options, const Resolution &resolution, int frame)
+{
+    if (options.resizeInterval <= 0) return resolution;
+
+    const bool isFull = (frame / options.resizeInterval) % 2 == 1;
+    if (isFull) return resolution;
+
+    const auto scale = [](int size) { return (size * 3 / 4 + 1) & ~1; };
+    return { scale(resolution.width), scale(resolution.height) };
+}
+
+
+// The gaze wanders over the frame in a figure eight every 90 frames, with the
+// default radii and deltas around it.
+Foveation GetFoveation(int frame)
+{
+    const double angle = 2.0 * 3.14159265358979 * (frame % 90) / 90.0;
+
+    Foveation foveation;
+    foveation.gazeX = static_cast<float>(0.5 + 0.3 * std::cos(angle));
+    foveation.gazeY = static_cast<float>(0.5 + 0.25 * std::sin(2.0 * angle));
+    return foveation;
+}
+
+
+// Times the foveated map of the case resolution as Encode builds it for every
+// frame, and compares it with the scalar reference.
+void MeasureQpMapBuild(const Options &options, const Resolution &resolution, Result &result)
+{
+    constexpr int iterationCount = 200;
+
+    const auto width = static_cast<uint32_t>(resolution.width);
+    const auto height = static_cast<uint32_t>(resolution.height);
+    const auto blockSize = GetQpMapBlockSize(options.codec);
+    const auto size = static_cast<size_t>((width + blockSize - 1) / blockSize) * ((height + blockSize - 1) / blockSize);
+    std::vector<int8_t> map(size);
+    std::vector<int8_t> reference(size);
+
+    double seconds = 0.0;
+    double referenceSeconds = 0.0;
+    for (int i = 0; i < iterationCount; ++i)
+    {
+        const auto foveation = GetFoveation(i);
+        const auto start = Clock::now();
+        BuildFoveatedQpMap(foveation, width, height, blockSize, map.data());
+        const auto middle = Clock::now();
+        BuildFoveatedQpMapReference(foveation, width, height, blockSize, reference.data());
+        const auto end = Clock::now();
+
+        seconds += std::chrono::duration<double>(middle - start).count();
+        referenceSeconds += std::chrono::duration<double>(end - middle).count();
+        for (size_t j = 0; j < size; ++j)
+        {
+            if (map[j] != reference[j]) ++result.qpMapMismatches;
+        }
+    }
+
+    result.qpMapBuildUs = seconds * 1e6 / iterationCount;
+    result.qpMapReferenceBuildUs = referenceSeconds * 1e6 / iterationCount;
+}
+
+
+// Rows of a frame in memory, NV12 and P010 with their chroma plane.
+uint32_t GetMemoryFrameRowCount(DXGI_FORMAT format, uint32_t height)
+{
+    return HasChromaPlane(GetBufferFormat(format)) ? height + (height + 1) / 2 : height;
+}
+
+
+// Times both row copies on a frame of the case resolution into a buffer with
+// the pitch alignment of the driver, as EncodeFromMemory copies it.
+void MeasureUploadCopy(const Options &options, const Resolution &resolution, Result &result)
+{
+    constexpr int iterationCount = 50;
+    constexpr size_t pitchAlignment = 256;
+
+    const auto height = static_cast<uint32_t>(resolution.height);
+    const auto rowSize = static_cast<size_t>(resolution.width) * GetBytesPerPixel(GetBufferFormat(options.format));
+    const auto pitch = (rowSize + pitchAlignment - 1) / pitchAlignment * pitchAlignment;
+    const auto rowCount = GetMemoryFrameRowCount(options.format, height);
+    std::vector<uint8_t> source(rowSize * rowCount, 0x5a);
+    std::vector<uint8_t> destination(pitch * rowCount + pitchAlignment);
+    auto *aligned = destination.data() + (pitchAlignment - reinterpret_cast<uintptr_t>(destination.data()) % pitchAlignment) % pitchAlignment;
+
+    double seconds = 0.0;
+    double referenceSeconds = 0.0;
+    for (int i = 0; i < iterationCount; ++i)
+    {
+        const auto start = Clock::now();
+        StreamCopyRows(aligned, pitch, source.data(), rowSize, rowSize, rowCount);
+        const auto middle = Clock::now();
+        CopyRowsReference(aligned, pitch, source.data(), rowSize, rowSize, rowCount);
+        const auto end = Clock::now();
+
+        seconds += std::chrono::duration<double>(middle - start).count();
+        referenceSeconds += std::chrono::duration<double>(end - middle).count();
+    }
+
+    const double bytes = static_cast<double>(rowSize) * rowCount * iterationCount;
+    result.streamCopyBytesPerSecond = bytes / seconds;
+    result.referenceCopyBytesPerSecond = bytes / referenceSeconds;
+
+    // Odd pitches and a misaligned destination take every path of the
+    // streaming copy, and the bytes between rows must stay untouched.
+    const auto oddPitch = rowSize + 3;
+    for (size_t i = 0; i < source.size(); ++i) source[i] = static_cast<uint8_t>(i * 7);
+    std::vector<uint8_t> streamed(oddPitch * rowCount + 1, 0xee);
+    std::vector<uint8_t> reference(streamed);
+    StreamCopyRows(streamed.data() + 1, oddPitch, source.data(), rowSize, rowSize - 5, rowCount);
+    CopyRowsReference(reference.data() + 1, oddPitch, source.data(), rowSize, rowSize - 5, rowCount);
+    for (size_t i = 0; i < streamed.size(); ++i)
+    {
+        if (streamed[i] != reference[i]) ++result.uploadCopyMismatches;
+    }
+}
+
+
+// YUV of an RGB color with the exact formula of the matrix and range.
+void GetExactYuv(const double (&rgb)[3], NvencColorMatrix matrix, NvencColorRange range, double (&yuv)[3])
+{
+    const double kr = matrix == NvencColorMatrix::Bt601 ? 0.299 : 0.2126;
+    const double kb = matrix == NvencColorMatrix::Bt601 ? 0.114 : 0.0722;
+    const bool isFullRange = range == NvencColorRange::Full;
+    const double y = kr * rgb[0] + (1 - kr - kb) * rgb[1] + kb * rgb[2];
+    const double chromaScale = isFullRange ? 1.0 : 224.0 / 255.0;
+    yuv[0] = isFullRange ? y : 16 + y * 219.0 / 255.0;
+    yuv[1] = 128 + (rgb[2] - y) / (2 * (1 - kb)) * chromaScale;
+    yuv[2] = 128 + (rgb[0] - y) / (2 * (1 - kr)) * chromaScale;
+}
+
+
+double GetSampleError(uint8_t sample, double exact)
+{
+    return std::abs(sample - std::min(std::max(exact, 0.0), 255.0));
+}
+
+
+// The largest distance of a converted frame from the exact formula. NV12
+// chroma is compared with the average of each 2x2 block.
+double GetConversionError(const RgbImage &image, const YuvImage &yuv, YuvFormat format, NvencColorMatrix matrix, NvencColorRange range)
+{
+    const auto getRgb = [&](uint32_t x, uint32_t y, double (&rgb)[3])
+    {
+        const auto pixel = image.data + y * image.pitch + 4 * x;
+        rgb[0] += pixel[image.isBgra ? 2 : 0];
+        rgb[1] += pixel[1];
+        rgb[2] += pixel[image.isBgra ? 0 : 2];
+    };
+
+    double maxError = 0.0;
+    for (uint32_t y = 0; y < image.height; ++y)
+    {
+        for (uint32_t x = 0; x < image.width; ++x)
+        {
+            double rgb[3] = {};
+            double exact[3];
+            getRgb(x, y, rgb);
+            GetExactYuv(rgb, matrix, range, exact);
+            const auto offset = y * yuv.pitch + x;
+            maxError = std::max(maxError, GetSampleError(yuv.y[offset], exact[0]));
+            if (format == YuvFormat::Yuv444)
+            {
+                maxError = std::max(maxError, GetSampleError(yuv.u[offset], exact[1]));
+                maxError = std::max(maxError, GetSampleError(yuv.v[offset], exact[2]));
+            }
+        }
+    }
+
+    if (format == YuvFormat::Nv12)
+    {
+        for (uint32_t y = 0; y < image.height; y += 2)
+        {
+            for (uint32_t x = 0; x < image.width; x += 2)
+            {
+                double rgb[3] = {};
+                double exact[3];
+                const auto right = std::min(x + 1, image.width - 1);
+                const auto bottom = std::min(y + 1, image.height - 1);
+                getRgb(x, y, rgb);
+                getRgb(right, y, rgb);
+                getRgb(x, bottom, rgb);
+                getRgb(right, bottom, rgb);
+                for (auto &c : rgb) c /= 4;
+                GetExactYuv(rgb, matrix, range, exact);
+                const auto offset = y / 2 * yuv.pitch + x;
+                maxError = std::max(maxError, GetSampleError(yuv.u[offset], exact[1]));
+                maxError = std::max(maxError, GetSampleError(yuv.u[offset + 1], exact[2]));
+            }
+        }
+    }
+
+    return maxError;
+}
+
+
+void FillPseudoRandom(std::vector<uint8_t> &bytes)
+{
+    uint32_t state = 12345;
+    for (auto &b : bytes)
+    {
+        state = state * 1664525 + 1013904223;
+        b = static_cast<uint8_t>(state >> 24);
+    }
+}
+
+
+template <class Convert>
+double MeasureConversionBytesPerSecond(double frameBytes, const Convert &convert)
+{
+    constexpr int iterationCount = 20;
+
+    // The first run faults the pages of the destination in.
+    convert();
+    const auto start = Clock::now();
+    for (int i = 0; i < iterationCount; ++i) convert();
+    const auto seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    return frameBytes * iterationCount / seconds;
+}
+
+
+// Checks every instruction set of this CPU and the threaded converter
+// against the scalar reference in every matrix and range, then times them
+// on a frame of the case resolution.
+void MeasureColorConversion(const Options &options, const Resolution &resolution, Result &result)
+{
+    const auto format = options.conversion == NvencInputConversion::Yuv444 ? YuvFormat::Yuv444 : YuvFormat::Nv12;
+    const auto bestIsa = GetBestConversionIsa();
+    const NvencColorMatrix matrices[] = { NvencColorMatrix::Bt601, NvencColorMatrix::Bt709 };
+    const NvencColorRange ranges[] = { NvencColorRange::Limited, NvencColorRange::Full };
+
+    // An odd size with padded rows takes the vector loops and their tails,
+    // repeats the last column and row of NV12, and splits into bands of
+    // uneven height.
+    {
+        constexpr uint32_t width = 203;
+        constexpr uint32_t height = 37;
+        constexpr size_t sourcePitch = width * 4 + 12;
+        constexpr size_t pitch = width + 21;
+        std::vector<uint8_t> pixels(sourcePitch * height);
+        FillPseudoRandom(pixels);
+        std::vector<uint8_t> reference(pitch * height * 3);
+        std::vector<uint8_t> converted(reference.size());
+        const auto getYuv = [&](std::vector<uint8_t> &planes)
+        {
+            return YuvImage { planes.data(), planes.data() + pitch * height, planes.data() + 2 * pitch * height, pitch };
+        };
+        ColorConverter converter(4, bestIsa);
+
+        for (const auto matrix : matrices)
+        {
+            for (const auto range : ranges)
+            {
+                for (const bool isBgra : { false, true })
+                {
+                    const RgbImage image = { pixels.data(), sourcePitch, width, height, isBgra };
+                    const auto coefficients = GetYuvCoefficients(matrix, range, isBgra);
+                    std::fill(reference.begin(), reference.end(), static_cast<uint8_t>(0xee));
+                    ConvertRows(image, getYuv(reference), format, coefficients, ConversionIsa::Scalar, 0, height);
+                    result.conversionMaxError = std::max(
+                        result.conversionMaxError, GetConversionError(image, getYuv(reference), format, matrix, range));
+
+                    for (int isa = static_cast<int>(ConversionIsa::Sse41); isa <= static_cast<int>(bestIsa) + 1; ++isa)
+                    {
+                        std::fill(converted.begin(), converted.end(), static_cast<uint8_t>(0xee));
+                        if (isa <= static_cast<int>(bestIsa))
+                        {
+                            ConvertRows(image, getYuv(converted), format, coefficients, static_cast<ConversionIsa>(isa), 0, height);
+                        }
+                        else
+                        {
+                            converter.Convert(image, getYuv(converted), format, matrix, range);
+                        }
+                        for (size_t i = 0; i < converted.size(); ++i)
+                        {
+                            if (converted[i] != reference[i]) ++result.conversionMismatches;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    constexpr size_t pitchAlignment = 256;
+    const auto width = static_cast<uint32_t>(resolution.width);
+    const auto height = static_cast<uint32_t>(resolution.height);
+    const auto pitch = (width + pitchAlignment - 1) / pitchAlignment * pitchAlignment;
+    std::vector<uint8_t> pixels(static_cast<size_t>(width) * height * 4);
+    FillPseudoRandom(pixels);
+    std::vector<uint8_t> planes(pitch * height * 3);
+    const RgbImage image = { pixels.data(), static_cast<size_t>(width) * 4, width, height, false };
+    const YuvImage yuv = { planes.data(), planes.data() + pitch * height, planes.data() + 2 * pitch * height, pitch };
+    const auto coefficients = GetYuvCoefficients(NvencColorMatrix::Bt709, NvencColorRange::Limited, false);
+    const auto frameBytes = static_cast<double>(pixels.size());
+
+    for (int isa = 0; isa <= static_cast<int>(bestIsa); ++isa)
+    {
+        result.conversionBytesPerSecond[isa] = MeasureConversionBytesPerSecond(frameBytes, [&]
+        {
+            ConvertRows(image, yuv, format, coefficients, static_cast<ConversionIsa>(isa), 0, height);
+        });
+    }
+
+    ColorConverter converter(GetConversionThreadCount(width, height), bestIsa);
+    result.conversionThreadCount = converter.GetThreadCount();
+    result.threadedConversionBytesPerSecond = MeasureConversionBytesPerSecond(frameBytes, [&]
+    {
+        converter.Convert(image, yuv, format, NvencColorMatrix::Bt709, NvencColorRange::Limited);
+    });
+}
+
+
+// Checks the SIMD hash against the reference on rows that end in every way
+// a stripe can, from a misaligned start with padded rows. Every changed byte
+// of a row has to change the hash and no byte of the padding may. Then times
+// both on an RGBA frame of the case resolution.
+void MeasureFrameHash(const Resolution &resolution, Result &result)
+{
+    constexpr uint32_t rowCount = 5;
+    constexpr size_t padding = 13;
+    for (const size_t rowSize : { 1, 7, 63, 64, 65, 130, 517 })
+    {
+        const auto pitch = rowSize + padding;
+        std::vector<uint8_t> bytes(pitch * rowCount + 1);
+        FillPseudoRandom(bytes);
+        const auto *data = bytes.data() + 1;
+        const auto hash = HashRows(data, pitch, rowSize, rowCount, rowSize);
+        if (hash != HashRowsReference(data, pitch, rowSize, rowCount, rowSize)) ++result.frameHashMismatches;
+
+        for (size_t i = 1; i < bytes.size(); ++i)
+        {
+            const bool isPadding = (i - 1) % pitch >= rowSize;
+            bytes[i] ^= 0x10;
+            if ((HashRows(data, pitch, rowSize, rowCount, rowSize) == hash) != isPadding) ++result.frameHashMismatches;
+            bytes[i] ^= 0x10;
+        }
+    }
+
+    constexpr int iterationCount = 20;
+    const auto rowSize = static_cast<size_t>(resolution.width) * 4;
+    const auto height = static_cast<uint32_t>(resolution.height);
+    std::vector<uint8_t> pixels(rowSize * height);
+    FillPseudoRandom(pixels);
+
+    uint64_t hash = 0;
+    const auto start = Clock::now();
+    for (int i = 0; i < iterationCount; ++i) hash ^= HashRows(pixels.data(), rowSize, rowSize, height, i);
+    const auto middle = Clock::now();
+    for (int i = 0; i < iterationCount; ++i) hash ^= HashRowsReference(pixels.data(), rowSize, rowSize, height, i);
+    const auto end = Clock::now();
+
+    // Both sums cancel out when the hashes agree.
+    if (hash != 0) ++result.frameHashMismatches;
+    const double bytes = static_cast<double>(pixels.size()) * iterationCount;
+    result.frameHashBytesPerSecond = bytes / std::chrono::duration<double>(middle - start).count();
+    result.referenceFrameHashBytesPerSecond = bytes / std::chrono::duration<double>(end - middle).count();
+}
+
+
+double GetStubScale(const Resolution &resolution)
+{
+    return static_cast<double>(resolution.width) * resolution.height / (1920.0 * 1080.0);
+}
+
+
+int64_t GetStubLatencyUs(const Options &options, const Resolution &resolution)
+{
+    return static_cast<int64_t>(options.latencyUs * GetStubScale(resolution));
+}
+
+
+StubEncodeConfig CreateStubConfig(const Options &options, const Resolution &resolution, std::vector<uint64_t> &invalidatedTimestamps)
+{
+    const double scale = GetStubScale(resolution);
+
+    StubEncodeConfig config;
+    config.encodeLatency = std::chrono::microseconds(GetStubLatencyUs(options, resolution));
+    config.encodeLatencyJitter = std::chrono::microseconds(options.jitterUs);
+    config.frameSize = static_cast<uint32_t>(options.frameSize * scale);
+    config.idrFrameSize = static_cast<uint32_t>(options.idrFrameSize * scale);
+    config.frameSizeJitter = config.frameSize / 4;
+    config.recoveryFrameSize = 2 * config.frameSize;
+    config.onInvalidateRefFrame = [&](uint64_t timestamp) { invalidatedTimestamps.push_back(timestamp); };
+    config.resourceLatency = std::chrono::microseconds(options.resourceLatencyUs);
+
+    // The renditions of a simulcast take the time of their own size.
+    if (options.isSimulcast)
+    {
+        config.encodeLatency = std::chrono::microseconds(options.latencyUs);
+        config.latencyReferencePixelCount = 1920 * 1080;
+    }
+    return config;
+}
+
+
+struct InvalidConfig
+{
+    const char *name;
+    void (*apply)(EncoderConfig &config);
+    int asyncDepth;
+};
+
+
+// One entry per rule of GetEncoderConfigError, each breaking only that rule
+// of a config that is valid otherwise.
+const InvalidConfig invalidConfigs[] =
+{
+    { "unknown codec", [](EncoderConfig &c) { c.codec = static_cast<NvencCodec>(2); }, 3 },
+    { "unknown preset", [](EncoderConfig &c) { c.preset = static_cast<NvencPreset>(6); }, 3 },
+    { "HEVC profile for H.264", [](EncoderConfig &c) { c.profile = NvencProfile::HevcMain; }, 3 },
+    { "H.264 profile for HEVC", [](EncoderConfig &c) { c.codec = NvencCodec::HEVC; c.profile = NvencProfile::H264High; }, 3 },
+    { "unknown profile", [](EncoderConfig &c) { c.profile = static_cast<NvencProfile>(6); }, 3 },
+    { "unknown rate control mode", [](EncoderConfig &c) { c.rateControlMode = static_cast<NvencRateControlMode>(6); }, 3 },
+    { "CBR without bitrate", [](EncoderConfig &c) { c.rateControlMode = NvencRateControlMode::Cbr; }, 3 },
+    { "max below average bitrate", [](EncoderConfig &c) { c.averageBitRate = 8000000; c.maxBitRate = 4000000; }, 3 },
+    { "target quality above 51", [](EncoderConfig &c) { c.targetQuality = 52; }, 3 },
+    { "more than 4 B-frames", [](EncoderConfig &c) { c.bFrameCount = 5; }, 16 },
+    { "B-frames in baseline", [](EncoderConfig &c) { c.profile = NvencProfile::H264Baseline; c.bFrameCount = 1; }, 3 },
+    { "GOP not longer than B-frames", [](EncoderConfig &c) { c.gopLength = 2; c.bFrameCount = 2; }, 8 },
+    { "lookahead deeper than 32", [](EncoderConfig &c) { c.lookaheadDepth = 33; }, 16 },
+    { "lookahead with constant QP", [](EncoderConfig &c) { c.rateControlMode = NvencRateControlMode::ConstQp; c.lookaheadDepth = 1; }, 3 },
+    { "zero async depth", [](EncoderConfig &) {}, 0 },
+    { "negative async depth", [](EncoderConfig &) {}, -1 },
+    { "async depth above 16", [](EncoderConfig &) {}, 17 },
+    { "async depth within B-frames and lookahead", [](EncoderConfig &c) { c.bFrameCount = 1; c.lookaheadDepth = 2; }, 3 },
+    { "AQ strength above 15", [](EncoderConfig &c) { c.enableSpatialAq = 1; c.aqStrength = 16; }, 3 },
+    { "AQ strength without spatial AQ", [](EncoderConfig &c) { c.aqStrength = 5; }, 3 },
+    { "temporal AQ for HEVC", [](EncoderConfig &c) { c.codec = NvencCodec::HEVC; c.enableTemporalAq = 1; }, 3 },
+    { "unknown slice mode", [](EncoderConfig &c) { c.sliceMode = static_cast<NvencSliceMode>(4); }, 3 },
+    { "slice mode without data", [](EncoderConfig &c) { c.sliceMode = NvencSliceMode::Count; }, 3 },
+    { "sub-frame readback with B-frames", [](EncoderConfig &c) { c.enableSubFrameReadback = 1; c.bFrameCount = 1; }, 3 },
+    { "intra refresh with B-frames", [](EncoderConfig &c) { c.enableIntraRefresh = 1; c.bFrameCount = 1; }, 3 },
+    { "intra-refresh period of 1", [](EncoderConfig &c) { c.enableIntraRefresh = 1; c.intraRefreshPeriod = 1; }, 3 },
+    { "intra-refresh count not below period", [](EncoderConfig &c) { c.enableIntraRefresh = 1; c.intraRefreshPeriod = 10; c.intraRefreshCount = 10; }, 3 },
+    { "LTR with B-frames", [](EncoderConfig &c) { c.enableLtr = 1; c.bFrameCount = 1; }, 3 },
+    { "more than 32 LTR frames", [](EncoderConfig &c) { c.enableLtr = 1; c.ltrFrameCount = 33; }, 3 },
+    { "YUV 4:4:4 with a profile", [](EncoderConfig &c) { c.inputConversion = NvencInputConversion::Yuv444; c.profile = NvencProfile::H264High; }, 3 },
+    { "unknown input conversion", [](EncoderConfig &c) { c.inputConversion = static_cast<NvencInputConversion>(3); }, 3 },
+    { "unknown color matrix", [](EncoderConfig &c) { c.colorMatrix = static_cast<NvencColorMatrix>(2); }, 3 },
+    { "unknown color range", [](EncoderConfig &c) { c.colorRange = static_cast<NvencColorRange>(2); }, 3 },
+};
+
+
+// Every invalid config has to be reported by the export, and a session
+// given it has to fail with that error before making a single NVENC call.
+// The valid config it is derived from has to make calls, which proves that
+// the stub sees them.
+uint64_t CheckInvalidConfigs()
+{
+    std::atomic<uint64_t> callCount = { 0 };
+    StubEncodeConfig stubConfig;
+    stubConfig.injectError = [&](const char *) { ++callCount; return NV_ENC_SUCCESS; };
+    StubEncodeBackend backend(stubConfig);
+    const auto device = backend.CreateGraphicsDevice();
+    BitstreamPool bitstreamPool;
+
+    const auto initialize = [&](const EncoderConfig &config, int asyncDepth, std::string &error)
+    {
+        NvencDesc desc;
+        desc.backend = &backend;
+        desc.device = device.get();
+        desc.config = config;
+        desc.width = 640;
+        desc.height = 360;
+        desc.asyncDepth = static_cast<uint32_t>(std::max(asyncDepth, 0));
+        desc.bitstreamPool = &bitstreamPool;
+
+        Nvenc nvenc(desc);
+        try
+        {
+            nvenc.Initialize();
+            nvenc.Finalize();
+            return true;
+        }
+        catch (const std::exception &e)
+        {
+            error = e.what();
+        }
+        return false;
+    };
+
+    EncoderConfig validConfig;
+    uNvEncoderGetDefaultEncoderConfig(&validConfig);
+
+    uint64_t mismatches = 0;
+    std::string error;
+    if (uNvEncoderGetEncoderConfigError(&validConfig, 3) || !initialize(validConfig, 3, error) || callCount == 0)
+    {
+        ++mismatches;
+    }
+
+    for (const auto &invalidConfig : invalidConfigs)
+    {
+        auto config = validConfig;
+        invalidConfig.apply(config);
+
+        const auto expected = uNvEncoderGetEncoderConfigError(&config, invalidConfig.asyncDepth);
+        callCount = 0;
+        error.clear();
+        const bool isInitialized = initialize(config, invalidConfig.asyncDepth, error);
+        if (!expected || isInitialized || callCount > 0 || error != std::string("Invalid encoder config: ") + expected)
+        {
+            ::fprintf(stderr, "invalid config not rejected up front: %s\n", invalidConfig.name);
+            ++mismatches;
+        }
+    }
+    return mismatches;
+}
+
+
+// NVENC calls made while a session initializes, each failed on the given
+// call so that the per-resource ones fail with part of the resources made.
+struct FailedInitialization
+{
+    const char *function;
+    int failingCall;
+};
+
+
+const FailedInitialization failedInitializations[] =
+{
+    { "nvEncOpenEncodeSessionEx", 1 },
+    { "nvEncGetEncodeCaps", 1 },
+    { "nvEncInitializeEncoder", 1 },
+    { "nvEncRegisterAsyncEvent", 2 },
+    { "nvEncRegisterResource", 2 },
+    { "nvEncCreateBitstreamBuffer", 2 },
+};
+
+
+// A session whose initialization fails has to leave no session and no input
+// texture behind, since consumer GPUs only allow a few sessions per process.
+uint64_t CheckFailedInitializations()
+{
+    uint64_t leaks = 0;
+    for (const auto &failure : failedInitializations)
+    {
+        int callCount = 0;
+        StubEncodeConfig stubConfig;
+        stubConfig.injectError = [&](const char *function)
+        {
+            if (::strcmp(function, failure.function) != 0 || ++callCount != failure.failingCall) return NV_ENC_SUCCESS;
+            return NV_ENC_ERR_GENERIC;
+        };
+        StubEncodeBackend backend(stubConfig);
+        const auto device = backend.CreateGraphicsDevice();
+        BitstreamPool bitstreamPool;
+
+        NvencDesc desc;
+        desc.backend = &backend;
+        desc.device = device.get();
+        uNvEncoderGetDefaultEncoderConfig(&desc.config);
+        desc.width = 640;
+        desc.height = 360;
+        desc.asyncDepth = 3;
+        desc.bitstreamPool = &bitstreamPool;
+
+        // The caps of the stub are cached, so they are only probed again
+        // once they are forgotten.
+        ClearEncoderCaps();
+
+        bool isInitialized = false;
+        {
+            Nvenc nvenc(desc);
+            try
+            {
+                nvenc.Initialize();
+                isInitialized = true;
+                nvenc.Finalize();
+            }
+            catch (const std::exception &)
+            {
+            }
+        }
+
+        const auto textureCount = static_cast<StubGraphicsDevice*>(device.get())->GetTextureCount();
+        if (isInitialized || callCount < failure.failingCall || backend.GetSessionCount() > 0 || textureCount > 0)
+        {
+            ::fprintf(stderr, "failed initialization at %s leaves %u sessions and %zu textures\n",
+                failure.function, backend.GetSessionCount(), textureCount);
+            ++leaks;
+        }
+    }
+    return leaks;
+}
+
+
+// Backend of a machine without NVENC, which fails before a session exists.
+class MissingEncodeBackend final : public IEncodeBackend
+{
+public:
+    const NV_ENCODE_API_FUNCTION_LIST & GetFunctionList() const override { return functionList_; }
+    NV_ENC_DEVICE_TYPE GetDeviceType() const override { return NV_ENC_DEVICE_TYPE_DIRECTX; }
+    std::unique_ptr<IGraphicsDevice> CreateGraphicsDevice() override
+    {
+        ThrowError("NVENC is not available.");
+        return nullptr;
+    }
+
+private:
+    NV_ENCODE_API_FUNCTION_LIST functionList_ = { NV_ENCODE_API_FUNCTION_LIST_VER };
+};
+
+
+// An encoder created without NVENC has to report an error and be destroyed
+// like any other. Off Windows no backend at all is loaded when none is set.
+uint64_t CheckMissingBackend()
+{
+    std::vector<std::shared_ptr<IEncodeBackend>> backends = { std::make_shared<MissingEncodeBackend>() };
+#ifndef _WIN32
+    backends.push_back(nullptr);
+#endif
+
+    uint64_t mismatches = 0;
+    for (const auto &backend : backends)
+    {
+        SetEncodeBackend(backend);
+        const auto id = uNvEncoderCreateEncoderEx(640, 360, DXGI_FORMAT_R8G8B8A8_UNORM, 60, 3, nullptr);
+        if (uNvEncoderIsValid(id) || !uNvEncoderHasError(id))
+        {
+            ::fprintf(stderr, "an encoder without %s backend reports no error\n", backend ? "a usable" : "any");
+            ++mismatches;
+        }
+        uNvEncoderDestroyEncoder(id);
+    }
+
+    SetEncodeBackend(nullptr);
+    return mismatches;
+}
+
+
+// One process start against the caps cache file. The stub driver reports
+// the given max width, while the caps have to show the one of the probe that
+// filled the cache. Only the LUID changes with a reboot.
+struct CapsCacheStart
+{
+    const char *name;
+    uint64_t adapterId;
+    uint32_t deviceId;
+    uint64_t driverVersion;
+    uint32_t reportedMaxWidth;
+    uint32_t expectedMaxWidth;
+    bool shouldProbe;
+};
+
+
+const CapsCacheStart capsCacheStarts[] =
+{
+    { "first start", 1, 0x2204, 1, 4096, 4096, true },
+    { "reboot", 2, 0x2204, 1, 2048, 4096, false },
+    { "driver update", 2, 0x2204, 2, 2048, 2048, true },
+    { "other GPU model", 3, 0x2684, 1, 1024, 1024, true },
+    { "reboot after the update", 4, 0x2204, 2, 4096, 2048, false },
+    { "driver rollback", 1, 0x2204, 1, 4096, 4096, true },
+};
+
+
+// Each start has to probe only when the cache file cannot answer, and a
+// second query in the same process has to be served from memory. The
+// rollback has to probe again, since the update replaced the entry of the
+// old driver while the other GPU model kept its own.
+uint64_t CheckEncoderCapsCache(const std::string &path)
+{
+    std::remove(path.c_str());
+
+    std::atomic<uint64_t> probeCount = { 0 };
+    uint64_t mismatches = 0;
+    for (const auto &start : capsCacheStarts)
+    {
+        StubEncodeConfig stubConfig;
+        stubConfig.adapterId = start.adapterId;
+        stubConfig.adapterIdentity.deviceId = start.deviceId;
+        stubConfig.driverVersion = start.driverVersion;
+        stubConfig.maxWidth = start.reportedMaxWidth;
+        stubConfig.injectError = [&](const char *function)
+        {
+            if (::strcmp(function, "nvEncGetEncodeCaps") == 0) ++probeCount;
+            return NV_ENC_SUCCESS;
+        };
+        SetEncodeBackend(std::make_shared<StubEncodeBackend>(stubConfig));
+        uNvEncoderSetEncoderCapsCachePath(path.c_str());
+
+        EncoderCaps caps;
+        probeCount = 0;
+        const bool isFirstQueried = uNvEncoderGetEncoderCaps(NvencCodec::H264, &caps);
+        const bool isProbed = probeCount > 0;
+        const auto maxWidth = caps.maxWidth;
+
+        probeCount = 0;
+        const bool isSecondQueried = uNvEncoderGetEncoderCaps(NvencCodec::H264, &caps);
+
+        if (!isFirstQueried || !isSecondQueried || isProbed != start.shouldProbe || probeCount > 0 ||
+            maxWidth != start.expectedMaxWidth || caps.maxWidth != start.expectedMaxWidth)
+        {
+            ::fprintf(stderr, "encoder caps cache mismatch on %s\n", start.name);
+            ++mismatches;
+        }
+    }
+
+    uNvEncoderSetEncoderCapsCachePath(nullptr);
+    SetEncodeBackend(nullptr);
+    std::remove(path.c_str());
+    return mismatches;
+}
+
+
+class Benchmark final
+{
+public:
+    Benchmark(const Options &options, const Case &c);
+    ~Benchmark();
+    Result Run();
+
+private:
+    bool Submit(EncoderState &encoder, int frame);
+    bool SubmitSimulcast(int frame);
+    EncodeOptions GetFrameOptions(EncoderState &encoder, int frame, bool &isChanged);
+    void AddSubmittedFrame(EncoderState &encoder, Clock::time_point now);
+    void Drain(EncoderState &encoder);
+    void AddReceivedFrame(EncoderState &encoder, uint64_t index, int size, Clock::time_point now);
+    void AddFirstChunk(EncoderState &encoder, uint64_t index, Clock::time_point now);
+    void Resize(int frame, Result &result);
+    void Recover(EncoderState &encoder);
+
+    const Options &options_;
+    const Case case_;
+    std::shared_ptr<StubEncodeBackend> backend_;
+    std::vector<EncoderState> encoders_;
+    EncoderId simulcastId_ = -1;
+    std::vector<EncodedFrame> frames_;
+    std::vector<double> latencies_;
+    std::vector<double> firstChunkLatencies_;
+    std::vector<double> resizeLatencies_;
+    std::vector<uint32_t> frameSizes_;
+    // What the stub driver received, in the order of the calls.
+    std::vector<uint64_t> invalidatedTimestamps_;
+    // Tightly packed source of memory input at the case resolution, which
+    // covers every size the encoders are resized to.
+    std::vector<uint8_t> memoryFrame_;
+    double uploadSeconds_ = 0.0;
+    double uploadBytes_ = 0.0;
+    bool isMeasuring_ = false;
+    uint64_t errors_ = 0;
+};
+
+
+Benchmark::Benchmark(const Options &options, const Case &c)
+    : options_(options)
+    , case_(c)
+    , backend_(std::make_shared<StubEncodeBackend>(CreateStubConfig(options, c.resolution, invalidatedTimestamps_)))
+    , encoders_(c.encoderCount)
+    , frames_(256)
+{
+    SetEncodeBackend(backend_);
+
+    EncoderConfig config;
+    uNvEncoderGetDefaultEncoderConfig(&config);
+    config.codec = options_.codec;
+    config.enableIntraRefresh = options_.isIntraRefreshEnabled ? 1 : 0;
+    if (options_.ltrInterval > 0)
+    {
+        config.enableLtr = 1;
+        config.ltrFrameCount = 2;
+    }
+    if (options_.sliceCount > 0)
+    {
+        config.sliceMode = NvencSliceMode::Count;
+        config.sliceModeData = options_.sliceCount;
+        config.enableSubFrameReadback = 1;
+    }
+    if (options_.isQpMapEnabled)
+    {
+        config.enableQpDeltaMap = 1;
+    }
+    config.inputConversion = options_.conversion;
+    config.enableStaticFrameSkip = options_.staticRun > 0 ? 1 : 0;
+    if (options_.isSurfacePreallocated)
+    {
+        config.maxWidth = c.resolution.width;
+        config.maxHeight = c.resolution.height;
+    }
+
+    const auto resolution = GetEncodeResolution(options_, c.resolution, 0);
+    const auto frameCount = static_cast<size_t>(options_.warmupFrames + options_.frames);
+    if (options_.isSimulcast)
+    {
+        std::vector<SimulcastRendition> renditions(encoders_.size());
+        for (size_t i = 0; i < renditions.size(); ++i)
+        {
+            const auto half = [&](int size) { return std::max(((size >> i) + 1) & ~1, 2); };
+            renditions[i].width = half(resolution.width);
+            renditions[i].height = half(resolution.height);
+            renditions[i].averageBitRate = std::max(config.averageBitRate >> (2 * i), 100000U);
+        }
+
+        simulcastId_ = uNvEncoderCreateSimulcastEncoder(
+            resolution.width,
+            resolution.height,
+            options_.format,
+            options_.frameRate > 0 ? options_.frameRate : 60,
+            c.asyncDepth,
+            &config,
+            renditions.data(),
+            static_cast<int>(renditions.size()));
+    }
+
+    for (size_t i = 0; i < encoders_.size(); ++i)
+    {
+        auto &encoder = encoders_[i];
+        encoder.id = options_.isSimulcast ?
+            uNvEncoderGetSimulcastRenditionEncoder(simulcastId_, static_cast<int>(i)) :
+            uNvEncoderCreateEncoderEx(
+                resolution.width,
+                resolution.height,
+                options_.format,
+                options_.frameRate > 0 ? options_.frameRate : 60,
+                c.asyncDepth,
+                &config);
+        uNvEncoderSetBitstreamLeaseEnabled(encoder.id, options_.consumer == Consumer::Lease);
+        if (options_.isQpMapEnabled)
+        {
+            const QpRegion hud = { 0, c.resolution.height * 7 / 8, c.resolution.width, c.resolution.height / 8, -2 };
+            if (!uNvEncoderSetQpRegions(encoder.id, &hud, 1)) ++errors_;
+        }
+        encoder.submitTimes.reserve(frameCount);
+        encoder.timestamps.resize(frameCount);
+        encoder.lostFrames.reserve(frameCount);
+        if (options_.isSimulcast) encoder.idrFrames.reserve(frameCount);
+    }
+
+    if (options_.isMemoryInput)
+    {
+        const auto pitch = static_cast<size_t>(c.resolution.width) * GetBytesPerPixel(GetBufferFormat(options_.format));
+        memoryFrame_.assign(pitch * GetMemoryFrameRowCount(options_.format, c.resolution.height), 0x5a);
+    }
+
+    latencies_.reserve(frameCount * encoders_.size());
+    for (auto &encoder : encoders_) encoder.latencies.reserve(frameCount);
+    firstChunkLatencies_.reserve(frameCount * encoders_.size());
+    frameSizes_.reserve(frameCount * encoders_.size());
+    if (options_.resizeInterval > 0)
+    {
+        resizeLatencies_.reserve(frameCount / options_.resizeInterval * encoders_.size());
+    }
+}
+
+
+Benchmark::~Benchmark()
+{
+    for (const auto &encoder : encoders_)
+    {
+        uNvEncoderDestroyEncoder(encoder.id);
+    }
+    uNvEncoderDestroySimulcastEncoder(simulcastId_);
+
+    SetEncodeBackend(nullptr);
+}
+
+
+// The stub device never dereferences the source texture.
+ID3D11Texture2D * GetSourceTexture()
+{
+    static int source = 0;
+    return reinterpret_cast<ID3D11Texture2D*>(&source);
+}
+
+
+EncodeOptions Benchmark::GetFrameOptions(EncoderState &encoder, int frame, bool &isChanged)
+{
+    // LTR marks alternate between two slots so that one older frame is always
+    // kept while the next one is marked.
+    auto options = encoder.nextOptions;
+    const auto index = static_cast<int>(encoder.submitTimes.size());
+    if (options_.ltrInterval > 0 && index % options_.ltrInterval == 0)
+    {
+        options.markLtrFrame = 1;
+        options.ltrMarkSlot = (index / options_.ltrInterval) % 2;
+    }
+
+    if (options_.isQpMapEnabled)
+    {
+        const auto foveation = GetFoveation(index);
+        if (!uNvEncoderSetFoveation(encoder.id, &foveation)) ++errors_;
+    }
+
+    // Memory frames change in their first bytes, which every encoder shares.
+    isChanged = options_.staticRun == 0 || frame % options_.staticRun == 0;
+    if (options_.isMemoryInput && isChanged)
+    {
+        const auto content = static_cast<uint32_t>(frame);
+        ::memcpy(memoryFrame_.data(), &content, sizeof(content));
+    }
+    else if (!isChanged)
+    {
+        options.isUnchanged = options_.isMemoryInput ? 0 : 1;
+    }
+
+    return options;
+}
+
+
+bool Benchmark::Submit(EncoderState &encoder, int frame)
+{
+    bool isChanged = false;
+    const auto options = GetFrameOptions(encoder, frame, isChanged);
+
+    const auto now = Clock::now();
+    if (options_.isMemoryInput)
+    {
+        const auto width = uNvEncoderGetWidth(encoder.id);
+        const auto height = static_cast<uint32_t>(uNvEncoderGetHeight(encoder.id));
+        const auto pitch = static_cast<size_t>(width) * GetBytesPerPixel(GetBufferFormat(options_.format));
+        const auto isEncoded = uNvEncoderEncodeFromMemoryWithOptions(
+            encoder.id, memoryFrame_.data(), static_cast<int>(pitch), options_.format, &options);
+        if (!isEncoded) return false;
+
+        if (isMeasuring_)
+        {
+            uploadSeconds_ += std::chrono::duration<double>(Clock::now() - now).count();
+            uploadBytes_ += static_cast<double>(pitch) * GetMemoryFrameRowCount(options_.format, height);
+        }
+    }
+    else if (!uNvEncoderEncodeWithOptions(encoder.id, GetSourceTexture(), &options))
+    {
+        return false;
+    }
+
+    AddSubmittedFrame(encoder, now);
+    return true;
+}
+
+
+// The renditions take the same options, since recovery only requests intra
+// refresh here and LTR frames are not used.
+bool Benchmark::SubmitSimulcast(int frame)
+{
+    bool isChanged = false;
+    EncodeOptions options;
+    for (auto &encoder : encoders_)
+    {
+        options = GetFrameOptions(encoder, frame, isChanged);
+    }
+
+    const auto now = Clock::now();
+    if (!uNvEncoderEncodeSimulcast(simulcastId_, GetSourceTexture(), &options)) return false;
+
+    for (auto &encoder : encoders_)
+    {
+        AddSubmittedFrame(encoder, now);
+    }
+    return true;
+}
+
+
+void Benchmark::AddSubmittedFrame(EncoderState &encoder, Clock::time_point now)
+{
+    encoder.nextOptions = EncodeOptions();
+    if (options_.staticRun > 0)
+    {
+        const auto skippedFrames = uNvEncoderGetSkippedDuplicateFrameCount(encoder.id);
+        if (skippedFrames != encoder.skippedFrames)
+        {
+            encoder.skippedFrames = skippedFrames;
+            return;
+        }
+    }
+    encoder.submitTimes.push_back(now);
+}
+
+
+void Benchmark::AddReceivedFrame(EncoderState &encoder, uint64_t index, int size, Clock::time_point now)
+{
+    ++encoder.received;
+    if (!isMeasuring_ || index >= encoder.submitTimes.size()) return;
+
+    const auto latency = std::chrono::duration<double, std::milli>(now - encoder.submitTimes[index]);
+    latencies_.push_back(latency.count());
+    encoder.latencies.push_back(latency.count());
+    frameSizes_.push_back(static_cast<uint32_t>(std::max(size, 0)));
+}
+
+
+// The receiver reports a loss a few frames after it happened, and has decoded
+// everything before the lost frame.
+void Benchmark::Recover(EncoderState &encoder)
+{
+    constexpr uint64_t lossReportDelay = 4;
+
+    const auto submitted = static_cast<uint64_t>(encoder.submitTimes.size());
+    if (options_.isInvalidationEnabled && submitted > lossReportDelay)
+    {
+        // Everything from the lost frame on is corrupt at the receiver.
+        const auto begin = encoder.lostFrames.size();
+        for (auto index = submitted - lossReportDelay - 1; index < submitted; ++index)
+        {
+            encoder.lostFrames.push_back(index);
+        }
+        const int count = uNvEncoderInvalidateRefFrames(encoder.id, &encoder.lostFrames[begin], lossReportDelay + 1);
+        if (count < 0) ++errors_;
+        else encoder.invalidatedFrames += count;
+        return;
+    }
+
+    const int slot = options_.ltrInterval > 0 && submitted > lossReportDelay ?
+        uNvEncoderFindLtrSlot(encoder.id, submitted - lossReportDelay - 1) : -1;
+    if (slot < 0)
+    {
+        uNvEncoderRequestIntraRefresh(encoder.id);
+        return;
+    }
+
+    encoder.nextOptions.useLtrFrames = 1;
+    encoder.nextOptions.ltrUseSlotMask = 1U << slot;
+}
+
+
+void Benchmark::Resize(int frame, Result &result)
+{
+    const auto resolution = GetEncodeResolution(options_, case_.resolution, frame);
+
+    for (auto &encoder : encoders_)
+    {
+        const auto start = Clock::now();
+        uNvEncoderResize(encoder.id, resolution.width, resolution.height);
+        const auto elapsed = std::chrono::duration<double, std::milli>(Clock::now() - start);
+
+        if (!uNvEncoderIsValid(encoder.id)) ++errors_;
+        if (frame < options_.warmupFrames) continue;
+        ++result.resizes;
+        resizeLatencies_.push_back(elapsed.count());
+    }
+}
+
+
+void Benchmark::AddFirstChunk(EncoderState &encoder, uint64_t index, Clock::time_point now)
+{
+    if (!isMeasuring_ || index >= encoder.submitTimes.size()) return;
+
+    const auto latency = std::chrono::duration<double, std::milli>(now - encoder.submitTimes[index]);
+    firstChunkLatencies_.push_back(latency.count());
+}
+
+
+void Benchmark::Drain(EncoderState &encoder)
+{
+    const auto id = encoder.id;
+
+    switch (options_.consumer)
+    {
+        case Consumer::Copy:
+        {
+            uNvEncoderCopyEncodedData(id);
+            const auto now = Clock::now();
+            const int count = uNvEncoderGetEncodedDataCount(id);
+            for (int i = 0; i < count; ++i)
+            {
+                const int size = uNvEncoderGetEncodedDataSize(id, i);
+                if (!uNvEncoderGetEncodedDataBuffer(id, i) || size <= 0) ++errors_;
+                AddReceivedFrame(encoder, encoder.received, size, now);
+            }
+            break;
+        }
+        case Consumer::Frames:
+        {
+            const int count = uNvEncoderGetEncodedFrames(id, frames_.data(), static_cast<int>(frames_.size()));
+            const auto now = Clock::now();
+            for (int i = 0; i < count; ++i)
+            {
+                // Only the chunk that ends a frame may be empty.
+                const auto &f = frames_[i];
+                if (!f.buffer || f.size < 0 || (f.size == 0 && !f.isFrameEnd)) ++errors_;
+                if (f.codec != static_cast<int32_t>(options_.codec)) ++errors_;
+                if (f.offset == 0) AddFirstChunk(encoder, f.frameIndex, now);
+                if (f.offset == 0 && simulcastId_ >= 0 && f.pictureType == NV_ENC_PIC_TYPE_IDR) encoder.idrFrames.push_back(f.frameIndex);
+                if (f.frameIndex < encoder.timestamps.size()) encoder.timestamps[f.frameIndex] = f.timestamp;
+                if (f.isLeased && !uNvEncoderReleaseEncodedData(id, f.frameIndex)) ++errors_;
+
+                encoder.receivedSize += f.size;
+                if (!f.isFrameEnd) continue;
+                AddReceivedFrame(encoder, f.frameIndex, encoder.receivedSize, now);
+                encoder.receivedSize = 0;
+            }
+            break;
+        }
+        case Consumer::Lease:
+        {
+            uNvEncoderCopyEncodedData(id);
+            const auto now = Clock::now();
+            const int count = uNvEncoderGetEncodedDataCount(id);
+            for (int i = 0; i < count; ++i)
+            {
+                // Frames drained by a flush are copied even in lease mode.
+                const void *buffer = nullptr;
+                int size = 0;
+                uint64_t token = 0;
+                if (!uNvEncoderGetLeasedEncodedData(id, i, &buffer, &size, &token))
+                {
+                    size = uNvEncoderGetEncodedDataSize(id, i);
+                    if (!uNvEncoderGetEncodedDataBuffer(id, i) || size <= 0) ++errors_;
+                    AddReceivedFrame(encoder, encoder.received, size, now);
+                    continue;
+                }
+                AddReceivedFrame(encoder, token, size, now);
+                if (!uNvEncoderReleaseEncodedData(id, token)) ++errors_;
+            }
+            break;
+        }
+    }
+}
+
+
+Result Benchmark::Run()
+{
+    Result result;
+    result.c = case_;
+
+    for (const auto &encoder : encoders_)
+    {
+        if (!uNvEncoderIsValid(encoder.id))
+        {
+            ::fprintf(stderr, "failed to create an encoder: %s\n", uNvEncoderGetError(encoder.id));
+            ++result.errors;
+        }
+    }
+    if (options_.isSimulcast && !uNvEncoderIsSimulcastValid(simulcastId_))
+    {
+        ::fprintf(stderr, "failed to create a simulcast encoder: %s\n", uNvEncoderGetSimulcastError(simulcastId_));
+        ++result.errors;
+    }
+    if (result.errors > 0) return result;
+
+    result.actualAsyncDepth = uNvEncoderGetAsyncDepth(encoders_.front().id);
+
+    const int totalFrames = options_.warmupFrames + options_.frames;
+    const bool isPaced = options_.frameRate > 0;
+    const auto interval = isPaced ?
+        std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / options_.frameRate)) :
+        Clock::duration::zero();
+
+    uint64_t allocationCountAtStart = 0;
+    uint64_t stubAllocationCountAtStart = 0;
+    uint64_t bitstreamAllocationCountAtStart = 0;
+    uint64_t receivedAtStart = 0;
+    uint64_t encodedAtStart = 0;
+    uint64_t starvedAtStart = 0;
+    uint64_t deviceOpensAtStart = 0;
+    uint64_t deviceContextsAtStart = 0;
+    Clock::time_point measureStart;
+    auto nextTick = Clock::now();
+
+    // One submit and one drain per encoder and tick, like a game loop does.
+    for (int frame = 0; frame < totalFrames; ++frame)
+    {
+        if (frame == options_.warmupFrames)
+        {
+            isMeasuring_ = true;
+            measureStart = Clock::now();
+            allocationCountAtStart = g_allocationCount;
+            stubAllocationCountAtStart = g_stubAllocationCount;
+            for (const auto &encoder : encoders_)
+            {
+                bitstreamAllocationCountAtStart += uNvEncoderGetBitstreamAllocationCount(encoder.id);
+            }
+            for (const auto &encoder : encoders_) receivedAtStart += encoder.received;
+            encodedAtStart = backend_->GetEncodedFrameCount();
+            starvedAtStart = backend_->GetStarvedFrameCount();
+            deviceOpensAtStart = backend_->GetDeviceStats().openCount;
+            deviceContextsAtStart = backend_->GetDeviceStats().contextCount;
+        }
+
+        if (isPaced)
+        {
+            // Slices are only worth it when a sender picks them up right
+            // away, so meanwhile drain like a network thread would.
+            const auto pollInterval = std::chrono::microseconds(250);
+            while (options_.sliceCount > 0 && Clock::now() + pollInterval < nextTick)
+            {
+                for (auto &encoder : encoders_) Drain(encoder);
+                std::this_thread::sleep_for(pollInterval);
+            }
+            std::this_thread::sleep_until(nextTick);
+            nextTick += interval;
+        }
+
+        // Alternates like a congestion controller stepping between two rates.
+        if (options_.rateChangeInterval > 0 && frame > 0 && frame % options_.rateChangeInterval == 0)
+        {
+            const bool isHigh = (frame / options_.rateChangeInterval) % 2 == 0;
+            const int bitRate = isHigh ? 8000000 : 4000000;
+            for (auto &encoder : encoders_)
+            {
+                if (!uNvEncoderSetRateControl(encoder.id, bitRate, 2 * bitRate, 0, false)) ++errors_;
+                if (frame >= options_.warmupFrames) ++result.rateChanges;
+            }
+        }
+
+        if (options_.resizeInterval > 0 && frame > 0 && frame % options_.resizeInterval == 0)
+        {
+            Resize(frame, result);
+        }
+
+        if (options_.recoveryInterval > 0 && frame > 0 && frame % options_.recoveryInterval == 0)
+        {
+            for (auto &encoder : encoders_)
+            {
+                Recover(encoder);
+                if (frame >= options_.warmupFrames) ++result.recoveries;
+            }
+        }
+
+        if (options_.isSimulcast)
+        {
+            if (isPaced)
+            {
+                if (!SubmitSimulcast(frame) && frame >= options_.warmupFrames)
+                {
+                    for (auto &encoder : encoders_) ++encoder.submitFailures;
+                }
+            }
+            else
+            {
+                while (!SubmitSimulcast(frame))
+                {
+                    for (auto &encoder : encoders_) Drain(encoder);
+                    std::this_thread::yield();
+                }
+            }
+        }
+        else
+        {
+            for (auto &encoder : encoders_)
+            {
+                if (isPaced)
+                {
+                    // A frame the encoder cannot take is lost like in the game.
+                    if (!Submit(encoder, frame) && frame >= options_.warmupFrames) ++encoder.submitFailures;
+                    continue;
+                }
+
+                while (!Submit(encoder, frame))
+                {
+                    Drain(encoder);
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        for (auto &encoder : encoders_)
+        {
+            Drain(encoder);
+        }
+    }
+
+    // The engine runs dry once nothing is submitted anymore, so only the
+    // frames encoded until then count.
+    const auto encodedFrames = backend_->GetEncodedFrameCount() - encodedAtStart;
+    const auto starvedFrames = backend_->GetStarvedFrameCount() - starvedAtStart;
+    result.starvedFrameRatio = encodedFrames > 0 ? static_cast<double>(starvedFrames) / encodedFrames : 0.0;
+
+    const auto deadline = Clock::now() + std::chrono::seconds(10);
+    for (;;)
+    {
+        bool isDone = true;
+        for (auto &encoder : encoders_)
+        {
+            Drain(encoder);
+            const auto overflows = uNvEncoderGetEncodedDataOverflowCount(encoder.id);
+            if (encoder.received + overflows < encoder.submitTimes.size()) isDone = false;
+        }
+        if (isDone || Clock::now() > deadline) break;
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    const auto measureEnd = Clock::now();
+    const auto stubAllocationCount = g_stubAllocationCount - stubAllocationCountAtStart;
+    auto allocationCount = g_allocationCount - allocationCountAtStart;
+
+    for (const auto &encoder : encoders_)
+    {
+        result.submitted += encoder.submitTimes.size();
+        result.received += encoder.received;
+        result.submitFailures += encoder.submitFailures;
+        result.overflows += uNvEncoderGetEncodedDataOverflowCount(encoder.id);
+        result.bitstreamAllocations += uNvEncoderGetBitstreamAllocationCount(encoder.id);
+        result.duplicateFrames += uNvEncoderGetDuplicateFrameCount(encoder.id);
+        result.skippedFrames += uNvEncoderGetSkippedDuplicateFrameCount(encoder.id);
+        if (uNvEncoderHasError(encoder.id))
+        {
+            ::fprintf(stderr, "encoder error: %s\n", uNvEncoderGetError(encoder.id));
+            ++errors_;
+        }
+    }
+    result.errors = errors_;
+    allocationCount -= std::min(allocationCount, result.bitstreamAllocations - bitstreamAllocationCountAtStart);
+    result.repeatedEos = backend_->GetRepeatedEosCount();
+    result.lockedBitstreams = backend_->GetLockedBitstreamCount();
+    result.unmatchedUnlocks = backend_->GetUnmatchedUnlockCount();
+
+    // The stub driver has to have been called once per invalidated frame, each
+    // time with the timestamp that the frame was reported with.
+    std::vector<uint64_t> lostTimestamps;
+    for (const auto &encoder : encoders_)
+    {
+        result.invalidatedFrames += encoder.invalidatedFrames;
+        for (const auto index : encoder.lostFrames)
+        {
+            if (index < encoder.timestamps.size()) lostTimestamps.push_back(encoder.timestamps[index]);
+        }
+    }
+    std::sort(lostTimestamps.begin(), lostTimestamps.end());
+    const auto callCount = static_cast<uint64_t>(invalidatedTimestamps_.size());
+    result.invalidationMismatches = std::max(callCount, result.invalidatedFrames) - std::min(callCount, result.invalidatedFrames);
+    for (const auto timestamp : invalidatedTimestamps_)
+    {
+        if (!std::binary_search(lostTimestamps.begin(), lostTimestamps.end(), timestamp)) ++result.invalidationMismatches;
+    }
+
+    const auto measuredFrames = result.received - receivedAtStart;
+    result.seconds = std::chrono::duration<double>(measureEnd - measureStart).count();
+    result.fps = result.seconds > 0.0 ? measuredFrames / result.seconds / encoders_.size() : 0.0;
+    result.allocationsPerFrame = measuredFrames > 0 ? static_cast<double>(allocationCount) / measuredFrames : 0.0;
+    result.stubAllocationsPerFrame = measuredFrames > 0 ? static_cast<double>(stubAllocationCount) / measuredFrames : 0.0;
+
+    const auto percentile = [](const std::vector<double> &values, double p)
+    {
+        const auto index = static_cast<size_t>(p * (values.size() - 1) + 0.5);
+        return values[index];
+    };
+
+    if (!latencies_.empty())
+    {
+        std::sort(latencies_.begin(), latencies_.end());
+        result.latencyP50 = percentile(latencies_, 0.5);
+        result.latencyP99 = percentile(latencies_, 0.99);
+        result.latencyP999 = percentile(latencies_, 0.999);
+        result.latencyMax = latencies_.back();
+    }
+
+    if (simulcastId_ >= 0 && !encoders_.front().latencies.empty() && !encoders_.back().latencies.empty())
+    {
+        for (auto *latencies : { &encoders_.front().latencies, &encoders_.back().latencies })
+        {
+            std::sort(latencies->begin(), latencies->end());
+        }
+        result.largestRenditionLatencyP50 = percentile(encoders_.front().latencies, 0.5);
+        result.smallestRenditionLatencyP50 = percentile(encoders_.back().latencies, 0.5);
+    }
+
+    if (!firstChunkLatencies_.empty())
+    {
+        std::sort(firstChunkLatencies_.begin(), firstChunkLatencies_.end());
+        result.firstChunkLatencyP50 = percentile(firstChunkLatencies_, 0.5);
+        result.firstChunkLatencyP99 = percentile(firstChunkLatencies_, 0.99);
+    }
+
+    if (!frameSizes_.empty())
+    {
+        std::sort(frameSizes_.begin(), frameSizes_.end());
+        const auto sizePercentile = [&](double p)
+        {
+            return frameSizes_[static_cast<size_t>(p * (frameSizes_.size() - 1) + 0.5)];
+        };
+        result.frameSizeP50 = sizePercentile(0.5);
+        result.frameSizeP99 = sizePercentile(0.99);
+        result.frameSizeMax = frameSizes_.back();
+    }
+
+    if (!resizeLatencies_.empty())
+    {
+        std::sort(resizeLatencies_.begin(), resizeLatencies_.end());
+        result.resizeP50 = percentile(resizeLatencies_, 0.5);
+        result.resizeP99 = percentile(resizeLatencies_, 0.99);
+        result.resizeMax = resizeLatencies_.back();
+    }
+
+    if (options_.isQpMapEnabled) MeasureQpMapBuild(options_, case_.resolution, result);
+    if (options_.isMemoryInput)
+    {
+        result.uploadBytesPerSecond = uploadSeconds_ > 0.0 ? uploadBytes_ / uploadSeconds_ : 0.0;
+        MeasureUploadCopy(options_, case_.resolution, result);
+    }
+    if (options_.conversion != NvencInputConversion::None) MeasureColorConversion(options_, case_.resolution, result);
+    const auto &deviceStats = backend_->GetDeviceStats();
+    result.deviceOpens = deviceStats.openCount - deviceOpensAtStart;
+    result.deviceContexts = deviceStats.contextCount - deviceContextsAtStart;
+    if (result.submitted > 0)
+    {
+        result.deviceCopiesPerFrame = static_cast<double>(deviceStats.copyCount) / result.submitted;
+        result.deviceScalesPerFrame = static_cast<double>(deviceStats.scaleCount) / result.submitted;
+        result.deviceFlushesPerFrame = static_cast<double>(deviceStats.flushCount) / result.submitted;
+    }
+
+    // A receiver can only switch renditions at an IDR frame that all of them
+    // have.
+    for (size_t i = 1; i < encoders_.size(); ++i)
+    {
+        const auto &first = encoders_.front().idrFrames;
+        const auto &other = encoders_[i].idrFrames;
+        std::vector<uint64_t> difference;
+        std::set_symmetric_difference(first.begin(), first.end(), other.begin(), other.end(), std::back_inserter(difference));
+        result.keyframeMismatches += difference.size();
+    }
+
+    if (options_.staticRun > 0)
+    {
+        // Every tick but the ones that change the content repeats a frame.
+        if (!isPaced && options_.resizeInterval == 0)
+        {
+            const auto changedFrames = static_cast<uint64_t>((totalFrames + options_.staticRun - 1) / options_.staticRun);
+            const auto expected = (totalFrames - changedFrames) * encoders_.size();
+            result.frameHashMismatches += std::max(expected, result.duplicateFrames) - std::min(expected, result.duplicateFrames);
+        }
+        MeasureFrameHash(case_.resolution, result);
+    }
+
+    return result;
+}
+
+
+// Past this the stub engine idles for frames that a deeper ring should have
+// queued.
+constexpr double maxStarvedFrameRatio = 0.05;
+
+
+// Without pacing, and with no more than a texture copy on the submitting
+// thread, the engine is the bottleneck. Every depth past one then has to
+// keep it busy, and run at least as fast as a depth of one. Resizes that
+// flush and frames that static-frame skip leaves out idle the engine on
+// purpose. Frames shorter than a scheduling hiccup of the submitting thread
+// leave the engine waiting for it too.
+bool IsEngineBound(const Options &options, const Resolution &resolution)
+{
+    constexpr int minEngineLatencyUs = 250;
+    return
+        options.frameRate == 0 && !options.isMemoryInput && options.sliceCount == 0 &&
+        options.resizeInterval == 0 && options.staticRun == 0 &&
+        GetStubLatencyUs(options, resolution) >= minEngineLatencyUs;
+}
+
+
+// The smallest rendition of a simulcast must not wait for the largest one.
+// Each rendition has a quarter of the pixels of the one before it, and its
+// latency may be at most twice what that share of the largest one would be.
+bool IsRenditionStalled(const Options &options, const Result &result)
+{
+    if (!options.isSimulcast || result.c.encoderCount < 2 || !IsEngineBound(options, result.c.resolution)) return false;
+
+    const double pixelRatio = std::pow(0.25, result.c.encoderCount - 1);
+    return result.smallestRenditionLatencyP50 >= 2.0 * pixelRatio * result.largestRenditionLatencyP50;
+}
+
+
+uint64_t CountThroughputFailures(const Options &options, const std::vector<Result> &results)
+{
+    uint64_t failures = 0;
+    for (const auto &r : results)
+    {
+        if (r.actualAsyncDepth < 2 || r.errors > 0 || !IsEngineBound(options, r.c.resolution)) continue;
+        // Smaller renditions of a simulcast idle while the largest one paces the frames.
+        if (r.starvedFrameRatio > maxStarvedFrameRatio && !options.isSimulcast) ++failures;
+
+        for (const auto &single : results)
+        {
+            const bool isSameCase =
+                single.c.resolution.width == r.c.resolution.width &&
+                single.c.resolution.height == r.c.resolution.height &&
+                single.c.encoderCount == r.c.encoderCount;
+            if (isSameCase && single.actualAsyncDepth == 1 && r.fps < single.fps) ++failures;
+        }
+    }
+    return failures;
+}
+
+
+// A bottleneck link with a drop-tail queue in front of it. Capacity steps at
+// the given times and packets are lost at random at lossRate on top of what
+// the queue drops. Every step has to converge within maxConvergenceMs.
+struct AbrTrace
+{
+    const char *name;
+    std::vector<std::pair<int, uint32_t>> capacitySteps;
+    int durationMs;
+    double lossRate;
+    int maxConvergenceMs;
+};
+
+
+struct AbrResult
+{
+    const char *trace = "";
+    int convergenceMs = -1;
+    int maxConvergenceMs = 0;
+    double overshootPercent = 0.0;
+    double utilization = 0.0;
+    double queueDelayP95Ms = 0.0;
+    uint64_t rateChanges = 0;
+    uint32_t minFrameRate = 0;
+    uint32_t finalFrameRate = 0;
+    bool isPassed = false;
+};
+
+
+// Applied rates that stay within this band of the capacity count as
+// converged. Below it the link idles and above it the queue grows.
+constexpr double abrConvergedLow = 0.7;
+constexpr double abrConvergedHigh = 1.15;
+constexpr double abrMaxOvershootPercent = 15.0;
+constexpr double abrMaxQueueDelayMs = 100.0;
+
+
+// Increases are GCC-like at 8% per second, or slower near the capacity of
+// the last decrease, so the limits grow with how far a step goes up.
+std::vector<AbrTrace> GetAbrTraces()
+{
+    return
+    {
+        { "step-down", { { 0, 20000000 }, { 30000, 8000000 } }, 60000, 0.0, 8000 },
+        { "step-up", { { 0, 4000000 }, { 20000, 12000000 } }, 60000, 0.0, 15000 },
+        { "random-loss", { { 0, 10000000 } }, 60000, 0.03, 8000 },
+        { "oscillating", { { 0, 12000000 }, { 20000, 6000000 }, { 40000, 12000000 }, { 60000, 6000000 } }, 80000, 0.0, 25000 },
+        { "collapse", { { 0, 8000000 }, { 20000, 1500000 }, { 40000, 8000000 } }, 70000, 0.0, 25000 },
+    };
+}
+
+
+// Deterministic, so that every run replays the same losses.
+double GetUniformRandom(uint64_t &state)
+{
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return static_cast<double>(state >> 11) / static_cast<double>(1ULL << 53);
+}
+
+
+AbrResult RunAbrSimulation(const AbrTrace &trace)
+{
+    constexpr int tickMs = 1;
+    constexpr int reportIntervalMs = 50;
+    constexpr int baseDelayMs = 20;
+    constexpr double maxQueueDelayMs = 300.0;
+    constexpr double packetBits = 1200.0 * 8.0;
+    constexpr uint32_t width = 1920;
+    constexpr uint32_t height = 1080;
+    constexpr uint32_t frameRate = 60;
+
+    AbrConfig config;
+    config.minFrameRate = 15;
+    AbrController controller(config, trace.capacitySteps.front().second / 2, width, height, frameRate);
+
+    AbrResult result;
+    result.trace = trace.name;
+    result.maxConvergenceMs = trace.maxConvergenceMs;
+    result.minFrameRate = frameRate;
+
+    uint64_t random = 0x9e3779b97f4a7c15ULL;
+    double queueBits = 0.0;
+    double packetCredit = 0.0;
+    double sentBits = 0.0;
+    double lostBits = 0.0;
+    double receivedBits = 0.0;
+    AbrTarget target;
+    controller.TakeTarget(target);
+
+    // Applied rate, capacity and queue delay of every report.
+    struct Sample
+    {
+        int timeMs;
+        double bitRate;
+        double capacity;
+        double queueDelayMs;
+        double receivedBitRate;
+    };
+    std::vector<Sample> samples;
+
+    size_t step = 0;
+    for (int timeMs = 0; timeMs < trace.durationMs; timeMs += tickMs)
+    {
+        while (step + 1 < trace.capacitySteps.size() && trace.capacitySteps[step + 1].first <= timeMs) ++step;
+        const double capacity = trace.capacitySteps[step].second;
+
+        // Packets of the sender either get lost on the way, overflow the
+        // queue, or wait in it.
+        packetCredit += target.averageBitRate * tickMs / 1000.0 / packetBits;
+        for (; packetCredit >= 1.0; packetCredit -= 1.0)
+        {
+            sentBits += packetBits;
+            const bool isLost = GetUniformRandom(random) < trace.lossRate;
+            const bool isOverflow = (queueBits + packetBits) / capacity * 1000.0 > maxQueueDelayMs;
+            if (isLost || isOverflow) lostBits += packetBits;
+            else queueBits += packetBits;
+        }
+
+        const double drainedBits = std::min(queueBits, capacity * tickMs / 1000.0);
+        queueBits -= drainedBits;
+        receivedBits += drainedBits;
+
+        if ((timeMs + tickMs) % reportIntervalMs != 0) continue;
+
+        const double queueDelayMs = queueBits / capacity * 1000.0;
+        NetworkFeedback feedback;
+        feedback.time = static_cast<uint64_t>(timeMs + tickMs) * 1000;
+        feedback.delay = static_cast<int64_t>((baseDelayMs + queueDelayMs) * 1000.0);
+        feedback.rtt = static_cast<uint32_t>((2 * baseDelayMs + queueDelayMs) * 1000.0);
+        feedback.receivedBitRate = static_cast<uint32_t>(receivedBits * 1000.0 / reportIntervalMs);
+        feedback.lossRate = sentBits > 0.0 ? static_cast<float>(lostBits / sentBits) : 0.0f;
+        controller.OnFeedback(feedback);
+        samples.push_back({ timeMs + tickMs, static_cast<double>(target.averageBitRate), capacity, queueDelayMs, static_cast<double>(feedback.receivedBitRate) });
+
+        // The encoder picks the target up with its next frame.
+        if (controller.TakeTarget(target)) ++result.rateChanges;
+        result.minFrameRate = std::min(result.minFrameRate, target.frameRate);
+
+        sentBits = 0.0;
+        lostBits = 0.0;
+        receivedBits = 0.0;
+    }
+    result.finalFrameRate = target.frameRate;
+
+    // Every capacity step is judged on its own until the next one, and the
+    // trace by its worst step.
+    std::vector<double> queueDelays;
+    double utilizationSum = 0.0;
+    size_t utilizationCount = 0;
+    result.convergenceMs = 0;
+    for (size_t i = 0; i < trace.capacitySteps.size(); ++i)
+    {
+        const int begin = trace.capacitySteps[i].first;
+        const int end = i + 1 < trace.capacitySteps.size() ? trace.capacitySteps[i + 1].first : trace.durationMs;
+        const double capacity = trace.capacitySteps[i].second;
+
+        int convergedMs = -1;
+        for (const auto &sample : samples)
+        {
+            if (sample.timeMs <= begin || sample.timeMs > end) continue;
+            const double ratio = sample.bitRate / capacity;
+            const bool isConverged = ratio >= abrConvergedLow && ratio <= abrConvergedHigh;
+            if (!isConverged) convergedMs = -1;
+            else if (convergedMs < 0) convergedMs = sample.timeMs;
+        }
+        if (convergedMs < 0)
+        {
+            result.convergenceMs = -1;
+            continue;
+        }
+        if (result.convergenceMs >= 0) result.convergenceMs = std::max(result.convergenceMs, convergedMs - begin);
+
+        for (const auto &sample : samples)
+        {
+            if (sample.timeMs < convergedMs || sample.timeMs > end) continue;
+            result.overshootPercent = std::max(result.overshootPercent, (sample.bitRate / capacity - 1.0) * 100.0);
+            queueDelays.push_back(sample.queueDelayMs);
+            utilizationSum += sample.receivedBitRate / capacity;
+            ++utilizationCount;
+        }
+    }
+
+    if (!queueDelays.empty())
+    {
+        std::sort(queueDelays.begin(), queueDelays.end());
+        result.queueDelayP95Ms = queueDelays[static_cast<size_t>(0.95 * (queueDelays.size() - 1) + 0.5)];
+    }
+    result.utilization = utilizationCount > 0 ? utilizationSum / utilizationCount : 0.0;
+    result.isPassed =
+        result.convergenceMs >= 0 &&
+        result.convergenceMs <= result.maxConvergenceMs &&
+        result.overshootPercent <= abrMaxOvershootPercent &&
+        result.queueDelayP95Ms <= abrMaxQueueDelayMs;
+    return result;
+}
+
+
+// The way encoded data got from the output thread to the game thread before
+// SpscRing: appended under a mutex, and swapped out under the same mutex.
+class MutexSwapHandoff final
+{
+public:
+    bool Push(NvencEncodedData &&ed)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        list_.push_back(std::move(ed));
+        return true;
+    }
+
+    const std::vector<NvencEncodedData> & Drain()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        copied_.clear();
+        std::swap(list_, copied_);
+        return copied_;
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<NvencEncodedData> list_;
+    std::vector<NvencEncodedData> copied_;
+};
+
+
+// What Encoder does now.
+class RingHandoff final
+{
+public:
+    RingHandoff()
+        : ring_(encodedDataQueueSize)
+    {
+        copied_.reserve(ring_.GetCapacity());
+    }
+
+    bool Push(NvencEncodedData &&ed)
+    {
+        return ring_.TryPush(std::move(ed));
+    }
+
+    const std::vector<NvencEncodedData> & Drain()
+    {
+        copied_.clear();
+        NvencEncodedData ed;
+        while (ring_.TryPop(ed)) copied_.push_back(std::move(ed));
+        return copied_;
+    }
+
+private:
+    static constexpr size_t encodedDataQueueSize = 256;
+
+    SpscRing<NvencEncodedData> ring_;
+    std::vector<NvencEncodedData> copied_;
+};
+
+
+struct HandoffResult
+{
+    const char *path = "";
+    int frameRate = 0;
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    uint64_t overflows = 0;
+    uint64_t orderMismatches = 0;
+    uint64_t allocations = 0;
+    double pushUsP99 = 0.0;
+    double pushUsMax = 0.0;
+    double drainUsP50 = 0.0;
+    double drainUsP99 = 0.0;
+    double drainUsMax = 0.0;
+    bool isPassed = false;
+};
+
+
+constexpr int handoffFrameRates[] = { 1000, 2000, 5000, 10000 };
+
+
+// One thread sends half a second of frames at the frame rate and this one
+// drains them every couple of milliseconds, like the output thread and a
+// fast game thread. Frames have to arrive in order, and the ones that do not
+// arrive have to be counted as overflows. The ring must not allocate once
+// warmed up, while the swapped vectors grow whenever a drain finds more
+// frames than any before.
+template <class Handoff>
+HandoffResult MeasureHandoff(const char *path, int frameRate)
+{
+    constexpr auto drainInterval = std::chrono::milliseconds(2);
+    const int frameCount = frameRate / 2;
+    const int warmupFrameCount = frameRate / 10;
+
+    HandoffResult result;
+    result.path = path;
+    result.frameRate = frameRate;
+    result.sent = frameCount;
+
+    Handoff handoff;
+    std::vector<double> pushUs;
+    std::vector<double> drainUs;
+    pushUs.reserve(frameCount);
+    drainUs.reserve(frameCount);
+    std::atomic<bool> isProducerDone = { false };
+    uint64_t overflows = 0;
+
+    const auto toUs = [](Clock::duration duration)
+    {
+        return std::chrono::duration<double, std::micro>(duration).count();
+    };
+
+    std::thread producer([&]
+    {
+        const auto start = Clock::now();
+        for (int i = 0; i < frameCount; ++i)
+        {
+            std::this_thread::sleep_until(start + std::chrono::microseconds(1000000LL * i / frameRate));
+
+            NvencEncodedData ed;
+            ed.index = i;
+            const auto pushStart = Clock::now();
+            const bool isPushed = handoff.Push(std::move(ed));
+            const auto pushEnd = Clock::now();
+            if (i >= warmupFrameCount) pushUs.push_back(toUs(pushEnd - pushStart));
+            if (!isPushed) ++overflows;
+        }
+        isProducerDone = true;
+    });
+
+    uint64_t nextIndex = 0;
+    uint64_t startAllocations = 0;
+    bool isWarm = false;
+    for (;;)
+    {
+        // Whatever was pushed before the producer finished is in this drain.
+        const bool isDone = isProducerDone;
+        const auto drainStart = Clock::now();
+        const auto &frames = handoff.Drain();
+        for (const auto &ed : frames)
+        {
+            if (ed.index < nextIndex) ++result.orderMismatches;
+            nextIndex = ed.index + 1;
+            ++result.received;
+        }
+        const auto drainEnd = Clock::now();
+
+        if (isWarm) drainUs.push_back(toUs(drainEnd - drainStart));
+        else if (result.received >= static_cast<uint64_t>(warmupFrameCount))
+        {
+            isWarm = true;
+            startAllocations = g_allocationCount;
+        }
+
+        if (isDone && frames.empty()) break;
+        std::this_thread::sleep_for(drainInterval);
+    }
+    result.allocations = g_allocationCount - startAllocations;
+    producer.join();
+    result.overflows = overflows;
+
+    const auto percentile = [](const std::vector<double> &values, double p)
+    {
+        return values[static_cast<size_t>(p * (values.size() - 1) + 0.5)];
+    };
+
+    if (!pushUs.empty())
+    {
+        std::sort(pushUs.begin(), pushUs.end());
+        result.pushUsP99 = percentile(pushUs, 0.99);
+        result.pushUsMax = pushUs.back();
+    }
+
+    if (!drainUs.empty())
+    {
+        std::sort(drainUs.begin(), drainUs.end());
+        result.drainUsP50 = percentile(drainUs, 0.5);
+        result.drainUsP99 = percentile(drainUs, 0.99);
+        result.drainUsMax = drainUs.back();
+    }
+
+    result.isPassed =
+        result.orderMismatches == 0 &&
+        result.received + result.overflows == result.sent &&
+        (std::is_same<Handoff, MutexSwapHandoff>::value || result.allocations == 0);
+    return result;
+}
+
+
+struct InteropResult
+{
+    Consumer consumer = Consumer::Frames;
+    int batchSize = 0;
+    uint64_t submitted = 0;
+    uint64_t received = 0;
+    uint64_t calls = 0;
+    uint64_t errors = 0;
+    double callsPerFrame = 0.0;
+    double nsPerFrame = 0.0;
+};
+
+
+constexpr int interopBatchSizes[] = { 1, 4, 16 };
+
+
+// Encodes batches of frames on an engine without latency and times what
+// draining each batch costs the consumer. Every exported call counts, since
+// a managed caller pays a transition for each of them.
+InteropResult MeasureInterop(Consumer consumer, int batchSize)
+{
+    constexpr int batchCount = 1000;
+
+    StubEncodeConfig stubConfig;
+    stubConfig.encodeLatency = std::chrono::microseconds(0);
+    const auto backend = std::make_shared<StubEncodeBackend>(stubConfig);
+    SetEncodeBackend(backend);
+
+    EncoderConfig config;
+    uNvEncoderGetDefaultEncoderConfig(&config);
+    const auto id = uNvEncoderCreateEncoderEx(640, 360, DXGI_FORMAT_R8G8B8A8_UNORM, 60, static_cast<int>(maxAsyncDepth), &config);
+
+    InteropResult result;
+    result.consumer = consumer;
+    result.batchSize = batchSize;
+    std::vector<EncodedFrame> frames(256);
+    // Per frame of the drains that took a whole batch, whose median is what
+    // a drain costs without the noise of the odd preemption.
+    std::vector<double> batchNsPerFrame;
+    batchNsPerFrame.reserve(batchCount);
+
+    const auto drain = [&]
+    {
+        const auto start = Clock::now();
+        int count = 0;
+        if (consumer == Consumer::Copy)
+        {
+            uNvEncoderCopyEncodedData(id);
+            count = uNvEncoderGetEncodedDataCount(id);
+            for (int i = 0; i < count; ++i)
+            {
+                if (uNvEncoderGetEncodedDataSize(id, i) <= 0 || !uNvEncoderGetEncodedDataBuffer(id, i)) ++result.errors;
+            }
+            result.calls += 2 + 2 * count;
+        }
+        else
+        {
+            count = uNvEncoderGetEncodedFrames(id, frames.data(), static_cast<int>(frames.size()));
+            for (int i = 0; i < count; ++i)
+            {
+                if (!frames[i].buffer || frames[i].size <= 0) ++result.errors;
+            }
+            result.calls += 1;
+        }
+        const auto end = Clock::now();
+
+        result.received += count;
+        if (count == batchSize) batchNsPerFrame.push_back(std::chrono::duration<double, std::nano>(end - start).count() / count);
+    };
+
+    for (int batch = 0; batch < batchCount && uNvEncoderIsValid(id); ++batch)
+    {
+        for (int i = 0; i < batchSize; ++i)
+        {
+            while (!uNvEncoderEncode(id, GetSourceTexture(), false)) std::this_thread::yield();
+            ++result.submitted;
+        }
+
+        // The output thread hands frames over right after the engine, so
+        // most batches are drained at once.
+        while (backend->GetEncodedFrameCount() < result.submitted) std::this_thread::yield();
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        drain();
+    }
+
+    const auto deadline = Clock::now() + std::chrono::seconds(1);
+    while (result.received < result.submitted && Clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        drain();
+    }
+
+    if (!uNvEncoderIsValid(id) || result.received != result.submitted) ++result.errors;
+    uNvEncoderDestroyEncoder(id);
+    SetEncodeBackend(nullptr);
+
+    if (result.received > 0) result.callsPerFrame = static_cast<double>(result.calls) / result.received;
+    if (!batchNsPerFrame.empty())
+    {
+        std::sort(batchNsPerFrame.begin(), batchNsPerFrame.end());
+        result.nsPerFrame = batchNsPerFrame[batchNsPerFrame.size() / 2];
+    }
+    return result;
+}
+
+
+void WriteAbrJson(FILE *file, const std::vector<AbrResult> &results)
+{
+    ::fprintf(file, "{\n");
+    ::fprintf(file, "  \"backend\": \"abr-sim\",\n");
+    ::fprintf(file, "  \"maxOvershootPercent\": %.1f,\n", abrMaxOvershootPercent);
+    ::fprintf(file, "  \"maxQueueDelayP95Ms\": %.1f,\n", abrMaxQueueDelayMs);
+    ::fprintf(file, "  \"results\": [\n");
+
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const auto &r = results[i];
+        ::fprintf(file, "    {\n");
+        ::fprintf(file, "      \"trace\": \"%s\",\n", r.trace);
+        ::fprintf(file, "      \"convergenceMs\": %d,\n", r.convergenceMs);
+        ::fprintf(file, "      \"maxConvergenceMs\": %d,\n", r.maxConvergenceMs);
+        ::fprintf(file, "      \"overshootPercent\": %.2f,\n", r.overshootPercent);
+        ::fprintf(file, "      \"utilization\": %.4f,\n", r.utilization);
+        ::fprintf(file, "      \"queueDelayP95Ms\": %.2f,\n", r.queueDelayP95Ms);
+        ::fprintf(file, "      \"rateChanges\": %llu,\n", static_cast<unsigned long long>(r.rateChanges));
+        ::fprintf(file, "      \"minFrameRate\": %u,\n", r.minFrameRate);
+        ::fprintf(file, "      \"finalFrameRate\": %u,\n", r.finalFrameRate);
+        ::fprintf(file, "      \"passed\": %s\n", r.isPassed ? "true" : "false");
+        ::fprintf(file, "    }%s\n", i + 1 < results.size() ? "," : "");
+    }
+
+    ::fprintf(file, "  ]\n");
+    ::fprintf(file, "}\n");
+}
+
+
+void WriteHandoffJson(FILE *file, const std::vector<HandoffResult> &results)
+{
+    ::fprintf(file, "{\n");
+    ::fprintf(file, "  \"backend\": \"handoff\",\n");
+    ::fprintf(file, "  \"results\": [\n");
+
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const auto &r = results[i];
+        ::fprintf(file, "    {\n");
+        ::fprintf(file, "      \"path\": \"%s\",\n", r.path);
+        ::fprintf(file, "      \"frameRate\": %d,\n", r.frameRate);
+        ::fprintf(file, "      \"sent\": %llu,\n", static_cast<unsigned long long>(r.sent));
+        ::fprintf(file, "      \"received\": %llu,\n", static_cast<unsigned long long>(r.received));
+        ::fprintf(file, "      \"overflows\": %llu,\n", static_cast<unsigned long long>(r.overflows));
+        ::fprintf(file, "      \"orderMismatches\": %llu,\n", static_cast<unsigned long long>(r.orderMismatches));
+        ::fprintf(file, "      \"allocations\": %llu,\n", static_cast<unsigned long long>(r.allocations));
+        ::fprintf(file, "      \"pushUs\": { \"p99\": %.3f, \"max\": %.3f },\n", r.pushUsP99, r.pushUsMax);
+        ::fprintf(file, "      \"drainUs\": { \"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f },\n",
+            r.drainUsP50, r.drainUsP99, r.drainUsMax);
+        ::fprintf(file, "      \"passed\": %s\n", r.isPassed ? "true" : "false");
+        ::fprintf(file, "    }%s\n", i + 1 < results.size() ? "," : "");
+    }
+
+    ::fprintf(file, "  ]\n");
+    ::fprintf(file, "}\n");
+}
+
+
+void WriteInteropJson(FILE *file, const std::vector<InteropResult> &results)
+{
+    ::fprintf(file, "{\n");
+    ::fprintf(file, "  \"backend\": \"interop\",\n");
+    ::fprintf(file, "  \"results\": [\n");
+
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const auto &r = results[i];
+        ::fprintf(file, "    {\n");
+        ::fprintf(file, "      \"consumer\": \"%s\",\n", GetConsumerName(r.consumer));
+        ::fprintf(file, "      \"batchSize\": %d,\n", r.batchSize);
+        ::fprintf(file, "      \"submitted\": %llu,\n", static_cast<unsigned long long>(r.submitted));
+        ::fprintf(file, "      \"received\": %llu,\n", static_cast<unsigned long long>(r.received));
+        ::fprintf(file, "      \"calls\": %llu,\n", static_cast<unsigned long long>(r.calls));
+        ::fprintf(file, "      \"errors\": %llu,\n", static_cast<unsigned long long>(r.errors));
+        ::fprintf(file, "      \"callsPerFrame\": %.4f,\n", r.callsPerFrame);
+        ::fprintf(file, "      \"nsPerFrame\": %.1f\n", r.nsPerFrame);
+        ::fprintf(file, "    }%s\n", i + 1 < results.size() ? "," : "");
+    }
+
+    ::fprintf(file, "  ]\n");
+    ::fprintf(file, "}\n");
+}
+
+
+// The second rendition of a simulcast fails to take a frame the first one
+// took. The simulcast has to refuse that frame and every later one, and each
+// rendition has to deliver the frames it took with indices from zero up, so
+// that none of them is left a frame ahead of the other.
+uint64_t CheckPartialSimulcastFrame()
+{
+    constexpr int renditionCount = 2;
+    constexpr int failingFrame = 3;
+    constexpr int frameCount = failingFrame + 2;
+
+    std::atomic<int> encodeCount = { 0 };
+    StubEncodeConfig stubConfig;
+    stubConfig.injectError = [&](const char *function)
+    {
+        if (::strcmp(function, "nvEncEncodePicture") != 0) return NV_ENC_SUCCESS;
+        return ++encodeCount == failingFrame * renditionCount + 2 ? NV_ENC_ERR_GENERIC : NV_ENC_SUCCESS;
+    };
+    SetEncodeBackend(std::make_shared<StubEncodeBackend>(stubConfig));
+
+    EncoderConfig config;
+    uNvEncoderGetDefaultEncoderConfig(&config);
+    SimulcastRendition renditions[renditionCount];
+    renditions[0].width = 640;
+    renditions[0].height = 360;
+    renditions[1].width = 320;
+    renditions[1].height = 180;
+    const auto id = uNvEncoderCreateSimulcastEncoder(
+        640, 360, DXGI_FORMAT_R8G8B8A8_UNORM, 60, frameCount, &config, renditions, renditionCount);
+
+    uint64_t mismatches = 0;
+    const auto check = [&](bool isMatch, const char *what)
+    {
+        if (isMatch) return;
+        ::fprintf(stderr, "partial simulcast frame: %s\n", what);
+        ++mismatches;
+    };
+
+    check(uNvEncoderIsSimulcastValid(id), "the simulcast could not be created");
+
+    EncodeOptions options = {};
+    for (int frame = 0; frame < frameCount; ++frame)
+    {
+        const bool isEncoded = uNvEncoderEncodeSimulcast(id, GetSourceTexture(), &options);
+        check(isEncoded == (frame < failingFrame), frame < failingFrame ? "a frame was refused" : "a frame was taken after the failure");
+    }
+    check(!uNvEncoderIsSimulcastValid(id) && uNvEncoderGetSimulcastError(id), "the failure is not reported");
+
+    // The first rendition took the failing frame, the second one did not.
+    const uint64_t expectedCounts[renditionCount] = { failingFrame + 1, failingFrame };
+    std::vector<EncodedFrame> frames(16);
+    for (int i = 0; i < renditionCount; ++i)
+    {
+        const auto rendition = uNvEncoderGetSimulcastRenditionEncoder(id, i);
+        uint64_t received = 0;
+        bool isInOrder = true;
+        const auto deadline = Clock::now() + std::chrono::seconds(1);
+        while (received < expectedCounts[i] && Clock::now() < deadline)
+        {
+            const int count = uNvEncoderGetEncodedFrames(rendition, frames.data(), static_cast<int>(frames.size()));
+            for (int j = 0; j < count; ++j)
+            {
+                const auto &f = frames[j];
+                if (f.isLeased) uNvEncoderReleaseEncodedData(rendition, f.frameIndex);
+                if (!f.isFrameEnd) continue;
+                if (f.frameIndex != received) isInOrder = false;
+                ++received;
+            }
+            if (count == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        check(isInOrder && received == expectedCounts[i], "a rendition delivered other frames than it took");
+    }
+
+    uNvEncoderDestroySimulcastEncoder(id);
+    SetEncodeBackend(nullptr);
+    return mismatches;
+}
+
+
+// Mismatches of the checks that run once before the cases.
+struct SelfChecks
+{
+    uint64_t invalidConfigMismatches = 0;
+    uint64_t capsCacheMismatches = 0;
+    uint64_t failedInitializationLeaks = 0;
+    uint64_t missingBackendMismatches = 0;
+    uint64_t partialSimulcastMismatches = 0;
+
+    bool HasMismatch() const
+    {
+        return
+            invalidConfigMismatches > 0 || capsCacheMismatches > 0 || failedInitializationLeaks > 0 ||
+            missingBackendMismatches > 0 || partialSimulcastMismatches > 0;
+    }
+};
+
+
+void WriteJson(FILE *file, const Options &options, const SelfChecks &checks, const std::vector<Result> &results)
+{
+    ::fprintf(file, "{\n");
+    ::fprintf(file, "  \"backend\": \"stub\",\n");
+    ::fprintf(file, "  \"consumer\": \"%s\",\n", GetConsumerName(options.consumer));
+    ::fprintf(file, "  \"codec\": \"%s\",\n", options.codec == NvencCodec::HEVC ? "hevc" : "h264");
+    ::fprintf(file, "  \"format\": \"%s\",\n", GetInputFormatName(options.format));
+    ::fprintf(file, "  \"frames\": %d,\n", options.frames);
+    ::fprintf(file, "  \"warmupFrames\": %d,\n", options.warmupFrames);
+    ::fprintf(file, "  \"targetFps\": %d,\n", options.frameRate);
+    ::fprintf(file, "  \"stubLatencyUs\": %d,\n", options.latencyUs);
+    ::fprintf(file, "  \"stubJitterUs\": %d,\n", options.jitterUs);
+    ::fprintf(file, "  \"stubResourceLatencyUs\": %d,\n", options.resourceLatencyUs);
+    ::fprintf(file, "  \"surfaces\": \"%s\",\n", options.isSurfacePreallocated ? "max" : "fit");
+    ::fprintf(file, "  \"intraRefresh\": %s,\n", options.isIntraRefreshEnabled ? "true" : "false");
+    ::fprintf(file, "  \"slices\": %d,\n", options.sliceCount);
+    ::fprintf(file, "  \"ltrStep\": %d,\n", options.ltrInterval);
+    ::fprintf(file, "  \"invalidate\": %s,\n", options.isInvalidationEnabled ? "true" : "false");
+    ::fprintf(file, "  \"qpMap\": \"%s\",\n", options.isQpMapEnabled ? "foveated" : "none");
+    ::fprintf(file, "  \"input\": \"%s\",\n", options.isMemoryInput ? "memory" : "texture");
+    ::fprintf(file, "  \"convert\": \"%s\",\n", GetInputConversionName(options.conversion));
+    ::fprintf(file, "  \"staticRun\": %d,\n", options.staticRun);
+    ::fprintf(file, "  \"simulcast\": %s,\n", options.isSimulcast ? "true" : "false");
+    ::fprintf(file, "  \"invalidConfigMismatches\": %llu,\n", static_cast<unsigned long long>(checks.invalidConfigMismatches));
+    ::fprintf(file, "  \"capsCacheMismatches\": %llu,\n", static_cast<unsigned long long>(checks.capsCacheMismatches));
+    ::fprintf(file, "  \"failedInitializationLeaks\": %llu,\n", static_cast<unsigned long long>(checks.failedInitializationLeaks));
+    ::fprintf(file, "  \"missingBackendMismatches\": %llu,\n", static_cast<unsigned long long>(checks.missingBackendMismatches));
+    ::fprintf(file, "  \"partialSimulcastMismatches\": %llu,\n", static_cast<unsigned long long>(checks.partialSimulcastMismatches));
+    ::fprintf(file, "  \"results\": [\n");
+
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const auto &r = results[i];
+        ::fprintf(file, "    {\n");
+        ::fprintf(file, "      \"width\": %d,\n", r.c.resolution.width);
+        ::fprintf(file, "      \"height\": %d,\n", r.c.resolution.height);
+        ::fprintf(file, "      \"asyncDepth\": %d,\n", r.actualAsyncDepth);
+        ::fprintf(file, "      \"encoders\": %d,\n", r.c.encoderCount);
+        ::fprintf(file, "      \"submitted\": %llu,\n", static_cast<unsigned long long>(r.submitted));
+        ::fprintf(file, "      \"received\": %llu,\n", static_cast<unsigned long long>(r.received));
+        ::fprintf(file, "      \"droppedFrames\": %llu,\n", static_cast<unsigned long long>(r.submitFailures + r.overflows));
+        ::fprintf(file, "      \"submitFailures\": %llu,\n", static_cast<unsigned long long>(r.submitFailures));
+        ::fprintf(file, "      \"queueOverflows\": %llu,\n", static_cast<unsigned long long>(r.overflows));
+        ::fprintf(file, "      \"errors\": %llu,\n", static_cast<unsigned long long>(r.errors));
+        ::fprintf(file, "      \"rateChanges\": %llu,\n", static_cast<unsigned long long>(r.rateChanges));
+        ::fprintf(file, "      \"resizes\": %llu,\n", static_cast<unsigned long long>(r.resizes));
+        ::fprintf(file, "      \"recoveries\": %llu,\n", static_cast<unsigned long long>(r.recoveries));
+        ::fprintf(file, "      \"invalidatedFrames\": %llu,\n", static_cast<unsigned long long>(r.invalidatedFrames));
+        ::fprintf(file, "      \"invalidationMismatches\": %llu,\n", static_cast<unsigned long long>(r.invalidationMismatches));
+        ::fprintf(file, "      \"resizeMs\": { \"p50\": %.4f, \"p99\": %.4f, \"max\": %.4f },\n",
+            r.resizeP50, r.resizeP99, r.resizeMax);
+        ::fprintf(file, "      \"repeatedEos\": %llu,\n", static_cast<unsigned long long>(r.repeatedEos));
+        ::fprintf(file, "      \"lockedBitstreams\": %lld,\n", static_cast<long long>(r.lockedBitstreams));
+        ::fprintf(file, "      \"unmatchedUnlocks\": %llu,\n", static_cast<unsigned long long>(r.unmatchedUnlocks));
+        ::fprintf(file, "      \"seconds\": %.6f,\n", r.seconds);
+        ::fprintf(file, "      \"fpsPerEncoder\": %.3f,\n", r.fps);
+        ::fprintf(file, "      \"starvedFrameRatio\": %.4f,\n", r.starvedFrameRatio);
+        ::fprintf(file, "      \"latencyMs\": { \"p50\": %.4f, \"p99\": %.4f, \"p999\": %.4f, \"max\": %.4f },\n",
+            r.latencyP50, r.latencyP99, r.latencyP999, r.latencyMax);
+        ::fprintf(file, "      \"firstChunkLatencyMs\": { \"p50\": %.4f, \"p99\": %.4f },\n",
+            r.firstChunkLatencyP50, r.firstChunkLatencyP99);
+        ::fprintf(file, "      \"frameBytes\": { \"p50\": %u, \"p99\": %u, \"max\": %u },\n",
+            r.frameSizeP50, r.frameSizeP99, r.frameSizeMax);
+        ::fprintf(file, "      \"allocationsPerFrame\": %.4f,\n", r.allocationsPerFrame);
+        ::fprintf(file, "      \"stubAllocationsPerFrame\": %.4f,\n", r.stubAllocationsPerFrame);
+        ::fprintf(file, "      \"qpMapBuildUs\": { \"simd\": %.3f, \"reference\": %.3f },\n",
+            r.qpMapBuildUs, r.qpMapReferenceBuildUs);
+        ::fprintf(file, "      \"qpMapMismatches\": %llu,\n", static_cast<unsigned long long>(r.qpMapMismatches));
+        ::fprintf(file, "      \"uploadGBps\": { \"encode\": %.3f, \"stream\": %.3f, \"reference\": %.3f },\n",
+            r.uploadBytesPerSecond * 1e-9, r.streamCopyBytesPerSecond * 1e-9, r.referenceCopyBytesPerSecond * 1e-9);
+        ::fprintf(file, "      \"uploadCopyMismatches\": %llu,\n", static_cast<unsigned long long>(r.uploadCopyMismatches));
+        ::fprintf(file, "      \"conversionGBps\": { \"scalar\": %.3f, \"sse41\": %.3f, \"avx2\": %.3f, \"threaded\": %.3f },\n",
+            r.conversionBytesPerSecond[0] * 1e-9, r.conversionBytesPerSecond[1] * 1e-9, r.conversionBytesPerSecond[2] * 1e-9,
+            r.threadedConversionBytesPerSecond * 1e-9);
+        ::fprintf(file, "      \"conversionThreads\": %u,\n", r.conversionThreadCount);
+        ::fprintf(file, "      \"conversionMismatches\": %llu,\n", static_cast<unsigned long long>(r.conversionMismatches));
+        ::fprintf(file, "      \"conversionMaxError\": %.4f,\n", r.conversionMaxError);
+        ::fprintf(file, "      \"duplicateFrames\": %llu,\n", static_cast<unsigned long long>(r.duplicateFrames));
+        ::fprintf(file, "      \"skippedFrames\": %llu,\n", static_cast<unsigned long long>(r.skippedFrames));
+        ::fprintf(file, "      \"frameHashGBps\": { \"simd\": %.3f, \"reference\": %.3f },\n",
+            r.frameHashBytesPerSecond * 1e-9, r.referenceFrameHashBytesPerSecond * 1e-9);
+        ::fprintf(file, "      \"frameHashMismatches\": %llu,\n", static_cast<unsigned long long>(r.frameHashMismatches));
+        ::fprintf(file, "      \"devicePerFrame\": { \"copies\": %.4f, \"scales\": %.4f, \"flushes\": %.4f },\n",
+            r.deviceCopiesPerFrame, r.deviceScalesPerFrame, r.deviceFlushesPerFrame);
+        ::fprintf(file, "      \"deviceAfterWarmup\": { \"opens\": %llu, \"contexts\": %llu },\n",
+            static_cast<unsigned long long>(r.deviceOpens), static_cast<unsigned long long>(r.deviceContexts));
+        ::fprintf(file, "      \"keyframeMismatches\": %llu,\n", static_cast<unsigned long long>(r.keyframeMismatches));
+        ::fprintf(file, "      \"largestRenditionLatencyP50\": %.3f,\n", r.largestRenditionLatencyP50);
+        ::fprintf(file, "      \"smallestRenditionLatencyP50\": %.3f,\n", r.smallestRenditionLatencyP50);
+        ::fprintf(file, "      \"bitstreamAllocations\": %llu\n", static_cast<unsigned long long>(r.bitstreamAllocations));
+        ::fprintf(file, "    }%s\n", i + 1 < results.size() ? "," : "");
+    }
+
+    ::fprintf(file, "  ]\n");
+    ::fprintf(file, "}\n");
+}
+
+
+}
+
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    std::vector<Result> results;
+    std::vector<AbrResult> abrResults;
+    std::vector<HandoffResult> handoffResults;
+    std::vector<InteropResult> interopResults;
+    bool hasError = false;
+
+    if (options.isAbrSimulation)
+    {
+        for (const auto &trace : GetAbrTraces())
+        {
+            const auto result = RunAbrSimulation(trace);
+            ::fprintf(stderr, "%s: converged in %d ms, overshoot %.1f%%, utilization %.3f, queue p95 %.1f ms\n",
+                result.trace, result.convergenceMs, result.overshootPercent, result.utilization, result.queueDelayP95Ms);
+            hasError = hasError || !result.isPassed;
+            abrResults.push_back(result);
+        }
+    }
+
+    if (options.isHandoffMeasured)
+    {
+        for (const auto frameRate : handoffFrameRates)
+        {
+            for (const auto &result : { MeasureHandoff<RingHandoff>("ring", frameRate), MeasureHandoff<MutexSwapHandoff>("mutex", frameRate) })
+            {
+                ::fprintf(stderr, "%s %d fps: push p99 %.3f us, drain p50 %.3f p99 %.3f max %.3f us, %llu allocations\n",
+                    result.path, result.frameRate, result.pushUsP99, result.drainUsP50, result.drainUsP99, result.drainUsMax,
+                    static_cast<unsigned long long>(result.allocations));
+                hasError = hasError || !result.isPassed;
+                handoffResults.push_back(result);
+            }
+        }
+    }
+
+    // Every frame has to arrive intact, and the frames consumer has to take
+    // each batch in about one call where the copy one takes 2N + 2. Times
+    // are only reported. Native calls cost nanoseconds, so they differ by
+    // less than the noise, while a managed caller pays for the transitions.
+    if (options.isInteropMeasured)
+    {
+        for (const auto batchSize : interopBatchSizes)
+        {
+            const auto copy = MeasureInterop(Consumer::Copy, batchSize);
+            const auto frames = MeasureInterop(Consumer::Frames, batchSize);
+            for (const auto &result : { copy, frames })
+            {
+                ::fprintf(stderr, "%s batch %d: %.2f calls and %.1f ns per frame, %llu errors\n",
+                    GetConsumerName(result.consumer), result.batchSize, result.callsPerFrame, result.nsPerFrame,
+                    static_cast<unsigned long long>(result.errors));
+                interopResults.push_back(result);
+            }
+            hasError = hasError || copy.errors > 0 || frames.errors > 0 || frames.callsPerFrame > 2.0 / batchSize;
+        }
+    }
+
+    const bool isEncoding = !options.isAbrSimulation && !options.isHandoffMeasured && !options.isInteropMeasured;
+    const bool isSurfaceGrowing = options.resizeInterval > 0 && !options.isSurfacePreallocated;
+
+    SelfChecks checks;
+    if (isEncoding)
+    {
+        checks.invalidConfigMismatches = CheckInvalidConfigs();
+        checks.failedInitializationLeaks = CheckFailedInitializations();
+        checks.missingBackendMismatches = CheckMissingBackend();
+        checks.partialSimulcastMismatches = CheckPartialSimulcastFrame();
+        const auto capsCachePath = options.outputPath.empty() ? std::string("uNvEncoderBenchmark.caps") : options.outputPath + ".caps";
+        checks.capsCacheMismatches = CheckEncoderCapsCache(capsCachePath);
+    }
+    hasError = hasError || checks.HasMismatch();
+
+    for (const auto &resolution : isEncoding ? options.resolutions : std::vector<Resolution>())
+    {
+        for (const auto asyncDepth : options.asyncDepths)
+        {
+            for (const auto encoderCount : options.encoderCounts)
+            {
+                if (encoderCount <= 0) continue;
+
+                const Case c = { resolution, asyncDepth, encoderCount };
+                Result result;
+                {
+                    Benchmark benchmark(options, c);
+                    result = benchmark.Run();
+                }
+
+                ::fprintf(stderr,
+                    "%dx%d depth %d encoders %d: %.1f fps, latency p50 %.3f p99 %.3f p99.9 %.3f ms, dropped %llu, %.2f allocs/frame, %.3f starved\n",
+                    resolution.width, resolution.height, result.actualAsyncDepth, encoderCount,
+                    result.fps, result.latencyP50, result.latencyP99, result.latencyP999,
+                    static_cast<unsigned long long>(result.submitFailures + result.overflows),
+                    result.allocationsPerFrame, result.starvedFrameRatio);
+
+                hasError = hasError || result.errors > 0 || result.invalidationMismatches > 0 || result.qpMapMismatches > 0 ||
+                    result.uploadCopyMismatches > 0 || result.conversionMismatches > 0 || result.conversionMaxError > 1.0 ||
+                    result.frameHashMismatches > 0 || result.keyframeMismatches > 0 || result.repeatedEos > 0 ||
+                    result.lockedBitstreams != 0 || result.unmatchedUnlocks > 0 || result.allocationsPerFrame > 0.0 ||
+                    IsRenditionStalled(options, result) ||
+                    (!isSurfaceGrowing && (result.deviceOpens > 0 || result.deviceContexts > 0));
+                results.push_back(result);
+            }
+        }
+    }
+
+    if (const auto failures = CountThroughputFailures(options, results))
+    {
+        ::fprintf(stderr, "%llu cases starve the engine or are slower than a depth of one\n", static_cast<unsigned long long>(failures));
+        hasError = true;
+    }
+
+    FILE *file = stdout;
+    if (!options.outputPath.empty())
+    {
+        file = ::fopen(options.outputPath.c_str(), "w");
+        if (!file)
+        {
+            ::fprintf(stderr, "failed to open %s\n", options.outputPath.c_str());
+            return 1;
+        }
+    }
+
+    if (options.isAbrSimulation) WriteAbrJson(file, abrResults);
+    else if (options.isHandoffMeasured) WriteHandoffJson(file, handoffResults);
+    else if (options.isInteropMeasured) WriteInteropJson(file, interopResults);
+    else WriteJson(file, options, checks, results);
+
+    if (file != stdout) ::fclose(file);
+
+    return hasError ? 2 : 0;
+}